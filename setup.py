@@ -1,5 +1,11 @@
 from distutils.core import setup, Extension
 import glob
+import os
+import sys
+
+# methods use the METH_FASTCALL calling convention, public since Python 3.7
+if sys.version_info < (3, 7):
+    sys.exit("PyAVL requires Python 3.7 or newer.")
 
 def get_version():
     vermap = {
@@ -20,9 +26,15 @@ def get_version():
         ver["major"], ver["minor"], ver["micro"]
     )
 
+# PYAVL_COMPACT_NODES=1 builds 24-byte nodes linked by 32-bit indices, see src/avl.h.
+define_macros = []
+if os.environ.get("PYAVL_COMPACT_NODES", "0") not in ("", "0"):
+    define_macros.append(("PYAVL_COMPACT_NODES", "1"))
+
 PyAVLExt = Extension(
     "pyavl",
-    sources=glob.glob("src/*.c")
+    sources=glob.glob("src/*.c"),
+    define_macros=define_macros
 )
 
 with open("README.md", "r") as f:
@@ -36,6 +48,7 @@ setup(
     author="wormtooth",
     author_email="ye@wormtooth.com",
     maintainer="wormtooth",
+    python_requires=">=3.7",
     ext_modules=[
         PyAVLExt
     ]
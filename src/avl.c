@@ -3,79 +3,1116 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 
+#include <math.h>
+
+#if defined(__linux__) || defined(PYAVL_COMPACT_NODES)
+#include <sys/mman.h>
+#endif
+
+#if defined(PYAVL_COMPACT_NODES) && defined(_WIN32)
+#error "Compact nodes need mmap to reserve their arena."
+#endif
+
 #define MAX_AVL_HEIGHT 128
 
+/* the last version given to a context, so that versions are never reused */
+static uint64_t _avl_versions = 0;
+
+/**
+ * @brief Renew the version of a context, when the shape of its tree changes.
+ */
+static inline void _avl_touch(avl_ctx_t *ctx) {
+    if (ctx) {
+        ctx->version = ++ _avl_versions;
+    }
+}
+
 /* Memory Management */
 
-extern void avl_node_init(avl_node_t *node, PyObject *key) {
+struct _avl_chunk {
+    avl_chunk_t *next;
+    size_t bytes;
+};
+
+/* Slots start right after the chunk header, at a cache line where chunks are aligned. */
+#define AVL_CHUNK_HEAD  ((sizeof(avl_chunk_t) + AVL_CACHE_LINE - 1) & ~(size_t)(AVL_CACHE_LINE - 1))
+
+#ifdef PYAVL_COMPACT_NODES
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+char *avl_arena_base = NULL;
+static char *_avl_arena_cursor = NULL;
+/* Released chunks by the log of their size, linked through their first word. */
+static void *_avl_arena_free[8 * sizeof(size_t)];
+
+static int _avl_log2_ceil(size_t bytes) {
+    int k = 0;
+    while (((size_t)1 << k) < bytes) {
+        k ++;
+    }
+    return k;
+}
+
+/**
+ * @brief Take a chunk of 2^k bytes from the arena, aligned to its size.
+ * Only address space is reserved up front, and pages are made accessible chunk by chunk.
+ */
+static void* _avl_arena_alloc(int k) {
+    size_t bytes = (size_t)1 << k;
+    void *mem = _avl_arena_free[k];
+    if (mem) {
+        _avl_arena_free[k] = *(void **)mem;
+        return mem;
+    }
+    if (!avl_arena_base) {
+        void *range = mmap(NULL, AVL_ARENA_BYTES + AVL_POOL_MAX_CHUNK, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (range == MAP_FAILED) {
+            PyErr_NoMemory();
+            return NULL;
+        }
+        avl_arena_base = (char *)(
+            ((uintptr_t)range + AVL_POOL_MAX_CHUNK - 1) & ~(uintptr_t)(AVL_POOL_MAX_CHUNK - 1));
+        _avl_arena_cursor = avl_arena_base;
+    }
+    char *chunk = (char *)(((uintptr_t)_avl_arena_cursor + bytes - 1) & ~(uintptr_t)(bytes - 1));
+    if (chunk + bytes > avl_arena_base + AVL_ARENA_BYTES) {
+        PyErr_Format(PyExc_MemoryError,
+            "The arena of compact nodes is full (%zu GiB per process), "
+            "build without PYAVL_COMPACT_NODES for more nodes.", AVL_ARENA_BYTES >> 30);
+        return NULL;
+    } else if (mprotect(chunk, bytes, PROT_READ | PROT_WRITE) != 0) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    _avl_arena_cursor = chunk + bytes;
+    return chunk;
+}
+
+/**
+ * @brief Give the pages of a chunk back to the system and keep its addresses for reuse.
+ */
+static void _avl_arena_release(void *chunk, int k) {
+#ifdef MADV_DONTNEED
+    madvise(chunk, (size_t)1 << k, MADV_DONTNEED);
+#endif
+    *(void **)chunk = _avl_arena_free[k];
+    _avl_arena_free[k] = chunk;
+}
+
+#endif
+
+extern void avl_pool_init(avl_pool_t *pool, size_t node_size, int hugepages) {
+    pool->chunks = NULL;
+    pool->free_list = NULL;
+    pool->cursor = NULL;
+    pool->end = NULL;
+    pool->node_size = (node_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    pool->nchunks = 0;
+    pool->bytes = 0;
+    pool->capacity = 0;
+    pool->used = 0;
+    pool->hugepages = hugepages;
+}
+
+/**
+ * @brief Add a new chunk to a pool, twice as large as the last one.
+ */
+static int _avl_pool_grow(avl_pool_t *pool) {
+    size_t bytes = pool->chunks? pool->chunks->bytes * 2: AVL_POOL_MIN_CHUNK;
+    if (bytes > AVL_POOL_MAX_CHUNK) {
+        bytes = AVL_POOL_MAX_CHUNK;
+    }
+    if (bytes < AVL_CHUNK_HEAD + pool->node_size) {
+        bytes = AVL_CHUNK_HEAD + pool->node_size;
+    }
+
+    avl_chunk_t *chunk = NULL;
+#ifdef PYAVL_COMPACT_NODES
+    int k = _avl_log2_ceil(bytes);
+    bytes = (size_t)1 << k;
+    chunk = (avl_chunk_t *)_avl_arena_alloc(k);
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (chunk && pool->hugepages && bytes >= AVL_POOL_MAX_CHUNK) {
+        madvise(chunk, bytes, MADV_HUGEPAGE);
+    }
+#endif
+    if (!chunk) {
+        return -1;
+    }
+#else
+#ifdef __linux__
+    void *mem = NULL;
+    if (pool->hugepages && bytes == AVL_POOL_MAX_CHUNK) {
+        if (posix_memalign(&mem, AVL_POOL_MAX_CHUNK, bytes) == 0) {
+#ifdef MADV_HUGEPAGE
+            madvise(mem, bytes, MADV_HUGEPAGE);
+#endif
+            chunk = (avl_chunk_t *)mem;
+        }
+    } else if (posix_memalign(&mem, AVL_CACHE_LINE, bytes) == 0) {
+        chunk = (avl_chunk_t *)mem;
+    }
+#endif
+    if (!chunk) {
+        chunk = (avl_chunk_t *)malloc(bytes);
+    }
+    if (!chunk) {
+        PyErr_NoMemory();
+        return -1;
+    }
+#endif
+
+    chunk->bytes = bytes;
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+    pool->cursor = (char *)chunk + AVL_CHUNK_HEAD;
+    pool->end = pool->cursor +
+        (bytes - AVL_CHUNK_HEAD) / pool->node_size * pool->node_size;
+    pool->nchunks ++;
+    pool->bytes += bytes;
+    pool->capacity += (bytes - AVL_CHUNK_HEAD) / pool->node_size;
+    return 0;
+}
+
+extern void* avl_pool_alloc(avl_pool_t *pool) {
+    void *node = pool->free_list;
+    if (node) {
+        pool->free_list = *(void **)node;
+    } else {
+        if (pool->cursor == pool->end && _avl_pool_grow(pool) < 0) {
+            return NULL;
+        }
+        node = pool->cursor;
+        pool->cursor += pool->node_size;
+    }
+    pool->used ++;
+    return node;
+}
+
+extern void avl_pool_free(avl_pool_t *pool, void *node) {
+    if (!node) return;
+    if (-- pool->used == 0) {
+        avl_pool_clear(pool);
+        return;
+    }
+    *(void **)node = pool->free_list;
+    pool->free_list = node;
+}
+
+extern void avl_pool_clear(avl_pool_t *pool) {
+    avl_chunk_t *chunk = pool->chunks;
+    while (chunk) {
+        avl_chunk_t *next = chunk->next;
+#ifdef PYAVL_COMPACT_NODES
+        _avl_arena_release(chunk, _avl_log2_ceil(chunk->bytes));
+#else
+        free(chunk);
+#endif
+        chunk = next;
+    }
+    avl_pool_init(pool, pool->node_size, pool->hugepages);
+}
+
+extern int avl_pool_reserve(avl_pool_t *pool, size_t n) {
+    while (pool->capacity - pool->used < n) {
+        /* growing leaves the rest of the current chunk, so keep it on the free list */
+        for (; pool->cursor != pool->end; pool->cursor += pool->node_size) {
+            *(void **)pool->cursor = pool->free_list;
+            pool->free_list = pool->cursor;
+        }
+        if (_avl_pool_grow(pool) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+extern void avl_node_init(avl_node_t *node, avl_key_t key) {
     AVL_HEIGHT(node) = 1;
+    AVL_REFS(node) = 0;
     AVL_SIZE(node) = 1;
-    AVL_LEFT(node) = NULL;
-    AVL_RIGHT(node) = NULL;
-    Py_INCREF(key);
-    AVL_KEY(node) = key;
+    AVL_SET_LEFT(node, NULL);
+    AVL_SET_RIGHT(node, NULL);
+    AVL_RAWKEY(node) = key;
 }
 
-extern void avl_node_clear(avl_node_t *node) {
-    Py_DECREF(AVL_KEY(node));
+extern void avl_node_clear(avl_node_t *node, avl_ctx_t *ctx) {
+    avl_key_release(ctx? ctx->dtype: AVL_DTYPE_OBJECT, AVL_RAWKEY(node));
     AVL_KEY(node) = NULL;
 }
 
-extern avl_node_t* avl_node_new(PyObject *key) {
-    avl_node_t *node = (avl_node_t*)malloc(sizeof(avl_node_t));
+extern avl_node_t* avl_node_new(avl_pool_t *pool, avl_key_t key) {
+    avl_node_t *node = (avl_node_t*)avl_pool_alloc(pool);
     if (node) {
         avl_node_init(node, key);
     }
     return node;
 }
 
-extern void avl_node_free(avl_node_t *root) {
-    if (!root) return;
-    avl_node_clear(root);
-    avl_node_free(AVL_LEFT(root));
-    avl_node_free(AVL_RIGHT(root));
-    free(root);
+extern void avl_node_free(avl_node_t *root, avl_ctx_t *ctx, avl_pool_t *pool) {
+    if (!root) return;
+    _avl_touch(ctx);
+    avl_node_clear(root, ctx);
+    avl_node_free(AVL_LEFT(root), ctx, pool);
+    avl_node_free(AVL_RIGHT(root), ctx, pool);
+    avl_pool_free(pool, root);
+}
+
+/* Key Storage */
+
+extern int avl_dtype_parse(PyObject *name, avl_dtype_t *dtype) {
+    if (!name || name == Py_None) {
+        *dtype = AVL_DTYPE_OBJECT;
+        return 0;
+    }
+    if (PyUnicode_Check(name)) {
+        for (int i = AVL_DTYPE_OBJECT; i <= AVL_DTYPE_BYTES; i++) {
+            if (PyUnicode_CompareWithASCIIString(name, avl_dtype_name(i)) == 0) {
+                *dtype = (avl_dtype_t)i;
+                return 0;
+            }
+        }
+    }
+    PyErr_Format(
+        PyExc_ValueError,
+        "dtype must be one of None, 'object', 'int64', 'float64' or 'bytes', not %R",
+        name
+    );
+    return -1;
+}
+
+extern const char* avl_dtype_name(avl_dtype_t dtype) {
+    switch (dtype) {
+    case AVL_DTYPE_INT64:
+        return "int64";
+    case AVL_DTYPE_FLOAT64:
+        return "float64";
+    case AVL_DTYPE_BYTES:
+        return "bytes";
+    default:
+        return "object";
+    }
+}
+
+extern int avl_key_from_object(avl_dtype_t dtype, PyObject *obj, avl_key_t *key) {
+    int overflow;
+    switch (dtype) {
+    case AVL_DTYPE_INT64:
+        if (!PyLong_Check(obj)) {
+            break;
+        }
+        key->i64 = PyLong_AsLongLongAndOverflow(obj, &overflow);
+        if (overflow) {
+            PyErr_SetString(PyExc_OverflowError, "int too large to convert to int64");
+            return -1;
+        }
+        return 0;
+    case AVL_DTYPE_FLOAT64:
+        if (!PyFloat_Check(obj) && !PyLong_Check(obj)) {
+            break;
+        }
+        key->f64 = PyFloat_AsDouble(obj);
+        if (key->f64 == -1.0 && PyErr_Occurred()) {
+            return -1;
+        }
+        return 0;
+    case AVL_DTYPE_BYTES:
+        if (PyBytes_CheckExact(obj)) {
+            Py_INCREF(obj);
+            key->obj = obj;
+            return 0;
+        } else if (PyBytes_Check(obj)) {
+            key->obj = PyBytes_FromStringAndSize(
+                PyBytes_AS_STRING(obj), PyBytes_GET_SIZE(obj));
+            return key->obj? 0: -1;
+        }
+        break;
+    default:
+        Py_INCREF(obj);
+        key->obj = obj;
+        return 0;
+    }
+    PyErr_Format(
+        PyExc_TypeError, "dtype %s does not accept %.200s objects",
+        avl_dtype_name(dtype), Py_TYPE(obj)->tp_name
+    );
+    return -1;
+}
+
+extern int avl_key_import(avl_dtype_t dtype, PyObject *obj, avl_key_t *key) {
+    if (avl_key_from_object(dtype, obj, key) < 0) {
+        return -1;
+    } else if (dtype == AVL_DTYPE_FLOAT64 && isnan(key->f64)) {
+        PyErr_SetString(PyExc_ValueError, "NaN cannot be a float64 key");
+        return -1;
+    }
+    return 0;
+}
+
+extern PyObject* avl_key_to_object(avl_dtype_t dtype, avl_key_t key) {
+    switch (dtype) {
+    case AVL_DTYPE_INT64:
+        return PyLong_FromLongLong(key.i64);
+    case AVL_DTYPE_FLOAT64:
+        return PyFloat_FromDouble(key.f64);
+    default:
+        Py_INCREF(key.obj);
+        return key.obj;
+    }
+}
+
+extern void avl_key_release(avl_dtype_t dtype, avl_key_t key) {
+    if (AVL_DTYPE_BOXED(dtype)) {
+        Py_XDECREF(key.obj);
+    }
+}
+
+/* Key Comparison */
+
+typedef avl_cmpfunc _avl_cmpfunc;
+
+/**
+ * @brief Compare two Python objects with rich comparisons.
+ * 
+ * @param a Left operand.
+ * @param b Right operand.
+ * @return Return -2 on errors, -1 if a < b, 0 if a == b or 1 if a > b.
+ */
+static int _avl_py_cmp(PyObject *a, PyObject *b);
+
+/**
+ * @brief Compare unboxed keys.
+ */
+static int _avl_int64_cmp(avl_key_t a, avl_key_t b);
+static int _avl_float64_cmp(avl_key_t a, avl_key_t b);
+
+/**
+ * @brief Get the kind of a key by its exact type.
+ */
+static avl_kind_t _avl_kind_of(PyObject *key);
+
+/**
+ * @brief Select the comparison function for an object key against the keys of a tree.
+ * The generic comparison is used whenever the key does not match the kind of the tree.
+ */
+static _avl_cmpfunc _avl_cmp_select(avl_ctx_t *ctx, PyObject *key);
+
+/**
+ * @brief Prepare a Python object to be compared against the keys of a tree.
+ * 
+ * @param ctx The context of the tree.
+ * @param obj The object to compare.
+ * @param key The storage to use as the left operand of the returned function.
+ * It is a borrowed reference for object storage.
+ * @return The comparison function to use.
+ */
+static _avl_cmpfunc _avl_query(avl_ctx_t *ctx, PyObject *obj, avl_key_t *key);
+
+/**
+ * @brief Compare two keys with `cmpf`, counting the comparison in `ctx`.
+ */
+static inline int _avl_cmp(avl_ctx_t *ctx, _avl_cmpfunc cmpf, avl_key_t a, avl_key_t b) {
+    if (ctx) {
+        ctx->ncmp++;
+    }
+    return cmpf(a, b);
+}
+
+/**
+ * @brief Select the comparison function for a key stored in a tree.
+ */
+static _avl_cmpfunc _avl_cmp_stored(avl_ctx_t *ctx, avl_key_t key);
+
+extern void avl_ctx_touch(avl_ctx_t *ctx) {
+    _avl_touch(ctx);
+}
+
+extern void avl_ctx_init(avl_ctx_t *ctx, avl_dtype_t dtype) {
+    ctx->dtype = dtype;
+    ctx->ncmp = 0;
+    ctx->augment = NULL;
+    ctx->share = NULL;
+    ctx->ends_version[0] = ctx->ends_version[1] = 0;
+    ctx->append = 0;
+    _avl_touch(ctx);
+    switch (dtype) {
+    case AVL_DTYPE_INT64:
+        ctx->kind = AVL_KIND_INT64;
+        break;
+    case AVL_DTYPE_FLOAT64:
+        ctx->kind = AVL_KIND_FLOAT64;
+        break;
+    case AVL_DTYPE_BYTES:
+        ctx->kind = AVL_KIND_BYTES;
+        break;
+    default:
+        ctx->kind = AVL_KIND_EMPTY;
+    }
+}
+
+extern avl_cmpfunc avl_cmp_query(avl_ctx_t *ctx, PyObject *obj, avl_key_t *key) {
+    return _avl_query(ctx, obj, key);
+}
+
+extern avl_cmpfunc avl_cmp_stored(avl_ctx_t *ctx, avl_key_t key) {
+    return _avl_cmp_stored(ctx, key);
+}
+
+extern int avl_key_cmp(avl_ctx_t *ctx, avl_key_t a, avl_key_t b) {
+    return _avl_cmp(ctx, _avl_cmp_stored(ctx, a), a, b);
+}
+
+extern int avl_object_cmp(avl_ctx_t *ctx, PyObject *a, PyObject *b) {
+    avl_key_t ka, kb;
+    _avl_cmpfunc cmpf = _avl_query(ctx, a, &ka);
+    if (cmpf == _avl_int64_cmp || cmpf == _avl_float64_cmp) {
+        if (_avl_query(ctx, b, &kb) == cmpf) {
+            return _avl_cmp(ctx, cmpf, ka, kb);
+        }
+    } else {
+        avl_ctx_t kind = {_avl_kind_of(a), AVL_DTYPE_OBJECT};
+        if (kind.kind == _avl_kind_of(b)) {
+            kb.obj = b;
+            return _avl_cmp(ctx, _avl_cmp_select(&kind, a), ka, kb);
+        }
+    }
+    if (ctx) {
+        ctx->ncmp++;
+    }
+    return _avl_py_cmp(a, b);
+}
+
+extern int avl_keys_sorted(avl_ctx_t *ctx, avl_key_t *keys, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        int cmp = avl_key_cmp(ctx, keys[i - 1], keys[i]);
+        if (cmp == -2) {
+            return -1;
+        } else if (cmp == 1) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int _avl_int64_qsort_cmp(const void *a, const void *b) {
+    return _avl_int64_cmp(*(const avl_key_t *)a, *(const avl_key_t *)b);
+}
+
+static int _avl_float64_qsort_cmp(const void *a, const void *b) {
+    return _avl_float64_cmp(*(const avl_key_t *)a, *(const avl_key_t *)b);
+}
+
+extern int avl_keys_sort(avl_ctx_t *ctx, avl_key_t *keys, size_t n) {
+    /* Equal unboxed keys are indistinguishable, so qsort is stable enough. */
+    if (ctx && ctx->dtype == AVL_DTYPE_INT64) {
+        qsort(keys, n, sizeof(avl_key_t), _avl_int64_qsort_cmp);
+        return 0;
+    } else if (ctx && ctx->dtype == AVL_DTYPE_FLOAT64) {
+        qsort(keys, n, sizeof(avl_key_t), _avl_float64_qsort_cmp);
+        return 0;
+    }
+
+    PyObject *list = PyList_New(n);
+    if (!list) {
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        Py_INCREF(keys[i].obj);
+        PyList_SET_ITEM(list, i, keys[i].obj);
+    }
+    int ret = PyList_Sort(list);
+    if (ret == 0) {
+        for (size_t i = 0; i < n; i++) {
+            keys[i].obj = PyList_GET_ITEM(list, i);
+        }
+    }
+    Py_DECREF(list);
+    return ret;
+}
+
+/* below this many keys, a run is sorted by insertion */
+#define AVL_SORT_RUN 16
+
+typedef struct {
+    avl_key_t key;
+    size_t idx;
+} _avl_sort_entry_t;
+
+extern int avl_keys_argsort(avl_ctx_t *ctx, const avl_key_t *keys, size_t n, size_t *order) {
+    if (n < 2) {
+        for (size_t i = 0; i < n; i++) {
+            order[i] = i;
+        }
+        return 0;
+    }
+    _avl_sort_entry_t *entries = (_avl_sort_entry_t *)malloc(sizeof(_avl_sort_entry_t) * 2 * n);
+    if (!entries) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        entries[i].key = keys[i];
+        entries[i].idx = i;
+    }
+    /* all keys are observed, so one comparison function fits them all */
+    _avl_cmpfunc cmpf = _avl_cmp_stored(ctx, keys[0]);
+    int cmp = 0;
+
+    for (size_t lo = 0; lo < n && cmp != -2; lo += AVL_SORT_RUN) {
+        size_t hi = lo + AVL_SORT_RUN < n? lo + AVL_SORT_RUN: n;
+        for (size_t i = lo + 1; i < hi && cmp != -2; i++) {
+            _avl_sort_entry_t entry = entries[i];
+            size_t j = i;
+            for (; j > lo; j--) {
+                cmp = _avl_cmp(ctx, cmpf, entries[j - 1].key, entry.key);
+                if (cmp <= 0) {
+                    break;
+                }
+                entries[j] = entries[j - 1];
+            }
+            entries[j] = entry;
+        }
+    }
+
+    _avl_sort_entry_t *src = entries, *dst = entries + n;
+    for (size_t width = AVL_SORT_RUN; width < n && cmp != -2; width *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2 * width) {
+            size_t mid = lo + width < n? lo + width: n;
+            size_t hi = mid + width < n? mid + width: n;
+            size_t i = lo, j = mid, k = lo;
+            /* a pair of runs in order already is copied as it is */
+            if (mid < hi && cmp != -2 &&
+                (cmp = _avl_cmp(ctx, cmpf, src[mid - 1].key, src[mid].key)) == 1) {
+                while (i < mid && j < hi) {
+                    cmp = _avl_cmp(ctx, cmpf, src[i].key, src[j].key);
+                    if (cmp == -2) {
+                        break;
+                    }
+                    dst[k++] = cmp <= 0? src[i++]: src[j++];
+                }
+            }
+            while (i < mid) {
+                dst[k++] = src[i++];
+            }
+            while (j < hi) {
+                dst[k++] = src[j++];
+            }
+        }
+        _avl_sort_entry_t *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    for (size_t i = 0; i < n; i++) {
+        order[i] = src[i].idx;
+    }
+    free(entries);
+    return cmp == -2? -1: 0;
+}
+
+/* Tree Modification */
+
+/**
+ * @brief Recompute the augmentation of a node, if the tree keeps one.
+ */
+static inline void _avl_augment(avl_ctx_t *ctx, avl_node_t *node) {
+    if (ctx && ctx->augment) {
+        ctx->augment(node);
+    }
+}
+
+extern avl_node_t* avl_node_build(avl_node_t **nodes, size_t n, avl_ctx_t *ctx) {
+    if (!n) return NULL;
+    _avl_touch(ctx);
+    size_t mid = n / 2;
+    avl_node_t *root = nodes[mid];
+    AVL_SET_LEFT(root, avl_node_build(nodes, mid, ctx));
+    AVL_SET_RIGHT(root, avl_node_build(nodes + mid + 1, n - mid - 1, ctx));
+    AVL_HEIGHT(root) = Py_MAX(
+        AVL_HEIGHT0(AVL_LEFT(root)), AVL_HEIGHT0(AVL_RIGHT(root))) + 1;
+    AVL_SIZE(root) = n;
+    _avl_augment(ctx, root);
+    return root;
+}
+
+/**
+ * @brief Rotate the subtree rooted at `y` to the right and return its new root.
+ */
+static avl_node_t* _avl_right_rotate(avl_ctx_t *ctx, avl_node_t *y);
+
+/**
+ * @brief Rotate the subtree rooted at `x` to the left and return its new root.
+ */
+static avl_node_t* _avl_left_rotate(avl_ctx_t *ctx, avl_node_t *x);
+
+/**
+ * @brief Replace `path[i]` by `node` in its parent, or in `*root` if `i` is 0.
+ * 
+ * @param path The nodes from the root down to the search position.
+ * @param dirs The direction taken at each node of `path`, -1 for left and 1 for right.
+ */
+static inline void
+_avl_relink(avl_node_t **path, const signed char *dirs, int i, avl_node_t *node, avl_node_t **root) {
+    if (i == 0) {
+        *root = node;
+    } else if (dirs[i - 1] < 0) {
+        AVL_SET_LEFT(path[i - 1], node);
+    } else {
+        AVL_SET_RIGHT(path[i - 1], node);
+    }
+}
+
+/**
+ * @brief Get a node of a tree to change, copying it if it is shared, see avl_share_t.
+ *
+ * @return Return the node itself if it is not shared, or its copy to link in its place;
+ * NULL with MemoryError set on failure.
+ */
+static avl_node_t* _avl_own(avl_ctx_t *ctx, avl_node_t *node) {
+    if (!node || !ctx || !ctx->share || !AVL_REFS(node)) {
+        return node;
+    }
+    avl_share_t *share = ctx->share;
+    avl_node_t *copy = (avl_node_t *)avl_pool_alloc(share->pool);
+    if (!copy) {
+        return NULL;
+    }
+    memcpy(copy, node, share->pool->node_size);
+    _avl_touch(ctx);
+    AVL_REFS(copy) = 0;
+    AVL_REFS(node) -= 1;
+    if (AVL_LEFT(copy)) {
+        AVL_REFS(AVL_LEFT(copy)) += 1;
+    }
+    if (AVL_RIGHT(copy)) {
+        AVL_REFS(AVL_RIGHT(copy)) += 1;
+    }
+    share->retain(copy, share->extra);
+    return copy;
+}
+
+/**
+ * @brief Get `cur`, the child of `path[n - 1]` or the root if `n` is 0, to change,
+ * see _avl_own. A copy is linked in its place.
+ */
+static inline avl_node_t* _avl_own_at(avl_ctx_t *ctx, avl_node_t **path, const signed char *dirs,
+    int n, avl_node_t *cur, avl_node_t **root) {
+    avl_node_t *node = _avl_own(ctx, cur);
+    if (node && node != cur) {
+        _avl_relink(path, dirs, n, node, root);
+    }
+    return node;
+}
+
+/**
+ * @brief The child of a node on the left, or on the right if `right` is true.
+ */
+#define _AVL_CHILD(node, right) ((right)? AVL_RIGHT(node): AVL_LEFT(node))
+
+/**
+ * @brief Recompute the augmentation of `path[0]`, ..., `path[n - 1]` bottom-up, if any.
+ */
+static inline void _avl_augment_path(avl_ctx_t *ctx, avl_node_t **path, int n) {
+    if (!ctx || !ctx->augment) return;
+    while (n-- > 0) {
+        ctx->augment(path[n]);
+    }
+}
+
+/**
+ * @brief Link `node` as the child on side `dirs[n - 1]` of `path[n - 1]`, or as the
+ * root if `n` is 0, and rebalance the tree upward along the path.
+ */
+static avl_node_t*
+_avl_link(avl_node_t *root, avl_ctx_t *ctx, avl_node_t **path, signed char *dirs, int n,
+    avl_node_t *node) {
+    _avl_touch(ctx);
+    avl_ctx_observe(ctx, AVL_RAWKEY(node));
+    _avl_augment(ctx, node);
+    _avl_relink(path, dirs, n, node, &root);
+    for (int i = 0; i < n; i++) {
+        AVL_SIZE(path[i]) += 1;
+    }
+
+    /*
+     * The parent of the new leaf cannot be unbalanced, so `path[i + 1]` is the
+     * child on the heavy side whenever `path[i]` is. A rotation restores the
+     * height the subtree had before the insertion.
+     */
+    int i = n - 1;
+    for (; i >= 0; i--) {
+        avl_node_t *p = path[i];
+        int lh = AVL_HEIGHT0(AVL_LEFT(p));
+        int rh = AVL_HEIGHT0(AVL_RIGHT(p));
+        int balance = lh - rh;
+
+        if (balance > 1) {
+            if (dirs[i + 1] > 0) {
+                AVL_SET_LEFT(p, _avl_left_rotate(ctx, AVL_LEFT(p)));
+            }
+            _avl_relink(path, dirs, i, _avl_right_rotate(ctx, p), &root);
+            break;
+        } else if (balance < -1) {
+            if (dirs[i + 1] < 0) {
+                AVL_SET_RIGHT(p, _avl_right_rotate(ctx, AVL_RIGHT(p)));
+            }
+            _avl_relink(path, dirs, i, _avl_left_rotate(ctx, p), &root);
+            break;
+        }
+
+        int height = Py_MAX(lh, rh) + 1;
+        _avl_augment(ctx, p);
+        if (height == AVL_HEIGHT(p)) {
+            break;
+        }
+        AVL_HEIGHT(p) = height;
+    }
+    /* Heights above are unchanged, but the augmentation is not. */
+    _avl_augment_path(ctx, path, i);
+
+    return root;
+}
+
+/**
+ * @brief Descend to the place of a key compared by `cmpf`, see avl_node_locate.
+ * 
+ * @return Return 1 if the key is found, 0 if not and -1 on errors.
+ */
+static int _avl_locate(avl_node_t **root, avl_ctx_t *ctx, _avl_cmpfunc cmpf, avl_key_t key,
+    avl_slot_t *slot) {
+    avl_node_t **path = slot->path;
+    signed char *dirs = slot->dirs;
+    int n = 0, side = 0;
+    uint64_t version = ctx? ctx->version: 0;
+    slot->n = 0;
+
+    /* a key beyond an end that inserts keep adding to is compared with that end only */
+    for (int last = 1; *root && ctx && !side && last >= 0; last--) {
+        if (!(ctx->append & (1 << last))) {
+            continue;
+        }
+        avl_node_t *end = avl_node_end(*root, ctx, last);
+        int cmp = _avl_cmp(ctx, cmpf, key, AVL_RAWKEY(end));
+        if (cmp == -2) {
+            return -1;
+        } else if (cmp == (last? 1: -1)) {
+            side = cmp;
+        }
+    }
+
+    if (side) {
+        for (avl_node_t *cur = *root; cur; n++) {
+            if (!(cur = _avl_own_at(ctx, path, dirs, n, cur, root))) {
+                return -1;
+            }
+            path[n] = cur;
+            dirs[n] = side;
+            cur = _AVL_CHILD(cur, side > 0);
+        }
+    } else {
+        for (avl_node_t *cur = *root; cur; n++) {
+            if (!(cur = _avl_own_at(ctx, path, dirs, n, cur, root))) {
+                return -1;
+            }
+            int cmp = _avl_cmp(ctx, cmpf, key, AVL_RAWKEY(cur));
+            if (cmp == -2) {
+                return -1;
+            }
+            path[n] = cur;
+            if (cmp == 0) {
+                slot->n = n + 1;
+                slot->version = ctx? ctx->version: 0;
+                return 1;
+            }
+            dirs[n] = cmp;
+            side = n && side != cmp? 0: cmp;
+            cur = cmp < 0? AVL_LEFT(cur): AVL_RIGHT(cur);
+        }
+    }
+
+    slot->n = n;
+    slot->side = side;
+    /* the end on the other side is the same node, unless it was copied on the way */
+    slot->keep = ctx && side && ctx->version == version && ctx->ends_version[side < 0] == version;
+    slot->version = ctx? ctx->version: 0;
+    return 0;
+}
+
+extern avl_node_t* avl_slot_link(avl_node_t *root, avl_ctx_t *ctx, avl_slot_t *slot, avl_node_t *node) {
+    int side = slot->side;
+    root = _avl_link(root, ctx, slot->path, slot->dirs, slot->n, node);
+    if (ctx) {
+        ctx->append = side? ctx->append | (1 << (side > 0)): 0;
+        if (side) {
+            ctx->ends[side > 0] = node;
+            ctx->ends_version[side > 0] = ctx->version;
+        }
+        if (slot->keep) {
+            ctx->ends_version[side < 0] = ctx->version;
+        }
+    }
+    return root;
+}
+
+extern avl_node_t*
+avl_node_insert(avl_node_t *root, avl_ctx_t *ctx, avl_node_t *node, int *ret, avl_node_t **found) {
+    avl_slot_t slot;
+    int code = _avl_locate(&root, ctx, _avl_cmp_stored(ctx, AVL_RAWKEY(node)), AVL_RAWKEY(node), &slot);
+    if (code == 1) {
+        *ret = 0;
+        if (found) {
+            *found = slot.path[slot.n - 1];
+        }
+        return root;
+    } else if (code == -1) {
+        *ret = -1;
+        return root;
+    }
+    *ret = 1;
+    return avl_slot_link(root, ctx, &slot, node);
+}
+
+extern avl_node_t* avl_node_locate(avl_node_t *root, avl_ctx_t *ctx, PyObject *key,
+    avl_slot_t *slot, int *ret, avl_node_t **found) {
+    avl_key_t query;
+    _avl_cmpfunc cmpf = _avl_query(ctx, key, &query);
+    *ret = _avl_locate(&root, ctx, cmpf, query, slot);
+    if (*ret == 1) {
+        *found = slot->path[slot->n - 1];
+    }
+    return root;
+}
+
+extern int avl_slot_valid(avl_slot_t *slot, avl_ctx_t *ctx) {
+    if (!ctx) {
+        return 1;
+    } else if (slot->version != ctx->version) {
+        return 0;
+    }
+    for (int i = 0; ctx->share && i < slot->n; i++) {
+        if (AVL_REFS(slot->path[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+extern void avl_slot_refresh(avl_slot_t *slot, avl_ctx_t *ctx) {
+    _avl_augment_path(ctx, slot->path, slot->n);
+}
+
+/**
+ * @brief Unlink `cur`, the child of `path[n - 1]` or the root if `n` is 0, from
+ * a tree and rebalance it, as avl_node_delete once the node is found. The in-order
+ * successor of a node with two children is found structurally and takes its place.
+ */
+static avl_node_t*
+_avl_unlink(avl_node_t *root, avl_ctx_t *ctx, avl_node_t **path, signed char *dirs, int n,
+    avl_node_t *cur, int *ret, avl_node_t **deleted) {
+    int top = -1;
+    avl_node_t *succ = NULL;
+    if (AVL_LEFT(cur) && AVL_RIGHT(cur)) {
+        top = n;
+        path[n] = cur;
+        dirs[n++] = 1;
+        succ = AVL_RIGHT(cur);
+        while ((succ = _avl_own_at(ctx, path, dirs, n, succ, &root)) && AVL_LEFT(succ)) {
+            path[n] = succ;
+            dirs[n++] = -1;
+            succ = AVL_LEFT(succ);
+        }
+    }
+    /* rebalancing copies at most two shared nodes per level, and must not fail halfway */
+    if (top >= 0 && !succ) {
+        *deleted = NULL;
+        *ret = -1;
+        return root;
+    }
+    if (ctx && ctx->share && avl_pool_reserve(ctx->share->pool, 2 * n) < 0) {
+        *deleted = NULL;
+        *ret = -1;
+        return root;
+    }
+    *ret = 1;
+    _avl_touch(ctx);
+
+    if (top < 0) {
+        _avl_relink(path, dirs, n, AVL_LEFT(cur)? AVL_LEFT(cur): AVL_RIGHT(cur), &root);
+    } else {
+        _avl_relink(path, dirs, n, AVL_RIGHT(succ), &root);
+
+        AVL_SET_LEFT(succ, AVL_LEFT(cur));
+        AVL_SET_RIGHT(succ, AVL_RIGHT(cur));
+        AVL_HEIGHT(succ) = AVL_HEIGHT(cur);
+        AVL_SIZE(succ) = AVL_SIZE(cur);
+        path[top] = succ;
+        _avl_relink(path, dirs, top, succ, &root);
+    }
+    AVL_SET_LEFT(cur, NULL);
+    AVL_SET_RIGHT(cur, NULL);
+
+    for (int i = 0; i < n; i++) {
+        AVL_SIZE(path[i]) -= 1;
+    }
+
+    int i = n - 1;
+    for (; i >= 0; i--) {
+        avl_node_t *p = path[i];
+        int lh = AVL_HEIGHT0(AVL_LEFT(p));
+        int rh = AVL_HEIGHT0(AVL_RIGHT(p));
+        int balance = lh - rh;
+        int height = AVL_HEIGHT(p);
+        avl_node_t *sub;
+
+        if (balance > 1) {
+            avl_node_t *child = _avl_own(ctx, AVL_LEFT(p));
+            AVL_SET_LEFT(p, child);
+            if (AVL_HEIGHT0(AVL_LEFT(child)) < AVL_HEIGHT0(AVL_RIGHT(child))) {
+                AVL_SET_RIGHT(child, _avl_own(ctx, AVL_RIGHT(child)));
+                AVL_SET_LEFT(p, _avl_left_rotate(ctx, child));
+            }
+            sub = _avl_right_rotate(ctx, p);
+        } else if (balance < -1) {
+            avl_node_t *child = _avl_own(ctx, AVL_RIGHT(p));
+            AVL_SET_RIGHT(p, child);
+            if (AVL_HEIGHT0(AVL_LEFT(child)) > AVL_HEIGHT0(AVL_RIGHT(child))) {
+                AVL_SET_LEFT(child, _avl_own(ctx, AVL_LEFT(child)));
+                AVL_SET_RIGHT(p, _avl_right_rotate(ctx, child));
+            }
+            sub = _avl_left_rotate(ctx, p);
+        } else {
+            AVL_HEIGHT(p) = Py_MAX(lh, rh) + 1;
+            _avl_augment(ctx, p);
+            if (AVL_HEIGHT(p) == height) {
+                break;
+            }
+            continue;
+        }
+
+        _avl_relink(path, dirs, i, sub, &root);
+        if (AVL_HEIGHT(sub) == height) {
+            break;
+        }
+    }
+    _avl_augment_path(ctx, path, i);
+
+    return root;
+}
+
+extern avl_node_t*
+avl_node_delete(avl_node_t *root, avl_ctx_t *ctx, PyObject *key, int *ret, avl_node_t **deleted) {
+    avl_key_t query;
+    _avl_cmpfunc cmpf = _avl_query(ctx, key, &query);
+    avl_node_t *path[MAX_AVL_HEIGHT];
+    signed char dirs[MAX_AVL_HEIGHT];
+    avl_node_t *cur = root;
+    int n = 0;
+
+    while (cur) {
+        if (!(cur = _avl_own_at(ctx, path, dirs, n, cur, &root))) {
+            *ret = -1;
+            return root;
+        }
+        int cmp = _avl_cmp(ctx, cmpf, query, AVL_RAWKEY(cur));
+        if (cmp == -2) {
+            *ret = -1;
+            return root;
+        } else if (cmp == 0) {
+            break;
+        }
+        path[n] = cur;
+        dirs[n] = cmp;
+        cur = cmp < 0? AVL_LEFT(cur): AVL_RIGHT(cur);
+        n++;
+    }
+
+    *deleted = cur;
+    if (!cur) {
+        *ret = 0;
+        return root;
+    }
+    return _avl_unlink(root, ctx, path, dirs, n, cur, ret, deleted);
 }
 
-/* Tree Modification */
-
-/**
- * @brief Compare two Python objects.
- * 
- * @param a Left operand.
- * @param b Right operand.
- * @return Return -2 on errors, -1 if a < b, 0 if a == b or 1 if a > b.
- */
-static int _avl_py_cmp(PyObject *a, PyObject *b);
-
-/**
- * @brief Implementation of avl_node_insert.
- */
-static avl_node_t*
-_avl_insert_helper(avl_node_t *tree, avl_node_t *node, int *ret, avl_node_t **found);
-
 extern avl_node_t*
-avl_node_insert(avl_node_t *root, avl_node_t *node, int *ret, avl_node_t **found) {
-    return _avl_insert_helper(root, node, ret, found);
+avl_node_delete_at(avl_node_t *root, avl_ctx_t *ctx, ptrdiff_t loc, int *ret, avl_node_t **deleted) {
+    avl_node_t *path[MAX_AVL_HEIGHT];
+    signed char dirs[MAX_AVL_HEIGHT];
+    avl_node_t *cur = root;
+    int n = 0;
+
+    *deleted = NULL;
+    if (loc < 0 || (uint64_t)loc >= AVL_SIZE0(root)) {
+        *ret = 0;
+        return root;
+    }
+    /* as avl_node_loc, descending by sizes only */
+    uint64_t p = loc;
+    while ((cur = _avl_own_at(ctx, path, dirs, n, cur, &root))) {
+        uint64_t lsize = AVL_SIZE0(AVL_LEFT(cur));
+        if (p == lsize) {
+            *deleted = cur;
+            return _avl_unlink(root, ctx, path, dirs, n, cur, ret, deleted);
+        }
+        path[n] = cur;
+        if (p < lsize) {
+            dirs[n++] = -1;
+            cur = AVL_LEFT(cur);
+        } else {
+            dirs[n++] = 1;
+            p -= lsize + 1;
+            cur = AVL_RIGHT(cur);
+        }
+    }
+    *ret = -1;
+    return root;
 }
 
-/**
- * @brief Implementation of avl_node_delete.
- */
-static avl_node_t*
-_avl_delete_helper(avl_node_t *root, PyObject *key, int *ret, avl_node_t **deleted);
+extern int avl_node_refresh(avl_node_t *root, avl_ctx_t *ctx, avl_node_t *node) {
+    if (!ctx || !ctx->augment) return 0;
+    _avl_cmpfunc cmpf = _avl_cmp_stored(ctx, AVL_RAWKEY(node));
+    avl_node_t *path[MAX_AVL_HEIGHT];
+    int n = 0;
+    while (root && root != node) {
+        int cmp = _avl_cmp(ctx, cmpf, AVL_RAWKEY(node), AVL_RAWKEY(root));
+        if (cmp == -2) {
+            return -1;
+        }
+        path[n++] = root;
+        root = cmp < 0? AVL_LEFT(root): AVL_RIGHT(root);
+    }
+    if (root) {
+        ctx->augment(root);
+    }
+    _avl_augment_path(ctx, path, n);
+    return 0;
+}
 
-extern avl_node_t*
-avl_node_delete(avl_node_t *root, PyObject *key, int *ret, avl_node_t **deleted) {
-    return _avl_delete_helper(root, key, ret, deleted);
+extern void avl_node_unref(avl_node_t *root, avl_pool_t *pool, avl_func release, void *extra) {
+    while (root) {
+        if (AVL_REFS(root)) {
+            AVL_REFS(root) -= 1;
+            return;
+        }
+        avl_node_t *left = AVL_LEFT(root), *right = AVL_RIGHT(root);
+        release(root, extra);
+        avl_pool_free(pool, root);
+        avl_node_unref(left, pool, release, extra);
+        root = right;
+    }
 }
 
 /* Tree Utilities */
 
 extern avl_node_t*
-avl_node_find(avl_node_t *root, PyObject *key, int *ret) {
+avl_node_find(avl_node_t *root, avl_ctx_t *ctx, PyObject *key, int *ret) {
+    avl_key_t query;
+    _avl_cmpfunc cmpf = _avl_query(ctx, key, &query);
     while (root) {
-        int cmp = _avl_py_cmp(key, AVL_KEY(root));
+        int cmp = _avl_cmp(ctx, cmpf, query, AVL_RAWKEY(root));
         if (cmp == -2) {
             *ret = -1;
             return NULL;
@@ -113,8 +1150,8 @@ avl_node_foreach(avl_node_t *root, avl_func func, void *extra) {
 }
 
 extern avl_node_t*
-avl_node_loc(avl_node_t *root, int loc) {
-    if (loc < 0 || loc >= AVL_SIZE0(root)) {
+avl_node_loc(avl_node_t *root, ptrdiff_t loc) {
+    if (loc < 0 || (uint64_t)loc >= AVL_SIZE0(root)) {
         return NULL;
     }
     uint64_t p = loc;
@@ -134,11 +1171,29 @@ avl_node_loc(avl_node_t *root, int loc) {
 }
 
 extern avl_node_t*
-avl_node_at_most(avl_node_t *root, PyObject *key, int *ret) {
-    int cnt = 0;
+avl_node_end(avl_node_t *root, avl_ctx_t *ctx, int last) {
+    last = last != 0;
+    if (ctx && ctx->ends_version[last] == ctx->version) {
+        return ctx->ends[last];
+    }
+    while (root && _AVL_CHILD(root, last)) {
+        root = _AVL_CHILD(root, last);
+    }
+    if (ctx) {
+        ctx->ends[last] = root;
+        ctx->ends_version[last] = ctx->version;
+    }
+    return root;
+}
+
+extern avl_node_t*
+avl_node_at_most(avl_node_t *root, avl_ctx_t *ctx, PyObject *key, ptrdiff_t *ret) {
+    avl_key_t query;
+    _avl_cmpfunc cmpf = _avl_query(ctx, key, &query);
+    ptrdiff_t cnt = 0;
     avl_node_t *ans = NULL;
     while (root) {
-        int cmp = _avl_py_cmp(key, AVL_KEY(root));
+        int cmp = _avl_cmp(ctx, cmpf, query, AVL_RAWKEY(root));
         if (cmp == -2) {
             *ret = -1;
             return NULL;
@@ -150,31 +1205,615 @@ avl_node_at_most(avl_node_t *root, PyObject *key, int *ret) {
             root = AVL_LEFT(root);
         }
     }
-
-    *ret = cnt;
-    return ans;
+
+    *ret = cnt;
+    return ans;
+}
+
+extern avl_node_t*
+avl_node_at_least(avl_node_t *root, avl_ctx_t *ctx, PyObject *key, ptrdiff_t *ret) {
+    avl_key_t query;
+    _avl_cmpfunc cmpf = _avl_query(ctx, key, &query);
+    ptrdiff_t cnt = 0;
+    avl_node_t *ans = NULL;
+    while (root) {
+        int cmp = _avl_cmp(ctx, cmpf, query, AVL_RAWKEY(root));
+        if (cmp == -2) {
+            *ret = -1;
+            return NULL;
+        } else if (cmp <= 0) {
+            cnt += (1 + AVL_SIZE0(AVL_RIGHT(root)));
+            ans = root;
+            root = AVL_LEFT(root);
+        } else {
+            root = AVL_RIGHT(root);
+        }
+    }
+
+    *ret = cnt;
+    return ans;
+}
+
+extern ptrdiff_t
+avl_node_bisect(avl_node_t *root, avl_ctx_t *ctx, PyObject *key, int right, int *found) {
+    avl_key_t query;
+    _avl_cmpfunc cmpf = _avl_query(ctx, key, &query);
+    ptrdiff_t cnt = 0;
+    if (found) {
+        *found = 0;
+    }
+    while (root) {
+        int cmp = _avl_cmp(ctx, cmpf, query, AVL_RAWKEY(root));
+        if (cmp == -2) {
+            return -1;
+        } else if (cmp == 0) {
+            /* keys are distinct, so the count is known at once */
+            if (found) {
+                *found = 1;
+            }
+            return cnt + AVL_SIZE0(AVL_LEFT(root)) + (right? 1: 0);
+        } else if (cmp > 0) {
+            cnt += (1 + AVL_SIZE0(AVL_LEFT(root)));
+            root = AVL_RIGHT(root);
+        } else {
+            root = AVL_LEFT(root);
+        }
+    }
+    return cnt;
+}
+
+extern int
+avl_node_cover(avl_node_t *root, avl_ctx_t *ctx, PyObject *lo, PyObject *hi,
+    int lo_inclusive, int hi_inclusive, avl_func node_func, avl_func tree_func, void *extra) {
+    avl_key_t qlo, qhi;
+    _avl_cmpfunc flo = lo? _avl_query(ctx, lo, &qlo): NULL;
+    _avl_cmpfunc fhi = hi? _avl_query(ctx, hi, &qhi): NULL;
+    int cmp;
+
+    /* the highest node in the range, where the paths to both bounds part */
+    while (root) {
+        if (lo) {
+            cmp = _avl_cmp(ctx, flo, qlo, AVL_RAWKEY(root));
+            if (cmp == -2) {
+                return -1;
+            } else if (cmp > 0 || (cmp == 0 && !lo_inclusive)) {
+                root = AVL_RIGHT(root);
+                continue;
+            }
+        }
+        if (hi) {
+            cmp = _avl_cmp(ctx, fhi, qhi, AVL_RAWKEY(root));
+            if (cmp == -2) {
+                return -1;
+            } else if (cmp < 0 || (cmp == 0 && !hi_inclusive)) {
+                root = AVL_LEFT(root);
+                continue;
+            }
+        }
+        break;
+    }
+    if (!root) {
+        return 0;
+    }
+    node_func(root, extra);
+
+    /* Below the left child, only lo bounds the range: every node in it comes
+     * with its right subtree. The right side is symmetric. */
+    avl_node_t *node = AVL_LEFT(root);
+    if (!lo) {
+        if (node) tree_func(node, extra);
+        node = NULL;
+    }
+    while (node) {
+        cmp = _avl_cmp(ctx, flo, qlo, AVL_RAWKEY(node));
+        if (cmp == -2) {
+            return -1;
+        } else if (cmp > 0) {
+            node = AVL_RIGHT(node);
+            continue;
+        }
+        if (cmp < 0 || lo_inclusive) {
+            node_func(node, extra);
+        }
+        if (AVL_RIGHT(node)) {
+            tree_func(AVL_RIGHT(node), extra);
+        }
+        node = cmp? AVL_LEFT(node): NULL;
+    }
+
+    node = AVL_RIGHT(root);
+    if (!hi) {
+        if (node) tree_func(node, extra);
+        node = NULL;
+    }
+    while (node) {
+        cmp = _avl_cmp(ctx, fhi, qhi, AVL_RAWKEY(node));
+        if (cmp == -2) {
+            return -1;
+        } else if (cmp < 0) {
+            node = AVL_LEFT(node);
+            continue;
+        }
+        if (cmp > 0 || hi_inclusive) {
+            node_func(node, extra);
+        }
+        if (AVL_LEFT(node)) {
+            tree_func(AVL_LEFT(node), extra);
+        }
+        node = cmp? AVL_RIGHT(node): NULL;
+    }
+    return 0;
+}
+
+/* Set Algebra */
+
+/**
+ * @brief Return a node to a pool, in the signature of avl_func.
+ */
+static void _avl_pool_free_node(avl_node_t *node, avl_pool_t *pool) {
+    avl_pool_free(pool, node);
+}
+
+/**
+ * @brief Copy the structure of a tree into a pool, copying the first size bytes of nodes.
+ */
+static avl_node_t* _avl_copy(avl_node_t *root, avl_pool_t *pool, size_t size, int *ret) {
+    *ret = 0;
+    if (!root) {
+        return NULL;
+    }
+    avl_node_t *left = _avl_copy(AVL_LEFT(root), pool, size, ret);
+    if (*ret < 0) {
+        return NULL;
+    }
+    avl_node_t *right = _avl_copy(AVL_RIGHT(root), pool, size, ret);
+    avl_node_t *node = *ret < 0? NULL: (avl_node_t*)avl_pool_alloc(pool);
+    if (!node) {
+        avl_node_drain(left, (avl_func)_avl_pool_free_node, pool);
+        avl_node_drain(right, (avl_func)_avl_pool_free_node, pool);
+        *ret = -1;
+        return NULL;
+    }
+    memcpy(node, root, size);
+    AVL_REFS(node) = 0;
+    AVL_SET_LEFT(node, left);
+    AVL_SET_RIGHT(node, right);
+    return node;
+}
+
+extern avl_node_t* avl_node_copy(avl_node_t *root, avl_pool_t *pool, int *ret) {
+    return _avl_copy(root, pool, pool->node_size, ret);
+}
+
+/**
+ * @brief Call func for every node of a copy and its original, walking both in step.
+ */
+static void _avl_copy_visit(avl_node_t *copy, avl_node_t *node, avl_copy_func func, void *extra) {
+    for (; copy; copy = AVL_RIGHT(copy), node = AVL_RIGHT(node)) {
+        func(copy, node, extra);
+        _avl_copy_visit(AVL_LEFT(copy), AVL_LEFT(node), func, extra);
+    }
+}
+
+extern avl_node_t*
+avl_node_copy_shape(avl_node_t *root, avl_pool_t *pool, avl_copy_func func, void *extra, int *ret) {
+    avl_node_t *copy = _avl_copy(root, pool, sizeof(avl_node_t), ret);
+    if (*ret == 0) {
+        _avl_copy_visit(copy, root, func, extra);
+    }
+    return copy;
+}
+
+/**
+ * @brief Recompute the height, the size and the augmentation of a node from its children.
+ */
+static inline void _avl_update(avl_ctx_t *ctx, avl_node_t *node) {
+    AVL_HEIGHT(node) = Py_MAX(AVL_HEIGHT0(AVL_LEFT(node)), AVL_HEIGHT0(AVL_RIGHT(node))) + 1;
+    AVL_SIZE(node) = AVL_SIZE0(AVL_LEFT(node)) + AVL_SIZE0(AVL_RIGHT(node)) + 1;
+    _avl_augment(ctx, node);
+}
+
+static avl_node_t*
+_avl_join_right(avl_node_t *left, avl_node_t *mid, avl_node_t *right, avl_ctx_t *ctx) {
+    avl_node_t *c = AVL_RIGHT(left);
+    if (AVL_HEIGHT0(c) <= AVL_HEIGHT0(right) + 1) {
+        AVL_SET_LEFT(mid, c);
+        AVL_SET_RIGHT(mid, right);
+        _avl_update(ctx, mid);
+        if (AVL_HEIGHT(mid) <= AVL_HEIGHT0(AVL_LEFT(left)) + 1) {
+            AVL_SET_RIGHT(left, mid);
+            _avl_update(ctx, left);
+            return left;
+        }
+        AVL_SET_RIGHT(left, _avl_right_rotate(ctx, mid));
+        return _avl_left_rotate(ctx, left);
+    }
+    c = _avl_join_right(c, mid, right, ctx);
+    AVL_SET_RIGHT(left, c);
+    _avl_update(ctx, left);
+    if (AVL_HEIGHT(c) <= AVL_HEIGHT0(AVL_LEFT(left)) + 1) {
+        return left;
+    }
+    return _avl_left_rotate(ctx, left);
+}
+
+static avl_node_t*
+_avl_join_left(avl_node_t *left, avl_node_t *mid, avl_node_t *right, avl_ctx_t *ctx) {
+    avl_node_t *c = AVL_LEFT(right);
+    if (AVL_HEIGHT0(c) <= AVL_HEIGHT0(left) + 1) {
+        AVL_SET_LEFT(mid, left);
+        AVL_SET_RIGHT(mid, c);
+        _avl_update(ctx, mid);
+        if (AVL_HEIGHT(mid) <= AVL_HEIGHT0(AVL_RIGHT(right)) + 1) {
+            AVL_SET_LEFT(right, mid);
+            _avl_update(ctx, right);
+            return right;
+        }
+        AVL_SET_LEFT(right, _avl_left_rotate(ctx, mid));
+        return _avl_right_rotate(ctx, right);
+    }
+    c = _avl_join_left(left, mid, c, ctx);
+    AVL_SET_LEFT(right, c);
+    _avl_update(ctx, right);
+    if (AVL_HEIGHT(c) <= AVL_HEIGHT0(AVL_RIGHT(right)) + 1) {
+        return right;
+    }
+    return _avl_right_rotate(ctx, right);
+}
+
+extern avl_node_t*
+avl_node_join(avl_node_t *left, avl_node_t *mid, avl_node_t *right, avl_ctx_t *ctx) {
+    _avl_touch(ctx);
+    int lh = AVL_HEIGHT0(left);
+    int rh = AVL_HEIGHT0(right);
+    if (lh > rh + 1) {
+        return _avl_join_right(left, mid, right, ctx);
+    } else if (rh > lh + 1) {
+        return _avl_join_left(left, mid, right, ctx);
+    }
+    AVL_SET_LEFT(mid, left);
+    AVL_SET_RIGHT(mid, right);
+    _avl_update(ctx, mid);
+    return mid;
+}
+
+/**
+ * @brief Detach the node with the smallest key from an AVL tree.
+ */
+static avl_node_t* _avl_remove_min(avl_node_t *root, avl_node_t **min, avl_ctx_t *ctx) {
+    if (!(AVL_LEFT(root))) {
+        *min = root;
+        avl_node_t *right = AVL_RIGHT(root);
+        AVL_SET_RIGHT(root, NULL);
+        return right;
+    }
+    AVL_SET_LEFT(root, _avl_remove_min(AVL_LEFT(root), min, ctx));
+    _avl_update(ctx, root);
+    avl_node_t *child = AVL_RIGHT(root);
+    if (AVL_HEIGHT0(child) - AVL_HEIGHT0(AVL_LEFT(root)) > 1) {
+        if (AVL_HEIGHT0(AVL_LEFT(child)) > AVL_HEIGHT0(AVL_RIGHT(child))) {
+            AVL_SET_RIGHT(root, _avl_right_rotate(ctx, child));
+        }
+        return _avl_left_rotate(ctx, root);
+    }
+    return root;
+}
+
+extern avl_node_t* avl_node_join2(avl_node_t *left, avl_node_t *right, avl_ctx_t *ctx) {
+    if (!left) {
+        return right;
+    } else if (!right) {
+        return left;
+    }
+    avl_node_t *mid;
+    right = _avl_remove_min(right, &mid, ctx);
+    return avl_node_join(left, mid, right, ctx);
+}
+
+/**
+ * @brief State of a set operation. Once a comparison fails, no more comparisons
+ * are made and all keys compare greater, so that every node is still accounted for.
+ */
+typedef struct {
+    avl_ctx_t *ctx;
+    avl_node_t *dropped;
+    int error;
+} _avl_setop_state_t;
+
+static avl_node_t*
+_avl_split(_avl_setop_state_t *st, avl_node_t *root, _avl_cmpfunc cmpf, avl_key_t key,
+    avl_node_t **left, avl_node_t **right) {
+    if (!root) {
+        *left = *right = NULL;
+        return NULL;
+    }
+    int cmp = 1;
+    if (!st->error) {
+        cmp = _avl_cmp(st->ctx, cmpf, key, AVL_RAWKEY(root));
+        if (cmp == -2) {
+            st->error = 1;
+            cmp = 1;
+        }
+    }
+
+    avl_node_t *found;
+    if (cmp == 0) {
+        *left = AVL_LEFT(root);
+        *right = AVL_RIGHT(root);
+        AVL_SET_LEFT(root, NULL);
+        AVL_SET_RIGHT(root, NULL);
+        return root;
+    } else if (cmp < 0) {
+        avl_node_t *rest = AVL_RIGHT(root);
+        found = _avl_split(st, AVL_LEFT(root), cmpf, key, left, right);
+        *right = avl_node_join(*right, root, rest, st->ctx);
+    } else {
+        avl_node_t *rest = AVL_LEFT(root);
+        found = _avl_split(st, AVL_RIGHT(root), cmpf, key, left, right);
+        *left = avl_node_join(rest, root, *left, st->ctx);
+    }
+    return found;
+}
+
+extern avl_node_t*
+avl_node_split(avl_node_t *root, avl_ctx_t *ctx, avl_key_t key,
+    avl_node_t **left, avl_node_t **right, int *ret) {
+    _avl_setop_state_t st = {ctx, NULL, 0};
+    _avl_touch(ctx);
+    avl_node_t *found = _avl_split(&st, root, _avl_cmp_stored(ctx, key), key, left, right);
+    *ret = -st.error;
+    return found;
+}
+
+static void _avl_split_at(avl_ctx_t *ctx, avl_node_t *root, uint64_t loc,
+    avl_node_t **left, avl_node_t **right) {
+    if (!root) {
+        *left = *right = NULL;
+        return;
+    }
+    uint64_t lsize = AVL_SIZE0(AVL_LEFT(root));
+    if (loc <= lsize) {
+        avl_node_t *rest = AVL_RIGHT(root);
+        _avl_split_at(ctx, AVL_LEFT(root), loc, left, right);
+        *right = avl_node_join(*right, root, rest, ctx);
+    } else {
+        avl_node_t *rest = AVL_LEFT(root);
+        _avl_split_at(ctx, AVL_RIGHT(root), loc - lsize - 1, left, right);
+        *left = avl_node_join(rest, root, *left, ctx);
+    }
+}
+
+extern void avl_node_split_at(avl_node_t *root, avl_ctx_t *ctx, ptrdiff_t loc,
+    avl_node_t **left, avl_node_t **right) {
+    _avl_touch(ctx);
+    _avl_split_at(ctx, root, loc < 0? 0: (uint64_t)loc, left, right);
+}
+
+/**
+ * @brief Add a detached subtree to the dropped nodes of a set operation.
+ */
+static void _avl_drop(_avl_setop_state_t *st, avl_node_t *root) {
+    if (!root) return;
+    avl_node_t *node = root;
+    while (AVL_LEFT(node)) {
+        node = AVL_LEFT(node);
+    }
+    AVL_SET_LEFT(node, st->dropped);
+    st->dropped = root;
+}
+
+/**
+ * @brief Split b by the key of the root of a, returning the node of b with that key.
+ */
+static avl_node_t*
+_avl_split_by(_avl_setop_state_t *st, avl_node_t *b, avl_node_t *a,
+    avl_node_t **left, avl_node_t **right) {
+    avl_key_t key = AVL_RAWKEY(a);
+    return _avl_split(st, b, _avl_cmp_stored(st->ctx, key), key, left, right);
+}
+
+static avl_node_t* _avl_union(_avl_setop_state_t *st, avl_node_t *a, avl_node_t *b) {
+    if (!a) return b;
+    if (!b) return a;
+    avl_node_t *l, *r;
+    avl_node_t *al = AVL_LEFT(a), *ar = AVL_RIGHT(a);
+    _avl_drop(st, _avl_split_by(st, b, a, &l, &r));
+    l = _avl_union(st, al, l);
+    r = _avl_union(st, ar, r);
+    return avl_node_join(l, a, r, st->ctx);
+}
+
+static avl_node_t* _avl_intersection(_avl_setop_state_t *st, avl_node_t *a, avl_node_t *b) {
+    if (!a || !b) {
+        _avl_drop(st, a);
+        _avl_drop(st, b);
+        return NULL;
+    }
+    avl_node_t *l, *r;
+    avl_node_t *al = AVL_LEFT(a), *ar = AVL_RIGHT(a);
+    avl_node_t *found = _avl_split_by(st, b, a, &l, &r);
+    l = _avl_intersection(st, al, l);
+    r = _avl_intersection(st, ar, r);
+    if (found) {
+        _avl_drop(st, found);
+        return avl_node_join(l, a, r, st->ctx);
+    }
+    AVL_SET_LEFT(a, NULL);
+    AVL_SET_RIGHT(a, NULL);
+    _avl_drop(st, a);
+    return avl_node_join2(l, r, st->ctx);
+}
+
+static avl_node_t* _avl_difference(_avl_setop_state_t *st, avl_node_t *a, avl_node_t *b) {
+    if (!a || !b) {
+        _avl_drop(st, b);
+        return a;
+    }
+    avl_node_t *l, *r;
+    avl_node_t *bl = AVL_LEFT(b), *br = AVL_RIGHT(b);
+    avl_node_t *found = _avl_split_by(st, a, b, &l, &r);
+    l = _avl_difference(st, l, bl);
+    r = _avl_difference(st, r, br);
+    AVL_SET_LEFT(b, NULL);
+    AVL_SET_RIGHT(b, NULL);
+    _avl_drop(st, b);
+    _avl_drop(st, found);
+    return avl_node_join2(l, r, st->ctx);
+}
+
+static avl_node_t* _avl_symmetric_difference(_avl_setop_state_t *st, avl_node_t *a, avl_node_t *b) {
+    if (!a) return b;
+    if (!b) return a;
+    avl_node_t *l, *r;
+    avl_node_t *al = AVL_LEFT(a), *ar = AVL_RIGHT(a);
+    avl_node_t *found = _avl_split_by(st, b, a, &l, &r);
+    l = _avl_symmetric_difference(st, al, l);
+    r = _avl_symmetric_difference(st, ar, r);
+    if (found) {
+        AVL_SET_LEFT(a, NULL);
+        AVL_SET_RIGHT(a, NULL);
+        _avl_drop(st, a);
+        _avl_drop(st, found);
+        return avl_node_join2(l, r, st->ctx);
+    }
+    return avl_node_join(l, a, r, st->ctx);
+}
+
+extern avl_node_t*
+avl_node_setop(avl_setop_t op, avl_node_t *a, avl_node_t *b, avl_ctx_t *ctx,
+    avl_node_t **dropped, int *ret) {
+    _avl_setop_state_t st = {ctx, NULL, 0};
+    avl_node_t *root;
+    _avl_touch(ctx);
+    switch (op) {
+    case AVL_SETOP_UNION:
+        root = _avl_union(&st, a, b);
+        break;
+    case AVL_SETOP_INTERSECTION:
+        root = _avl_intersection(&st, a, b);
+        break;
+    case AVL_SETOP_DIFFERENCE:
+        root = _avl_difference(&st, a, b);
+        break;
+    default:
+        root = _avl_symmetric_difference(&st, a, b);
+    }
+    *dropped = st.dropped;
+    *ret = -st.error;
+    return root;
+}
+
+static void _avl_collect(avl_node_t *node, avl_node_t ***out) {
+    *(*out)++ = node;
+}
+
+extern avl_node_t*
+avl_node_merge(avl_node_t *root, avl_node_t **nodes, size_t m, avl_ctx_t *ctx,
+    avl_merge_func func, void *extra, int *ret) {
+    *ret = 0;
+    if (!m) return root;
+    size_t n = AVL_SIZE0(root);
+    /* the nodes of the tree, the merged order, then pairs of nodes with equal keys */
+    avl_node_t **old = (avl_node_t **)malloc(sizeof(avl_node_t *) * (2 * n + 3 * m));
+    if (!old) {
+        PyErr_NoMemory();
+        *ret = -1;
+        return root;
+    }
+    avl_node_t **out = old + n, **dups = out + n + m, **p = old;
+    avl_node_foreach(root, (avl_func)_avl_collect, &p);
+
+    size_t i = 0, j = 0, k = 0, d = 0;
+    while (i < n && j < m) {
+        int cmp = avl_key_cmp(ctx, AVL_RAWKEY(old[i]), AVL_RAWKEY(nodes[j]));
+        if (cmp == -2) {
+            free(old);
+            *ret = -1;
+            return root;
+        } else if (cmp < 0) {
+            out[k++] = old[i++];
+        } else if (cmp > 0) {
+            out[k++] = nodes[j++];
+        } else {
+            dups[d++] = old[i];
+            dups[d++] = nodes[j++];
+            out[k++] = old[i++];
+        }
+    }
+    while (i < n) {
+        out[k++] = old[i++];
+    }
+    while (j < m) {
+        out[k++] = nodes[j++];
+    }
+    for (size_t t = 0; t < d; t += 2) {
+        func(dups[t], dups[t + 1], extra);
+    }
+    root = avl_node_build(out, k, ctx);
+    free(old);
+    return root;
+}
+
+extern void avl_node_drain(avl_node_t *root, avl_func func, void *extra) {
+    while (root) {
+        avl_node_t *left = AVL_LEFT(root);
+        if (left) {
+            AVL_SET_LEFT(root, AVL_RIGHT(left));
+            AVL_SET_RIGHT(left, root);
+            root = left;
+        } else {
+            avl_node_t *right = AVL_RIGHT(root);
+            func(root, extra);
+            root = right;
+        }
+    }
+}
+
+/**
+ * @brief Check whether every key of a is found in b (want = 1) or none is (want = 0).
+ */
+static int _avl_all_found(avl_node_t *a, avl_node_t *b, avl_ctx_t *ctx, int want) {
+    avl_node_t *stack[MAX_AVL_HEIGHT];
+    int n = 0;
+
+    while (n || a) {
+        if (a) {
+            stack[n++] = a;
+            a = AVL_LEFT(a);
+            continue;
+        }
+        a = stack[--n];
+        avl_key_t key = AVL_RAWKEY(a);
+        _avl_cmpfunc cmpf = _avl_cmp_stored(ctx, key);
+        avl_node_t *node = b;
+        int found = 0;
+        while (node) {
+            int cmp = _avl_cmp(ctx, cmpf, key, AVL_RAWKEY(node));
+            if (cmp == -2) {
+                return -1;
+            } else if (cmp == 0) {
+                found = 1;
+                break;
+            }
+            node = cmp < 0? AVL_LEFT(node): AVL_RIGHT(node);
+        }
+        if (found != want) {
+            return 0;
+        }
+        a = AVL_RIGHT(a);
+    }
+    return 1;
 }
 
-extern avl_node_t*
-avl_node_at_least(avl_node_t *root, PyObject *key, int *ret) {
-    int cnt = 0;
-    avl_node_t *ans = NULL;
-    while (root) {
-        int cmp = _avl_py_cmp(key, AVL_KEY(root));
-        if (cmp == -2) {
-            *ret = -1;
-            return NULL;
-        } else if (cmp <= 0) {
-            cnt += (1 + AVL_SIZE0(AVL_RIGHT(root)));
-            ans = root;
-            root = AVL_LEFT(root);
-        } else {
-            root = AVL_RIGHT(root);
-        }
+extern int avl_node_issubset(avl_node_t *a, avl_node_t *b, avl_ctx_t *ctx) {
+    if (AVL_SIZE0(a) > AVL_SIZE0(b)) {
+        return 0;
     }
+    return _avl_all_found(a, b, ctx, 1);
+}
 
-    *ret = cnt;
-    return ans;
+extern int avl_node_isdisjoint(avl_node_t *a, avl_node_t *b, avl_ctx_t *ctx) {
+    return _avl_all_found(a, b, ctx, 0);
 }
 
 /* Implementation of Static Functions */
@@ -195,6 +1834,208 @@ static int _avl_py_cmp(PyObject *a, PyObject *b) {
     return eq? 0: 1;
 }
 
+static int _avl_generic_cmp(avl_key_t a, avl_key_t b) {
+    return _avl_py_cmp(a.obj, b.obj);
+}
+
+/* Specialized comparisons, both operands must have the exact type of the kind. */
+
+static int _avl_int_cmp(avl_key_t ka, avl_key_t kb) {
+    PyObject *a = ka.obj, *b = kb.obj;
+    if (a == b) return 0;
+    int oa, ob;
+    long long x = PyLong_AsLongLongAndOverflow(a, &oa);
+    long long y = PyLong_AsLongLongAndOverflow(b, &ob);
+    if (oa || ob) {
+        if (oa != ob) {
+            return oa < ob? -1: 1;
+        }
+        return _avl_py_cmp(a, b);
+    }
+    return (x > y) - (x < y);
+}
+
+static int _avl_float_cmp(avl_key_t ka, avl_key_t kb) {
+    PyObject *a = ka.obj, *b = kb.obj;
+    if (a == b) return 0;
+    double x = PyFloat_AS_DOUBLE(a);
+    double y = PyFloat_AS_DOUBLE(b);
+    if (x < y) return -1;
+    return x == y? 0: 1;
+}
+
+static int _avl_str_cmp(avl_key_t ka, avl_key_t kb) {
+    PyObject *a = ka.obj, *b = kb.obj;
+    if (a == b) return 0;
+    int cmp = PyUnicode_Compare(a, b);
+    if (cmp == -1 && PyErr_Occurred()) {
+        return -2;
+    }
+    return cmp;
+}
+
+static int _avl_bytes_cmp(avl_key_t ka, avl_key_t kb) {
+    PyObject *a = ka.obj, *b = kb.obj;
+    if (a == b) return 0;
+    Py_ssize_t la = PyBytes_GET_SIZE(a);
+    Py_ssize_t lb = PyBytes_GET_SIZE(b);
+    int cmp = memcmp(PyBytes_AS_STRING(a), PyBytes_AS_STRING(b), Py_MIN(la, lb));
+    if (cmp) {
+        return cmp < 0? -1: 1;
+    }
+    return (la > lb) - (la < lb);
+}
+
+static int _avl_tuple_cmp(avl_key_t ka, avl_key_t kb) {
+    PyObject *a = ka.obj, *b = kb.obj;
+    if (a == b) return 0;
+    Py_ssize_t la = PyTuple_GET_SIZE(a);
+    Py_ssize_t lb = PyTuple_GET_SIZE(b);
+    Py_ssize_t n = Py_MIN(la, lb);
+    for (Py_ssize_t i = 0; i < n; i++) {
+        avl_key_t x = {PyTuple_GET_ITEM(a, i)};
+        avl_key_t y = {PyTuple_GET_ITEM(b, i)};
+        if (x.obj == y.obj) continue;
+        avl_kind_t kind = _avl_kind_of(x.obj);
+        if (kind != AVL_KIND_GENERIC && Py_TYPE(x.obj) == Py_TYPE(y.obj)) {
+            avl_ctx_t ctx = {kind, AVL_DTYPE_OBJECT};
+            int cmp = _avl_cmp_select(&ctx, x.obj)(x, y);
+            if (cmp) return cmp;
+            continue;
+        }
+        /* Same as tuple comparison in Python: first unequal item decides. */
+        int eq = PyObject_RichCompareBool(x.obj, y.obj, Py_EQ);
+        if (eq == -1) {
+            return -2;
+        } else if (eq) {
+            continue;
+        }
+        int lt = PyObject_RichCompareBool(x.obj, y.obj, Py_LT);
+        if (lt == -1) {
+            return -2;
+        }
+        return lt? -1: 1;
+    }
+    return (la > lb) - (la < lb);
+}
+
+/* Comparisons of unboxed keys. */
+
+static int _avl_int64_cmp(avl_key_t a, avl_key_t b) {
+    return (a.i64 > b.i64) - (a.i64 < b.i64);
+}
+
+static int _avl_float64_cmp(avl_key_t a, avl_key_t b) {
+    if (a.f64 < b.f64) return -1;
+    return a.f64 == b.f64? 0: 1;
+}
+
+/* An object that cannot be unboxed is compared against boxed keys. */
+
+static int _avl_int64_boxed_cmp(avl_key_t a, avl_key_t b) {
+    PyObject *obj = PyLong_FromLongLong(b.i64);
+    if (!obj) return -2;
+    int cmp = _avl_py_cmp(a.obj, obj);
+    Py_DECREF(obj);
+    return cmp;
+}
+
+static int _avl_float64_boxed_cmp(avl_key_t a, avl_key_t b) {
+    PyObject *obj = PyFloat_FromDouble(b.f64);
+    if (!obj) return -2;
+    int cmp = _avl_py_cmp(a.obj, obj);
+    Py_DECREF(obj);
+    return cmp;
+}
+
+static avl_kind_t _avl_kind_of(PyObject *key) {
+    if (PyLong_CheckExact(key)) {
+        return AVL_KIND_INT;
+    } else if (PyFloat_CheckExact(key)) {
+        return AVL_KIND_FLOAT;
+    } else if (PyUnicode_CheckExact(key)) {
+        return AVL_KIND_STR;
+    } else if (PyBytes_CheckExact(key)) {
+        return AVL_KIND_BYTES;
+    } else if (PyTuple_CheckExact(key)) {
+        return AVL_KIND_TUPLE;
+    }
+    return AVL_KIND_GENERIC;
+}
+
+static _avl_cmpfunc _avl_cmp_select(avl_ctx_t *ctx, PyObject *key) {
+    if (!ctx) return _avl_generic_cmp;
+    switch (ctx->kind) {
+    case AVL_KIND_INT:
+        return PyLong_CheckExact(key)? _avl_int_cmp: _avl_generic_cmp;
+    case AVL_KIND_FLOAT:
+        return PyFloat_CheckExact(key)? _avl_float_cmp: _avl_generic_cmp;
+    case AVL_KIND_STR:
+        return PyUnicode_CheckExact(key)? _avl_str_cmp: _avl_generic_cmp;
+    case AVL_KIND_BYTES:
+        return PyBytes_CheckExact(key)? _avl_bytes_cmp: _avl_generic_cmp;
+    case AVL_KIND_TUPLE:
+        return PyTuple_CheckExact(key)? _avl_tuple_cmp: _avl_generic_cmp;
+    default:
+        return _avl_generic_cmp;
+    }
+}
+
+static _avl_cmpfunc _avl_query(avl_ctx_t *ctx, PyObject *obj, avl_key_t *key) {
+    int overflow;
+    if (ctx && ctx->kind == AVL_KIND_INT64) {
+        if (PyLong_Check(obj)) {
+            key->i64 = PyLong_AsLongLongAndOverflow(obj, &overflow);
+            if (!overflow) {
+                return _avl_int64_cmp;
+            }
+        }
+        key->obj = obj;
+        return _avl_int64_boxed_cmp;
+    } else if (ctx && ctx->kind == AVL_KIND_FLOAT64) {
+        if (PyFloat_Check(obj)) {
+            key->f64 = PyFloat_AS_DOUBLE(obj);
+            return _avl_float64_cmp;
+        }
+        key->obj = obj;
+        return _avl_float64_boxed_cmp;
+    }
+    key->obj = obj;
+    return _avl_cmp_select(ctx, obj);
+}
+
+static _avl_cmpfunc _avl_cmp_stored(avl_ctx_t *ctx, avl_key_t key) {
+    if (ctx && ctx->kind == AVL_KIND_INT64) {
+        return _avl_int64_cmp;
+    } else if (ctx && ctx->kind == AVL_KIND_FLOAT64) {
+        return _avl_float64_cmp;
+    }
+    return _avl_cmp_select(ctx, key.obj);
+}
+
+extern void avl_ctx_observe(avl_ctx_t *ctx, avl_key_t key) {
+    if (!ctx || ctx->dtype != AVL_DTYPE_OBJECT || ctx->kind == AVL_KIND_GENERIC) return;
+    avl_kind_t kind = _avl_kind_of(key.obj);
+    if (ctx->kind == AVL_KIND_EMPTY) {
+        ctx->kind = kind;
+    } else if (ctx->kind != kind) {
+        ctx->kind = AVL_KIND_GENERIC;
+    }
+}
+
+extern void avl_ctx_merge(avl_ctx_t *ctx, const avl_ctx_t *other) {
+    if (ctx->dtype != AVL_DTYPE_OBJECT || other->kind == AVL_KIND_EMPTY) return;
+    if (ctx->kind == AVL_KIND_EMPTY) {
+        ctx->kind = other->kind;
+    } else if (ctx->kind != other->kind) {
+        ctx->kind = AVL_KIND_GENERIC;
+    }
+}
+
+extern int avl_ctx_fallible(const avl_ctx_t *ctx) {
+    return ctx->kind == AVL_KIND_GENERIC || ctx->kind == AVL_KIND_TUPLE;
+}
+
 /*
       y                               x
     / \     Right Rotation          /  \
@@ -204,205 +2045,462 @@ static int _avl_py_cmp(PyObject *a, PyObject *b) {
 
 */
 
-static avl_node_t* _avl_right_rotate(avl_node_t *y) {
+static avl_node_t* _avl_right_rotate(avl_ctx_t *ctx, avl_node_t *y) {
     avl_node_t *x = AVL_LEFT(y);
     avl_node_t *T2 = AVL_RIGHT(x);
 
-    AVL_RIGHT(x) = y;
-    AVL_LEFT(y) = T2;
+    AVL_SET_RIGHT(x, y);
+    AVL_SET_LEFT(y, T2);
 
     AVL_HEIGHT(y) = Py_MAX(AVL_HEIGHT0(AVL_LEFT(y)), AVL_HEIGHT0(AVL_RIGHT(y))) + 1;
     AVL_HEIGHT(x) = Py_MAX(AVL_HEIGHT0(AVL_LEFT(x)), AVL_HEIGHT0(AVL_RIGHT(x))) + 1;
     AVL_SIZE(y) = AVL_SIZE0(AVL_LEFT(y)) + AVL_SIZE0(AVL_RIGHT(y)) + 1;
     AVL_SIZE(x) = AVL_SIZE0(AVL_LEFT(x)) + AVL_SIZE0(AVL_RIGHT(x)) + 1;
+    _avl_augment(ctx, y);
+    _avl_augment(ctx, x);
 
     return x;
 }
 
-static avl_node_t* _avl_left_rotate(avl_node_t *x) {
+static avl_node_t* _avl_left_rotate(avl_ctx_t *ctx, avl_node_t *x) {
     avl_node_t *y = AVL_RIGHT(x);
     avl_node_t *T2 = AVL_LEFT(y);
 
-    AVL_LEFT(y) = x;
-    AVL_RIGHT(x) = T2;
+    AVL_SET_LEFT(y, x);
+    AVL_SET_RIGHT(x, T2);
 
     AVL_HEIGHT(x) = Py_MAX(AVL_HEIGHT0(AVL_LEFT(x)), AVL_HEIGHT0(AVL_RIGHT(x))) + 1;
     AVL_HEIGHT(y) = Py_MAX(AVL_HEIGHT0(AVL_LEFT(y)), AVL_HEIGHT0(AVL_RIGHT(y))) + 1;
     AVL_SIZE(x) = AVL_SIZE0(AVL_LEFT(x)) + AVL_SIZE0(AVL_RIGHT(x)) + 1;
     AVL_SIZE(y) = AVL_SIZE0(AVL_LEFT(y)) + AVL_SIZE0(AVL_RIGHT(y)) + 1;
+    _avl_augment(ctx, x);
+    _avl_augment(ctx, y);
 
     return y;
 }
 
-static avl_node_t*
-_avl_insert_helper(avl_node_t *root, avl_node_t *node, int *ret, avl_node_t **found) {
-    if (!root) {
-        *ret = 1;
-        return node;
-    }
-    int cmp = _avl_py_cmp(AVL_KEY(node), AVL_KEY(root));
-    if (cmp == -2) {
-        *ret = -1;
-        return root;
-    } else if (cmp == 0) {
-        *ret = 0;
-        if (found) {
-            *found = root;
-        }
-        return root;
-    } else if (cmp == -1) {
-        AVL_LEFT(root) = _avl_insert_helper(AVL_LEFT(root), node, ret, found);
+/* `avl_iter_t` starts here */
+
+/**
+ * @brief Advance a path to the next node, on the right if `right` is true.
+ * When there is no child on that side, climb until leaving a subtree from the other side.
+ */
+#define _AVL_ITER_STEP(stack, idx, right)                                   \
+    do {                                                                    \
+        avl_node_t *next = _AVL_CHILD(stack[idx - 1], right);               \
+        if (next) {                                                         \
+            while (next) {                                                  \
+                stack[idx ++] = next;                                       \
+                next = _AVL_CHILD(next, !(right));                          \
+            }                                                               \
+        } else {                                                            \
+            do {                                                            \
+                next = stack[-- idx];                                       \
+            } while (idx > 0 && _AVL_CHILD(stack[idx - 1], right) == next); \
+        }                                                                   \
+    } while (0)
+
+static void _avl_iter_set_next(avl_iter_t *iter) {
+    if (!iter || !(iter->idx)) return;
+    avl_node_t **stack = iter->stack;
+    int idx = iter->idx;
+
+    if (iter->reverse) {
+        _AVL_ITER_STEP(stack, idx, 0);
     } else {
-        AVL_RIGHT(root) = _avl_insert_helper(AVL_RIGHT(root), node, ret, found);
+        _AVL_ITER_STEP(stack, idx, 1);
+    }
+
+    iter->idx = idx;
+}
+
+static avl_iter_t* _avl_iter_alloc(int reverse) {
+    avl_iter_t *iter = (avl_iter_t *)malloc(sizeof(avl_iter_t));
+    if (iter) {
+        iter->idx = 0;
+        iter->reverse = reverse;
     }
+    return iter;
+}
+
+extern avl_iter_t* avl_iter_new(avl_node_t *root) {
+    return avl_iter_new_at(root, 0, 0);
+}
 
-    int lh = AVL_HEIGHT0(AVL_LEFT(root));
-    int rh = AVL_HEIGHT0(AVL_RIGHT(root));
-    AVL_HEIGHT(root) = Py_MAX(lh, rh) + 1;
-    AVL_SIZE(root) = AVL_SIZE0(AVL_LEFT(root)) + AVL_SIZE0(AVL_RIGHT(root)) + 1;
-    int balance = lh - rh;
+extern avl_iter_t* avl_iter_new_at(avl_node_t *root, ptrdiff_t loc, int reverse) {
+    avl_iter_t *iter = _avl_iter_alloc(reverse);
+    if (!iter) return NULL;
+    if (loc < 0 || (uint64_t)loc >= AVL_SIZE0(root)) {
+        return iter;
+    }
+    int idx = 0;
+    uint64_t p = loc;
+    while (root) {
+        iter->stack[idx ++] = root;
+        uint64_t lsize = AVL_SIZE0(AVL_LEFT(root));
+        if (p < lsize) {
+            root = AVL_LEFT(root);
+        } else if (p == lsize) {
+            break;
+        } else {
+            p -= lsize + 1;
+            root = AVL_RIGHT(root);
+        }
+    }
+    iter->idx = idx;
+    return iter;
+}
 
-    if (balance > 1) {
-        cmp = _avl_py_cmp(AVL_KEY(node), AVL_KEY(AVL_LEFT(root)));
+extern avl_iter_t*
+avl_iter_new_from(avl_node_t *root, avl_ctx_t *ctx, PyObject *key, int inclusive, int reverse) {
+    avl_iter_t *iter = _avl_iter_alloc(reverse);
+    if (!iter) return NULL;
+    avl_key_t query;
+    _avl_cmpfunc cmpf = _avl_query(ctx, key, &query);
+    int idx = 0, found = 0;
+    while (root) {
+        int cmp = _avl_cmp(ctx, cmpf, query, AVL_RAWKEY(root));
         if (cmp == -2) {
-            *ret = -1;
-            return root;
-        } else if (cmp == -1) {
-            return _avl_right_rotate(root);
-        } else if (cmp == 1) {
-            AVL_LEFT(root) = _avl_left_rotate(AVL_LEFT(root));
-            return _avl_right_rotate(root);
+            avl_iter_free(iter);
+            return NULL;
+        }
+        iter->stack[idx ++] = root;
+        if (cmp == 0 && inclusive) {
+            found = idx;
+            break;
+        }
+        /* a candidate lies beyond key in the order of the iterator */
+        int candidate = reverse? cmp > 0: cmp < 0;
+        if (candidate) {
+            found = idx;
         }
-    } else if (balance < -1) {
-        cmp = _avl_py_cmp(AVL_KEY(node), AVL_KEY(AVL_RIGHT(root)));
+        root = _AVL_CHILD(root, candidate == reverse);
+    }
+    iter->idx = found;
+    return iter;
+}
+
+extern void avl_iter_free(avl_iter_t *iter) {
+    if (!iter) return;
+    free(iter);
+}
+
+extern avl_node_t* avl_iter_next(avl_iter_t *iter) {
+    if (!iter || !(iter->idx)) return NULL;
+    avl_node_t *ret = iter->stack[iter->idx - 1];
+    _avl_iter_set_next(iter);
+    return ret;
+}
+
+/* `avl_finger_t` starts here */
+
+extern void avl_finger_init(avl_finger_t *finger, avl_node_t *root) {
+    finger->root = root;
+    finger->depth = 0;
+}
+
+extern int avl_finger_seek(avl_finger_t *finger, avl_ctx_t *ctx, PyObject *key) {
+    avl_key_t query;
+    _avl_cmpfunc cmpf = _avl_query(ctx, key, &query);
+    avl_node_t **path = finger->path;
+    signed char *dirs = finger->dirs;
+    avl_node_t *cur = finger->root;
+    int n = finger->depth, cmp, c;
+
+    if (n) {
+        cmp = _avl_cmp(ctx, cmpf, query, AVL_RAWKEY(path[n - 1]));
         if (cmp == -2) {
-            *ret = -1;
-            return root;
-        } else if (cmp == -1) {
-            AVL_RIGHT(root) = _avl_right_rotate(AVL_RIGHT(root));
-            return _avl_left_rotate(root);
-        } else if (cmp == 1) {
-            return _avl_left_rotate(root);
+            return -1;
+        } else if (cmp == 0) {
+            dirs[n - 1] = 0;
+            return 1;
+        }
+        /* The ancestors left towards the other side bound the subtree on the side
+         * of key. They are ordered, so gallop over them from the deepest one
+         * to find where key stops passing them. */
+        int bounds[MAX_AVL_HEIGHT], m = 0, i = n - 2;
+        int lo = 0, hi;
+        for (int step = 1; ; step *= 2) {
+            int k = lo + step - 1;
+            for (; m <= k && i >= 0; i--) {
+                if (dirs[i] == -cmp) {
+                    bounds[m++] = i;
+                }
+            }
+            if (k >= m) {
+                hi = m;
+                break;
+            }
+            c = _avl_cmp(ctx, cmpf, query, AVL_RAWKEY(path[bounds[k]]));
+            if (c == -2) {
+                return -1;
+            } else if (c == 0) {
+                n = bounds[k] + 1;
+                goto found;
+            } else if (c != cmp) {
+                hi = k;
+                break;
+            }
+            lo = k + 1;
         }
+        while (lo < hi) {
+            int k = (lo + hi) / 2;
+            c = _avl_cmp(ctx, cmpf, query, AVL_RAWKEY(path[bounds[k]]));
+            if (c == -2) {
+                return -1;
+            } else if (c == 0) {
+                n = bounds[k] + 1;
+                goto found;
+            } else if (c != cmp) {
+                hi = k;
+            } else {
+                lo = k + 1;
+            }
+        }
+        /* key lies past path[top] on the side of cmp, within the remaining bounds */
+        int top = lo? bounds[lo - 1]: n - 1;
+        n = top + 1;
+        dirs[top] = cmp;
+        cur = _AVL_CHILD(path[top], cmp > 0);
     }
 
-    return root;
+    while (cur) {
+        c = _avl_cmp(ctx, cmpf, query, AVL_RAWKEY(cur));
+        if (c == -2) {
+            finger->depth = 0;
+            return -1;
+        }
+        path[n] = cur;
+        dirs[n++] = c;
+        if (c == 0) {
+            finger->depth = n;
+            return 1;
+        }
+        cur = _AVL_CHILD(cur, c > 0);
+    }
+    finger->depth = n;
+    return 0;
+
+found:
+    dirs[n - 1] = 0;
+    finger->depth = n;
+    return 1;
 }
 
-static avl_node_t*
-_avl_delete_helper(avl_node_t *root, PyObject *key, int *ret, avl_node_t **deleted) {
-    if (!root) {
-        *deleted = NULL;
-        *ret = 0;
-        return root;
+extern avl_node_t* avl_finger_at_most(avl_finger_t *finger) {
+    for (int i = finger->depth - 1; i >= 0; i--) {
+        if (finger->dirs[i] >= 0) {
+            return finger->path[i];
+        }
     }
+    return NULL;
+}
 
-    int cmp = _avl_py_cmp(key, AVL_KEY(root));
-    if (cmp == -2) {
-        *ret = -1;
-        return root;
-    } else if (cmp == -1) {
-        AVL_LEFT(root) = _avl_delete_helper(AVL_LEFT(root), key, ret, deleted);
-    } else if (cmp == 1) {
-        AVL_RIGHT(root) = _avl_delete_helper(AVL_RIGHT(root), key, ret, deleted);
-    } else {
-        *deleted = root;
-        if (!(AVL_LEFT(root)) || !(AVL_RIGHT(root))) {
-            root = AVL_LEFT(root)? AVL_LEFT(root): AVL_RIGHT(root);
-        } else {
-            avl_node_t *tmp = AVL_RIGHT(root);
-            while (AVL_LEFT(tmp))
-                tmp = AVL_LEFT(tmp);
-            AVL_RIGHT(root) = _avl_delete_helper(
-                AVL_RIGHT(root), AVL_KEY(tmp), ret, &tmp);
-            AVL_LEFT(tmp) = AVL_LEFT(root);
-            AVL_RIGHT(tmp) = AVL_RIGHT(root);
-            root = tmp;
+extern avl_node_t* avl_finger_at_least(avl_finger_t *finger) {
+    for (int i = finger->depth - 1; i >= 0; i--) {
+        if (finger->dirs[i] <= 0) {
+            return finger->path[i];
+        }
+    }
+    return NULL;
+}
+
+/* `avl_cursor_t` starts here */
+
+/**
+ * @brief Make `path[0]`, ..., `path[n - 1]` private to the tree, see _avl_own.
+ */
+static int _avl_own_path(avl_ctx_t *ctx, avl_node_t **path, signed char *dirs, int n,
+    avl_node_t **root) {
+    if (!ctx || !ctx->share) return 0;
+    for (int i = 0; i < n; i++) {
+        avl_node_t *node = _avl_own_at(ctx, path, dirs, i, path[i], root);
+        if (!node) {
+            return -1;
         }
-        *ret = 1;
-        AVL_LEFT(*deleted) = NULL;
-        AVL_RIGHT(*deleted) = NULL;
+        path[i] = node;
     }
+    return 0;
+}
 
-    if (!root)
+extern avl_node_t* avl_cursor_seek_loc(avl_cursor_t *cursor, avl_node_t *root, ptrdiff_t loc) {
+    uint64_t size = AVL_SIZE0(root);
+    cursor->depth = 0;
+    if (loc < 0 || (uint64_t)loc >= size) {
+        cursor->loc = loc < 0? -1: (ptrdiff_t)size;
         return NULL;
-
-    int lh = AVL_HEIGHT0(AVL_LEFT(root));
-    int rh = AVL_HEIGHT0(AVL_RIGHT(root));
-    AVL_HEIGHT(root) = Py_MAX(lh, rh) + 1;
-    AVL_SIZE(root) = AVL_SIZE0(AVL_LEFT(root)) + AVL_SIZE0(AVL_RIGHT(root)) + 1;
-    int balance = lh - rh;
-
-    if (balance > 1) {
-        avl_node_t *node = AVL_LEFT(root);
-        balance = AVL_HEIGHT0(AVL_LEFT(node)) - AVL_HEIGHT0(AVL_RIGHT(node));
-        if (balance >= 0) {
-            return _avl_right_rotate(root);
-        } else {
-            AVL_LEFT(root) = _avl_left_rotate(node);
-            return _avl_right_rotate(root);
-        }
-    } else if (balance < -1) {
-        avl_node_t *node = AVL_RIGHT(root);
-        balance = AVL_HEIGHT0(AVL_LEFT(node)) - AVL_HEIGHT0(AVL_RIGHT(node));
-        if (balance <= 0) {
-            return _avl_left_rotate(root);
+    }
+    cursor->loc = loc;
+    uint64_t p = loc;
+    int n = 0;
+    for (;;) {
+        uint64_t lsize = AVL_SIZE0(AVL_LEFT(root));
+        cursor->path[n] = root;
+        if (p == lsize) {
+            break;
+        } else if (p < lsize) {
+            cursor->dirs[n++] = -1;
+            root = AVL_LEFT(root);
         } else {
-            AVL_RIGHT(root) = _avl_right_rotate(node);
-            return _avl_left_rotate(root);
+            cursor->dirs[n++] = 1;
+            p -= lsize + 1;
+            root = AVL_RIGHT(root);
         }
     }
-
+    cursor->depth = n + 1;
     return root;
 }
 
-/* `avl_iter_t` starts here */
+extern int avl_cursor_seek(avl_cursor_t *cursor, avl_node_t *root, avl_ctx_t *ctx, PyObject *key) {
+    avl_key_t query;
+    _avl_cmpfunc cmpf = _avl_query(ctx, key, &query);
+    int n = 0, depth = 0, found = 0;
+    ptrdiff_t loc = 0;
 
-static void _avl_iter_set_next(avl_iter_t *iter) {
-    if (!iter || !(iter->next)) return;
-    avl_node_t **stack = iter->stack;
-    avl_node_t *next = iter->next;
-    int idx = iter->idx;
+    /* the last node passed on its left is the smallest one not smaller than key */
+    while (root) {
+        int c = _avl_cmp(ctx, cmpf, query, AVL_RAWKEY(root));
+        if (c == -2) {
+            cursor->depth = 0;
+            cursor->loc = -1;
+            return -1;
+        }
+        cursor->path[n] = root;
+        if (c == 0) {
+            depth = n + 1;
+            found = 1;
+            loc += AVL_SIZE0(AVL_LEFT(root));
+            break;
+        } else if (c < 0) {
+            depth = n + 1;
+            cursor->dirs[n++] = -1;
+            root = AVL_LEFT(root);
+        } else {
+            loc += AVL_SIZE0(AVL_LEFT(root)) + 1;
+            cursor->dirs[n++] = 1;
+            root = AVL_RIGHT(root);
+        }
+    }
+    cursor->depth = depth;
+    cursor->loc = loc;
+    return found;
+}
 
-    if (AVL_RIGHT(next)) {
-        next = AVL_RIGHT(next);
-        while (AVL_LEFT(next)) {
-            stack[idx ++] = next;
-            next = AVL_LEFT(next);
+extern avl_node_t* avl_cursor_step(avl_cursor_t *cursor, avl_node_t *root, int dir) {
+    int right = dir > 0, n = cursor->depth;
+    if (!n) {
+        if (right && cursor->loc < 0) {
+            return avl_cursor_seek_loc(cursor, root, 0);
+        } else if (!right && cursor->loc >= 0) {
+            return avl_cursor_seek_loc(cursor, root, (ptrdiff_t)AVL_SIZE0(root) - 1);
         }
-    } else if (idx > 0) {
-        next = stack[-- idx];
-    } else {
-        next = NULL;
+        return NULL;
     }
 
-    iter->next = next;
-    iter->idx = idx;
+    avl_node_t *node = _AVL_CHILD(cursor->path[n - 1], right);
+    if (node) {
+        /* down to the nearest node of the subtree on that side */
+        cursor->dirs[n - 1] = right? 1: -1;
+        cursor->path[n++] = node;
+        while ((node = _AVL_CHILD(node, !right))) {
+            cursor->dirs[n - 1] = right? -1: 1;
+            cursor->path[n++] = node;
+        }
+    } else {
+        /* up to the nearest ancestor the path leaves towards the other side */
+        int side = right? -1: 1;
+        n --;
+        while (n > 0 && cursor->dirs[n - 1] != side) {
+            n --;
+        }
+        if (!n) {
+            cursor->depth = 0;
+            cursor->loc = right? (ptrdiff_t)AVL_SIZE0(root): -1;
+            return NULL;
+        }
+    }
+    cursor->depth = n;
+    cursor->loc += right? 1: -1;
+    return cursor->path[n - 1];
 }
 
-extern avl_iter_t* avl_iter_new(avl_node_t *root) {
-    avl_iter_t *iter = (avl_iter_t *)malloc(sizeof(avl_iter_t));
-    if (!iter) return NULL;
-    int idx = 0;
-    if (root) {
-        while (AVL_LEFT(root)) {
-            iter->stack[idx ++] = root;
-            root = AVL_LEFT(root);
+extern avl_node_t* avl_cursor_insert(avl_cursor_t *cursor, avl_node_t *root, avl_ctx_t *ctx,
+    avl_node_t *node, int after, int *ret) {
+    avl_node_t **path = cursor->path;
+    signed char *dirs = cursor->dirs;
+    int n = cursor->depth, side = after? 1: -1;
+    _avl_cmpfunc cmpf = _avl_cmp_stored(ctx, AVL_RAWKEY(node));
+
+    /* the neighbour on that side is down its subtree, or up the path */
+    avl_node_t *cur = path[n - 1];
+    avl_node_t *next = _AVL_CHILD(cur, after);
+    if (next) {
+        while (_AVL_CHILD(next, !after)) {
+            next = _AVL_CHILD(next, !after);
+        }
+    } else {
+        int i = n - 1;
+        while (i > 0 && dirs[i - 1] == side) {
+            i --;
         }
+        next = i? path[i - 1]: NULL;
     }
-    iter->next = root;
-    iter->idx = idx;
-    return iter;
+    int c = _avl_cmp(ctx, cmpf, AVL_RAWKEY(node), AVL_RAWKEY(cur));
+    if (c == side && next) {
+        c = -_avl_cmp(ctx, cmpf, AVL_RAWKEY(node), AVL_RAWKEY(next));
+    }
+    if (c == -2 || c == 2) {
+        *ret = -1;
+        return root;
+    } else if (c != side) {
+        *ret = 0;
+        return root;
+    }
+
+    /* the node goes next to `cur` if it has no child on that side, else next to `next` */
+    if (_avl_own_path(ctx, path, dirs, n, &root) < 0) {
+        *ret = -1;
+        return root;
+    }
+    dirs[n - 1] = side;
+    for (next = _AVL_CHILD(path[n - 1], after); next; next = _AVL_CHILD(next, !after)) {
+        if (!(next = _avl_own_at(ctx, path, dirs, n, next, &root))) {
+            *ret = -1;
+            return root;
+        }
+        path[n] = next;
+        dirs[n++] = -side;
+    }
+    ptrdiff_t loc = cursor->loc + !after;
+    *ret = 1;
+    root = _avl_link(root, ctx, path, dirs, n, node);
+    avl_cursor_seek_loc(cursor, root, loc);
+    return root;
 }
 
-extern void avl_iter_free(avl_iter_t *iter) {
-    if (!iter) return;
-    free(iter);
+extern avl_node_t* avl_cursor_delete(avl_cursor_t *cursor, avl_node_t *root, avl_ctx_t *ctx,
+    int *ret, avl_node_t **deleted) {
+    int n = cursor->depth;
+    *deleted = NULL;
+    if (_avl_own_path(ctx, cursor->path, cursor->dirs, n, &root) < 0) {
+        *ret = -1;
+        return root;
+    }
+    *deleted = cursor->path[n - 1];
+    root = _avl_unlink(root, ctx, cursor->path, cursor->dirs, n - 1, *deleted, ret, deleted);
+    if (*ret == 1) {
+        avl_cursor_seek_loc(cursor, root, cursor->loc);
+    }
+    return root;
 }
 
-extern avl_node_t* avl_iter_next(avl_iter_t *iter) {
-    if (!iter) return NULL;
-    avl_node_t *ret = iter->next;
-    _avl_iter_set_next(iter);
-    return ret;
+extern avl_node_t* avl_cursor_own(avl_cursor_t *cursor, avl_node_t **root, avl_ctx_t *ctx) {
+    if (_avl_own_path(ctx, cursor->path, cursor->dirs, cursor->depth, root) < 0) {
+        return NULL;
+    }
+    return AVL_CURSOR_NODE(cursor);
+}
+
+extern void avl_cursor_refresh(avl_cursor_t *cursor, avl_ctx_t *ctx) {
+    _avl_augment_path(ctx, cursor->path, cursor->depth);
 }
\ No newline at end of file
@@ -23,20 +23,139 @@
 #ifndef PY_AVL_H
 #define PY_AVL_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 typedef struct _object PyObject;
 
+/**
+ * @brief Storage of a key, either a Python object or an unboxed machine value.
+ * Which member is used is decided by the dtype of the tree. Maps use it for values too.
+ */
+typedef union _avl_key {
+    PyObject *obj;
+    int64_t i64;
+    double f64;
+} avl_key_t;
+
+#ifdef PYAVL_COMPACT_NODES
+
+/**
+ * With `PYAVL_COMPACT_NODES` defined at build time, children are 32-bit indices of
+ * 8-byte units into one arena reserved for all pools, and 0 is NULL. This takes
+ * a third off the overhead of a node besides its key: 16 bytes instead of 24.
+ * The arena holds at most `AVL_ARENA_BYTES` of nodes for all trees of the process.
+ * It is shared rather than per tree, since a link is decoded without its tree, and
+ * allocations past its end raise MemoryError.
+ */
+typedef uint32_t avl_link_t;
+
+#define AVL_ARENA_BYTES     ((size_t)8 << 32)
+
+extern char *avl_arena_base;
+
+#else
+
+typedef struct _avl_node *avl_link_t;
+
+#endif
+
 typedef struct _avl_node {
-    struct _avl_node *left;
-    struct _avl_node *right;
-    PyObject *key;
+    avl_link_t left;
+    avl_link_t right;
+    avl_key_t key;
     uint64_t height:8;
-    uint64_t size:56;
+    uint64_t refs:16;       /* links to the node besides one, see avl_share_t */
+    uint64_t size:40;
 } avl_node_t;
 
+#ifdef PYAVL_COMPACT_NODES
+
+static inline avl_node_t* avl_link_node(avl_link_t link) {
+    return link? (avl_node_t *)(avl_arena_base + ((size_t)link << 3)): NULL;
+}
+
+static inline avl_link_t avl_node_link(void *node) {
+    return node? (avl_link_t)((size_t)((char *)node - avl_arena_base) >> 3): 0;
+}
+
+#define AVL_LINK_NODE(link) avl_link_node(link)
+#define AVL_NODE_LINK(node) avl_node_link(node)
+
+#else
+
+#define AVL_LINK_NODE(link) (link)
+#define AVL_NODE_LINK(node) ((avl_node_t *)(node))
+
+#endif
+
 typedef void (*avl_func)(avl_node_t *, void *);
 
+/**
+ * @brief Kinds of keys a tree can specialize its comparisons for.
+ * 
+ * A tree starts as `AVL_KIND_EMPTY` and takes the kind of the first inserted key.
+ * It becomes `AVL_KIND_GENERIC` for good once a key of another type is inserted.
+ */
+typedef enum _avl_kind {
+    AVL_KIND_EMPTY = 0,
+    AVL_KIND_GENERIC,
+    AVL_KIND_INT,
+    AVL_KIND_FLOAT,
+    AVL_KIND_STR,
+    AVL_KIND_BYTES,
+    AVL_KIND_TUPLE,
+    AVL_KIND_INT64,
+    AVL_KIND_FLOAT64
+} avl_kind_t;
+
+/**
+ * @brief Storage types of keys and values.
+ * 
+ * `AVL_DTYPE_OBJECT` stores any Python object. `AVL_DTYPE_INT64` and `AVL_DTYPE_FLOAT64`
+ * store unboxed machine values in `avl_key_t`. `AVL_DTYPE_BYTES` stores bytes objects only.
+ */
+typedef enum _avl_dtype {
+    AVL_DTYPE_OBJECT = 0,
+    AVL_DTYPE_INT64,
+    AVL_DTYPE_FLOAT64,
+    AVL_DTYPE_BYTES
+} avl_dtype_t;
+
+/**
+ * @brief Whether storage of a dtype holds a reference to a Python object.
+ * 
+ */
+#define AVL_DTYPE_BOXED(dtype)  ((dtype) == AVL_DTYPE_OBJECT || (dtype) == AVL_DTYPE_BYTES)
+
+/**
+ * @brief Recompute the augmentation of an extended node from its own fields and
+ * the augmentations of its children, which are up to date.
+ */
+typedef void (*avl_augment_func)(avl_node_t *);
+
+/**
+ * @brief Per-tree context passed to every operation comparing keys.
+ * 
+ * A NULL context is allowed and means generic comparisons of object keys.
+ * The kind of a tree with a dtype other than `AVL_DTYPE_OBJECT` never changes.
+ * 
+ * Besides height and size, a tree can keep its own augmentation in extended
+ * nodes with `augment`, which every operation changing the shape of the tree
+ * with the context calls bottom-up on the nodes whose subtrees changed.
+ */
+typedef struct _avl_ctx {
+    avl_kind_t kind;
+    avl_dtype_t dtype;
+    size_t ncmp;            /* key comparisons made since avl_ctx_init */
+    avl_augment_func augment;   /* NULL after avl_ctx_init */
+    struct _avl_share *share;   /* NULL after avl_ctx_init, see avl_share_t */
+    uint64_t version;       /* renewed whenever the shape of the tree changes, see avl_cursor_t */
+    avl_node_t *ends[2];    /* the first and the last node, see avl_node_end */
+    uint64_t ends_version[2];   /* the version each of ends is valid at */
+    int append;             /* bits 0 and 1 set while inserts add the first or the last node */
+} avl_ctx_t;
+
 /**
  * @brief Define the initial segment of every extension of avl_node_t.
  * 
@@ -44,16 +163,28 @@ typedef void (*avl_func)(avl_node_t *, void *);
 #define AVL_NODE_HEAD       avl_node_t _;
 
 /**
- * @brief Left child of root.
+ * @brief Left child of root. Can only be rvalue, see AVL_SET_LEFT.
+ * 
+ */
+#define AVL_LEFT(root)      AVL_LINK_NODE(((avl_node_t*)(root))->left)
+
+/**
+ * @brief Right child of root. Can only be rvalue, see AVL_SET_RIGHT.
+ * 
+ */
+#define AVL_RIGHT(root)     AVL_LINK_NODE(((avl_node_t*)(root))->right)
+
+/**
+ * @brief Set the left child of root.
  * 
  */
-#define AVL_LEFT(root)      ((avl_node_t*)(root))->left
+#define AVL_SET_LEFT(root, child)   (((avl_node_t*)(root))->left = AVL_NODE_LINK(child))
 
 /**
- * @brief Right child of root.
+ * @brief Set the right child of root.
  * 
  */
-#define AVL_RIGHT(root)     ((avl_node_t*)(root))->right
+#define AVL_SET_RIGHT(root, child)  (((avl_node_t*)(root))->right = AVL_NODE_LINK(child))
 
 /**
  * @brief Height of root.
@@ -80,47 +211,319 @@ typedef void (*avl_func)(avl_node_t *, void *);
 #define AVL_SIZE0(root)   ((root)? AVL_SIZE(root): 0)
 
 /**
- * @brief Key of root.
+ * @brief Key of root, for trees of object keys.
+ * 
+ */
+#define AVL_KEY(root)       ((avl_node_t*)(root))->key.obj
+
+/**
+ * @brief Key storage of root, for trees of any dtype.
+ * 
+ */
+#define AVL_RAWKEY(root)    ((avl_node_t*)(root))->key
+
+/**
+ * @brief Number of links to root besides one, from parents or roots of other versions.
+ * 
+ */
+#define AVL_REFS(root)      ((avl_node_t*)(root))->refs
+
+/**
+ * `avl_pool_t` is a slab allocator of nodes of a single tree.
+ * 
+ * Nodes are carved out of chunks growing geometrically up to `AVL_POOL_MAX_CHUNK` bytes.
+ * Freed nodes are recycled, and all chunks are released at once by `avl_pool_clear`.
+ * With compact nodes, chunks come from the arena instead of malloc.
+ */
+
+#define AVL_POOL_MIN_CHUNK  (4 * 1024)
+/* Where chunks can be aligned, nodes of a multiple of this size start at cache lines. */
+#define AVL_CACHE_LINE      64
+#define AVL_POOL_MAX_CHUNK  (2 * 1024 * 1024)
+
+typedef struct _avl_chunk avl_chunk_t;
+
+typedef struct _avl_pool {
+    avl_chunk_t *chunks;
+    void *free_list;
+    char *cursor;
+    char *end;
+    size_t node_size;
+    size_t nchunks;
+    size_t bytes;
+    size_t capacity;
+    size_t used;
+    int hugepages;
+} avl_pool_t;
+
+/**
+ * @brief Initialize an empty pool.
+ * 
+ * @param pool The pool to initialize.
+ * @param node_size The size of nodes allocated from the pool.
+ * @param hugepages Whether to back chunks of `AVL_POOL_MAX_CHUNK` bytes by
+ * transparent huge pages, only effective on Linux.
+ */
+extern void avl_pool_init(avl_pool_t *pool, size_t node_size, int hugepages);
+
+/**
+ * @brief Allocate a node from a pool.
+ * 
+ * @return Return the allocated memory, NULL with MemoryError set on failure.
+ */
+extern void* avl_pool_alloc(avl_pool_t *pool);
+
+/**
+ * @brief Return a node to its pool. Chunks are released once the pool is unused.
+ */
+extern void avl_pool_free(avl_pool_t *pool, void *node);
+
+/**
+ * @brief Release all chunks of a pool. Nodes allocated from it become invalid.
+ */
+extern void avl_pool_clear(avl_pool_t *pool);
+
+/**
+ * @brief Make sure that the next n allocations from a pool do not fail.
+ * 
+ * @return Return 0 on success, -1 with MemoryError set on failure.
+ */
+extern int avl_pool_reserve(avl_pool_t *pool, size_t n);
+
+/**
+ * `avl_share_t` lets a tree share nodes with persistent snapshots of itself.
+ * 
+ * A snapshot is another root into the same nodes, taken in O(1) by counting one
+ * more link to the root in `AVL_REFS`. Nodes with a count are shared and never
+ * changed: avl_node_insert and avl_node_delete copy the nodes they change along
+ * the path, and only the copies belong to the tree. Each copy adds a link to its
+ * children. Snapshots drop their nodes by avl_node_unref.
+ * 
+ * A node is linked at most once from each version of the tree, so counts stay
+ * below `AVL_MAX_SNAPSHOTS` as long as the tree has fewer snapshots.
+ */
+typedef struct _avl_share {
+    avl_pool_t *pool;       /* the pool of all versions */
+    avl_func retain;        /* take the references held by a copied node */
+    void *extra;            /* the second argument of retain */
+    size_t snapshots;
+} avl_share_t;
+
+#define AVL_MAX_SNAPSHOTS   0xffff
+
+/**
+ * @brief Initialize a context for an empty tree.
+ * 
+ * @param ctx The context to initialize.
+ * @param dtype The dtype of keys of the tree.
+ */
+extern void avl_ctx_init(avl_ctx_t *ctx, avl_dtype_t dtype);
+
+/**
+ * @brief Renew the version of a context, for other engines changing the shape of its tree.
+ * 
+ */
+extern void avl_ctx_touch(avl_ctx_t *ctx);
+
+/**
+ * @brief Update the kind of a tree for keys of another tree of the same dtype
+ * about to be compared with or stored in it.
+ * 
+ * @param ctx The context of the tree.
+ * @param other The context of the other tree.
+ */
+extern void avl_ctx_merge(avl_ctx_t *ctx, const avl_ctx_t *other);
+
+/**
+ * @brief Whether comparing keys of a tree may run Python code and fail.
+ * 
+ * @param ctx The context of the tree.
+ * @return Return 1 for generic and tuple keys, 0 otherwise.
+ */
+extern int avl_ctx_fallible(const avl_ctx_t *ctx);
+
+/**
+ * @brief Parse the name of a dtype.
+ * 
+ * @param name None, "object", "int64", "float64" or "bytes".
+ * @param dtype The parsed dtype.
+ * @return Return 0 on success, -1 with ValueError set on failure.
+ */
+extern int avl_dtype_parse(PyObject *name, avl_dtype_t *dtype);
+
+/**
+ * @brief Get the name of a dtype.
+ */
+extern const char* avl_dtype_name(avl_dtype_t dtype);
+
+/**
+ * @brief Convert a Python object to the storage of a dtype.
+ * 
+ * @param dtype The dtype of the storage.
+ * @param obj The object to convert.
+ * @param key The converted storage, holding a new reference for object dtypes.
+ * @return Return 0 on success, -1 with an exception set on failure.
+ */
+extern int avl_key_from_object(avl_dtype_t dtype, PyObject *obj, avl_key_t *key);
+
+/**
+ * @brief Convert a Python object to a key stored in a tree, see avl_key_from_object.
+ * Unlike values, float64 keys must not be NaN, which has no place in the order.
+ * 
+ * @return Return 0 on success, -1 with an exception set on failure.
+ */
+extern int avl_key_import(avl_dtype_t dtype, PyObject *obj, avl_key_t *key);
+
+/**
+ * @brief Convert the storage of a dtype to a Python object.
+ * 
+ * @return Return a new reference, NULL on failure.
+ */
+extern PyObject* avl_key_to_object(avl_dtype_t dtype, avl_key_t key);
+
+/**
+ * @brief Release the reference held by the storage of a dtype, if any.
+ */
+extern void avl_key_release(avl_dtype_t dtype, avl_key_t key);
+
+/**
+ * @brief Three-way comparison of two keys.
+ * Return -2 on errors, -1 if a < b, 0 if a == b or 1 if a > b.
+ */
+typedef int (*avl_cmpfunc)(avl_key_t a, avl_key_t b);
+
+/**
+ * @brief Prepare a Python object to be compared against the keys of a tree,
+ * for engines other than the AVL tree sharing its comparisons.
+ * Comparisons made by the returned function are not counted in the context.
+ * 
+ * @param ctx The context of the tree.
+ * @param obj The object to compare.
+ * @param key The storage to use as the left operand of the returned function.
+ * It is a borrowed reference for object storage.
+ * @return The comparison function to use.
+ */
+extern avl_cmpfunc avl_cmp_query(avl_ctx_t *ctx, PyObject *obj, avl_key_t *key);
+
+/**
+ * @brief Select the comparison function for a key stored in a tree, see avl_cmp_query.
+ */
+extern avl_cmpfunc avl_cmp_stored(avl_ctx_t *ctx, avl_key_t key);
+
+/**
+ * @brief Compare two keys stored in a tree.
+ * 
+ * @param ctx The context of the tree.
+ * @param a Left operand.
+ * @param b Right operand.
+ * @return Return -2 on errors, -1 if a < b, 0 if a == b or 1 if a > b.
+ */
+extern int avl_key_cmp(avl_ctx_t *ctx, avl_key_t a, avl_key_t b);
+
+/**
+ * @brief Compare two Python objects the way a tree compares keys, for objects
+ * that are not stored in it yet.
+ * 
+ * @param ctx The context of the tree, counting the comparison.
+ * @param a Left operand.
+ * @param b Right operand.
+ * @return Return -2 on errors, -1 if a < b, 0 if a == b or 1 if a > b.
+ */
+extern int avl_object_cmp(avl_ctx_t *ctx, PyObject *a, PyObject *b);
+
+/**
+ * @brief Update the kind of a tree for a key about to be stored in it.
+ * 
+ * @param ctx The context of the tree.
+ * @param key The stored key.
+ */
+extern void avl_ctx_observe(avl_ctx_t *ctx, avl_key_t key);
+
+/**
+ * @brief Check whether an array of stored keys is sorted.
+ * 
+ * @param ctx The context of the tree.
+ * @param keys The keys to check.
+ * @param n The number of keys.
+ * @return Return 1 if keys are non-decreasing, 0 if not and -1 on errors.
+ */
+extern int avl_keys_sorted(avl_ctx_t *ctx, avl_key_t *keys, size_t n);
+
+/**
+ * @brief Stably sort an array of stored keys.
+ * Unboxed keys are sorted natively, and objects by the sort of Python lists.
  * 
+ * @param ctx The context of the tree.
+ * @param keys The keys to sort.
+ * @param n The number of keys.
+ * @return Return 0 on success, -1 on errors.
  */
-#define AVL_KEY(root)       ((avl_node_t*)(root))->key
+extern int avl_keys_sort(avl_ctx_t *ctx, avl_key_t *keys, size_t n);
+
+/**
+ * @brief Find the stable sorted order of an array of stored keys, by a merge sort
+ * that keeps runs already in order, so that the values of the keys can follow.
+ * 
+ * @param ctx The context of the tree, which has observed all keys.
+ * @param keys The keys to sort, left as they are.
+ * @param n The number of keys.
+ * @param order Set to the indices of the keys in sorted order.
+ * @return Return 0 on success, -1 on errors.
+ */
+extern int avl_keys_argsort(avl_ctx_t *ctx, const avl_key_t *keys, size_t n, size_t *order);
 
 /**
  * @brief Initialize a tree node with a given key.
  * 
  * @param node The node to initialize.
- * @param key The associated key to the node.
+ * @param key The associated key to the node, see avl_key_from_object.
+ * The node takes over the reference held by key.
  */
-extern void avl_node_init(avl_node_t *node, PyObject *key);
+extern void avl_node_init(avl_node_t *node, avl_key_t key);
 
 /**
  * @brief Undo intialization process.
  * 
  * @param node The node to clear.
+ * @param ctx The context of the tree.
  */
-extern void avl_node_clear(avl_node_t *node);
+extern void avl_node_clear(avl_node_t *node, avl_ctx_t *ctx);
 
 /**
  * @brief Create a tree node with a given key.
  * This is only intended for avl_node_t. Do not use it for extensions of avl_node_t.
  * 
- * @param key The associated key to the node.
+ * @param pool The pool of the tree.
+ * @param key The associated key to the node, see avl_node_init.
  * @return Return the created node on success, NULL on failure.
  */
-extern avl_node_t* avl_node_new(PyObject *key);
+extern avl_node_t* avl_node_new(avl_pool_t *pool, avl_key_t key);
 
 /**
  * @brief Free an AVL tree properly.
  * This is only intended for avl_node_t. Do not use it for extensions of avl_node_t.
  * 
  * @param root The root of an AVL tree.
+ * @param ctx The context of the tree.
+ * @param pool The pool of the tree.
  */
-extern void avl_node_free(avl_node_t* root);
+extern void avl_node_free(avl_node_t* root, avl_ctx_t *ctx, avl_pool_t *pool);
+
+/**
+ * @brief Build a perfectly balanced AVL tree without comparisons.
+ * 
+ * @param nodes Initialized nodes sorted by distinct keys.
+ * @param n The number of nodes.
+ * @param ctx The context of the tree, for its augmentation.
+ * @return Return the root of the tree.
+ */
+extern avl_node_t* avl_node_build(avl_node_t **nodes, size_t n, avl_ctx_t *ctx);
 
 /**
  * @brief Insert a key into an AVL tree.
  * 
  * @param root The root of an AVL tree.
+ * @param ctx The context of the tree.
  * @param node The node to insert.
  * @param ret The return code of insertion.
  * @param found The found node with the key.
@@ -132,14 +535,74 @@ extern void avl_node_free(avl_node_t* root);
  * 
  * Return the modified tree if the node is successfully inserted and set
  * return code to 1.
+ * 
+ * If the tree shares nodes, see avl_share_t, the returned tree may have copies of
+ * nodes on the path in any case, so that the found node can be changed in place.
+ * 
+ * While inserts keep adding the first or the last node, a key beyond that end is
+ * compared with it once and linked down the spine without other comparisons.
  */
 extern avl_node_t*
-avl_node_insert(avl_node_t *root, avl_node_t *node, int *ret, avl_node_t **found);
+avl_node_insert(avl_node_t *root, avl_ctx_t *ctx, avl_node_t *node, int *ret, avl_node_t **found);
+
+/**
+ *  `avl_slot_t` is the place of a key in an AVL tree, found by avl_node_locate:
+ *  the path to the node with the key, or to where a node with the key belongs.
+ *  It lets a caller allocate a node only when the key is missing, and link it
+ *  without searching again while the `version` of the context is unchanged.
+ */
+
+typedef struct _avl_slot {
+    avl_node_t *path[128];
+    signed char dirs[128];  /* dirs[i] is the side of path[i + 1], or of a new node, under path[i] */
+    int n;                  /* the length of the path, ending at the node found if any */
+    int side;               /* the end a new node would be the first or the last node at, or 0 */
+    int keep;               /* whether the other end stays cached after linking a new node */
+    uint64_t version;       /* the version of the context the slot was found at */
+} avl_slot_t;
+
+/**
+ * @brief Find the place of a key in an AVL tree, as avl_node_insert without inserting.
+ * Nodes on the path are made private to the tree, see avl_share_t, so the node
+ * found can be changed in place.
+ * 
+ * @param root The root of an AVL tree.
+ * @param ctx The context of the tree.
+ * @param key The key to look for.
+ * @param slot Set to the place of the key.
+ * @param ret Set to 1 if the key is found, 0 if not and -1 on errors.
+ * @param found Set to the node with the key if it is found.
+ * @return Return the root of the tree, which may have copies of shared nodes.
+ */
+extern avl_node_t* avl_node_locate(avl_node_t *root, avl_ctx_t *ctx, PyObject *key,
+    avl_slot_t *slot, int *ret, avl_node_t **found);
+
+/**
+ * @brief Check whether a slot is still valid, after code that may have changed the
+ * tree ran: the shape of the tree is unchanged and the nodes on the path are not
+ * shared with snapshots taken since.
+ */
+extern int avl_slot_valid(avl_slot_t *slot, avl_ctx_t *ctx);
+
+/**
+ * @brief Link a node with the key looked for where avl_node_locate found it missing.
+ * The slot must be valid, see avl_slot_valid.
+ * 
+ * @return Return the root of the tree.
+ */
+extern avl_node_t* avl_slot_link(avl_node_t *root, avl_ctx_t *ctx, avl_slot_t *slot, avl_node_t *node);
+
+/**
+ * @brief Recompute the augmentation on the path of a slot, if any, after the node
+ * found by avl_node_locate changed in place.
+ */
+extern void avl_slot_refresh(avl_slot_t *slot, avl_ctx_t *ctx);
 
 /**
  * @brief Delete a key from an AVL tree.
  * 
  * @param root The root of an AVL tree.
+ * @param ctx The context of the tree.
  * @param key The key to delete.
  * @param ret The return code of deletion.
  * @param deleted The deleted node.
@@ -150,15 +613,54 @@ avl_node_insert(avl_node_t *root, avl_node_t *node, int *ret, avl_node_t **found
  * 
  * Return the modified tree if the node is successfully deleted and set
  * return code to 1. `deleted` is set to the deleted node with its left and
- * right children set to NULL.
+ * right children set to NULL. If the tree shares nodes, the deleted node is a
+ * copy belonging to the tree alone, as in avl_node_insert.
+ */
+extern avl_node_t*
+avl_node_delete(avl_node_t *root, avl_ctx_t *ctx, PyObject *key, int *ret, avl_node_t **deleted);
+
+/**
+ * @brief Delete the node at a given position from an AVL tree, descending by
+ * subtree sizes without comparing keys.
+ * 
+ * @param root The root of an AVL tree.
+ * @param ctx The context of the tree.
+ * @param loc The position of the node, from 0.
+ * @param ret The return code of deletion.
+ * @param deleted The deleted node.
+ * @return Return the tree with return code 1 and `deleted` set as avl_node_delete,
+ * or return code 0 if loc is out of range and -1 on errors.
  */
 extern avl_node_t*
-avl_node_delete(avl_node_t *root, PyObject *key, int *ret, avl_node_t **deleted);
+avl_node_delete_at(avl_node_t *root, avl_ctx_t *ctx, ptrdiff_t loc, int *ret, avl_node_t **deleted);
+
+/**
+ * @brief Recompute the augmentation on the path from the root to a node whose
+ * fields changed in place. Nodes on the path must not be shared, see avl_node_insert.
+ * 
+ * @param root The root of an AVL tree.
+ * @param ctx The context of the tree.
+ * @param node The changed node in the tree.
+ * @return Return 0 on success, -1 on errors.
+ */
+extern int avl_node_refresh(avl_node_t *root, avl_ctx_t *ctx, avl_node_t *node);
+
+/**
+ * @brief Drop a link to a tree shared with other versions, see avl_share_t.
+ * Nodes no other version links to are released and returned to the pool.
+ * 
+ * @param root The root of a version of the tree.
+ * @param pool The pool of the tree.
+ * @param release Drop the references held by a node.
+ * @param extra The second argument of release.
+ */
+extern void avl_node_unref(avl_node_t *root, avl_pool_t *pool, avl_func release, void *extra);
 
 /**
  * @brief Find a tree node by a key.
  * 
  * @param root The root of an tree.
+ * @param ctx The context of the tree.
  * @param key The key to find.
  * @param ret The return code of search.
  * @return Return NULL on errors and return code is set to -1.
@@ -169,7 +671,7 @@ avl_node_delete(avl_node_t *root, PyObject *key, int *ret, avl_node_t **deleted)
  * return code to 1.
  */
 extern avl_node_t*
-avl_node_find(avl_node_t *root, PyObject *key, int *ret);
+avl_node_find(avl_node_t *root, avl_ctx_t *ctx, PyObject *key, int *ret);
 
 /**
  * @brief Execute a function for all nodes in an AVL tree in order.
@@ -191,40 +693,255 @@ avl_node_foreach(avl_node_t *root, avl_func func, void *extra);
  * if the index is in the range.
  */
 extern avl_node_t*
-avl_node_loc(avl_node_t *root, int loc);
+avl_node_loc(avl_node_t *root, ptrdiff_t loc);
+
+/**
+ * @brief Get the first or the last node of an AVL tree, in O(1) while the shape of
+ * the tree is unchanged since the last call, or since the last insert at that end.
+ * 
+ * @param root The root of an AVL tree.
+ * @param ctx The context of the tree, caching the node. It may be NULL.
+ * @param last Whether to get the last node instead of the first.
+ * @return Return the node, NULL if the tree is empty.
+ */
+extern avl_node_t*
+avl_node_end(avl_node_t *root, avl_ctx_t *ctx, int last);
 
 /**
  * @brief Get the node with largest node->key <= key
  * 
  * @param root The root of an AVL tree.
+ * @param ctx The context of the tree.
  * @param key The key to compare.
  * @param ret Reture code of the function.
  * @return The node with largest node->key <= key, and set ret to the number of
  * nodes satisfying node->key <= key. On error, set ret to -1 and return NULL.
  */
 extern avl_node_t*
-avl_node_at_most(avl_node_t *root, PyObject *key, int *ret);
+avl_node_at_most(avl_node_t *root, avl_ctx_t *ctx, PyObject *key, ptrdiff_t *ret);
 
 /**
  * @brief Get the node with smallest node->key >= key
  * 
  * @param root The root of an AVL tree.
+ * @param ctx The context of the tree.
  * @param key The key to compare.
  * @param ret Reture code of the function.
  * @return The node with smallest node->key >= key, and set ret to the number of
  * nodes satisfying node->key >= key. On error, set ret to -1 and return NULL.
  */
 extern avl_node_t*
-avl_node_at_least(avl_node_t *root, PyObject *key, int *ret);
+avl_node_at_least(avl_node_t *root, avl_ctx_t *ctx, PyObject *key, ptrdiff_t *ret);
+
+/**
+ * @brief Cover the nodes with keys between lo and hi by O(log n) single nodes
+ * and whole subtrees, to combine augmentations over a range of keys.
+ * 
+ * @param root The root of an AVL tree.
+ * @param ctx The context of the tree.
+ * @param lo The lower bound, NULL for no bound.
+ * @param hi The upper bound, NULL for no bound.
+ * @param lo_inclusive Whether lo is in the range.
+ * @param hi_inclusive Whether hi is in the range.
+ * @param node_func The function to execute for a node in the range, without its children.
+ * @param tree_func The function to execute for a subtree in the range.
+ * @param extra Extra data to pass into the functions.
+ * @return Return 0 on success, -1 on errors.
+ */
+extern int
+avl_node_cover(avl_node_t *root, avl_ctx_t *ctx, PyObject *lo, PyObject *hi,
+    int lo_inclusive, int hi_inclusive, avl_func node_func, avl_func tree_func, void *extra);
+
+/**
+ * @brief Count the nodes with node->key < key, or node->key <= key if `right` is true.
+ * This is the position where key would be inserted to keep the order, as with
+ * the bisect module. Counts have the width of Py_ssize_t.
+ * 
+ * @param root The root of an AVL tree.
+ * @param ctx The context of the tree.
+ * @param key The key to compare.
+ * @param right Whether to count nodes with keys equal to key.
+ * @param found If not NULL, set to whether key is in the tree.
+ * @return Return the count, -1 on errors.
+ */
+extern ptrdiff_t
+avl_node_bisect(avl_node_t *root, avl_ctx_t *ctx, PyObject *key, int right, int *found);
+
+/**
+ * @brief Set operations of avl_node_setop.
+ */
+typedef enum {
+    AVL_SETOP_UNION,
+    AVL_SETOP_INTERSECTION,
+    AVL_SETOP_DIFFERENCE,
+    AVL_SETOP_SYMMETRIC_DIFFERENCE,
+} avl_setop_t;
+
+/**
+ * @brief Copy the structure of an AVL tree into a pool without comparisons.
+ * Nodes are copied bytewise by the node size of the pool, so references held
+ * by the copied keys (and values) must be taken by the caller.
+ * 
+ * @param root The root of an AVL tree.
+ * @param pool The pool to allocate the copy from.
+ * @param ret The return code, -1 with MemoryError set if the pool runs out of memory and 0 otherwise.
+ * @return Return the root of the copy, NULL on errors.
+ */
+extern avl_node_t* avl_node_copy(avl_node_t *root, avl_pool_t *pool, int *ret);
+
+/**
+ * @brief Fill in a node copied by avl_node_copy_shape from the original node.
+ */
+typedef void (*avl_copy_func)(avl_node_t *copy, avl_node_t *node, void *extra);
+
+/**
+ * @brief Copy the structure of an AVL tree into a pool of nodes of another layout,
+ * without comparisons. Only the `avl_node_t` part of nodes is copied, then func is
+ * called for every copy and its original once all nodes are allocated.
+ * 
+ * @param root The root of an AVL tree.
+ * @param pool The pool to allocate the copy from.
+ * @param func The function filling in the rest of a copy and taking its references.
+ * @param extra The third argument of func.
+ * @param ret The return code, -1 with MemoryError set if the pool runs out of memory and 0 otherwise.
+ * @return Return the root of the copy, NULL on errors.
+ */
+extern avl_node_t*
+avl_node_copy_shape(avl_node_t *root, avl_pool_t *pool, avl_copy_func func, void *extra, int *ret);
+
+/**
+ * @brief Join two AVL trees by a middle node in O(|h(left) - h(right)|).
+ * 
+ * @param left The root of an AVL tree with keys less than the key of mid.
+ * @param mid The middle node. Its children are overwritten.
+ * @param right The root of an AVL tree with keys greater than the key of mid.
+ * @param ctx The context of the trees, for their augmentation.
+ * @return Return the root of the joined tree.
+ */
+extern avl_node_t*
+avl_node_join(avl_node_t *left, avl_node_t *mid, avl_node_t *right, avl_ctx_t *ctx);
+
+/**
+ * @brief Join two AVL trees where all keys of left are less than keys of right.
+ * 
+ * @return Return the root of the joined tree.
+ */
+extern avl_node_t* avl_node_join2(avl_node_t *left, avl_node_t *right, avl_ctx_t *ctx);
+
+/**
+ * @brief Split an AVL tree by a key in O(log n).
+ * 
+ * @param root The root of an AVL tree.
+ * @param ctx The context of the tree.
+ * @param key The stored key to split by.
+ * @param left Set to the tree with keys less than key.
+ * @param right Set to the tree with keys greater than key.
+ * @param ret The return code, -1 on errors and 0 otherwise.
+ * @return Return the node with the given key, detached from both trees, or NULL.
+ * On errors, all nodes are still in `left`, `right` or the returned node but
+ * the trees are no longer ordered.
+ */
+extern avl_node_t*
+avl_node_split(avl_node_t *root, avl_ctx_t *ctx, avl_key_t key,
+    avl_node_t **left, avl_node_t **right, int *ret);
+
+/**
+ * @brief Split an AVL tree by position in O(log n), without comparisons.
+ * The tree must not share nodes, see avl_share_t.
+ * 
+ * @param root The root of an AVL tree.
+ * @param ctx The context of the tree, for its augmentation.
+ * @param loc The number of nodes to keep in `left`.
+ * @param left Set to the tree of the first loc nodes.
+ * @param right Set to the tree of the rest.
+ */
+extern void avl_node_split_at(avl_node_t *root, avl_ctx_t *ctx, ptrdiff_t loc,
+    avl_node_t **left, avl_node_t **right);
+
+/**
+ * @brief Combine two AVL trees of the same pool by a set operation in
+ * O(m log(n/m + 1)) comparisons, where m <= n are the sizes of the trees.
+ * Both trees are consumed and their nodes are reused by the result. On equal
+ * keys, the node from `a` is kept.
+ * 
+ * @param op The set operation.
+ * @param a The root of the left operand.
+ * @param b The root of the right operand.
+ * @param ctx A context fit to compare keys of both trees, see avl_ctx_merge.
+ * @param dropped Set to the nodes not in the result, linked as a binary tree
+ * that is not balanced nor ordered. Release them by avl_node_drain.
+ * @param ret The return code, -1 on errors and 0 otherwise.
+ * @return Return the root of the result. On errors, all nodes are still in the
+ * returned tree or in `dropped` but the returned tree is no longer ordered.
+ */
+extern avl_node_t*
+avl_node_setop(avl_setop_t op, avl_node_t *a, avl_node_t *b, avl_ctx_t *ctx,
+    avl_node_t **dropped, int *ret);
 
 /**
- *  `avl_iter_t` provides iterator protocol for `avl_node_t *`
+ * @brief Hand a node over to the node of a tree with the same key, see avl_node_merge.
+ */
+typedef void (*avl_merge_func)(avl_node_t *kept, avl_node_t *node, void *extra);
+
+/**
+ * @brief Merge sorted nodes into an AVL tree in O(n + m) comparisons and rebuild it
+ * balanced, where n and m are the sizes of the tree and of the nodes.
+ * The tree must not share nodes, see avl_share_t.
+ * 
+ * @param root The root of an AVL tree.
+ * @param nodes Nodes in no tree, sorted by key without equal keys.
+ * @param m The number of nodes.
+ * @param ctx The context of the tree.
+ * @param func Called with the node of the tree and the merged node for every key in
+ * both, after all comparisons. It takes over the merged node, which is not linked.
+ * @param extra The third argument of func.
+ * @param ret The return code, -1 on errors and 0 otherwise.
+ * @return Return the root of the merged tree. On errors, the tree is unchanged and
+ * the nodes are left to the caller.
+ */
+extern avl_node_t*
+avl_node_merge(avl_node_t *root, avl_node_t **nodes, size_t m, avl_ctx_t *ctx,
+    avl_merge_func func, void *extra, int *ret);
+
+/**
+ * @brief Execute a function once for every node of a binary tree, without
+ * using a stack. The function may free the node it is given.
+ * 
+ * @param root The root of a binary tree, possibly unbalanced.
+ * @param func The function to execute.
+ * @param extra Extra data to pass into the function.
+ */
+extern void avl_node_drain(avl_node_t *root, avl_func func, void *extra);
+
+/**
+ * @brief Check whether all keys of an AVL tree are in another one.
+ * 
+ * @param a The root of the tree to check.
+ * @param b The root of the other tree.
+ * @param ctx A context fit to compare keys of both trees, see avl_ctx_merge.
+ * @return Return 1 if a is a subset of b, 0 if not and -1 on errors.
+ */
+extern int avl_node_issubset(avl_node_t *a, avl_node_t *b, avl_ctx_t *ctx);
+
+/**
+ * @brief Check whether two AVL trees have no keys in common.
+ * 
+ * @param a The root of a tree, preferably the smaller one.
+ * @param b The root of the other tree.
+ * @param ctx A context fit to compare keys of both trees, see avl_ctx_merge.
+ * @return Return 1 if a and b are disjoint, 0 if not and -1 on errors.
+ */
+extern int avl_node_isdisjoint(avl_node_t *a, avl_node_t *b, avl_ctx_t *ctx);
+
+/**
+ *  `avl_iter_t` provides iterator protocol for `avl_node_t *`, in either order.
+ *  It keeps the whole path from the root down to the next node.
  */
 
 typedef struct _avl_iter {
-    avl_node_t *next;
     avl_node_t *stack[128];
     int idx;
+    int reverse;
 } avl_iter_t;
 
 /**
@@ -235,6 +952,32 @@ typedef struct _avl_iter {
  */
 extern avl_iter_t* avl_iter_new(avl_node_t *root);
 
+/**
+ * @brief Create an iterator associated to an AVL tree, starting at a given position.
+ * 
+ * @param root The root of an AVL tree.
+ * @param loc The location index of the first node, indexed from 0.
+ * The iterator is exhausted if it is out of range.
+ * @param reverse Whether to walk towards smaller keys.
+ * @return Return the created iterator on success, NULL on failure.
+ */
+extern avl_iter_t* avl_iter_new_at(avl_node_t *root, ptrdiff_t loc, int reverse);
+
+/**
+ * @brief Create an iterator associated to an AVL tree, starting at a bound of a key.
+ * 
+ * @param root The root of an AVL tree.
+ * @param ctx The context of the tree.
+ * @param key The key to bound.
+ * @param inclusive Whether a node with the given key is the first one.
+ * @param reverse Whether to walk towards smaller keys. Forward iterators start
+ * at the smallest key greater than key, reverse ones at the largest key less than key.
+ * @return Return the created iterator on success, NULL on failure with an
+ * exception set if a comparison failed.
+ */
+extern avl_iter_t*
+avl_iter_new_from(avl_node_t *root, avl_ctx_t *ctx, PyObject *key, int inclusive, int reverse);
+
 /**
  * @brief Free an iterator.
  * 
@@ -243,11 +986,158 @@ extern avl_iter_t* avl_iter_new(avl_node_t *root);
 extern void avl_iter_free(avl_iter_t *iter);
 
 /**
- * @brief Return the next node in an AVL tree.
+ * @brief Return the next node in an AVL tree, in the order of the iterator.
  * 
  * @param iter The iterator assoicated to an AVL tree.
  * @return Return the node on success, NULL if stopped. 
  */
 extern avl_node_t* avl_iter_next(avl_iter_t *iter);
 
+/**
+ *  `avl_finger_t` keeps the path to the last key searched in an AVL tree, so that
+ *  a search for a nearby key only walks up as far as needed instead of
+ *  restarting at the root. It lives on the stack and must not outlive changes
+ *  to the tree.
+ */
+
+typedef struct _avl_finger {
+    avl_node_t *root;
+    avl_node_t *path[128];
+    signed char dirs[128];
+    int depth;
+} avl_finger_t;
+
+/**
+ * @brief Place a finger at the root of an AVL tree.
+ * 
+ * @param finger The finger.
+ * @param root The root of an AVL tree.
+ */
+extern void avl_finger_init(avl_finger_t *finger, avl_node_t *root);
+
+/**
+ * @brief Move a finger to a key. The cost grows with the log of the distance
+ * from the previous key, so sorted keys (in either order) are the cheapest.
+ * 
+ * @param finger The finger.
+ * @param ctx The context of the tree.
+ * @param key The key to search.
+ * @return Return 1 if key is in the tree, 0 if not and -1 on errors.
+ */
+extern int avl_finger_seek(avl_finger_t *finger, avl_ctx_t *ctx, PyObject *key);
+
+/**
+ * @brief Get the node with the largest key not bigger than the key last sought.
+ * 
+ * @param finger The finger.
+ * @return Return the node, NULL if there is none.
+ */
+extern avl_node_t* avl_finger_at_most(avl_finger_t *finger);
+
+/**
+ * @brief Get the node with the smallest key not smaller than the key last sought.
+ * 
+ * @param finger The finger.
+ * @return Return the node, NULL if there is none.
+ */
+extern avl_node_t* avl_finger_at_least(avl_finger_t *finger);
+
+/**
+ *  `avl_cursor_t` keeps the path from the root to a node of an AVL tree, so that
+ *  stepping to either neighbour costs O(1) amortized, and inserting or deleting
+ *  next to the node only rebalances upward, without searching. The cursor may be
+ *  off the tree, before the first node or after the last one. It must be placed
+ *  again after any change to the shape of the tree other than its own, which
+ *  renews the `version` of the context.
+ */
+
+typedef struct _avl_cursor {
+    avl_node_t *path[128];
+    signed char dirs[128];  /* dirs[i] is the side of path[i + 1] under path[i] */
+    int depth;              /* path[depth - 1] is the node at the cursor, 0 if off the tree */
+    ptrdiff_t loc;          /* the position of the node, -1 or the size off the tree */
+} avl_cursor_t;
+
+/**
+ * @brief The node at a cursor, NULL if it is off the tree.
+ * 
+ */
+#define AVL_CURSOR_NODE(cursor) ((cursor)->depth? (cursor)->path[(cursor)->depth - 1]: NULL)
+
+/**
+ * @brief Place a cursor at a position, descending by subtree sizes.
+ * 
+ * @param cursor The cursor.
+ * @param root The root of an AVL tree.
+ * @param loc The position, the cursor is off the tree if it is out of range.
+ * @return Return the node at the cursor, NULL if there is none.
+ */
+extern avl_node_t* avl_cursor_seek_loc(avl_cursor_t *cursor, avl_node_t *root, ptrdiff_t loc);
+
+/**
+ * @brief Place a cursor at the node with the smallest key not smaller than key,
+ * or after the last node if there is none.
+ * 
+ * @param cursor The cursor.
+ * @param root The root of an AVL tree.
+ * @param ctx The context of the tree.
+ * @param key The key to search.
+ * @return Return 1 if key is in the tree, 0 if not and -1 on errors.
+ */
+extern int avl_cursor_seek(avl_cursor_t *cursor, avl_node_t *root, avl_ctx_t *ctx, PyObject *key);
+
+/**
+ * @brief Move a cursor to the next node, or the previous one if `dir` is negative.
+ * A cursor off the tree moves onto the first or the last node towards the tree.
+ * 
+ * @return Return the node at the cursor, NULL if it moved off the tree.
+ */
+extern avl_node_t* avl_cursor_step(avl_cursor_t *cursor, avl_node_t *root, int dir);
+
+/**
+ * @brief Insert a node next to the node at a cursor, comparing its key with
+ * the two keys it goes between only. The cursor stays at its node.
+ * 
+ * @param cursor A cursor at a node.
+ * @param root The root of the AVL tree.
+ * @param ctx The context of the tree.
+ * @param node The node to insert.
+ * @param after Whether to insert after the node at the cursor instead of before.
+ * @param ret The return code: 1 if inserted, 0 if the key does not go there,
+ * and -1 on errors.
+ * @return Return the modified tree.
+ */
+extern avl_node_t* avl_cursor_insert(avl_cursor_t *cursor, avl_node_t *root, avl_ctx_t *ctx,
+    avl_node_t *node, int after, int *ret);
+
+/**
+ * @brief Delete the node at a cursor, which moves to the next node.
+ * 
+ * @param cursor A cursor at a node.
+ * @param root The root of the AVL tree.
+ * @param ctx The context of the tree.
+ * @param ret The return code: 1 if deleted and -1 on errors.
+ * @param deleted The deleted node, as avl_node_delete.
+ * @return Return the modified tree.
+ */
+extern avl_node_t* avl_cursor_delete(avl_cursor_t *cursor, avl_node_t *root, avl_ctx_t *ctx,
+    int *ret, avl_node_t **deleted);
+
+/**
+ * @brief Get the node at a cursor to change in place, copying it and its ancestors
+ * if they are shared, see avl_share_t. Call avl_cursor_refresh after changing it.
+ * 
+ * @param cursor A cursor at a node.
+ * @param root The root of the AVL tree, updated if the path is copied.
+ * @param ctx The context of the tree.
+ * @return Return the node, NULL with MemoryError set on failure.
+ */
+extern avl_node_t* avl_cursor_own(avl_cursor_t *cursor, avl_node_t **root, avl_ctx_t *ctx);
+
+/**
+ * @brief Recompute the augmentation on the path of a cursor, if any, after its
+ * node changed in place.
+ */
+extern void avl_cursor_refresh(avl_cursor_t *cursor, avl_ctx_t *ctx);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,1046 @@
+#include "btree.h"
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#define _BT_LEAF(node)      ((btree_leaf_t *)(node))
+#define _BT_INNER(node)     ((btree_inner_t *)(node))
+#define _BT_LEAF_MIN        (BTREE_LEAF_KEYS / 2)
+#define _BT_INNER_MIN       (BTREE_FANOUT / 2)
+
+/*
+ * Besides the root, leaves have at least one key and internal nodes at least two
+ * children. Nodes below half full are refilled by deletions, but appending at the
+ * end of the tree splits nodes unevenly to keep the left ones full.
+ */
+
+/* Memory Management */
+
+/**
+ * @brief Initialize an empty tree with the given columns.
+ */
+static void _btree_reset(btree_t *tree, int hugepages, int ncols, const avl_dtype_t *vtypes) {
+    tree->root = NULL;
+    tree->first = NULL;
+    tree->last = NULL;
+    tree->size = 0;
+    tree->height = 0;
+    tree->ncols = ncols;
+    for (int i = 0; i < BTREE_MAX_COLUMNS - 1; i++) {
+        tree->vtypes[i] = i < ncols - 1? vtypes[i]: AVL_DTYPE_OBJECT;
+    }
+    avl_pool_init(
+        &tree->leaves, sizeof(btree_leaf_t) + ncols * BTREE_LEAF_KEYS * sizeof(avl_key_t), hugepages
+    );
+    avl_pool_init(&tree->inners, sizeof(btree_inner_t), hugepages);
+}
+
+extern void btree_init(btree_t *tree, int hugepages) {
+    _btree_reset(tree, hugepages, 1, NULL);
+}
+
+extern void btree_set_columns(btree_t *tree, int ncols, const avl_dtype_t *vtypes) {
+    /* no node is in use, but chunks may remain after removals */
+    int hugepages = tree->leaves.hugepages;
+    avl_pool_clear(&tree->leaves);
+    avl_pool_clear(&tree->inners);
+    _btree_reset(tree, hugepages, ncols, vtypes);
+}
+
+/**
+ * @brief The dtype of a column of a tree.
+ */
+static inline avl_dtype_t _btree_dtype(btree_t *tree, avl_ctx_t *ctx, int col) {
+    return col? tree->vtypes[col - 1]: ctx->dtype;
+}
+
+extern void btree_release(btree_t *tree, avl_ctx_t *ctx, avl_key_t *entry) {
+    for (int col = 0; col < tree->ncols; col++) {
+        avl_key_release(_btree_dtype(tree, ctx, col), entry[col]);
+    }
+}
+
+/**
+ * @brief Release references held by separators of internal nodes.
+ */
+static void _btree_release(btree_node_t *node, int height, avl_dtype_t dtype) {
+    if (height <= 1) return;
+    btree_inner_t *inner = _BT_INNER(node);
+    for (uint32_t i = 0; i < inner->head.n; i++) {
+        if (i) {
+            avl_key_release(dtype, inner->keys[i - 1]);
+        }
+        _btree_release(inner->children[i], height - 1, dtype);
+    }
+}
+
+extern void btree_clear(btree_t *tree, avl_ctx_t *ctx) {
+    btree_t old = *tree;
+    avl_dtype_t dtype = ctx->dtype;
+    _btree_reset(tree, old.leaves.hugepages, old.ncols, old.vtypes);
+    avl_ctx_init(ctx, dtype);
+
+    for (int col = 0; col < old.ncols; col++) {
+        avl_dtype_t ctype = _btree_dtype(&old, ctx, col);
+        if (!AVL_DTYPE_BOXED(ctype)) {
+            continue;
+        }
+        for (btree_leaf_t *leaf = old.first; leaf; leaf = leaf->next) {
+            for (uint32_t i = 0; i < leaf->head.n; i++) {
+                avl_key_release(ctype, BTREE_LEAF_COLUMN(leaf, col)[i]);
+            }
+        }
+    }
+    if (AVL_DTYPE_BOXED(dtype)) {
+        _btree_release(old.root, old.height, dtype);
+    }
+    avl_pool_clear(&old.leaves);
+    avl_pool_clear(&old.inners);
+}
+
+/**
+ * @brief Copy a key into a separator, which holds its own reference.
+ */
+static inline avl_key_t _btree_key_copy(avl_ctx_t *ctx, avl_key_t key) {
+    if (AVL_DTYPE_BOXED(ctx->dtype)) {
+        Py_INCREF(key.obj);
+    }
+    return key;
+}
+
+/* Entries of leaves */
+
+/**
+ * @brief Move n entries between leaves of a tree, or within one, as memmove.
+ */
+static inline void
+_btree_leaf_move(btree_t *tree, btree_leaf_t *dst, int di, btree_leaf_t *src, int si, int n) {
+    for (int col = 0; col < tree->ncols; col++) {
+        memmove(BTREE_LEAF_COLUMN(dst, col) + di, BTREE_LEAF_COLUMN(src, col) + si,
+            n * sizeof(avl_key_t));
+    }
+}
+
+static inline void _btree_leaf_put(btree_t *tree, btree_leaf_t *leaf, int i, const avl_key_t *entry) {
+    for (int col = 0; col < tree->ncols; col++) {
+        BTREE_LEAF_COLUMN(leaf, col)[i] = entry[col];
+    }
+}
+
+static inline void _btree_leaf_get(btree_t *tree, btree_leaf_t *leaf, int i, avl_key_t *entry) {
+    for (int col = 0; col < tree->ncols; col++) {
+        entry[col] = BTREE_LEAF_COLUMN(leaf, col)[i];
+    }
+}
+
+extern int btree_build(btree_t *tree, avl_ctx_t *ctx, avl_key_t *const *columns, size_t n) {
+    if (n == 0) {
+        return 0;
+    }
+    /* Spread keys and children evenly, so that every node is at least half full. */
+    size_t nleaves = (n + BTREE_LEAF_KEYS - 1) / BTREE_LEAF_KEYS;
+    size_t ninners = 0;
+    int height = 1;
+    for (size_t m = nleaves; m > 1; m = (m + BTREE_FANOUT - 1) / BTREE_FANOUT) {
+        ninners += (m + BTREE_FANOUT - 1) / BTREE_FANOUT;
+        height ++;
+    }
+
+    btree_node_t **nodes = PyMem_New(btree_node_t *, nleaves + ninners);
+    uint64_t *sizes = PyMem_New(uint64_t, nleaves);
+    avl_key_t *mins = PyMem_New(avl_key_t, nleaves);
+    if (!nodes || !sizes || !mins) {
+        goto nomem;
+    }
+    for (size_t i = 0; i < nleaves + ninners; i++) {
+        nodes[i] = avl_pool_alloc(i < nleaves? &tree->leaves: &tree->inners);
+        if (!nodes[i]) {
+            avl_pool_clear(&tree->leaves);
+            avl_pool_clear(&tree->inners);
+            goto error;
+        }
+    }
+
+    size_t off = 0;
+    for (size_t i = 0; i < nleaves; i++) {
+        btree_leaf_t *leaf = _BT_LEAF(nodes[i]);
+        size_t cnt = n / nleaves + (i < n % nleaves);
+        leaf->head.n = (uint32_t)cnt;
+        leaf->head.leaf = 1;
+        leaf->prev = i? _BT_LEAF(nodes[i - 1]): NULL;
+        leaf->next = i + 1 < nleaves? _BT_LEAF(nodes[i + 1]): NULL;
+        for (int col = 0; col < tree->ncols; col++) {
+            memcpy(BTREE_LEAF_COLUMN(leaf, col), columns[col] + off, cnt * sizeof(avl_key_t));
+        }
+        sizes[i] = cnt;
+        mins[i] = columns[0][off];
+        off += cnt;
+    }
+
+    /* Parents overwrite sizes and mins of children they have read already. */
+    btree_node_t **level = nodes;
+    size_t m = nleaves;
+    while (m > 1) {
+        size_t k = (m + BTREE_FANOUT - 1) / BTREE_FANOUT;
+        btree_node_t **parents = level + m;
+        size_t c_off = 0;
+        for (size_t j = 0; j < k; j++) {
+            btree_inner_t *p = _BT_INNER(parents[j]);
+            size_t c = m / k + (j < m % k);
+            uint64_t total = 0;
+            p->head.n = (uint32_t)c;
+            p->head.leaf = 0;
+            for (size_t t = 0; t < c; t++) {
+                p->children[t] = level[c_off + t];
+                p->counts[t] = sizes[c_off + t];
+                total += sizes[c_off + t];
+                if (t) {
+                    p->keys[t - 1] = _btree_key_copy(ctx, mins[c_off + t]);
+                }
+            }
+            sizes[j] = total;
+            mins[j] = mins[c_off];
+            c_off += c;
+        }
+        level = parents;
+        m = k;
+    }
+
+    tree->root = level[0];
+    tree->first = _BT_LEAF(nodes[0]);
+    tree->last = _BT_LEAF(nodes[nleaves - 1]);
+    tree->size = n;
+    tree->height = height;
+    avl_ctx_touch(ctx);
+    PyMem_Free(nodes);
+    PyMem_Free(sizes);
+    PyMem_Free(mins);
+    return 0;
+
+nomem:
+    PyErr_NoMemory();
+error:
+    PyMem_Free(nodes);
+    PyMem_Free(sizes);
+    PyMem_Free(mins);
+    return -1;
+}
+
+extern void btree_export(btree_t *tree, avl_ctx_t *ctx, avl_key_t *const *columns) {
+    for (int col = 0; col < tree->ncols; col++) {
+        avl_dtype_t ctype = _btree_dtype(tree, ctx, col);
+        avl_key_t *out = columns[col];
+        for (btree_leaf_t *leaf = tree->first; leaf; leaf = leaf->next) {
+            avl_key_t *items = BTREE_LEAF_COLUMN(leaf, col);
+            for (uint32_t i = 0; i < leaf->head.n; i++) {
+                if (AVL_DTYPE_BOXED(ctype)) {
+                    Py_INCREF(items[i].obj);
+                }
+                *out++ = items[i];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Allocate an array of n items for each of ncols columns, at least one each.
+ *
+ * @return Return 0 on success, -1 with MemoryError set on failure.
+ */
+static int _btree_columns_new(avl_key_t **columns, int ncols, size_t n) {
+    for (int col = 0; col < ncols; col++) {
+        columns[col] = PyMem_New(avl_key_t, n? n: 1);
+        if (!columns[col]) {
+            while (col--) {
+                PyMem_Free(columns[col]);
+            }
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void _btree_columns_free(avl_key_t **columns, int ncols) {
+    for (int col = 0; col < ncols; col++) {
+        PyMem_Free(columns[col]);
+    }
+}
+
+extern int btree_copy(btree_t *tree, avl_ctx_t *ctx, btree_t *src, avl_ctx_t *src_ctx) {
+    avl_key_t *columns[BTREE_MAX_COLUMNS];
+    size_t n = src->size;
+    if (_btree_columns_new(columns, src->ncols, n) < 0) {
+        return -1;
+    }
+    btree_export(src, src_ctx, columns);
+    int ret = btree_build(tree, ctx, columns, n);
+    if (ret < 0) {
+        for (int col = 0; col < src->ncols; col++) {
+            for (size_t i = 0; i < n; i++) {
+                avl_key_release(_btree_dtype(src, src_ctx, col), columns[col][i]);
+            }
+        }
+    }
+    _btree_columns_free(columns, src->ncols);
+    return ret;
+}
+
+/* Search */
+
+/**
+ * @brief Find the index of the first key of a leaf not less than q.
+ *
+ * @return Return the index, setting found to whether the key there equals q,
+ * and -1 on errors.
+ */
+static inline int
+_btree_leaf_search(avl_ctx_t *ctx, avl_cmpfunc cmpf, avl_key_t q, btree_leaf_t *leaf, int *found) {
+    int lo = 0, hi = leaf->head.n;
+    *found = 0;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        ctx->ncmp++;
+        int cmp = cmpf(q, leaf->keys[mid]);
+        if (cmp == -2) {
+            return -1;
+        } else if (cmp == 0) {
+            *found = 1;
+            return mid;
+        } else if (cmp > 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief Find the index of the child of an internal node which may hold q.
+ *
+ * @return Return the index, -1 on errors.
+ */
+static inline int
+_btree_inner_search(avl_ctx_t *ctx, avl_cmpfunc cmpf, avl_key_t q, btree_inner_t *inner) {
+    int lo = 0, hi = inner->head.n - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        ctx->ncmp++;
+        int cmp = cmpf(q, inner->keys[mid]);
+        if (cmp == -2) {
+            return -1;
+        } else if (cmp == 0) {
+            return mid + 1;
+        } else if (cmp > 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief Walk down a non-empty tree to the leaf which may hold q, recording the
+ * internal nodes passed and the indices of the children taken.
+ *
+ * @return Return the leaf, NULL on errors.
+ */
+static btree_leaf_t*
+_btree_descend(btree_t *tree, avl_ctx_t *ctx, avl_cmpfunc cmpf, avl_key_t q,
+    btree_inner_t **path, int *idx) {
+    btree_node_t *node = tree->root;
+    for (int d = 0; d < tree->height - 1; d++) {
+        btree_inner_t *inner = _BT_INNER(node);
+        int i = _btree_inner_search(ctx, cmpf, q, inner);
+        if (i < 0) {
+            return NULL;
+        }
+        path[d] = inner;
+        idx[d] = i;
+        node = inner->children[i];
+    }
+    return _BT_LEAF(node);
+}
+
+/**
+ * @brief Walk down a non-empty tree to the leaf holding the location loc by counts,
+ * recording the path as _btree_descend. The location past the end is in the last leaf.
+ *
+ * @param cmpf To insert q at loc, the comparison of q, which picks the child at
+ * a boundary between two by their separator. NULL to take the right child.
+ * @param loc The location, set to the index in the leaf.
+ * @return Return the leaf, NULL on errors.
+ */
+static btree_leaf_t*
+_btree_descend_at(btree_t *tree, avl_ctx_t *ctx, avl_cmpfunc cmpf, avl_key_t q, size_t *loc,
+    btree_inner_t **path, int *idx) {
+    btree_node_t *node = tree->root;
+    uint64_t p = *loc;
+    for (int d = 0; d < tree->height - 1; d++) {
+        btree_inner_t *inner = _BT_INNER(node);
+        int i = 0;
+        while (i + 1 < (int)inner->head.n && p >= inner->counts[i]) {
+            if (cmpf && p == inner->counts[i]) {
+                ctx->ncmp++;
+                int cmp = cmpf(q, inner->keys[i]);
+                if (cmp == -2) {
+                    return NULL;
+                } else if (cmp < 0) {
+                    break;
+                }
+            }
+            p -= inner->counts[i];
+            i ++;
+        }
+        path[d] = inner;
+        idx[d] = i;
+        node = inner->children[i];
+    }
+    *loc = p;
+    return _BT_LEAF(node);
+}
+
+extern ptrdiff_t
+btree_bisect(btree_t *tree, avl_ctx_t *ctx, PyObject *key, int right, int *found, btree_pos_t *pos) {
+    avl_key_t query;
+    avl_cmpfunc cmpf = avl_cmp_query(ctx, key, &query);
+    ptrdiff_t cnt = 0;
+    if (found) {
+        *found = 0;
+    }
+    if (!tree->root) {
+        if (pos) {
+            pos->leaf = NULL;
+            pos->idx = 0;
+        }
+        return 0;
+    }
+
+    btree_node_t *node = tree->root;
+    for (int h = tree->height; h > 1; h--) {
+        btree_inner_t *inner = _BT_INNER(node);
+        int i = _btree_inner_search(ctx, cmpf, query, inner);
+        if (i < 0) {
+            return -1;
+        }
+        for (int k = 0; k < i; k++) {
+            cnt += inner->counts[k];
+        }
+        node = inner->children[i];
+    }
+    btree_leaf_t *leaf = _BT_LEAF(node);
+    int eq;
+    int idx = _btree_leaf_search(ctx, cmpf, query, leaf, &eq);
+    if (idx < 0) {
+        return -1;
+    }
+    if (eq && right) {
+        idx ++;
+    }
+    if (found) {
+        *found = eq;
+    }
+    if (pos) {
+        pos->leaf = leaf;
+        pos->idx = idx;
+        if ((uint32_t)idx == leaf->head.n) {
+            pos->leaf = leaf->next;
+            pos->idx = 0;
+        }
+    }
+    return cnt + idx;
+}
+
+extern int btree_seek(btree_t *tree, avl_ctx_t *ctx, PyObject *key, btree_pos_t *pos) {
+    avl_key_t query;
+    avl_cmpfunc cmpf = avl_cmp_query(ctx, key, &query);
+    btree_leaf_t *leaf = pos->leaf;
+    if (leaf) {
+        /* the leaf holds the key if it is between its ends */
+        ctx->ncmp += 2;
+        int lo = cmpf(query, leaf->keys[0]);
+        int hi = lo < 0? -1: cmpf(query, leaf->keys[leaf->head.n - 1]);
+        if (lo == -2 || hi == -2) {
+            return -1;
+        } else if (lo < 0 || hi > 0) {
+            leaf = NULL;
+        }
+    }
+    if (!leaf) {
+        if (!tree->root) {
+            pos->leaf = NULL;
+            pos->idx = 0;
+            return 0;
+        }
+        btree_node_t *node = tree->root;
+        for (int h = tree->height; h > 1; h--) {
+            btree_inner_t *inner = _BT_INNER(node);
+            int i = _btree_inner_search(ctx, cmpf, query, inner);
+            if (i < 0) {
+                return -1;
+            }
+            node = inner->children[i];
+        }
+        leaf = _BT_LEAF(node);
+    }
+    int found;
+    int idx = _btree_leaf_search(ctx, cmpf, query, leaf, &found);
+    if (idx < 0) {
+        return -1;
+    }
+    pos->leaf = leaf;
+    pos->idx = idx;
+    if ((uint32_t)idx == leaf->head.n) {
+        pos->leaf = leaf->next;
+        pos->idx = 0;
+    }
+    return found;
+}
+
+extern int btree_loc(btree_t *tree, ptrdiff_t loc, btree_pos_t *pos) {
+    pos->leaf = NULL;
+    pos->idx = 0;
+    if (loc < 0 || (size_t)loc >= tree->size) {
+        return 0;
+    }
+    uint64_t p = loc;
+    btree_node_t *node = tree->root;
+    for (int h = tree->height; h > 1; h--) {
+        btree_inner_t *inner = _BT_INNER(node);
+        int i = 0;
+        while (p >= inner->counts[i]) {
+            p -= inner->counts[i];
+            i ++;
+        }
+        node = inner->children[i];
+    }
+    pos->leaf = _BT_LEAF(node);
+    pos->idx = (int)p;
+    return 1;
+}
+
+extern void btree_pos_next(btree_pos_t *pos) {
+    if (++ pos->idx == (int)pos->leaf->head.n) {
+        pos->leaf = pos->leaf->next;
+        pos->idx = 0;
+    }
+}
+
+extern void btree_pos_prev(btree_pos_t *pos) {
+    if (-- pos->idx < 0) {
+        pos->leaf = pos->leaf->prev;
+        pos->idx = pos->leaf? (int)pos->leaf->head.n - 1: 0;
+    }
+}
+
+/* Insertion */
+
+/**
+ * @brief Put a child after the child at index j of an internal node which is not full.
+ */
+static void
+_btree_inner_put(btree_inner_t *p, int j, avl_key_t sep, btree_node_t *child, uint64_t count) {
+    int n = p->head.n;
+    memmove(p->keys + j + 1, p->keys + j, (n - 1 - j) * sizeof(avl_key_t));
+    memmove(p->children + j + 2, p->children + j + 1, (n - 1 - j) * sizeof(btree_node_t *));
+    memmove(p->counts + j + 2, p->counts + j + 1, (n - 1 - j) * sizeof(uint64_t));
+    p->keys[j] = sep;
+    p->children[j + 1] = child;
+    p->counts[j + 1] = count;
+    p->head.n ++;
+}
+
+/**
+ * @brief Split a full internal node while putting a child after the child at
+ * index j, moving the upper half into `right`.
+ *
+ * @param append Whether to keep the node full, for appending at the end of the tree.
+ * @param sep The separator of the child to put, and set to the separator of `right`.
+ * @return Return the number of keys under `right`.
+ */
+static uint64_t
+_btree_inner_split(btree_inner_t *p, btree_inner_t *right, int j, avl_key_t *sep,
+    btree_node_t *child, uint64_t count, int append) {
+    avl_key_t keys[BTREE_FANOUT];
+    btree_node_t *children[BTREE_FANOUT + 1];
+    uint64_t counts[BTREE_FANOUT + 1];
+    int c = BTREE_FANOUT + 1;
+
+    memcpy(keys, p->keys, j * sizeof(avl_key_t));
+    keys[j] = *sep;
+    memcpy(keys + j + 1, p->keys + j, (BTREE_FANOUT - 1 - j) * sizeof(avl_key_t));
+    memcpy(children, p->children, (j + 1) * sizeof(btree_node_t *));
+    children[j + 1] = child;
+    memcpy(children + j + 2, p->children + j + 1, (BTREE_FANOUT - 1 - j) * sizeof(btree_node_t *));
+    memcpy(counts, p->counts, (j + 1) * sizeof(uint64_t));
+    counts[j + 1] = count;
+    memcpy(counts + j + 2, p->counts + j + 1, (BTREE_FANOUT - 1 - j) * sizeof(uint64_t));
+
+    int nl = append? BTREE_FANOUT - 1: c / 2;
+    memcpy(p->keys, keys, (nl - 1) * sizeof(avl_key_t));
+    memcpy(p->children, children, nl * sizeof(btree_node_t *));
+    memcpy(p->counts, counts, nl * sizeof(uint64_t));
+    p->head.n = nl;
+
+    *sep = keys[nl - 1];
+    uint64_t total = 0;
+    right->head.n = c - nl;
+    right->head.leaf = 0;
+    memcpy(right->keys, keys + nl, (c - nl - 1) * sizeof(avl_key_t));
+    memcpy(right->children, children + nl, (c - nl) * sizeof(btree_node_t *));
+    memcpy(right->counts, counts + nl, (c - nl) * sizeof(uint64_t));
+    for (int i = 0; i < c - nl; i++) {
+        total += right->counts[i];
+    }
+    return total;
+}
+
+/**
+ * @brief Split a full leaf while inserting an entry at index pos, moving the upper
+ * half into `right`, which is linked after the leaf.
+ */
+static void
+_btree_leaf_split(btree_t *tree, btree_leaf_t *leaf, btree_leaf_t *right, int pos,
+    const avl_key_t *entry, int append) {
+    int c = BTREE_LEAF_KEYS + 1;
+    int nl = append? BTREE_LEAF_KEYS: c / 2;
+    for (int col = 0; col < tree->ncols; col++) {
+        avl_key_t keys[BTREE_LEAF_KEYS + 1];
+        avl_key_t *items = BTREE_LEAF_COLUMN(leaf, col);
+        memcpy(keys, items, pos * sizeof(avl_key_t));
+        keys[pos] = entry[col];
+        memcpy(keys + pos + 1, items + pos, (BTREE_LEAF_KEYS - pos) * sizeof(avl_key_t));
+        memcpy(items, keys, nl * sizeof(avl_key_t));
+        memcpy(BTREE_LEAF_COLUMN(right, col), keys + nl, (c - nl) * sizeof(avl_key_t));
+    }
+    leaf->head.n = nl;
+    right->head.n = c - nl;
+    right->head.leaf = 1;
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next) {
+        leaf->next->prev = right;
+    } else {
+        tree->last = right;
+    }
+    leaf->next = right;
+}
+
+/**
+ * @brief Insert an entry into an empty tree.
+ */
+static int _btree_insert_first(btree_t *tree, avl_ctx_t *ctx, const avl_key_t *entry) {
+    btree_leaf_t *leaf = avl_pool_alloc(&tree->leaves);
+    if (!leaf) {
+        return -1;
+    }
+    leaf->head.n = 1;
+    leaf->head.leaf = 1;
+    leaf->prev = NULL;
+    leaf->next = NULL;
+    _btree_leaf_put(tree, leaf, 0, entry);
+    avl_ctx_observe(ctx, entry[0]);
+    avl_ctx_touch(ctx);
+    tree->root = (btree_node_t *)leaf;
+    tree->first = tree->last = leaf;
+    tree->height = 1;
+    tree->size = 1;
+    return 1;
+}
+
+/**
+ * @brief Insert an entry at index pos of a leaf reached by the path of a descent,
+ * splitting nodes on the way up as needed.
+ *
+ * @return Return 1 if inserted, -1 on errors.
+ */
+static int
+_btree_insert_path(btree_t *tree, avl_ctx_t *ctx, btree_inner_t **path, int *idx,
+    btree_leaf_t *leaf, int pos, const avl_key_t *entry) {
+    /* Reserve the nodes of all splits first, so that nothing fails halfway. */
+    int d = tree->height - 1;
+    int splits = 0, grow = 0;
+    btree_leaf_t *spare_leaf = NULL;
+    btree_inner_t *spare[BTREE_MAX_HEIGHT];
+    if (leaf->head.n == BTREE_LEAF_KEYS) {
+        while (splits < d && path[d - 1 - splits]->head.n == BTREE_FANOUT) {
+            splits ++;
+        }
+        grow = splits == d;
+        if (grow && tree->height == BTREE_MAX_HEIGHT) {
+            PyErr_SetString(PyExc_OverflowError, "B+ tree is too high");
+            return -1;
+        }
+        spare_leaf = avl_pool_alloc(&tree->leaves);
+        if (!spare_leaf) {
+            return -1;
+        }
+        for (int i = 0; i < splits + grow; i++) {
+            spare[i] = avl_pool_alloc(&tree->inners);
+            if (!spare[i]) {
+                while (i--) {
+                    avl_pool_free(&tree->inners, spare[i]);
+                }
+                avl_pool_free(&tree->leaves, spare_leaf);
+                return -1;
+            }
+        }
+    }
+
+    avl_ctx_observe(ctx, entry[0]);
+    avl_ctx_touch(ctx);
+    tree->size ++;
+    for (int i = 0; i < d; i++) {
+        path[i]->counts[idx[i]] ++;
+    }
+    if (!spare_leaf) {
+        _btree_leaf_move(tree, leaf, pos + 1, leaf, pos, leaf->head.n - pos);
+        _btree_leaf_put(tree, leaf, pos, entry);
+        leaf->head.n ++;
+        return 1;
+    }
+
+    int append = leaf == tree->last && (uint32_t)pos == leaf->head.n;
+    _btree_leaf_split(tree, leaf, spare_leaf, pos, entry, append);
+    btree_node_t *child = (btree_node_t *)spare_leaf;
+    uint64_t count = spare_leaf->head.n;
+    avl_key_t sep = _btree_key_copy(ctx, spare_leaf->keys[0]);
+    int s = 0;
+    for (int i = d - 1; i >= 0 && child; i--) {
+        btree_inner_t *p = path[i];
+        p->counts[idx[i]] -= count;
+        if (p->head.n < BTREE_FANOUT) {
+            _btree_inner_put(p, idx[i], sep, child, count);
+            child = NULL;
+        } else {
+            btree_inner_t *right = spare[s++];
+            count = _btree_inner_split(p, right, idx[i], &sep, child, count, append);
+            child = (btree_node_t *)right;
+        }
+    }
+    if (child) {
+        btree_inner_t *root = spare[s++];
+        root->head.n = 2;
+        root->head.leaf = 0;
+        root->keys[0] = sep;
+        root->children[0] = tree->root;
+        root->children[1] = child;
+        root->counts[0] = tree->size - count;
+        root->counts[1] = count;
+        tree->root = (btree_node_t *)root;
+        tree->height ++;
+    }
+    return 1;
+}
+
+extern int btree_insert(btree_t *tree, avl_ctx_t *ctx, const avl_key_t *entry, btree_pos_t *pos) {
+    if (!tree->root) {
+        return _btree_insert_first(tree, ctx, entry);
+    }
+
+    avl_cmpfunc cmpf = avl_cmp_stored(ctx, entry[0]);
+    btree_inner_t *path[BTREE_MAX_HEIGHT];
+    int idx[BTREE_MAX_HEIGHT];
+    btree_leaf_t *leaf = _btree_descend(tree, ctx, cmpf, entry[0], path, idx);
+    if (!leaf) {
+        return -1;
+    }
+    int found;
+    int i = _btree_leaf_search(ctx, cmpf, entry[0], leaf, &found);
+    if (i < 0) {
+        return -1;
+    } else if (found) {
+        if (pos) {
+            pos->leaf = leaf;
+            pos->idx = i;
+        }
+        return 0;
+    }
+    return _btree_insert_path(tree, ctx, path, idx, leaf, i, entry);
+}
+
+extern int btree_insert_at(btree_t *tree, avl_ctx_t *ctx, size_t loc, const avl_key_t *entry) {
+    if (!tree->root) {
+        return _btree_insert_first(tree, ctx, entry);
+    }
+    avl_cmpfunc cmpf = avl_cmp_stored(ctx, entry[0]);
+    btree_inner_t *path[BTREE_MAX_HEIGHT];
+    int idx[BTREE_MAX_HEIGHT];
+    btree_leaf_t *leaf = _btree_descend_at(tree, ctx, cmpf, entry[0], &loc, path, idx);
+    if (!leaf) {
+        return -1;
+    }
+    return _btree_insert_path(tree, ctx, path, idx, leaf, (int)loc, entry);
+}
+
+/* Deletion */
+
+/**
+ * @brief Remove the child at index k > 0 of an internal node with its separator.
+ */
+static void _btree_inner_remove(btree_inner_t *p, int k) {
+    int n = p->head.n;
+    memmove(p->keys + k - 1, p->keys + k, (n - 1 - k) * sizeof(avl_key_t));
+    memmove(p->children + k, p->children + k + 1, (n - 1 - k) * sizeof(btree_node_t *));
+    memmove(p->counts + k, p->counts + k + 1, (n - 1 - k) * sizeof(uint64_t));
+    p->head.n --;
+}
+
+/**
+ * @brief Refill the leaf at index j of an internal node from a sibling, or merge them.
+ *
+ * @param dropped Collect separators to release once the tree is consistent again.
+ * @return Return 1 if the internal node lost a child, 0 otherwise.
+ */
+static int
+_btree_fix_leaf(btree_t *tree, avl_ctx_t *ctx, btree_inner_t *p, int j,
+    avl_key_t *dropped, int *ndropped) {
+    btree_leaf_t *node = _BT_LEAF(p->children[j]);
+    btree_leaf_t *left = j > 0? _BT_LEAF(p->children[j - 1]): NULL;
+    btree_leaf_t *right = j + 1 < (int)p->head.n? _BT_LEAF(p->children[j + 1]): NULL;
+
+    if (left && left->head.n > _BT_LEAF_MIN) {
+        _btree_leaf_move(tree, node, 1, node, 0, node->head.n);
+        _btree_leaf_move(tree, node, 0, left, -- left->head.n, 1);
+        node->head.n ++;
+        dropped[(*ndropped)++] = p->keys[j - 1];
+        p->keys[j - 1] = _btree_key_copy(ctx, node->keys[0]);
+        p->counts[j - 1] --;
+        p->counts[j] ++;
+        return 0;
+    } else if (right && right->head.n > _BT_LEAF_MIN) {
+        _btree_leaf_move(tree, node, node->head.n ++, right, 0, 1);
+        right->head.n --;
+        _btree_leaf_move(tree, right, 0, right, 1, right->head.n);
+        dropped[(*ndropped)++] = p->keys[j];
+        p->keys[j] = _btree_key_copy(ctx, right->keys[0]);
+        p->counts[j] ++;
+        p->counts[j + 1] --;
+        return 0;
+    }
+
+    int k = left? j: j + 1;
+    left = _BT_LEAF(p->children[k - 1]);
+    right = _BT_LEAF(p->children[k]);
+    _btree_leaf_move(tree, left, left->head.n, right, 0, right->head.n);
+    left->head.n += right->head.n;
+    left->next = right->next;
+    if (right->next) {
+        right->next->prev = left;
+    } else {
+        tree->last = left;
+    }
+    dropped[(*ndropped)++] = p->keys[k - 1];
+    p->counts[k - 1] += p->counts[k];
+    _btree_inner_remove(p, k);
+    avl_pool_free(&tree->leaves, right);
+    return 1;
+}
+
+/**
+ * @brief Refill the internal node at index j of another from a sibling, or merge them.
+ * Separators only move, so no references are dropped.
+ *
+ * @return Return 1 if the parent lost a child, 0 otherwise.
+ */
+static int _btree_fix_inner(btree_t *tree, btree_inner_t *p, int j) {
+    btree_inner_t *node = _BT_INNER(p->children[j]);
+    btree_inner_t *left = j > 0? _BT_INNER(p->children[j - 1]): NULL;
+    btree_inner_t *right = j + 1 < (int)p->head.n? _BT_INNER(p->children[j + 1]): NULL;
+    int n = node->head.n;
+
+    if (left && left->head.n > _BT_INNER_MIN) {
+        int ln = left->head.n;
+        memmove(node->keys + 1, node->keys, (n - 1) * sizeof(avl_key_t));
+        memmove(node->children + 1, node->children, n * sizeof(btree_node_t *));
+        memmove(node->counts + 1, node->counts, n * sizeof(uint64_t));
+        node->keys[0] = p->keys[j - 1];
+        node->children[0] = left->children[ln - 1];
+        node->counts[0] = left->counts[ln - 1];
+        node->head.n ++;
+        p->keys[j - 1] = left->keys[ln - 2];
+        p->counts[j - 1] -= node->counts[0];
+        p->counts[j] += node->counts[0];
+        left->head.n --;
+        return 0;
+    } else if (right && right->head.n > _BT_INNER_MIN) {
+        int rn = right->head.n;
+        node->keys[n - 1] = p->keys[j];
+        node->children[n] = right->children[0];
+        node->counts[n] = right->counts[0];
+        node->head.n ++;
+        p->keys[j] = right->keys[0];
+        p->counts[j] += right->counts[0];
+        p->counts[j + 1] -= right->counts[0];
+        memmove(right->keys, right->keys + 1, (rn - 2) * sizeof(avl_key_t));
+        memmove(right->children, right->children + 1, (rn - 1) * sizeof(btree_node_t *));
+        memmove(right->counts, right->counts + 1, (rn - 1) * sizeof(uint64_t));
+        right->head.n --;
+        return 0;
+    }
+
+    int k = left? j: j + 1;
+    left = _BT_INNER(p->children[k - 1]);
+    right = _BT_INNER(p->children[k]);
+    int ln = left->head.n, rn = right->head.n;
+    left->keys[ln - 1] = p->keys[k - 1];
+    memcpy(left->keys + ln, right->keys, (rn - 1) * sizeof(avl_key_t));
+    memcpy(left->children + ln, right->children, rn * sizeof(btree_node_t *));
+    memcpy(left->counts + ln, right->counts, rn * sizeof(uint64_t));
+    left->head.n += rn;
+    p->counts[k - 1] += p->counts[k];
+    _btree_inner_remove(p, k);
+    avl_pool_free(&tree->inners, right);
+    return 1;
+}
+
+/**
+ * @brief Delete the entry at index pos of a leaf reached by the path of a descent,
+ * refilling nodes on the way up as needed.
+ */
+static void
+_btree_delete_path(btree_t *tree, avl_ctx_t *ctx, btree_inner_t **path, int *idx,
+    btree_leaf_t *leaf, int pos, avl_key_t *entry) {
+    /* Keys are released last, since releasing them may run code touching the tree. */
+    avl_key_t removed[BTREE_MAX_COLUMNS];
+    avl_key_t dropped[BTREE_MAX_HEIGHT];
+    int ndropped = 0;
+    _btree_leaf_get(tree, leaf, pos, entry? entry: removed);
+    leaf->head.n --;
+    _btree_leaf_move(tree, leaf, pos, leaf, pos + 1, leaf->head.n - pos);
+    tree->size --;
+    avl_ctx_touch(ctx);
+
+    int d = tree->height - 1;
+    for (int i = 0; i < d; i++) {
+        path[i]->counts[idx[i]] --;
+    }
+    if (d && leaf->head.n < _BT_LEAF_MIN) {
+        int i = d - 1;
+        int shrunk = _btree_fix_leaf(tree, ctx, path[i], idx[i], dropped, &ndropped);
+        while (shrunk && i > 0 && path[i]->head.n < _BT_INNER_MIN) {
+            i --;
+            shrunk = _btree_fix_inner(tree, path[i], idx[i]);
+        }
+    }
+
+    if (d && tree->root->n == 1) {
+        btree_node_t *root = _BT_INNER(tree->root)->children[0];
+        avl_pool_free(&tree->inners, tree->root);
+        tree->root = root;
+        tree->height --;
+    } else if (!d && tree->root->n == 0) {
+        avl_pool_free(&tree->leaves, tree->root);
+        tree->root = NULL;
+        tree->first = tree->last = NULL;
+        tree->height = 0;
+    }
+
+    for (int i = 0; i < ndropped; i++) {
+        avl_key_release(ctx->dtype, dropped[i]);
+    }
+    if (!entry) {
+        btree_release(tree, ctx, removed);
+    }
+}
+
+extern int btree_delete(btree_t *tree, avl_ctx_t *ctx, PyObject *key, avl_key_t *entry) {
+    if (!tree->root) {
+        return 0;
+    }
+    avl_key_t query;
+    avl_cmpfunc cmpf = avl_cmp_query(ctx, key, &query);
+    btree_inner_t *path[BTREE_MAX_HEIGHT];
+    int idx[BTREE_MAX_HEIGHT];
+    btree_leaf_t *leaf = _btree_descend(tree, ctx, cmpf, query, path, idx);
+    if (!leaf) {
+        return -1;
+    }
+    int found;
+    int pos = _btree_leaf_search(ctx, cmpf, query, leaf, &found);
+    if (pos < 0) {
+        return -1;
+    } else if (!found) {
+        return 0;
+    }
+    _btree_delete_path(tree, ctx, path, idx, leaf, pos, entry);
+    return 1;
+}
+
+extern int btree_delete_at(btree_t *tree, avl_ctx_t *ctx, size_t loc, avl_key_t *entry) {
+    if (loc >= tree->size) {
+        return 0;
+    }
+    btree_inner_t *path[BTREE_MAX_HEIGHT];
+    int idx[BTREE_MAX_HEIGHT];
+    avl_key_t none = {0};
+    btree_leaf_t *leaf = _btree_descend_at(tree, ctx, NULL, none, &loc, path, idx);
+    _btree_delete_path(tree, ctx, path, idx, leaf, (int)loc, entry);
+    return 1;
+}
+
+extern int btree_delete_range(btree_t *tree, avl_ctx_t *ctx, size_t start, size_t end) {
+    if (end > tree->size) {
+        end = tree->size;
+    }
+    if (start >= end) {
+        return 0;
+    }
+    int ncols = tree->ncols;
+    size_t k = end - start, n = tree->size - k;
+    avl_key_t *removed = PyMem_New(avl_key_t, k * ncols);
+    if (!removed) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    if (k * 4 <= tree->size) {
+        for (size_t i = 0; i < k; i++) {
+            btree_delete_at(tree, ctx, start, removed + i * ncols);
+        }
+    } else {
+        /* the rest is built into a new tree, which replaces the tree once complete */
+        avl_key_t *columns[BTREE_MAX_COLUMNS];
+        if (_btree_columns_new(columns, ncols, n) < 0) {
+            PyMem_Free(removed);
+            return -1;
+        }
+        size_t i = 0;
+        for (btree_leaf_t *leaf = tree->first; leaf; leaf = leaf->next) {
+            for (uint32_t j = 0; j < leaf->head.n; j++, i++) {
+                if (i >= start && i < end) {
+                    _btree_leaf_get(tree, leaf, j, removed + (i - start) * ncols);
+                    continue;
+                }
+                for (int col = 0; col < ncols; col++) {
+                    columns[col][i < start? i: i - k] = BTREE_LEAF_COLUMN(leaf, col)[j];
+                }
+            }
+        }
+        btree_t rest;
+        _btree_reset(&rest, tree->leaves.hugepages, ncols, tree->vtypes);
+        if (btree_build(&rest, ctx, columns, n) < 0) {
+            _btree_columns_free(columns, ncols);
+            PyMem_Free(removed);
+            return -1;
+        }
+        _btree_columns_free(columns, ncols);
+        btree_t old = *tree;
+        *tree = rest;
+        if (AVL_DTYPE_BOXED(ctx->dtype)) {
+            _btree_release(old.root, old.height, ctx->dtype);
+        }
+        avl_pool_clear(&old.leaves);
+        avl_pool_clear(&old.inners);
+    }
+    avl_ctx_touch(ctx);
+
+    for (size_t i = 0; i < k; i++) {
+        btree_release(tree, ctx, removed + i * ncols);
+    }
+    PyMem_Free(removed);
+    return 0;
+}
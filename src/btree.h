@@ -0,0 +1,257 @@
+/**
+ * @file btree.h
+ * @author wormtooth (ye@wormtooth.com)
+ * @brief Interfaces for B+ tree, an alternative engine to the AVL tree with wide nodes.
+ *
+ * Keys are stored in leaves of `BTREE_LEAF_KEYS` keys, linked in order, and
+ * internal nodes of `BTREE_FANOUT` children keep the number of keys under each
+ * child for order statistics. Nodes are a whole number of cache lines and come
+ * from `avl_pool_t`, so that a search touches a few lines per level of a tree
+ * much shallower than an AVL tree. Keys are compared the same way as in avl.h.
+ * Values kept along keys, such as those of a map, are further columns of leaves.
+ *
+ * @version 0.2
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef PY_BTREE_H
+#define PY_BTREE_H
+
+#include "avl.h"
+
+#define BTREE_LEAF_KEYS     29      /* a leaf of keys only is 4 cache lines */
+#define BTREE_FANOUT        16      /* an internal node is 6 cache lines */
+#define BTREE_MAX_HEIGHT    32
+#define BTREE_MAX_COLUMNS   3       /* the keys, the values of a map and the objects keys are derived from */
+
+/**
+ * @brief The initial segment of both kinds of nodes.
+ *
+ */
+typedef struct _btree_node {
+    uint32_t n;         /* keys of a leaf or children of an internal node */
+    uint32_t leaf;
+} btree_node_t;
+
+/**
+ * A leaf keeps a column of `BTREE_LEAF_KEYS` keys, followed by a column as long
+ * for each kind of value kept along the keys, see btree_set_columns.
+ */
+typedef struct _btree_leaf {
+    btree_node_t head;
+    struct _btree_leaf *prev;
+    struct _btree_leaf *next;
+    avl_key_t keys[];
+} btree_leaf_t;
+
+/**
+ * Child `i + 1` only has keys not less than `keys[i]`, and child `i` only keys less than it.
+ * Separators are copies of keys and hold their own references for object dtypes.
+ */
+typedef struct _btree_inner {
+    btree_node_t head;
+    avl_key_t keys[BTREE_FANOUT - 1];
+    uint64_t counts[BTREE_FANOUT];
+    btree_node_t *children[BTREE_FANOUT];
+} btree_inner_t;
+
+typedef struct _btree {
+    btree_node_t *root;
+    btree_leaf_t *first;
+    btree_leaf_t *last;
+    size_t size;
+    int height;             /* 0 for an empty tree, 1 for a single leaf */
+    int ncols;              /* columns of leaves, 1 for keys only */
+    avl_dtype_t vtypes[BTREE_MAX_COLUMNS - 1];  /* the dtypes of the columns after the keys */
+    avl_pool_t leaves;
+    avl_pool_t inners;
+} btree_t;
+
+/**
+ * @brief A position of a key, as a leaf and an index into it.
+ * The leaf is NULL for the position past either end.
+ */
+typedef struct _btree_pos {
+    btree_leaf_t *leaf;
+    int idx;
+} btree_pos_t;
+
+/**
+ * @brief Column `col` of a leaf, 0 for the keys.
+ *
+ */
+#define BTREE_LEAF_COLUMN(leaf, col)    ((leaf)->keys + (col) * BTREE_LEAF_KEYS)
+
+/**
+ * @brief Key at a valid position.
+ *
+ */
+#define BTREE_POS_KEY(pos)  ((pos).leaf->keys[(pos).idx])
+
+/**
+ * @brief Item of column `col` at a valid position.
+ *
+ */
+#define BTREE_POS_AT(pos, col)  (BTREE_LEAF_COLUMN((pos).leaf, col)[(pos).idx])
+
+/*
+ * Functions changing a tree renew the version of its context, see avl_ctx_touch,
+ * since positions into it may be freed. An entry is an array of an item of each
+ * column, the key first.
+ */
+
+/**
+ * @brief Initialize an empty tree of keys only.
+ *
+ * @param tree The tree to initialize.
+ * @param hugepages Whether node pools are backed by huge pages, see avl_pool_init.
+ */
+extern void btree_init(btree_t *tree, int hugepages);
+
+/**
+ * @brief Set the columns kept along the keys of an empty tree.
+ *
+ * @param tree An empty tree.
+ * @param ncols The number of columns, counting the keys, up to BTREE_MAX_COLUMNS.
+ * @param vtypes The dtypes of the ncols - 1 columns after the keys.
+ */
+extern void btree_set_columns(btree_t *tree, int ncols, const avl_dtype_t *vtypes);
+
+/**
+ * @brief Release the references held by an entry taken out of a tree.
+ *
+ */
+extern void btree_release(btree_t *tree, avl_ctx_t *ctx, avl_key_t *entry);
+
+/**
+ * @brief Remove all keys of a tree, dropping references held by them.
+ * The tree is emptied first, in case releasing keys runs code touching it.
+ *
+ * @param tree The tree.
+ * @param ctx The context of the tree, reset for its dtype.
+ */
+extern void btree_clear(btree_t *tree, avl_ctx_t *ctx);
+
+/**
+ * @brief Build a tree from sorted distinct keys without comparisons.
+ *
+ * @param tree An empty tree.
+ * @param ctx The context of the tree, which has observed the keys.
+ * @param columns The keys, then the items of each other column, n of each.
+ * The tree takes over their references on success.
+ * @param n The number of keys.
+ * @return Return 0 on success, -1 with MemoryError set on failure.
+ */
+extern int btree_build(btree_t *tree, avl_ctx_t *ctx, avl_key_t *const *columns, size_t n);
+
+/**
+ * @brief Copy the items of all columns of a tree in order, taking new references.
+ *
+ * @param columns An array of size items for each column of the tree.
+ */
+extern void btree_export(btree_t *tree, avl_ctx_t *ctx, avl_key_t *const *columns);
+
+/**
+ * @brief Copy a tree into an empty one with the same columns, packing leaves
+ * full, in O(n) without comparisons.
+ *
+ * @return Return 0 on success, -1 with MemoryError set on failure.
+ */
+extern int btree_copy(btree_t *tree, avl_ctx_t *ctx, btree_t *src, avl_ctx_t *src_ctx);
+
+/**
+ * @brief Insert an entry into a tree.
+ *
+ * @param tree The tree.
+ * @param ctx The context of the tree.
+ * @param entry The entry, with the key as in avl_key_from_object. The tree takes
+ * over its references if inserted.
+ * @param pos If not NULL, set to the position of the key found in the tree.
+ * @return Return 1 if inserted, 0 if the key is presented already and -1 on errors.
+ */
+extern int btree_insert(btree_t *tree, avl_ctx_t *ctx, const avl_key_t *entry, btree_pos_t *pos);
+
+/**
+ * @brief Insert an entry at a location, which the caller has checked to be
+ * between the keys around it. Only separators at the boundaries of children
+ * are compared, to pick the side of the boundary.
+ *
+ * @param loc The location, from 0 to the size of the tree.
+ * @return Return 1 if inserted, -1 on errors.
+ */
+extern int btree_insert_at(btree_t *tree, avl_ctx_t *ctx, size_t loc, const avl_key_t *entry);
+
+/**
+ * @brief Delete a key from a tree.
+ *
+ * @param tree The tree.
+ * @param ctx The context of the tree.
+ * @param key The key to delete.
+ * @param entry If not NULL, set to the entry deleted, whose references pass to
+ * the caller. Otherwise they are released.
+ * @return Return 1 if deleted, 0 if the key is not presented and -1 on errors.
+ */
+extern int btree_delete(btree_t *tree, avl_ctx_t *ctx, PyObject *key, avl_key_t *entry);
+
+/**
+ * @brief Delete the key at a location, descending by counts without comparisons.
+ *
+ * @param entry As btree_delete.
+ * @return Return 1 if deleted, 0 if the location is out of range.
+ */
+extern int btree_delete_at(btree_t *tree, avl_ctx_t *ctx, size_t loc, avl_key_t *entry);
+
+/**
+ * @brief Delete the keys at locations from start to end, exclusive, without
+ * comparisons: one by one for a few keys, otherwise by building the rest anew.
+ *
+ * @return Return 0 on success, -1 with MemoryError set on failure.
+ */
+extern int btree_delete_range(btree_t *tree, avl_ctx_t *ctx, size_t start, size_t end);
+
+/**
+ * @brief Count the keys < key, or <= key if `right` is true, as avl_node_bisect.
+ *
+ * @param tree The tree.
+ * @param ctx The context of the tree.
+ * @param key The key to compare.
+ * @param right Whether to count keys equal to key.
+ * @param found If not NULL, set to whether key is in the tree.
+ * @param pos If not NULL, set to the position of the first key not counted.
+ * @return Return the count, -1 on errors.
+ */
+extern ptrdiff_t
+btree_bisect(btree_t *tree, avl_ctx_t *ctx, PyObject *key, int right, int *found, btree_pos_t *pos);
+
+/**
+ * @brief Find the position of the first key not less than key, searching the
+ * leaf of a previous position first, as a finger for sorted lookups.
+ *
+ * @param pos A position at the current version of the tree, or with a NULL
+ * leaf to search from the root; set to the position found.
+ * @return Return 1 if key is in the tree, 0 if not and -1 on errors.
+ */
+extern int btree_seek(btree_t *tree, avl_ctx_t *ctx, PyObject *key, btree_pos_t *pos);
+
+/**
+ * @brief Get the position of the key at a location, indexed from 0.
+ *
+ * @return Return 1 if the location is in range, 0 if not with the leaf of pos set to NULL.
+ */
+extern int btree_loc(btree_t *tree, ptrdiff_t loc, btree_pos_t *pos);
+
+/**
+ * @brief Move a position to the next key, or past the end.
+ *
+ */
+extern void btree_pos_next(btree_pos_t *pos);
+
+/**
+ * @brief Move a position to the previous key, or past the beginning.
+ *
+ */
+extern void btree_pos_prev(btree_pos_t *pos);
+
+#endif
\ No newline at end of file
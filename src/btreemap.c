@@ -0,0 +1,1813 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "avl.h"
+#include "btree.h"
+#include "pyavlmodule.h"
+
+/*
+ * A BTreeMap is a TreeMap whose items are in the B+ tree `btree`, while the AVL
+ * tree at `root` stays empty. Leaves keep the keys, the values, of the dtype of the
+ * first column after the keys, then for a map with a key function the objects keys
+ * are derived from. Every method of TreeMap reading `root` is overridden.
+ */
+typedef PyAVLTreeObj BTreeMapObj;
+
+static avl_dtype_t btreemap_vtype(BTreeMapObj *self) {
+    return self->btree->vtypes[0];
+}
+
+/**
+ * @brief Lay out the leaves of an empty tree for a dtype of values, with a column
+ * for the objects keys are derived from if the tree has a key function.
+ */
+static void btreemap_set_columns(BTreeMapObj *self, avl_dtype_t vtype) {
+    int ncols = self->keyfunc? 3: 2;
+    if (ncols != self->btree->ncols || vtype != btreemap_vtype(self)) {
+        avl_dtype_t vtypes[2] = {vtype, AVL_DTYPE_OBJECT};
+        btree_set_columns(self->btree, ncols, vtypes);
+    }
+}
+
+static PyObject* BTreeMapObj_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    BTreeMapObj *self = (BTreeMapObj *)TreeMap_Type.tp_new(type, NULL, NULL);
+    if (self == NULL) {
+        return NULL;
+    }
+    self->btree = PyMem_New(btree_t, 1);
+    if (!self->btree) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    btree_init(self->btree, pyavl_hugepages);
+    btreemap_set_columns(self, AVL_DTYPE_OBJECT);
+
+    return (PyObject *)self;
+}
+
+static void BTreeMapObj_free(BTreeMapObj *self) {
+    if (self->btree) {
+        btree_clear(self->btree, &self->ctx);
+        PyMem_Free(self->btree);
+        self->btree = NULL;
+    }
+    TreeMap_Type.tp_dealloc((PyObject *)self);
+}
+
+static Py_ssize_t btreemap_size(BTreeMapObj *self) {
+    return (Py_ssize_t)self->btree->size;
+}
+
+/**
+ * @brief Create an empty BTreeMap with the dtypes and the key function of like.
+ */
+static BTreeMapObj* btreemap_empty(BTreeMapObj *like) {
+    BTreeMapObj *self = (BTreeMapObj *)BTreeMapObj_new(&BTreeMap_Type, NULL, NULL);
+    if (!self) {
+        return NULL;
+    }
+    avl_ctx_init(&self->ctx, like->ctx.dtype);
+    Py_XINCREF(like->keyfunc);
+    self->keyfunc = like->keyfunc;
+    btreemap_set_columns(self, btreemap_vtype(like));
+    return self;
+}
+
+/* Items */
+
+static PyObject* btreemap_getkey(btree_pos_t pos, BTreeMapObj *owner) {
+    if (!pos.leaf) {
+        return NULL;
+    } else if (owner->keyfunc) {
+        PyObject *obj = BTREE_POS_AT(pos, 2).obj;
+        Py_INCREF(obj);
+        return obj;
+    }
+    return avl_key_to_object(owner->ctx.dtype, BTREE_POS_KEY(pos));
+}
+
+static PyObject* btreemap_getval(btree_pos_t pos, BTreeMapObj *owner) {
+    if (!pos.leaf) {
+        return NULL;
+    }
+    return avl_key_to_object(btreemap_vtype(owner), BTREE_POS_AT(pos, 1));
+}
+
+static PyObject* btreemap_getitem(btree_pos_t pos, BTreeMapObj *owner) {
+    if (!pos.leaf) {
+        return NULL;
+    }
+    PyObject *key = btreemap_getkey(pos, owner);
+    if (!key) {
+        return NULL;
+    }
+    PyObject *val = btreemap_getval(pos, owner);
+    if (!val) {
+        Py_DECREF(key);
+        return NULL;
+    }
+    return Py_BuildValue("(NN)", key, val);
+}
+
+/**
+ * @brief Fill an entry for a key, whose key is derived already, and a value.
+ *
+ * @return Return 0 on success, -1 on errors.
+ */
+static int btreemap_entry_from(BTreeMapObj *self, PyObject *derived, PyObject *key,
+    PyObject *val, avl_key_t *entry) {
+    if (avl_key_import(self->ctx.dtype, derived, &entry[0]) < 0) {
+        return -1;
+    }
+    if (avl_key_from_object(btreemap_vtype(self), val, &entry[1]) < 0) {
+        avl_key_release(self->ctx.dtype, entry[0]);
+        return -1;
+    }
+    if (self->keyfunc) {
+        Py_INCREF(key);
+        entry[2].obj = key;
+    }
+    return 0;
+}
+
+/**
+ * @brief Fill an entry for a key, with the key derived from it, and a value.
+ *
+ * @return Return 0 on success, -1 on errors.
+ */
+static int btreemap_new_entry(BTreeMapObj *self, PyObject *key, PyObject *val, avl_key_t *entry) {
+    PyObject *derived = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!derived) {
+        return -1;
+    }
+    int ret = btreemap_entry_from(self, derived, key, val, entry);
+    Py_DECREF(derived);
+    return ret;
+}
+
+/**
+ * @brief Insert an entry, taking it over. If the key is in the tree already, its
+ * value is replaced and the rest of the entry released, so that the first key stays.
+ *
+ * @param stored If not NULL, set to a new reference to the value stored.
+ * @return Return 0 on success, -1 on errors.
+ */
+static int btreemap_put(BTreeMapObj *self, avl_key_t *entry, PyObject **stored) {
+    avl_key_t val = entry[1];
+    btree_pos_t pos;
+    int ret = btree_insert(self->btree, &self->ctx, entry, &pos);
+    if (ret == 0) {
+        entry[1] = BTREE_POS_AT(pos, 1);
+        BTREE_POS_AT(pos, 1) = val;
+    }
+    /* read before releasing the entry, which may run code changing the tree */
+    PyObject *obj = ret >= 0 && stored? avl_key_to_object(btreemap_vtype(self), val): NULL;
+    if (ret != 1) {
+        btree_release(self->btree, &self->ctx, entry);
+    }
+    if (ret < 0 || (stored && !obj)) {
+        return -1;
+    } else if (stored) {
+        *stored = obj;
+    }
+    return 0;
+}
+
+/**
+ * @brief Set a key to a value, allocating leaf space only if the key is missing.
+ */
+static int btreemap_insert(BTreeMapObj *self, PyObject *key, PyObject *val) {
+    avl_key_t entry[3];
+    if (btreemap_new_entry(self, key, val, entry) < 0) {
+        return -1;
+    }
+    return btreemap_put(self, entry, NULL);
+}
+
+/**
+ * @brief Replace the value at a position found at a version of the tree. If the
+ * tree has changed since, the key is set again from the root.
+ *
+ * @param stored Set to a new reference to the value stored.
+ * @return Return 0 on success, -1 on errors.
+ */
+static int btreemap_store(BTreeMapObj *self, btree_pos_t pos, uint64_t version,
+    PyObject *derived, PyObject *key, PyObject *val, PyObject **stored) {
+    avl_dtype_t vtype = btreemap_vtype(self);
+    avl_key_t v;
+    if (avl_key_from_object(vtype, val, &v) < 0) {
+        return -1;
+    }
+    if (version != self->ctx.version) {
+        avl_key_release(vtype, v);
+        avl_key_t entry[3];
+        if (btreemap_entry_from(self, derived, key, val, entry) < 0) {
+            return -1;
+        }
+        return btreemap_put(self, entry, stored);
+    }
+    avl_key_t old = BTREE_POS_AT(pos, 1);
+    BTREE_POS_AT(pos, 1) = v;
+    *stored = avl_key_to_object(vtype, v);
+    avl_key_release(vtype, old);
+    return *stored? 0: -1;
+}
+
+/**
+ * @brief Count the keys less than a derived key, or not bigger if right, as btree_bisect.
+ *
+ * @return Return the count, -1 on errors.
+ */
+static Py_ssize_t
+btreemap_bisect(BTreeMapObj *self, PyObject *derived, int right, int *found, btree_pos_t *pos) {
+    return btree_bisect(self->btree, &self->ctx, derived, right, found, pos);
+}
+
+/**
+ * @brief Count the keys less than the key derived from an object, or not bigger if right.
+ *
+ * @return Return the count, -1 on errors.
+ */
+static Py_ssize_t
+btreemap_bisect_key(BTreeMapObj *self, PyObject *key, int right, int *found, btree_pos_t *pos) {
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return -1;
+    }
+    Py_ssize_t ret = btreemap_bisect(self, query, right, found, pos);
+    Py_DECREF(query);
+    return ret;
+}
+
+static PyObject* BTreeMapObj_get(BTreeMapObj *self, PyObject *const *args, Py_ssize_t nargs) {
+    if (nargs == 0 || nargs > 2) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "BTreeMap.get takes 1 or 2 positional arguments."
+        );
+        return NULL;
+    }
+    PyObject *ret = nargs == 2? args[1]: Py_None;
+    int found;
+    btree_pos_t pos;
+    if (btreemap_bisect_key(self, args[0], 0, &found, &pos) < 0) {
+        PyErr_Clear();
+    } else if (found) {
+        return btreemap_getval(pos, self);
+    }
+
+    Py_INCREF(ret);
+    return ret;
+}
+
+/**
+ * @brief Return the value of a key, setting it to default first if the key is missing.
+ */
+static PyObject* BTreeMapObj_setdefault(
+    BTreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"key", "default", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args("setdefault", args, nargs, kwnames, kwlist, 1, 2, argv) < 0) {
+        return NULL;
+    }
+    PyObject *key = argv[0], *dflt = argv[1]? argv[1]: Py_None;
+    PyObject *derived = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!derived) {
+        return NULL;
+    }
+    PyObject *ret = NULL;
+    avl_key_t entry[3];
+    int found;
+    btree_pos_t pos;
+    if (btreemap_bisect(self, derived, 0, &found, &pos) < 0) {
+        ret = NULL;
+    } else if (found) {
+        ret = btreemap_getval(pos, self);
+    } else if (btreemap_entry_from(self, derived, key, dflt, entry) == 0) {
+        btreemap_put(self, entry, &ret);
+    }
+    Py_DECREF(derived);
+    return ret;
+}
+
+/**
+ * @brief Return the value of a key, setting it to factory() first if the key is missing.
+ * The factory is only called for missing keys.
+ */
+static PyObject* BTreeMapObj_get_or_insert(
+    BTreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"key", "factory", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args("get_or_insert", args, nargs, kwnames, kwlist, 2, 2, argv) < 0) {
+        return NULL;
+    }
+    PyObject *key = argv[0];
+    PyObject *derived = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!derived) {
+        return NULL;
+    }
+    PyObject *ret = NULL;
+    int found;
+    btree_pos_t pos;
+    if (btreemap_bisect(self, derived, 0, &found, &pos) < 0) {
+        ret = NULL;
+    } else if (found) {
+        ret = btreemap_getval(pos, self);
+    } else {
+        /* the factory may change the tree, so the key is inserted from the root */
+        PyObject *val = PyObject_CallFunctionObjArgs(argv[1], NULL);
+        avl_key_t entry[3];
+        if (val && btreemap_entry_from(self, derived, key, val, entry) == 0) {
+            btreemap_put(self, entry, &ret);
+        }
+        Py_XDECREF(val);
+    }
+    Py_DECREF(derived);
+    return ret;
+}
+
+/**
+ * @brief Add delta to the value of a key, setting it to delta if the key is missing.
+ * Values of dtype int64 and float64 are added in place at the position found;
+ * int64 sums that overflow raise OverflowError.
+ */
+static PyObject* BTreeMapObj_increment(
+    BTreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"key", "delta", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args("increment", args, nargs, kwnames, kwlist, 1, 2, argv) < 0) {
+        return NULL;
+    }
+    PyObject *key = argv[0], *delta = argv[1];
+    avl_dtype_t vtype = btreemap_vtype(self);
+    avl_key_t d;
+    if (!delta) {
+        delta = PyLong_FromLong(1);
+    } else {
+        Py_INCREF(delta);
+    }
+    if (!delta) {
+        return NULL;
+    }
+    /* unboxed deltas are converted before the search, which no Python code may follow */
+    if (vtype == AVL_DTYPE_INT64 || vtype == AVL_DTYPE_FLOAT64) {
+        PyObject *num = vtype == AVL_DTYPE_INT64? PyNumber_Index(delta): PyNumber_Float(delta);
+        Py_DECREF(delta);
+        delta = num;
+        if (!delta || avl_key_from_object(vtype, delta, &d) < 0) {
+            Py_XDECREF(delta);
+            return NULL;
+        }
+    }
+    PyObject *derived = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!derived) {
+        Py_DECREF(delta);
+        return NULL;
+    }
+
+    PyObject *ret = NULL;
+    int found;
+    btree_pos_t pos;
+    avl_key_t entry[3];
+    if (btreemap_bisect(self, derived, 0, &found, &pos) < 0) {
+        ret = NULL;
+    } else if (!found) {
+        if (btreemap_entry_from(self, derived, key, delta, entry) == 0) {
+            btreemap_put(self, entry, &ret);
+        }
+    } else if (vtype == AVL_DTYPE_INT64) {
+        int64_t v = BTREE_POS_AT(pos, 1).i64;
+        if ((d.i64 > 0 && v > INT64_MAX - d.i64) || (d.i64 < 0 && v < INT64_MIN - d.i64)) {
+            PyErr_SetString(PyExc_OverflowError, "BTreeMap.increment overflows int64.");
+        } else {
+            BTREE_POS_AT(pos, 1).i64 = v + d.i64;
+            ret = PyLong_FromLongLong(v + d.i64);
+        }
+    } else if (vtype == AVL_DTYPE_FLOAT64) {
+        BTREE_POS_AT(pos, 1).f64 += d.f64;
+        ret = PyFloat_FromDouble(BTREE_POS_AT(pos, 1).f64);
+    } else {
+        uint64_t version = self->ctx.version;
+        PyObject *old = BTREE_POS_AT(pos, 1).obj;
+        Py_INCREF(old);
+        PyObject *val = PyNumber_Add(old, delta);
+        Py_DECREF(old);
+        if (val) {
+            btreemap_store(self, pos, version, derived, key, val, &ret);
+            Py_DECREF(val);
+        }
+    }
+    Py_DECREF(derived);
+    Py_DECREF(delta);
+    return ret;
+}
+
+/**
+ * @brief Set the value of a key to func(value), or to func(default) if the key is
+ * missing, without searching again unless func changes the tree. Return the new value.
+ */
+static PyObject* BTreeMapObj_update_with(
+    BTreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"key", "func", "default", NULL};
+    PyObject *argv[3];
+    if (pyavl_parse_args("update_with", args, nargs, kwnames, kwlist, 2, 3, argv) < 0) {
+        return NULL;
+    }
+    PyObject *key = argv[0], *func = argv[1];
+    PyObject *derived = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!derived) {
+        return NULL;
+    }
+    PyObject *ret = NULL;
+    int found;
+    btree_pos_t pos;
+    if (btreemap_bisect(self, derived, 0, &found, &pos) >= 0) {
+        uint64_t version = self->ctx.version;
+        PyObject *old = found? btreemap_getval(pos, self): argv[2]? argv[2]: Py_None;
+        if (!found) {
+            Py_INCREF(old);
+        }
+        PyObject *val = old? PyObject_CallFunctionObjArgs(func, old, NULL): NULL;
+        Py_XDECREF(old);
+        avl_key_t entry[3];
+        if (!val) {
+            ret = NULL;
+        } else if (found) {
+            btreemap_store(self, pos, version, derived, key, val, &ret);
+        } else if (btreemap_entry_from(self, derived, key, val, entry) == 0) {
+            btreemap_put(self, entry, &ret);
+        }
+        Py_XDECREF(val);
+    }
+    Py_DECREF(derived);
+    return ret;
+}
+
+/* Batches */
+
+/**
+ * @brief Release the entries from `start` to `end` of columns of the tree.
+ */
+static void btreemap_release_columns(BTreeMapObj *self, avl_key_t *const *columns,
+    size_t start, size_t end) {
+    avl_key_t entry[3];
+    for (size_t i = start; i < end; i++) {
+        for (int col = 0; col < self->btree->ncols; col++) {
+            entry[col] = columns[col][i];
+        }
+        btree_release(self->btree, &self->ctx, entry);
+    }
+}
+
+/**
+ * @brief Allocate `ncols` columns of n items each.
+ *
+ * @return Return 0 on success, -1 with MemoryError set on failure.
+ */
+static int btreemap_columns_new(avl_key_t **columns, int ncols, size_t n) {
+    for (int col = 0; col < ncols; col++) {
+        columns[col] = PyMem_New(avl_key_t, n? n: 1);
+        if (!columns[col]) {
+            while (col--) {
+                PyMem_Free(columns[col]);
+            }
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void btreemap_columns_free(avl_key_t **columns, int ncols) {
+    for (int col = 0; col < ncols; col++) {
+        PyMem_Free(columns[col]);
+    }
+}
+
+/**
+ * @brief Merge sorted distinct entries into the tree in one pass, replacing the
+ * values of keys in the tree. The result is packed into a new tree that replaces
+ * the old one on success, so that self is never seen half-way nor lost on errors.
+ *
+ * @param other_ctx The context the entries were observed by.
+ * @param columns The columns of the entries, whose references are taken over.
+ * @param m The number of entries.
+ * @return Return 0 on success, -1 on errors.
+ */
+static int btreemap_merge(BTreeMapObj *self, avl_ctx_t *other_ctx, avl_key_t *const *columns,
+    size_t m) {
+    btree_t *tree = self->btree;
+    int ncols = tree->ncols;
+    size_t n = tree->size, i = 0, j = 0, k = 0;
+    avl_key_t *mine[3] = {NULL, NULL, NULL}, *out[3] = {NULL, NULL, NULL};
+    if (btreemap_columns_new(mine, ncols, n) < 0) {
+        btreemap_release_columns(self, columns, 0, m);
+        return -1;
+    } else if (btreemap_columns_new(out, ncols, n + m) < 0) {
+        btreemap_columns_free(mine, ncols);
+        btreemap_release_columns(self, columns, 0, m);
+        return -1;
+    }
+    btree_export(tree, &self->ctx, mine);
+
+    avl_ctx_t ctx = self->ctx;
+    avl_ctx_merge(&ctx, other_ctx);
+    int ret = 0;
+    while (i < n || j < m) {
+        int c = i == n? 1: j == m? -1: avl_key_cmp(&ctx, mine[0][i], columns[0][j]);
+        if (c == -2) {
+            ret = -1;
+            break;
+        }
+        avl_key_t *const *from = c > 0? columns: mine;
+        size_t at = c > 0? j: i;
+        for (int col = 0; col < ncols; col++) {
+            out[col][k] = from[col][at];
+        }
+        if (c == 0) {
+            /* the key stays, with the new value */
+            avl_key_t v = out[1][k];
+            out[1][k] = columns[1][j];
+            columns[1][j] = v;
+            btreemap_release_columns(self, columns, j, j + 1);
+        }
+        k ++;
+        i += c <= 0;
+        j += c >= 0;
+    }
+    self->ctx.ncmp = ctx.ncmp;
+
+    btree_t fresh;
+    avl_ctx_t fresh_ctx = self->ctx;
+    fresh_ctx.kind = ctx.kind;
+    btree_init(&fresh, tree->leaves.hugepages);
+    btree_set_columns(&fresh, ncols, tree->vtypes);
+    if (ret == 0 && btree_build(&fresh, &fresh_ctx, out, k) < 0) {
+        ret = -1;
+    }
+    if (ret < 0) {
+        btreemap_release_columns(self, mine, i, n);
+        btreemap_release_columns(self, columns, j, m);
+        btreemap_release_columns(self, out, 0, k);
+    } else {
+        /* the old tree still holds its own references */
+        btree_t old = *tree;
+        avl_ctx_t old_ctx = self->ctx;
+        *tree = fresh;
+        self->ctx.kind = fresh_ctx.kind;
+        avl_ctx_touch(&self->ctx);
+        btree_clear(&old, &old_ctx);
+    }
+    btreemap_columns_free(mine, ncols);
+    btreemap_columns_free(out, ncols);
+    return ret;
+}
+
+/**
+ * @brief Add sorted distinct entries to the tree, replacing the values of keys in it.
+ * Entries are packed into leaves in O(n) if the tree is empty, merged with it if they
+ * are many and inserted one by one otherwise.
+ *
+ * @param other_ctx The context the entries were observed by.
+ * @param columns The columns of the entries, whose references are taken over.
+ * @param m The number of entries.
+ * @return Return 0 on success, -1 on errors.
+ */
+static int btreemap_add(BTreeMapObj *self, avl_ctx_t *other_ctx, avl_key_t *const *columns,
+    size_t m) {
+    btree_t *tree = self->btree;
+    if (!tree->size) {
+        if (other_ctx != &self->ctx) {
+            avl_ctx_merge(&self->ctx, other_ctx);
+        }
+        int ret = btree_build(tree, &self->ctx, columns, m);
+        if (ret < 0) {
+            btreemap_release_columns(self, columns, 0, m);
+        }
+        return ret;
+    } else if (m * 4 > tree->size) {
+        return btreemap_merge(self, other_ctx, columns, m);
+    }
+    avl_key_t entry[3];
+    size_t i = 0;
+    int ret = 0;
+    for (; i < m && ret == 0; i++) {
+        for (int col = 0; col < tree->ncols; col++) {
+            entry[col] = columns[col][i];
+        }
+        ret = btreemap_put(self, entry, NULL);
+    }
+    btreemap_release_columns(self, columns, i, m);
+    return ret;
+}
+
+/**
+ * @brief Set the items of another BTreeMap of the same dtypes and key function,
+ * copied in order without comparisons nor Python objects.
+ */
+static int btreemap_update_from(BTreeMapObj *self, BTreeMapObj *src) {
+    if (src == self || !src->btree->size) {
+        return 0;
+    } else if (!self->btree->size) {
+        self->ctx.kind = src->ctx.kind;
+        return btree_copy(self->btree, &self->ctx, src->btree, &src->ctx);
+    }
+    int ncols = src->btree->ncols;
+    size_t m = src->btree->size;
+    avl_key_t *columns[3] = {NULL, NULL, NULL};
+    if (btreemap_columns_new(columns, ncols, m) < 0) {
+        return -1;
+    }
+    btree_export(src->btree, &src->ctx, columns);
+    int ret = btreemap_add(self, &src->ctx, columns, m);
+    btreemap_columns_free(columns, ncols);
+    return ret;
+}
+
+/* pairs streamed in by btreemap_update, converted to entries */
+typedef struct {
+    avl_key_t *columns[3];
+    Py_ssize_t n;
+    Py_ssize_t cap;
+    int sorted;
+} btreemap_batch_t;
+
+/**
+ * @brief Append a pair to a batch as an entry, noting whether keys still come sorted.
+ *
+ * @return Return 0 on success, -1 on errors.
+ */
+static int btreemap_batch_push(BTreeMapObj *self, btreemap_batch_t *batch, PyObject *key,
+    PyObject *val) {
+    int ncols = self->btree->ncols;
+    if (batch->n == batch->cap) {
+        Py_ssize_t cap = batch->cap? batch->cap * 2: 64;
+        for (int col = 0; col < ncols; col++) {
+            avl_key_t *items = PyMem_Resize(batch->columns[col], avl_key_t, cap);
+            if (!items) {
+                PyErr_NoMemory();
+                return -1;
+            }
+            batch->columns[col] = items;
+        }
+        batch->cap = cap;
+    }
+    avl_key_t entry[3];
+    if (btreemap_new_entry(self, key, val, entry) < 0) {
+        return -1;
+    }
+    avl_ctx_observe(&self->ctx, entry[0]);
+    int cmp = batch->sorted && batch->n?
+        avl_key_cmp(&self->ctx, batch->columns[0][batch->n - 1], entry[0]): -1;
+    if (cmp == -2) {
+        btree_release(self->btree, &self->ctx, entry);
+        return -1;
+    } else if (cmp == 1) {
+        batch->sorted = 0;
+    }
+    for (int col = 0; col < ncols; col++) {
+        batch->columns[col][batch->n] = entry[col];
+    }
+    batch->n ++;
+    return 0;
+}
+
+/**
+ * @brief Add the entries of a batch, sorting them unless they came sorted. Of equal
+ * keys, the first key and the last value are kept. The batch is released.
+ *
+ * @return Return 0 on success, -1 on errors.
+ */
+static int btreemap_batch_add(BTreeMapObj *self, btreemap_batch_t *batch) {
+    int ncols = self->btree->ncols;
+    Py_ssize_t n = batch->n, m = 0, i = 0;
+    size_t *order = batch->sorted? NULL: PyMem_New(size_t, n? n: 1);
+    avl_key_t *out[3] = {NULL, NULL, NULL};
+    int ret = -1;
+    if (!batch->sorted && !order) {
+        PyErr_NoMemory();
+        goto done;
+    } else if (order && avl_keys_argsort(&self->ctx, batch->columns[0], n, order) < 0) {
+        goto done;
+    } else if (btreemap_columns_new(out, ncols, n) < 0) {
+        goto done;
+    }
+    for (; i < n; i++) {
+        Py_ssize_t j = order? (Py_ssize_t)order[i]: i;
+        int cmp = m? avl_key_cmp(&self->ctx, out[0][m - 1], batch->columns[0][j]): -1;
+        if (cmp == -2) {
+            break;
+        }
+        avl_key_t *dst = NULL, entry[3];
+        for (int col = 0; col < ncols; col++) {
+            entry[col] = batch->columns[col][j];
+            batch->columns[col][j].obj = NULL;
+        }
+        if (cmp == 0) {
+            /* the key stays, with the last value */
+            avl_key_t v = out[1][m - 1];
+            out[1][m - 1] = entry[1];
+            entry[1] = v;
+            btree_release(self->btree, &self->ctx, entry);
+            continue;
+        }
+        for (int col = 0; col < ncols; col++) {
+            dst = out[col];
+            dst[m] = entry[col];
+        }
+        m ++;
+    }
+    if (i < n) {
+        btreemap_release_columns(self, out, 0, m);
+        for (; i < n; i++) {
+            Py_ssize_t j = order? (Py_ssize_t)order[i]: i;
+            btreemap_release_columns(self, batch->columns, j, j + 1);
+        }
+        n = 0;
+        goto done;
+    }
+    n = 0;
+    ret = btreemap_add(self, &self->ctx, out, m);
+
+done:
+    btreemap_release_columns(self, batch->columns, 0, n);
+    btreemap_columns_free(out, out[0]? ncols: 0);
+    btreemap_columns_free(batch->columns, ncols);
+    PyMem_Free(order);
+    return ret;
+}
+
+/**
+ * @brief Set the pairs of a mapping or an iterable of pairs, streamed without a
+ * temporary dict or list of pairs. A BTreeMap of the same dtypes and key function
+ * hands over its entries in order. Other pairs are converted as they come into
+ * entries, sorted unless they came sorted, and added in bulk, see btreemap_add.
+ */
+static int btreemap_update(BTreeMapObj *self, PyObject *mapping) {
+    if (!mapping) return 0;
+    if (BTreeMapObj_Check(mapping)) {
+        BTreeMapObj *src = (BTreeMapObj *)mapping;
+        if (src->ctx.dtype == self->ctx.dtype && btreemap_vtype(src) == btreemap_vtype(self) &&
+            src->keyfunc == self->keyfunc) {
+            return btreemap_update_from(self, src);
+        }
+    }
+    PyObject *iter = pyavl_map_pairs(mapping);
+    if (!iter) {
+        return -1;
+    }
+    btreemap_batch_t batch = {{NULL, NULL, NULL}, 0, 0, 1};
+    int ret;
+    for (Py_ssize_t idx = 0; ; idx++) {
+        PyObject *key = NULL, *val = NULL;
+        if ((ret = pyavl_map_next_pair(iter, idx, &key, &val)) <= 0) {
+            break;
+        }
+        ret = btreemap_batch_push(self, &batch, key, val);
+        Py_DECREF(key);
+        Py_DECREF(val);
+        if (ret < 0) {
+            break;
+        }
+    }
+    Py_DECREF(iter);
+    if (ret < 0) {
+        btreemap_release_columns(self, batch.columns, 0, batch.n);
+        btreemap_columns_free(batch.columns, self->btree->ncols);
+    } else {
+        ret = btreemap_batch_add(self, &batch);
+    }
+    if (ret < 0 && !self->btree->size) {
+        avl_ctx_init(&self->ctx, self->ctx.dtype);
+    }
+    return ret;
+}
+
+static PyObject* BTreeMapObj_update(BTreeMapObj *self, PyObject *obj) {
+    if (btreemap_update(self, obj) < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+/* Methods */
+
+static PyObject* BTreeMapObj_clear(BTreeMapObj *self) {
+    btree_clear(self->btree, &self->ctx);
+    Py_RETURN_NONE;
+}
+
+static PyObject* BTreeMapObj_stats(BTreeMapObj *self) {
+    return pyavl_btree_stats(self->btree, &self->ctx);
+}
+
+/**
+ * @brief Copy a tree with full leaves, in O(n) without comparisons.
+ */
+static BTreeMapObj* btreemap_copy(BTreeMapObj *self) {
+    BTreeMapObj *copy = btreemap_empty(self);
+    if (!copy) {
+        return NULL;
+    }
+    copy->ctx.kind = self->ctx.kind;
+    if (btree_copy(copy->btree, &copy->ctx, self->btree, &self->ctx) < 0) {
+        Py_DECREF(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+static PyObject* BTreeMapObj_copy(BTreeMapObj *self) {
+    return (PyObject *)btreemap_copy(self);
+}
+
+static PyObject* BTreeMapObj_keyset(BTreeMapObj *self) {
+    return BTreeSet_FromTree(self->btree, &self->ctx, self->keyfunc);
+}
+
+/**
+ * @brief Take a read-only TreeMapSnapshot of the items. A B+ tree shares no nodes
+ * with views, so the items are copied in O(n) into a TreeMap, the owner of the snapshot.
+ */
+static PyObject* BTreeMapObj_snapshot(BTreeMapObj *self) {
+    int ncols = self->btree->ncols;
+    size_t n = self->btree->size;
+    avl_key_t *columns[3] = {NULL, NULL, NULL};
+    if (btreemap_columns_new(columns, ncols, n) < 0) {
+        return NULL;
+    }
+    btree_export(self->btree, &self->ctx, columns);
+    PyObject *map = TreeMap_FromColumns(
+        self->ctx.dtype, btreemap_vtype(self), self->keyfunc, columns, n);
+    if (!map) {
+        btreemap_release_columns(self, columns, 0, n);
+    } else if (self->keyfunc) {
+        /* the TreeMap holds its own references to the objects */
+        for (size_t i = 0; i < n; i++) {
+            Py_DECREF(columns[2][i].obj);
+        }
+    }
+    btreemap_columns_free(columns, ncols);
+    if (!map) {
+        return NULL;
+    }
+    PyObject *snap = PyObject_CallMethod(map, "snapshot", NULL);
+    Py_DECREF(map);
+    return snap;
+}
+
+static PyObject* BTreeMapObj_freeze(BTreeMapObj *self) {
+    if (self->keyfunc) {
+        PyErr_SetString(PyExc_ValueError, "Cannot freeze a BTreeMap with a key function.");
+        return NULL;
+    }
+    pyavl_column_t keys = {NULL, self->btree, 0};
+    pyavl_column_t values = {NULL, self->btree, 1};
+    return FrozenTree_New(&FrozenTreeMap_Type, &keys, &values, btreemap_size(self), &self->ctx,
+        btreemap_vtype(self));
+}
+
+static PyObject* BTreeMapObj_keys_array(BTreeMapObj *self) {
+    if (self->keyfunc) {
+        PyErr_SetString(PyExc_ValueError, "Cannot export keys of a BTreeMap with a key function to a buffer.");
+        return NULL;
+    }
+    pyavl_column_t keys = {NULL, self->btree, 0};
+    return pyavl_export_keys(&keys, btreemap_size(self), self->ctx.dtype);
+}
+
+static PyObject* BTreeMapObj_values_array(BTreeMapObj *self) {
+    pyavl_column_t values = {NULL, self->btree, 1};
+    return pyavl_export_keys(&values, btreemap_size(self), btreemap_vtype(self));
+}
+
+/* Iteration and order statistics */
+
+/**
+ * @brief The position of the last key, with a NULL leaf if the tree is empty.
+ */
+static btree_pos_t btreemap_last(BTreeMapObj *self) {
+    btree_leaf_t *last = self->btree->last;
+    btree_pos_t pos = {last, last? (int)last->head.n - 1: 0};
+    return pos;
+}
+
+/**
+ * @brief The position of the key before pos, which may be past the end.
+ */
+static btree_pos_t btreemap_before(BTreeMapObj *self, btree_pos_t pos) {
+    if (!pos.leaf) {
+        return btreemap_last(self);
+    }
+    btree_pos_prev(&pos);
+    return pos;
+}
+
+/**
+ * @brief Iterate over the BTreeMap, in descending order if the keyword `reverse` is true.
+ */
+static PyObject* btreemap_iter(BTreeMapObj *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames, const char *name, btree_iter_getter getter) {
+    static const char *const kwlist[] = {"reverse", NULL};
+    PyObject *argv[1];
+    if (pyavl_parse_args(name, args, nargs, kwnames, kwlist, 0, 0, argv) < 0)
+        return NULL;
+    int reverse = argv[0]? PyObject_IsTrue(argv[0]): 0;
+    if (reverse < 0)
+        return NULL;
+    btree_pos_t first = {self->btree->first, 0};
+    return BTreeIter_New(
+        (PyObject *)self, reverse? btreemap_last(self): first, -1, reverse, getter
+    );
+}
+
+static PyObject* BTreeMapObj_iter(BTreeMapObj *self) {
+    btree_pos_t pos = {self->btree->first, 0};
+    return BTreeIter_New((PyObject *)self, pos, -1, 0, (btree_iter_getter)btreemap_getkey);
+}
+
+static PyObject* BTreeMapObj_reversed(BTreeMapObj *self) {
+    return BTreeIter_New(
+        (PyObject *)self, btreemap_last(self), -1, 1, (btree_iter_getter)btreemap_getkey
+    );
+}
+
+static PyObject* BTreeMapObj_keys(
+    BTreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    return btreemap_iter(self, args, nargs, kwnames, "keys", (btree_iter_getter)btreemap_getkey);
+}
+
+static PyObject* BTreeMapObj_values(
+    BTreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    return btreemap_iter(self, args, nargs, kwnames, "values", (btree_iter_getter)btreemap_getval);
+}
+
+static PyObject* BTreeMapObj_items(
+    BTreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    return btreemap_iter(self, args, nargs, kwnames, "items", (btree_iter_getter)btreemap_getitem);
+}
+
+static PyObject* BTreeMapObj_iter_from(
+    BTreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"key", "inclusive", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args("iter_from", args, nargs, kwnames, kwlist, 1, 2, argv) < 0)
+        return NULL;
+    int inclusive = argv[1]? PyObject_IsTrue(argv[1]): 1;
+    if (inclusive < 0)
+        return NULL;
+    btree_pos_t pos;
+    if (btreemap_bisect_key(self, argv[0], !inclusive, NULL, &pos) < 0)
+        return NULL;
+    return BTreeIter_New((PyObject *)self, pos, -1, 0, (btree_iter_getter)btreemap_getkey);
+}
+
+static PyObject* BTreeMapObj_iter_before(
+    BTreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"key", "inclusive", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args("iter_before", args, nargs, kwnames, kwlist, 1, 2, argv) < 0)
+        return NULL;
+    int inclusive = argv[1]? PyObject_IsTrue(argv[1]): 0;
+    if (inclusive < 0)
+        return NULL;
+    btree_pos_t pos;
+    Py_ssize_t cnt = btreemap_bisect_key(self, argv[0], inclusive, NULL, &pos);
+    if (cnt < 0)
+        return NULL;
+    if (cnt == 0) {
+        pos.leaf = NULL;
+    } else {
+        pos = btreemap_before(self, pos);
+    }
+    return BTreeIter_New((PyObject *)self, pos, -1, 1, (btree_iter_getter)btreemap_getkey);
+}
+
+static PyObject* BTreeMapObj_min(BTreeMapObj *self) {
+    if (!self->btree->size) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "BTreeMap is empty"
+        );
+        return NULL;
+    }
+    btree_pos_t pos = {self->btree->first, 0};
+    return btreemap_getitem(pos, self);
+}
+
+static PyObject* BTreeMapObj_max(BTreeMapObj *self) {
+    if (!self->btree->size) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "BTreeMap is empty"
+        );
+        return NULL;
+    }
+    return btreemap_getitem(btreemap_last(self), self);
+}
+
+static PyObject* BTreeMapObj_loc(BTreeMapObj *self, PyObject *arg) {
+    Py_ssize_t loc = PyNumber_AsSsize_t(arg, PyExc_OverflowError);
+    if (loc == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    if (loc < 0) {
+        loc += btreemap_size(self);
+    }
+    btree_pos_t pos;
+    if (loc < 0 || !btree_loc(self->btree, loc, &pos)) {
+        PyErr_SetString(
+            PyExc_IndexError, "BTreeMap index out of range"
+        );
+        return NULL;
+    }
+    return btreemap_getitem(pos, self);
+}
+
+/**
+ * @brief Remove and return the (key, val) pair at a position, the last one by default,
+ * descending by counts without comparing keys.
+ */
+static PyObject* BTreeMapObj_popitem(
+    BTreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"index", NULL};
+    PyObject *argv[1];
+    if (pyavl_parse_args("popitem", args, nargs, kwnames, kwlist, 0, 1, argv) < 0) {
+        return NULL;
+    }
+    Py_ssize_t loc = argv[0]? PyNumber_AsSsize_t(argv[0], PyExc_OverflowError): -1;
+    if (loc == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    if (loc < 0) {
+        loc += btreemap_size(self);
+    }
+    avl_key_t entry[3];
+    if (loc < 0 || !btree_delete_at(self->btree, &self->ctx, loc, entry)) {
+        if (btreemap_size(self)) {
+            PyErr_SetString(PyExc_IndexError, "BTreeMap index out of range");
+        } else {
+            PyErr_SetString(PyExc_KeyError, "popitem(): BTreeMap is empty");
+        }
+        return NULL;
+    }
+    PyObject *key;
+    if (self->keyfunc) {
+        key = entry[2].obj;
+        Py_INCREF(key);
+    } else {
+        key = avl_key_to_object(self->ctx.dtype, entry[0]);
+    }
+    PyObject *val = key? avl_key_to_object(btreemap_vtype(self), entry[1]): NULL;
+    btree_release(self->btree, &self->ctx, entry);
+    if (!val) {
+        Py_XDECREF(key);
+        return NULL;
+    }
+    return Py_BuildValue("(NN)", key, val);
+}
+
+static int
+btreemap_cursor_entry(BTreeMapObj *self, PyObject *key, PyObject *val, avl_key_t *entry) {
+    return btreemap_new_entry(self, key, val, entry);
+}
+
+/**
+ * @brief Replace the value at a position, releasing the old one after the leaf holds the new one.
+ */
+static int btreemap_set_entry_val(btree_pos_t pos, BTreeMapObj *self, PyObject *val) {
+    avl_dtype_t vtype = btreemap_vtype(self);
+    avl_key_t v;
+    if (avl_key_from_object(vtype, val, &v) < 0) {
+        return -1;
+    }
+    avl_key_t old = BTREE_POS_AT(pos, 1);
+    BTREE_POS_AT(pos, 1) = v;
+    avl_key_release(vtype, old);
+    return 0;
+}
+
+static const pyavl_cursor_ops_t btreemap_cursor_ops = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    (btree_iter_getter)btreemap_getkey,
+    (btree_iter_getter)btreemap_getval,
+    (int (*)(PyObject *, PyObject *, PyObject *, avl_key_t *))btreemap_cursor_entry,
+    (int (*)(btree_pos_t, PyObject *, PyObject *))btreemap_set_entry_val
+};
+
+static PyObject* BTreeMapObj_cursor(BTreeMapObj *self) {
+    return TreeCursor_New((PyObject *)self, &btreemap_cursor_ops);
+}
+
+static PyObject* BTreeMapObj_at_most(BTreeMapObj *self, PyObject *key) {
+    btree_pos_t pos;
+    Py_ssize_t ret = btreemap_bisect_key(self, key, 1, NULL, &pos);
+    if (ret < 0) {
+        return NULL;
+    } else if (ret == 0) {
+        Py_RETURN_NONE;
+    }
+    return btreemap_getkey(btreemap_before(self, pos), self);
+}
+
+static PyObject* BTreeMapObj_at_least(BTreeMapObj *self, PyObject *key) {
+    btree_pos_t pos;
+    if (btreemap_bisect_key(self, key, 0, NULL, &pos) < 0) {
+        return NULL;
+    } else if (!pos.leaf) {
+        Py_RETURN_NONE;
+    }
+    return btreemap_getkey(pos, self);
+}
+
+static PyObject* BTreeMapObj_bisect_left(BTreeMapObj *self, PyObject *key) {
+    Py_ssize_t ret = btreemap_bisect_key(self, key, 0, NULL, NULL);
+    if (ret < 0) {
+        return NULL;
+    }
+    return PyLong_FromSsize_t(ret);
+}
+
+static PyObject* BTreeMapObj_bisect_right(BTreeMapObj *self, PyObject *key) {
+    Py_ssize_t ret = btreemap_bisect_key(self, key, 1, NULL, NULL);
+    if (ret < 0) {
+        return NULL;
+    }
+    return PyLong_FromSsize_t(ret);
+}
+
+static PyObject* BTreeMapObj_index(BTreeMapObj *self, PyObject *key) {
+    int found;
+    Py_ssize_t ret = btreemap_bisect_key(self, key, 0, &found, NULL);
+    if (ret < 0) {
+        return NULL;
+    } else if (!found) {
+        PyErr_SetObject(PyExc_KeyError, key);
+        return NULL;
+    }
+    return PyLong_FromSsize_t(ret);
+}
+
+static PyObject* BTreeMapObj_count_range(
+    BTreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    PyObject *lo, *hi;
+    int lo_inclusive, hi_inclusive;
+    if (pyavl_parse_range(
+            "count_range", args, nargs, kwnames, &lo, &hi, &lo_inclusive, &hi_inclusive) < 0)
+        return NULL;
+    Py_ssize_t start, end;
+    if (pyavl_range_bounds(
+            (PyAVLTreeObj *)self, lo, hi, lo_inclusive, hi_inclusive, &start, &end) < 0)
+        return NULL;
+    return PyLong_FromSsize_t(end - start);
+}
+
+/**
+ * @brief Count the keys between lo and hi with op "count". Leaves keep no aggregates
+ * of values, so the other ops need a TreeMap with aggregate=True.
+ */
+static PyObject* BTreeMapObj_aggregate(
+    BTreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"lo", "hi", "op", "inclusive", NULL};
+    PyObject *argv[4];
+    if (pyavl_parse_args("aggregate", args, nargs, kwnames, kwlist, 0, 4, argv) < 0)
+        return NULL;
+    PyObject *lo = argv[0]? argv[0]: Py_None, *hi = argv[1]? argv[1]: Py_None;
+    const char *op = "sum";
+    int lo_inclusive = 1, hi_inclusive = 1;
+    if (argv[2] && !PyUnicode_Check(argv[2])) {
+        PyErr_Format(
+            PyExc_TypeError, "aggregate() argument 'op' must be str, not %.200s",
+            Py_TYPE(argv[2])->tp_name
+        );
+        return NULL;
+    } else if (argv[2] && !(op = PyUnicode_AsUTF8(argv[2]))) {
+        return NULL;
+    } else if (argv[3] && pyavl_parse_inclusive(argv[3], &lo_inclusive, &hi_inclusive) < 0) {
+        return NULL;
+    }
+    int count = strcmp(op, "count") == 0;
+    if (!count && strcmp(op, "sum") && strcmp(op, "min") && strcmp(op, "max")) {
+        PyErr_Format(
+            PyExc_ValueError, "aggregate op must be 'sum', 'min', 'max' or 'count', not '%.100s'", op
+        );
+        return NULL;
+    } else if (!count) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "BTreeMap keeps no aggregates of values, which need a TreeMap with aggregate=True."
+        );
+        return NULL;
+    }
+    Py_ssize_t start, end;
+    if (pyavl_range_bounds(
+            (PyAVLTreeObj *)self, lo, hi, lo_inclusive, hi_inclusive, &start, &end) < 0)
+        return NULL;
+    return PyLong_FromSsize_t(end - start);
+}
+
+static PyObject* BTreeMapObj_irange(
+    BTreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    PyObject *lo, *hi;
+    int lo_inclusive, hi_inclusive;
+    if (pyavl_parse_range(
+            "irange", args, nargs, kwnames, &lo, &hi, &lo_inclusive, &hi_inclusive) < 0)
+        return NULL;
+    return TreeRange_NewBTree(
+        (PyObject *)self, lo, hi, lo_inclusive, hi_inclusive, (btree_iter_getter)btreemap_getkey
+    );
+}
+
+static PyObject* BTreeMapObj_contains_many(BTreeMapObj *self, PyObject *keys) {
+    return pyavl_lookup_many((PyObject *)self, keys, PYAVL_LOOKUP_FIND, NULL, NULL, NULL);
+}
+
+static PyObject* BTreeMapObj_get_many(BTreeMapObj *self, PyObject *const *args, Py_ssize_t nargs) {
+    static const char *const kwlist[] = {"keys", "default", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args("get_many", args, nargs, NULL, kwlist, 1, 2, argv) < 0) {
+        return NULL;
+    }
+    return pyavl_lookup_many(
+        (PyObject *)self, argv[0], PYAVL_LOOKUP_FIND, NULL, (btree_iter_getter)btreemap_getval,
+        argv[1]? argv[1]: Py_None
+    );
+}
+
+static PyObject* BTreeMapObj_at_most_many(BTreeMapObj *self, PyObject *keys) {
+    return pyavl_lookup_many(
+        (PyObject *)self, keys, PYAVL_LOOKUP_AT_MOST, NULL,
+        (btree_iter_getter)btreemap_getkey, Py_None
+    );
+}
+
+static PyObject* BTreeMapObj_at_least_many(BTreeMapObj *self, PyObject *keys) {
+    return pyavl_lookup_many(
+        (PyObject *)self, keys, PYAVL_LOOKUP_AT_LEAST, NULL,
+        (btree_iter_getter)btreemap_getkey, Py_None
+    );
+}
+
+/* Snapshots */
+
+static PyObject* btreemap_save(BTreeMapObj *self, PyObject *file) {
+    avl_dtype_t dtypes[3] = {self->ctx.dtype, btreemap_vtype(self), AVL_DTYPE_OBJECT};
+    pyavl_column_t columns[3] = {
+        {NULL, self->btree, 0}, {NULL, self->btree, 1}, {NULL, self->btree, 2}
+    };
+    return pyavl_snapshot_save(file, (PyAVLTreeObj *)self, PYAVL_SNAPSHOT_MAP, 0,
+        self->keyfunc? 3: 2, dtypes, columns);
+}
+
+/**
+ * @brief Create a BTreeMap from a snapshot, packing leaves without comparisons.
+ * Snapshots of TreeMap and BTreeMap are the same, so either loads the other's;
+ * the aggregates of a TreeMap with aggregate=True are not kept.
+ */
+static PyObject* btreemap_load_snapshot(PyTypeObject *type, PyObject *src, int in_memory) {
+    pyavl_snapshot_t snap;
+    if (pyavl_snapshot_load(src, in_memory, PYAVL_SNAPSHOT_MAP, &snap) < 0) {
+        return NULL;
+    }
+    BTreeMapObj *self = (BTreeMapObj *)BTreeMapObj_new(type, NULL, NULL);
+    if (!self) {
+        goto error;
+    }
+    avl_ctx_init(&self->ctx, snap.dtypes[0]);
+    if (snap.keyfunc && pyavl_set_keyfunc((PyAVLTreeObj *)self, snap.keyfunc) < 0) {
+        goto error;
+    }
+    btreemap_set_columns(self, snap.dtypes[1]);
+    for (Py_ssize_t i = 0; i < snap.size; i++) {
+        avl_ctx_observe(&self->ctx, snap.columns[0][i]);
+    }
+    /* the tree takes over the keys, the values and the objects */
+    if (btree_build(self->btree, &self->ctx, snap.columns, snap.size) < 0) {
+        goto error;
+    }
+    pyavl_snapshot_free(&snap, 0);
+    return (PyObject *)self;
+
+error:
+    pyavl_snapshot_free(&snap, 1);
+    Py_XDECREF(self);
+    return NULL;
+}
+
+static PyObject* BTreeMapObj_save(BTreeMapObj *self, PyObject *file) {
+    return btreemap_save(self, file);
+}
+
+static PyObject* BTreeMapObj_load(PyTypeObject *type, PyObject *file) {
+    return btreemap_load_snapshot(type, file, 0);
+}
+
+static PyObject* BTreeMapObj_from_snapshot(PyTypeObject *type, PyObject *data) {
+    return btreemap_load_snapshot(type, data, 1);
+}
+
+static PyObject* BTreeMapObj_reduce(BTreeMapObj *self) {
+    PyObject *restore = PyObject_GetAttrString((PyObject *)Py_TYPE(self), "_from_snapshot");
+    PyObject *data = restore? btreemap_save(self, NULL): NULL;
+    if (!data) {
+        Py_XDECREF(restore);
+        return NULL;
+    }
+    return Py_BuildValue("(N(N))", restore, data);
+}
+
+/* init */
+
+/**
+ * @brief Set the dtypes and the key function of an empty BTreeMap from the keyword
+ * arguments of __init__. "key_dtype", "value_dtype", "aggregate", "key" and "backend"
+ * are removed from kwargs, which becomes a new reference.
+ */
+static int btreemap_init_options(BTreeMapObj *self, PyObject **kwargs) {
+    static const char *names[5] = {"key_dtype", "value_dtype", "aggregate", "key", "backend"};
+    PyObject *opts[5] = {NULL, NULL, NULL, NULL, NULL};
+    if (*kwargs) {
+        for (int i = 0; i < 5; i++) {
+            opts[i] = PyDict_GetItemString(*kwargs, names[i]);
+        }
+    }
+    if (!opts[0] && !opts[1] && !opts[2] && !opts[3] && !opts[4]) {
+        Py_XINCREF(*kwargs);
+        return 0;
+    }
+
+    /* TreeMap(backend="btree") passes its arguments on */
+    PyObject *backend = opts[4];
+    if (backend && backend != Py_None && (!PyUnicode_Check(backend) ||
+        PyUnicode_CompareWithASCIIString(backend, "btree") != 0)) {
+        PyErr_Format(PyExc_ValueError, "backend of a BTreeMap must be \"btree\", not %R", backend);
+        return -1;
+    }
+    int aggregate = opts[2]? PyObject_IsTrue(opts[2]): 0;
+    if (aggregate < 0) {
+        return -1;
+    } else if (aggregate) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "BTreeMap keeps no aggregates of values, aggregate=True needs backend=\"avl\"."
+        );
+        return -1;
+    }
+    avl_dtype_t dtypes[2] = {self->ctx.dtype, btreemap_vtype(self)};
+    for (int i = 0; i < 2; i++) {
+        if (opts[i] && avl_dtype_parse(opts[i], &dtypes[i]) < 0) {
+            return -1;
+        }
+    }
+    if (dtypes[0] != self->ctx.dtype || dtypes[1] != btreemap_vtype(self)) {
+        if (self->btree->size) {
+            PyErr_SetString(
+                PyExc_ValueError, "Cannot change dtypes of a non-empty BTreeMap."
+            );
+            return -1;
+        }
+        avl_ctx_init(&self->ctx, dtypes[0]);
+    }
+    if (opts[3] && pyavl_set_keyfunc((PyAVLTreeObj *)self, opts[3]) < 0) {
+        return -1;
+    }
+    if (!self->btree->size) {
+        btreemap_set_columns(self, dtypes[1]);
+    }
+
+    *kwargs = PyDict_Copy(*kwargs);
+    if (!*kwargs) {
+        return -1;
+    }
+    for (int i = 0; i < 5; i++) {
+        if (opts[i] && PyDict_DelItemString(*kwargs, names[i]) < 0) {
+            Py_CLEAR(*kwargs);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+BTreeMapObj_init(BTreeMapObj *self, PyObject *args, PyObject *kwargs) {
+    int argc = args? PyTuple_Size(args): 0;
+    if (argc > 1) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "BTreeMap.__init__ takes at most 1 positional argument."
+        );
+        return -1;
+    }
+
+    if (btreemap_init_options(self, &kwargs) < 0) {
+        return -1;
+    }
+
+    int ret = 0;
+    if (argc == 1) {
+        PyObject *obj;
+        if (!PyArg_ParseTuple(args, "O:__init__", &obj) ||
+            btreemap_update(self, obj) < 0) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && kwargs && PyDict_Size(kwargs) && btreemap_update(self, kwargs) < 0) {
+        ret = -1;
+    }
+    Py_XDECREF(kwargs);
+
+    return ret;
+}
+
+/* Mapping Protocol */
+
+static Py_ssize_t BTreeMapObj_length(BTreeMapObj *self) {
+    return btreemap_size(self);
+}
+
+static PyObject* BTreeMapObj_subscript(BTreeMapObj *self, PyObject *key) {
+    int found;
+    btree_pos_t pos;
+    if (btreemap_bisect_key(self, key, 0, &found, &pos) < 0) {
+        return NULL;
+    } else if (!found) {
+        _PyErr_SetKeyError(key);
+        return NULL;
+    }
+    return btreemap_getval(pos, self);
+}
+
+static int BTreeMapObj_ass_sub(BTreeMapObj *self, PyObject *key, PyObject *val) {
+    if (val) {
+        return btreemap_insert(self, key, val);
+    }
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return -1;
+    }
+    int ret = btree_delete(self->btree, &self->ctx, query, NULL);
+    Py_DECREF(query);
+    if (ret == 0) {
+        _PyErr_SetKeyError(key);
+    }
+    return ret == 1? 0: -1;
+}
+
+static PyMappingMethods BTreeMapObj_Mapping = {
+    (lenfunc)BTreeMapObj_length,         // mp_length
+    (binaryfunc)BTreeMapObj_subscript,   // mp_subscript
+    (objobjargproc)BTreeMapObj_ass_sub,  // mp_ass_subscript
+};
+
+/* Sequence Protocol */
+static int BTreeMapObj_contains(BTreeMapObj *self, PyObject *key) {
+    int found;
+    if (btreemap_bisect_key(self, key, 0, &found, NULL) < 0) {
+        return -1;
+    }
+    return found;
+}
+
+static PySequenceMethods BTreeMapObj_Sequence = {
+    .sq_contains = (objobjproc)BTreeMapObj_contains
+};
+
+static PyMethodDef BTreeMapObj_Methods[] = {
+    {
+        "__reduce__",
+        (PyCFunction)BTreeMapObj_reduce,
+        METH_NOARGS,
+        "Pickle the BTreeMap as a snapshot."
+    },
+    {
+        "_from_snapshot",
+        (PyCFunction)BTreeMapObj_from_snapshot,
+        METH_O | METH_CLASS,
+        "Create a BTreeMap from the bytes of a snapshot, for unpickling."
+    },
+    {
+        "__reversed__",
+        (PyCFunction)BTreeMapObj_reversed,
+        METH_NOARGS,
+        "Return an iterator over keys of the BTreeMap in descending order."
+    },
+    {
+        "clear",
+        (PyCFunction)BTreeMapObj_clear,
+        METH_NOARGS,
+        "Remove all items from the BTreeMap."
+    },
+    {
+        "freeze",
+        (PyCFunction)BTreeMapObj_freeze,
+        METH_NOARGS,
+        "Return a read-only FrozenTreeMap of the items, laid out for fast lookups."
+    },
+    {
+        "get",
+        (PyCFunction)BTreeMapObj_get,
+        METH_FASTCALL,
+        "Return the value for key if key is in the BTreeMap, else default."
+    },
+    {
+        "get_many",
+        (PyCFunction)BTreeMapObj_get_many,
+        METH_FASTCALL,
+        "Return a list of get for each key of an iterable, fastest if the keys are sorted."
+    },
+    {
+        "contains_many",
+        (PyCFunction)BTreeMapObj_contains_many,
+        METH_O,
+        "Return a list of whether each key of an iterable is in the BTreeMap."
+    },
+    {
+        "keys",
+        (PyCFunction)BTreeMapObj_keys,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate over keys of the BTreeMap in order, descending if reverse."
+    },
+    {
+        "keys_array",
+        (PyCFunction)BTreeMapObj_keys_array,
+        METH_NOARGS,
+        "Return a memoryview of the keys in order, for key dtype int64, float64 or bytes."
+    },
+    {
+        "load",
+        (PyCFunction)BTreeMapObj_load,
+        METH_O | METH_CLASS,
+        "Load a BTreeMap from a snapshot saved to a path or a binary file by TreeMap or BTreeMap."
+    },
+    {
+        "loc",
+        (PyCFunction)BTreeMapObj_loc,
+        METH_O,
+        "Return the (key, val) pair at the given location."
+    },
+    {
+        "aggregate",
+        (PyCFunction)BTreeMapObj_aggregate,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Return the count (op) of keys between lo and hi, inclusive by default. Other ops need a TreeMap with aggregate=True."
+    },
+    {
+        "at_most",
+        (PyCFunction)BTreeMapObj_at_most,
+        METH_O,
+        "Get the largest key in the BTreeMap that is not bigger than the given key."
+    },
+    {
+        "iter_from",
+        (PyCFunction)BTreeMapObj_iter_from,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate in ascending order over keys greater than key, or equal if inclusive (default)."
+    },
+    {
+        "iter_before",
+        (PyCFunction)BTreeMapObj_iter_before,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate in descending order over keys less than key, or equal if inclusive."
+    },
+    {
+        "irange",
+        (PyCFunction)BTreeMapObj_irange,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Return a view of keys between lo and hi, inclusive by default. None means no bound."
+    },
+    {
+        "at_least",
+        (PyCFunction)BTreeMapObj_at_least,
+        METH_O,
+        "Get the smallest key in the BTreeMap that is not smaller than the given key."
+    },
+    {
+        "at_most_many",
+        (PyCFunction)BTreeMapObj_at_most_many,
+        METH_O,
+        "Return a list of at_most for each key of an iterable, fastest if the keys are sorted."
+    },
+    {
+        "at_least_many",
+        (PyCFunction)BTreeMapObj_at_least_many,
+        METH_O,
+        "Return a list of at_least for each key of an iterable, fastest if the keys are sorted."
+    },
+    {
+        "rank",
+        (PyCFunction)BTreeMapObj_bisect_left,
+        METH_O,
+        "Return the number of keys in the BTreeMap less than the given key."
+    },
+    {
+        "bisect_left",
+        (PyCFunction)BTreeMapObj_bisect_left,
+        METH_O,
+        "Return the number of keys in the BTreeMap less than the given key."
+    },
+    {
+        "bisect_right",
+        (PyCFunction)BTreeMapObj_bisect_right,
+        METH_O,
+        "Return the number of keys in the BTreeMap not bigger than the given key."
+    },
+    {
+        "index",
+        (PyCFunction)BTreeMapObj_index,
+        METH_O,
+        "Return the location of the given key. Raises KeyError if it is not present."
+    },
+    {
+        "count_range",
+        (PyCFunction)BTreeMapObj_count_range,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Count keys between lo and hi, inclusive by default. None means no bound."
+    },
+    {
+        "max",
+        (PyCFunction)BTreeMapObj_max,
+        METH_NOARGS,
+        "Get the (key, val) pair with maximal key in the BTreeMap."
+    },
+    {
+        "min",
+        (PyCFunction)BTreeMapObj_min,
+        METH_NOARGS,
+        "Get the (key, val) pair with minimal key in the BTreeMap."
+    },
+    {
+        "values",
+        (PyCFunction)BTreeMapObj_values,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate over values of the BTreeMap, ordered by their keys, descending if reverse."
+    },
+    {
+        "values_array",
+        (PyCFunction)BTreeMapObj_values_array,
+        METH_NOARGS,
+        "Return a memoryview of the values ordered by their keys, for value dtype int64, float64 or bytes."
+    },
+    {
+        "items",
+        (PyCFunction)BTreeMapObj_items,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate over (key, value) pairs of the BTreeMap, ordered by key, descending if reverse."
+    },
+    {
+        "popitem",
+        (PyCFunction)BTreeMapObj_popitem,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Remove and return the (key, val) pair at the given location, the last one by default."
+    },
+    {
+        "save",
+        (PyCFunction)BTreeMapObj_save,
+        METH_O,
+        "Save the BTreeMap to a path or a binary file, in the snapshot format of TreeMap."
+    },
+    {
+        "snapshot",
+        (PyCFunction)BTreeMapObj_snapshot,
+        METH_NOARGS,
+        "Return a read-only TreeMapSnapshot of the items as they are now, copied in O(n) into a TreeMap that owns it."
+    },
+    {
+        "cursor",
+        (PyCFunction)BTreeMapObj_cursor,
+        METH_NOARGS,
+        "Return a cursor at the smallest key, which steps, inserts, erases and sets values in place."
+    },
+    {
+        "copy",
+        (PyCFunction)BTreeMapObj_copy,
+        METH_NOARGS,
+        "Return a shallow copy of the BTreeMap with full leaves, in O(n) without comparisons."
+    },
+    {
+        "__copy__",
+        (PyCFunction)BTreeMapObj_copy,
+        METH_NOARGS,
+        "Return a shallow copy of the BTreeMap, see copy()."
+    },
+    {
+        "keyset",
+        (PyCFunction)BTreeMapObj_keyset,
+        METH_NOARGS,
+        "Return a BTreeSet of the keys with full leaves, in O(n) without comparisons."
+    },
+    {
+        "setdefault",
+        (PyCFunction)(void(*)(void))BTreeMapObj_setdefault,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Return the value of the key, setting it to default first if the key is missing."
+    },
+    {
+        "get_or_insert",
+        (PyCFunction)(void(*)(void))BTreeMapObj_get_or_insert,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Return the value of the key, setting it to factory() first if the key is missing."
+    },
+    {
+        "increment",
+        (PyCFunction)(void(*)(void))BTreeMapObj_increment,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Add delta, 1 by default, to the value of the key, setting it to delta if the key is missing. Return the new value."
+    },
+    {
+        "update_with",
+        (PyCFunction)(void(*)(void))BTreeMapObj_update_with,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Set the value of the key to func(value), or to func(default) if the key is missing. Return the new value."
+    },
+    {
+        "stats",
+        (PyCFunction)BTreeMapObj_stats,
+        METH_NOARGS,
+        "Report the memory usage, leaf fill and key comparisons of the BTreeMap."
+    },
+    {
+        "update",
+        (PyCFunction)BTreeMapObj_update,
+        METH_O,
+        "Update the BTreeMap by a dict, the argument will be converted to a dict if needed."
+    },
+    {NULL}
+};
+
+static PyObject* BTreeMapObj_get_backend(BTreeMapObj *self, void *closure) {
+    return PyUnicode_FromString("btree");
+}
+
+static PyObject* BTreeMapObj_get_value_dtype(BTreeMapObj *self, void *closure) {
+    return PyUnicode_FromString(avl_dtype_name(btreemap_vtype(self)));
+}
+
+/* key and key_dtype are those of TreeMap */
+static PyGetSetDef BTreeMapObj_GetSet[] = {
+    {
+        "backend",
+        (getter)BTreeMapObj_get_backend,
+        NULL,
+        "The engine of the BTreeMap, always \"btree\".",
+        NULL
+    },
+    {
+        "value_dtype",
+        (getter)BTreeMapObj_get_value_dtype,
+        NULL,
+        "The dtype of values of the BTreeMap.",
+        NULL
+    },
+    {NULL}
+};
+
+PyTypeObject BTreeMap_Type = {
+    /* The ob_type field must be initialized in the module init function
+     * to be portable to Windows without using C++. */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "pyavl.BTreeMap",           /*tp_name*/
+    0,                          /*tp_basicsize, that of TreeMap*/
+    0,                          /*tp_itemsize*/
+    /* methods */
+    (destructor)BTreeMapObj_free,/*tp_dealloc*/
+    0,                          /*tp_vectorcall_offset*/
+    (getattrfunc)0,             /*tp_getattr*/
+    (setattrfunc)0,             /*tp_setattr*/
+    0,                          /*tp_as_async*/
+    0,                          /*tp_repr*/
+    0,                          /*tp_as_number*/
+    &BTreeMapObj_Sequence,      /*tp_as_sequence*/
+    &BTreeMapObj_Mapping,       /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    (getattrofunc)0,            /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    0,                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
+    0,                          /*tp_doc*/
+    0,                          /*tp_traverse*/
+    0,                          /*tp_clear*/
+    0,                          /*tp_richcompare*/
+    0,                          /*tp_weaklistoffset*/
+    (getiterfunc)BTreeMapObj_iter,/*tp_iter*/
+    0,                          /*tp_iternext*/
+    BTreeMapObj_Methods,        /*tp_methods*/
+    0,                          /*tp_members*/
+    BTreeMapObj_GetSet,         /*tp_getset*/
+    &TreeMap_Type,              /*tp_base*/
+    0,                          /*tp_dict*/
+    0,                          /*tp_descr_get*/
+    0,                          /*tp_descr_set*/
+    0,                          /*tp_dictoffset*/
+    (initproc)BTreeMapObj_init, /*tp_init*/
+    0,                          /*tp_alloc*/
+    BTreeMapObj_new,            /*tp_new*/
+    0,                          /*tp_free*/
+    0,                          /*tp_is_gc*/
+};
@@ -0,0 +1,1718 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "avl.h"
+#include "btree.h"
+#include "pyavlmodule.h"
+
+/*
+ * A BTreeSet is a TreeSet whose keys are in the B+ tree `btree`, while the AVL
+ * tree at `root` stays empty. Leaves keep the keys, then for a set with a key
+ * function the objects keys are derived from. Every method of TreeSet reading
+ * `root` is overridden.
+ */
+typedef PyAVLTreeObj BTreeSetObj;
+
+static PyObject* BTreeSetObj_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    BTreeSetObj *self = (BTreeSetObj *)TreeSet_Type.tp_new(type, NULL, NULL);
+    if (self == NULL) {
+        return NULL;
+    }
+    self->btree = PyMem_New(btree_t, 1);
+    if (!self->btree) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    btree_init(self->btree, pyavl_hugepages);
+
+    return (PyObject *)self;
+}
+
+static void BTreeSetObj_free(BTreeSetObj *self) {
+    if (self->btree) {
+        btree_clear(self->btree, &self->ctx);
+        PyMem_Free(self->btree);
+        self->btree = NULL;
+    }
+    TreeSet_Type.tp_dealloc((PyObject *)self);
+}
+
+/**
+ * @brief Set the key function of an empty tree, with a column of leaves for the
+ * objects keys are derived from.
+ */
+static int btreeset_set_keyfunc(BTreeSetObj *self, PyObject *func) {
+    if (pyavl_set_keyfunc((PyAVLTreeObj *)self, func) < 0) {
+        return -1;
+    }
+    int ncols = self->keyfunc? 2: 1;
+    if (ncols != self->btree->ncols) {
+        avl_dtype_t vtypes[1] = {AVL_DTYPE_OBJECT};
+        btree_set_columns(self->btree, ncols, vtypes);
+    }
+    return 0;
+}
+
+static Py_ssize_t btreeset_size(BTreeSetObj *self) {
+    return (Py_ssize_t)self->btree->size;
+}
+
+static PyObject* btreeset_getkey(btree_pos_t pos, BTreeSetObj *owner) {
+    if (!pos.leaf) {
+        return NULL;
+    } else if (owner->keyfunc) {
+        PyObject *obj = BTREE_POS_AT(pos, 1).obj;
+        Py_INCREF(obj);
+        return obj;
+    }
+    return avl_key_to_object(owner->ctx.dtype, BTREE_POS_KEY(pos));
+}
+
+/**
+ * @brief Fill an entry for a Python object, with the key derived from it.
+ *
+ * @return Return 0 on success, -1 on errors.
+ */
+static int btreeset_new_entry(BTreeSetObj *self, PyObject *obj, avl_key_t *entry) {
+    PyObject *derived = pyavl_derive_key((PyAVLTreeObj *)self, obj);
+    if (!derived) {
+        return -1;
+    }
+    int ret = avl_key_import(self->ctx.dtype, derived, &entry[0]);
+    Py_DECREF(derived);
+    if (ret < 0) {
+        return -1;
+    }
+    if (self->keyfunc) {
+        Py_INCREF(obj);
+        entry[1].obj = obj;
+    }
+    return 0;
+}
+
+/**
+ * @brief Insert a Python object into the tree.
+ *
+ * @return Return -1 on errors, 0 if the key is presented already and 1 if inserted.
+ */
+static int btreeset_insert(BTreeSetObj *self, PyObject *obj) {
+    avl_key_t entry[2];
+    if (btreeset_new_entry(self, obj, entry) < 0) {
+        return -1;
+    }
+    int ret = btree_insert(self->btree, &self->ctx, entry, NULL);
+    if (ret != 1) {
+        btree_release(self->btree, &self->ctx, entry);
+    }
+    return ret;
+}
+
+static PyObject* BTreeSetObj_add(BTreeSetObj *self, PyObject *key) {
+    if (btreeset_insert(self, key) < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* BTreeSetObj_remove(BTreeSetObj *self, PyObject *key) {
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return NULL;
+    }
+    int ret = btree_delete(self->btree, &self->ctx, query, NULL);
+    Py_DECREF(query);
+    if (ret < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+/**
+ * @brief Create an empty BTreeSet with the dtype and the key function of like.
+ */
+static BTreeSetObj* btreeset_empty(BTreeSetObj *like) {
+    BTreeSetObj *self = (BTreeSetObj *)BTreeSetObj_new(&BTreeSet_Type, NULL, NULL);
+    if (!self) {
+        return NULL;
+    }
+    avl_ctx_init(&self->ctx, like->ctx.dtype);
+    if (btreeset_set_keyfunc(self, like->keyfunc? like->keyfunc: Py_None) < 0) {
+        Py_CLEAR(self);
+    }
+    return self;
+}
+
+/* Merges */
+
+/**
+ * @brief Release the entries from `start` to `end` of columns of the tree.
+ */
+static void btreeset_release_columns(BTreeSetObj *self, avl_key_t *const *columns,
+    size_t start, size_t end) {
+    avl_key_t entry[2];
+    for (size_t i = start; i < end; i++) {
+        for (int col = 0; col < self->btree->ncols; col++) {
+            entry[col] = columns[col][i];
+        }
+        btree_release(self->btree, &self->ctx, entry);
+    }
+}
+
+/**
+ * @brief Allocate `ncols` columns of n items each.
+ *
+ * @return Return 0 on success, -1 with MemoryError set on failure.
+ */
+static int btreeset_columns_new(avl_key_t **columns, int ncols, size_t n) {
+    for (int col = 0; col < ncols; col++) {
+        columns[col] = PyMem_New(avl_key_t, n? n: 1);
+        if (!columns[col]) {
+            while (col--) {
+                PyMem_Free(columns[col]);
+            }
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void btreeset_columns_free(avl_key_t **columns, int ncols) {
+    for (int col = 0; col < ncols; col++) {
+        PyMem_Free(columns[col]);
+    }
+}
+
+/**
+ * @brief Replace the keys of self by the result of a set operation with sorted
+ * distinct entries. Both sides are merged in one pass, and the result is packed
+ * into a new tree that replaces the old one on success, so that self is never
+ * seen half-way nor lost on errors. The entry of self is kept for equal keys.
+ *
+ * @param other_ctx The context the other entries were observed by.
+ * @param columns The columns of the other entries, whose references are taken over.
+ * @param m The number of other entries.
+ * @return Return 0 on success, -1 on errors.
+ */
+static int btreeset_merge(BTreeSetObj *self, avl_ctx_t *other_ctx, avl_key_t *const *columns,
+    size_t m, avl_setop_t op) {
+    btree_t *tree = self->btree;
+    int ncols = tree->ncols;
+    size_t n = tree->size, i = 0, j = 0, k = 0;
+    avl_key_t *mine[2], *out[2];
+    if (btreeset_columns_new(mine, ncols, n) < 0) {
+        btreeset_release_columns(self, columns, 0, m);
+        return -1;
+    } else if (btreeset_columns_new(out, ncols, n + m) < 0) {
+        btreeset_columns_free(mine, ncols);
+        btreeset_release_columns(self, columns, 0, m);
+        return -1;
+    }
+    btree_export(tree, &self->ctx, mine);
+
+    int keep_left = op != AVL_SETOP_INTERSECTION;
+    int keep_right = op == AVL_SETOP_UNION || op == AVL_SETOP_SYMMETRIC_DIFFERENCE;
+    int keep_both = op == AVL_SETOP_UNION || op == AVL_SETOP_INTERSECTION;
+    avl_ctx_t ctx = self->ctx;
+    avl_ctx_merge(&ctx, other_ctx);
+    int ret = 0;
+    while (i < n || j < m) {
+        int c = i == n? 1: j == m? -1: avl_key_cmp(&ctx, mine[0][i], columns[0][j]);
+        if (c == -2) {
+            ret = -1;
+            break;
+        }
+        avl_key_t *const *from = c > 0? columns: mine;
+        size_t at = c > 0? j: i;
+        if (c? (c < 0? keep_left: keep_right): keep_both) {
+            for (int col = 0; col < ncols; col++) {
+                out[col][k] = from[col][at];
+            }
+            k ++;
+        } else {
+            btreeset_release_columns(self, from, at, at + 1);
+        }
+        if (c == 0) {
+            btreeset_release_columns(self, columns, j, j + 1);
+        }
+        i += c <= 0;
+        j += c >= 0;
+    }
+    self->ctx.ncmp = ctx.ncmp;
+
+    btree_t fresh;
+    avl_ctx_t fresh_ctx = self->ctx;
+    if (keep_right) {
+        fresh_ctx.kind = ctx.kind;
+    }
+    btree_init(&fresh, tree->leaves.hugepages);
+    btree_set_columns(&fresh, ncols, tree->vtypes);
+    if (ret == 0 && btree_build(&fresh, &fresh_ctx, out, k) < 0) {
+        ret = -1;
+    }
+    if (ret < 0) {
+        btreeset_release_columns(self, mine, i, n);
+        btreeset_release_columns(self, columns, j, m);
+        btreeset_release_columns(self, out, 0, k);
+    } else {
+        /* the old tree still holds its own references */
+        btree_t old = *tree;
+        avl_ctx_t old_ctx = self->ctx;
+        *tree = fresh;
+        self->ctx.kind = fresh_ctx.kind;
+        avl_ctx_touch(&self->ctx);
+        btree_clear(&old, &old_ctx);
+    }
+    btreeset_columns_free(mine, ncols);
+    btreeset_columns_free(out, ncols);
+    return ret;
+}
+
+/**
+ * @brief Add sorted keys to the tree, keeping the first of equal keys. Keys are
+ * packed into leaves in O(n) if the tree is empty, merged with it if they are
+ * many and inserted one by one otherwise.
+ *
+ * @param keys The keys, observed by the context. The tree takes over their references,
+ * which are released on errors.
+ * @param n The number of keys.
+ * @param pairs For a tree with a key function, the list of (key, object) pairs the
+ * keys come from, in the same order. NULL otherwise.
+ * @return Return 0 on success, -1 on errors.
+ */
+static int btreeset_build(BTreeSetObj *self, avl_key_t *keys, Py_ssize_t n, PyObject *pairs) {
+    avl_dtype_t dtype = self->ctx.dtype;
+    Py_ssize_t m = 0;
+    for (Py_ssize_t i = 0; i < n; i++) {
+        int cmp = m? avl_key_cmp(&self->ctx, keys[m - 1], keys[i]): -1;
+        if (cmp == -2) {
+            for (; i < n; i++) {
+                avl_key_release(dtype, keys[i]);
+            }
+            goto error;
+        } else if (cmp == 0) {
+            avl_key_release(dtype, keys[i]);
+        } else {
+            if (pairs && m != i) {
+                /* the pair of a key kept moves along with it */
+                PyObject *pair = PyList_GET_ITEM(pairs, m);
+                PyList_SET_ITEM(pairs, m, PyList_GET_ITEM(pairs, i));
+                PyList_SET_ITEM(pairs, i, pair);
+            }
+            keys[m++] = keys[i];
+        }
+    }
+
+    avl_key_t *items = NULL;
+    if (pairs) {
+        items = PyMem_New(avl_key_t, m? m: 1);
+        if (!items) {
+            PyErr_NoMemory();
+            goto error;
+        }
+        for (Py_ssize_t i = 0; i < m; i++) {
+            items[i].obj = PyTuple_GET_ITEM(PyList_GET_ITEM(pairs, i), 1);
+            Py_INCREF(items[i].obj);
+        }
+    }
+    avl_key_t *columns[2] = {keys, items};
+    btree_t *tree = self->btree;
+    int ret = 0;
+    if (!tree->size) {
+        ret = btree_build(tree, &self->ctx, columns, m);
+        if (ret < 0) {
+            btreeset_release_columns(self, columns, 0, m);
+        }
+    } else if ((size_t)m * 4 > tree->size) {
+        ret = btreeset_merge(self, &self->ctx, columns, m, AVL_SETOP_UNION);
+    } else {
+        avl_key_t entry[2];
+        Py_ssize_t i = 0;
+        for (; i < m && ret == 0; i++) {
+            for (int col = 0; col < tree->ncols; col++) {
+                entry[col] = columns[col][i];
+            }
+            int inserted = btree_insert(tree, &self->ctx, entry, NULL);
+            if (inserted != 1) {
+                btree_release(tree, &self->ctx, entry);
+            }
+            ret = inserted < 0? -1: 0;
+        }
+        btreeset_release_columns(self, columns, i, m);
+    }
+    PyMem_Free(items);
+    return ret;
+
+error:
+    for (Py_ssize_t i = 0; i < m; i++) {
+        avl_key_release(dtype, keys[i]);
+    }
+    return -1;
+}
+
+/**
+ * @brief The object to derive the i-th key from in btreeset_load.
+ */
+static PyObject* btreeset_load_key(BTreeSetObj *self, PyObject *list, Py_ssize_t i) {
+    PyObject *obj = PyList_GET_ITEM(list, i);
+    return self->keyfunc? PyTuple_GET_ITEM(obj, 0): obj;
+}
+
+/**
+ * @brief Add the keys of an iterator, as a batch. Keys are sorted unless they are
+ * sorted already, then added by btreeset_build. The first of equal keys is kept.
+ * With a key function, objects are paired with their keys, derived once, and
+ * sorted along.
+ */
+static int btreeset_load(BTreeSetObj *self, PyObject *iter) {
+    PyObject *list = PySequence_List(iter);
+    if (!list) {
+        return -1;
+    }
+    Py_ssize_t n = PyList_GET_SIZE(list);
+    avl_dtype_t dtype = self->ctx.dtype;
+    avl_key_t *keys = PyMem_New(avl_key_t, n? n: 1);
+    Py_ssize_t cnt = 0;
+    int ret = -1;
+    if (!keys) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    for (Py_ssize_t i = 0; i < n && self->keyfunc; i++) {
+        PyObject *obj = PyList_GET_ITEM(list, i);
+        PyObject *derived = pyavl_derive_key((PyAVLTreeObj *)self, obj);
+        PyObject *pair = derived? PyTuple_Pack(2, derived, obj): NULL;
+        Py_XDECREF(derived);
+        if (!pair) {
+            goto done;
+        }
+        PyList_SET_ITEM(list, i, pair);
+        Py_DECREF(obj);
+    }
+    for (; cnt < n; cnt++) {
+        if (avl_key_import(dtype, btreeset_load_key(self, list, cnt), &keys[cnt]) < 0) {
+            goto done;
+        }
+        avl_ctx_observe(&self->ctx, keys[cnt]);
+    }
+    int sorted = avl_keys_sorted(&self->ctx, keys, n);
+    if (sorted < 0) {
+        goto done;
+    } else if (!sorted && !self->keyfunc) {
+        if (avl_keys_sort(&self->ctx, keys, n) < 0) {
+            goto done;
+        }
+    } else if (!sorted) {
+        if (pyavl_sort_pairs(list) < 0) {
+            goto done;
+        }
+        for (Py_ssize_t i = 0; i < n; i++) {
+            avl_key_release(dtype, keys[i]);
+            if (avl_key_import(dtype, btreeset_load_key(self, list, i), &keys[i]) < 0) {
+                for (Py_ssize_t j = i + 1; j < n; j++) {
+                    avl_key_release(dtype, keys[j]);
+                }
+                cnt = i;
+                goto done;
+            }
+        }
+    }
+
+    ret = btreeset_build(self, keys, n, self->keyfunc? list: NULL);
+    cnt = 0;
+
+done:
+    for (Py_ssize_t i = 0; i < cnt; i++) {
+        avl_key_release(dtype, keys[i]);
+    }
+    if (ret < 0 && !self->btree->size) {
+        avl_ctx_init(&self->ctx, dtype);
+    }
+    PyMem_Free(keys);
+    Py_DECREF(list);
+    return ret;
+}
+
+static PyObject* BTreeSetObj_extend_iter(BTreeSetObj *self, PyObject *iter) {
+    if (self->btree->size == 0) {
+        if (btreeset_load(self, iter) < 0) {
+            return NULL;
+        }
+        Py_RETURN_NONE;
+    }
+
+    PyObject *key;
+    while ((key = PyIter_Next(iter))) {
+        int ret = btreeset_insert(self, key);
+        Py_DECREF(key);
+        if (ret == -1) {
+            return NULL;
+        }
+    }
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* BTreeSetObj_extend(BTreeSetObj *self, PyObject *obj) {
+    PyObject *iter = PyObject_GetIter(obj);
+    if (iter == NULL) {
+        PyErr_SetString(
+            PyExc_TypeError, "BTreeSet.extend must take an iterable as input.");
+        return NULL;
+    }
+    PyObject *ret = BTreeSetObj_extend_iter(self, iter);
+    Py_DECREF(iter);
+
+    return ret;
+}
+
+static PyObject* BTreeSetObj_extend_sorted(BTreeSetObj *self, PyObject *obj) {
+    PyObject *iter = PyObject_GetIter(obj);
+    if (iter == NULL) {
+        return NULL;
+    }
+    int ret = btreeset_load(self, iter);
+    Py_DECREF(iter);
+    if (ret < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+/**
+ * @brief Copy a tree with full leaves, in O(n) without comparisons.
+ */
+static BTreeSetObj* btreeset_copy(BTreeSetObj *self) {
+    BTreeSetObj *copy = btreeset_empty(self);
+    if (!copy) {
+        return NULL;
+    }
+    copy->ctx.kind = self->ctx.kind;
+    if (btree_copy(copy->btree, &copy->ctx, self->btree, &self->ctx) < 0) {
+        Py_DECREF(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+static PyObject* BTreeSetObj_copy(BTreeSetObj *self) {
+    return (PyObject *)btreeset_copy(self);
+}
+
+extern PyObject* BTreeSet_FromTree(btree_t *src, avl_ctx_t *ctx, PyObject *keyfunc) {
+    BTreeSetObj *self = (BTreeSetObj *)BTreeSetObj_new(&BTreeSet_Type, NULL, NULL);
+    if (!self) {
+        return NULL;
+    }
+    avl_ctx_init(&self->ctx, ctx->dtype);
+    self->ctx.kind = ctx->kind;
+    avl_key_t *columns[2];
+    int ncols = keyfunc? 2: 1;
+    if (btreeset_set_keyfunc(self, keyfunc? keyfunc: Py_None) < 0 ||
+        btreeset_columns_new(columns, ncols, src->size) < 0) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    size_t n = 0;
+    for (btree_leaf_t *leaf = src->first; leaf; leaf = leaf->next) {
+        avl_key_t *items = BTREE_LEAF_COLUMN(leaf, src->ncols - 1);
+        for (uint32_t i = 0; i < leaf->head.n; i++, n++) {
+            columns[0][n] = leaf->keys[i];
+            if (AVL_DTYPE_BOXED(ctx->dtype)) {
+                Py_INCREF(leaf->keys[i].obj);
+            }
+            if (keyfunc) {
+                columns[1][n] = items[i];
+                Py_INCREF(items[i].obj);
+            }
+        }
+    }
+    if (btree_build(self->btree, &self->ctx, columns, n) < 0) {
+        btreeset_release_columns(self, columns, 0, n);
+        Py_CLEAR(self);
+    }
+    btreeset_columns_free(columns, ncols);
+    return (PyObject *)self;
+}
+
+/* Set operations */
+
+/**
+ * @brief Get a BTreeSet with the dtype and the key function of self holding the keys of an iterable.
+ *
+ * @return Return a new reference, to other itself if it is such a BTreeSet.
+ */
+static BTreeSetObj* btreeset_coerce(BTreeSetObj *self, PyObject *other) {
+    if (BTreeSetObj_Check(other) &&
+        ((BTreeSetObj *)other)->ctx.dtype == self->ctx.dtype &&
+        ((BTreeSetObj *)other)->keyfunc == self->keyfunc) {
+        Py_INCREF(other);
+        return (BTreeSetObj *)other;
+    }
+    PyObject *iter = PyObject_GetIter(other);
+    if (!iter) {
+        return NULL;
+    }
+    BTreeSetObj *tmp = btreeset_empty(self);
+    if (tmp && btreeset_load(tmp, iter) < 0) {
+        Py_CLEAR(tmp);
+    }
+    Py_DECREF(iter);
+    return tmp;
+}
+
+/**
+ * @brief Apply a set operation with other to self in place, merging the entries of other.
+ */
+static int btreeset_setop(BTreeSetObj *self, BTreeSetObj *other, avl_setop_t op) {
+    int ncols = other->btree->ncols;
+    size_t m = other->btree->size;
+    avl_key_t *columns[2];
+    if (btreeset_columns_new(columns, ncols, m) < 0) {
+        return -1;
+    }
+    btree_export(other->btree, &other->ctx, columns);
+    int ret = btreeset_merge(self, &other->ctx, columns, m, op);
+    btreeset_columns_free(columns, ncols);
+    return ret;
+}
+
+/**
+ * @brief Return a new BTreeSet with the result of a set operation of self with an iterable.
+ */
+static PyObject* btreeset_binop(BTreeSetObj *self, PyObject *other, avl_setop_t op) {
+    BTreeSetObj *rhs = btreeset_coerce(self, other);
+    if (!rhs) {
+        return NULL;
+    }
+    BTreeSetObj *res = btreeset_copy(self);
+    if (res && btreeset_setop(res, rhs, op) < 0) {
+        Py_CLEAR(res);
+    }
+    Py_DECREF(rhs);
+    return (PyObject *)res;
+}
+
+/**
+ * @brief Update self by a set operation with an iterable.
+ */
+static int btreeset_update_op(BTreeSetObj *self, PyObject *other, avl_setop_t op) {
+    BTreeSetObj *rhs = btreeset_coerce(self, other);
+    if (!rhs) {
+        return -1;
+    }
+    int ret = btreeset_setop(self, rhs, op);
+    Py_DECREF(rhs);
+    return ret;
+}
+
+static PyObject* BTreeSetObj_union(BTreeSetObj *self, PyObject *other) {
+    return btreeset_binop(self, other, AVL_SETOP_UNION);
+}
+
+static PyObject* BTreeSetObj_intersection(BTreeSetObj *self, PyObject *other) {
+    return btreeset_binop(self, other, AVL_SETOP_INTERSECTION);
+}
+
+static PyObject* BTreeSetObj_difference(BTreeSetObj *self, PyObject *other) {
+    return btreeset_binop(self, other, AVL_SETOP_DIFFERENCE);
+}
+
+static PyObject* BTreeSetObj_symmetric_difference(BTreeSetObj *self, PyObject *other) {
+    return btreeset_binop(self, other, AVL_SETOP_SYMMETRIC_DIFFERENCE);
+}
+
+static PyObject* BTreeSetObj_update(BTreeSetObj *self, PyObject *other) {
+    if (btreeset_update_op(self, other, AVL_SETOP_UNION) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject* BTreeSetObj_intersection_update(BTreeSetObj *self, PyObject *other) {
+    if (btreeset_update_op(self, other, AVL_SETOP_INTERSECTION) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject* BTreeSetObj_difference_update(BTreeSetObj *self, PyObject *other) {
+    if (btreeset_update_op(self, other, AVL_SETOP_DIFFERENCE) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject* BTreeSetObj_symmetric_difference_update(BTreeSetObj *self, PyObject *other) {
+    if (btreeset_update_op(self, other, AVL_SETOP_SYMMETRIC_DIFFERENCE) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+/**
+ * @brief Check whether all keys of a are in b, or none of them if disjoint, walking
+ * the leaves of both trees in order.
+ *
+ * @return Return a new reference to a bool, NULL on errors.
+ */
+static PyObject* btreeset_relation(BTreeSetObj *self, BTreeSetObj *a, BTreeSetObj *b, int disjoint) {
+    avl_ctx_t ctx = a->ctx;
+    avl_ctx_merge(&ctx, &b->ctx);
+    ctx.ncmp = self->ctx.ncmp;
+    uint64_t va = a->ctx.version, vb = b->ctx.version;
+    btree_pos_t pa = {a->btree->first, 0}, pb = {b->btree->first, 0};
+    int ret = disjoint || a->btree->size <= b->btree->size;
+    while (ret == 1 && pa.leaf && pb.leaf) {
+        int c = avl_key_cmp(&ctx, BTREE_POS_KEY(pa), BTREE_POS_KEY(pb));
+        if (c == -2) {
+            ret = -1;
+        } else if (va != a->ctx.version || vb != b->ctx.version) {
+            /* leaves of a changed tree may be freed, so the positions are lost */
+            PyErr_SetString(PyExc_RuntimeError, "BTreeSet changed during comparison");
+            ret = -1;
+        } else if (disjoint? c == 0: c < 0) {
+            ret = 0;
+        } else {
+            if (c <= 0) {
+                btree_pos_next(&pa);
+            }
+            if (c >= 0) {
+                btree_pos_next(&pb);
+            }
+        }
+    }
+    if (ret == 1 && !disjoint && pa.leaf) {
+        ret = 0;
+    }
+    self->ctx.ncmp = ctx.ncmp;
+    if (ret < 0) {
+        return NULL;
+    }
+    return PyBool_FromLong(ret);
+}
+
+static PyObject* BTreeSetObj_issubset(BTreeSetObj *self, PyObject *other) {
+    BTreeSetObj *rhs = btreeset_coerce(self, other);
+    if (!rhs)
+        return NULL;
+    PyObject *ret = btreeset_relation(self, self, rhs, 0);
+    Py_DECREF(rhs);
+    return ret;
+}
+
+static PyObject* BTreeSetObj_issuperset(BTreeSetObj *self, PyObject *other) {
+    BTreeSetObj *rhs = btreeset_coerce(self, other);
+    if (!rhs)
+        return NULL;
+    PyObject *ret = btreeset_relation(self, rhs, self, 0);
+    Py_DECREF(rhs);
+    return ret;
+}
+
+static PyObject* BTreeSetObj_isdisjoint(BTreeSetObj *self, PyObject *other) {
+    BTreeSetObj *rhs = btreeset_coerce(self, other);
+    if (!rhs)
+        return NULL;
+    PyObject *ret = btreeset_relation(self, self, rhs, 1);
+    Py_DECREF(rhs);
+    return ret;
+}
+
+static PyObject* BTreeSetObj_clear(BTreeSetObj *self) {
+    btree_clear(self->btree, &self->ctx);
+    Py_RETURN_NONE;
+}
+
+static PyObject* BTreeSetObj_stats(BTreeSetObj *self) {
+    return pyavl_btree_stats(self->btree, &self->ctx);
+}
+
+/* Buffers and snapshots */
+
+static PyObject* BTreeSetObj_freeze(BTreeSetObj *self) {
+    if (self->keyfunc) {
+        PyErr_SetString(PyExc_ValueError, "Cannot freeze a BTreeSet with a key function.");
+        return NULL;
+    }
+    pyavl_column_t keys = {NULL, self->btree, 0};
+    return FrozenTree_New(
+        &FrozenTreeSet_Type, &keys, NULL, btreeset_size(self), &self->ctx, AVL_DTYPE_OBJECT
+    );
+}
+
+static PyObject* BTreeSetObj_to_buffer(BTreeSetObj *self) {
+    if (self->keyfunc) {
+        PyErr_SetString(PyExc_ValueError, "Cannot export a BTreeSet with a key function to a buffer.");
+        return NULL;
+    }
+    pyavl_column_t keys = {NULL, self->btree, 0};
+    return pyavl_export_keys(&keys, btreeset_size(self), self->ctx.dtype);
+}
+
+static PyObject* BTreeSetObj_from_buffer(PyTypeObject *type, PyObject *buffer) {
+    avl_dtype_t dtype;
+    Py_ssize_t n;
+    avl_key_t *keys = pyavl_import_keys(buffer, &dtype, &n);
+    if (!keys) {
+        return NULL;
+    }
+    BTreeSetObj *self = (BTreeSetObj *)BTreeSetObj_new(type, NULL, NULL);
+    int sorted = -1;
+    if (self) {
+        avl_ctx_init(&self->ctx, dtype);
+        for (Py_ssize_t i = 0; i < n; i++) {
+            avl_ctx_observe(&self->ctx, keys[i]);
+        }
+        sorted = avl_keys_sorted(&self->ctx, keys, n);
+    }
+    if (sorted < 0 || (!sorted && avl_keys_sort(&self->ctx, keys, n) < 0)) {
+        for (Py_ssize_t i = 0; i < n; i++) {
+            avl_key_release(dtype, keys[i]);
+        }
+        Py_XDECREF(self);
+        self = NULL;
+    } else if (btreeset_build(self, keys, n, NULL) < 0) {
+        Py_CLEAR(self);
+    }
+    PyMem_Free(keys);
+    return (PyObject *)self;
+}
+
+static PyObject* btreeset_save(BTreeSetObj *self, PyObject *file) {
+    avl_dtype_t dtypes[2] = {self->ctx.dtype, AVL_DTYPE_OBJECT};
+    pyavl_column_t columns[2] = {{NULL, self->btree, 0}, {NULL, self->btree, 1}};
+    return pyavl_snapshot_save(file, (PyAVLTreeObj *)self, PYAVL_SNAPSHOT_SET, 0,
+        self->keyfunc? 2: 1, dtypes, columns);
+}
+
+/**
+ * @brief Create a BTreeSet from a snapshot, packing leaves without comparisons.
+ * Snapshots of TreeSet and BTreeSet are the same, so either loads the other's.
+ */
+static PyObject* btreeset_load_snapshot(PyTypeObject *type, PyObject *src, int in_memory) {
+    pyavl_snapshot_t snap;
+    if (pyavl_snapshot_load(src, in_memory, PYAVL_SNAPSHOT_SET, &snap) < 0) {
+        return NULL;
+    }
+    BTreeSetObj *self = (BTreeSetObj *)BTreeSetObj_new(type, NULL, NULL);
+    if (!self) {
+        goto error;
+    }
+    avl_ctx_init(&self->ctx, snap.dtypes[0]);
+    if (snap.keyfunc && btreeset_set_keyfunc(self, snap.keyfunc) < 0) {
+        goto error;
+    }
+    for (Py_ssize_t i = 0; i < snap.size; i++) {
+        avl_ctx_observe(&self->ctx, snap.columns[0][i]);
+    }
+    /* the tree takes over the keys and the objects */
+    if (btree_build(self->btree, &self->ctx, snap.columns, snap.size) < 0) {
+        goto error;
+    }
+    pyavl_snapshot_free(&snap, 0);
+    return (PyObject *)self;
+
+error:
+    pyavl_snapshot_free(&snap, 1);
+    Py_XDECREF(self);
+    return NULL;
+}
+
+static PyObject* BTreeSetObj_save(BTreeSetObj *self, PyObject *file) {
+    return btreeset_save(self, file);
+}
+
+static PyObject* BTreeSetObj_load(PyTypeObject *type, PyObject *file) {
+    return btreeset_load_snapshot(type, file, 0);
+}
+
+static PyObject* BTreeSetObj_from_snapshot(PyTypeObject *type, PyObject *data) {
+    return btreeset_load_snapshot(type, data, 1);
+}
+
+static PyObject* BTreeSetObj_reduce(BTreeSetObj *self) {
+    PyObject *restore = PyObject_GetAttrString((PyObject *)Py_TYPE(self), "_from_snapshot");
+    PyObject *data = restore? btreeset_save(self, NULL): NULL;
+    if (!data) {
+        Py_XDECREF(restore);
+        return NULL;
+    }
+    return Py_BuildValue("(N(N))", restore, data);
+}
+
+static int btreeset_init_iterable(BTreeSetObj *self, PyObject *obj) {
+    if (!self->btree->size && BTreeSetObj_Check(obj) &&
+        ((BTreeSetObj *)obj)->ctx.dtype == self->ctx.dtype &&
+        ((BTreeSetObj *)obj)->keyfunc == self->keyfunc) {
+        /* copied leaf by leaf, without comparisons */
+        BTreeSetObj *other = (BTreeSetObj *)obj;
+        self->ctx.kind = other->ctx.kind;
+        return btree_copy(self->btree, &self->ctx, other->btree, &other->ctx);
+    }
+    PyObject *iter = PyObject_GetIter(obj);
+    if (!iter) {
+        PyErr_SetString(
+            PyExc_ValueError, "BTreeSet.__init__ accepts only iterable."
+        );
+        return -1;
+    }
+
+    PyObject *ret = BTreeSetObj_extend_iter(self, iter);
+    Py_DECREF(iter);
+    if (!ret) return -1;
+    Py_DECREF(ret);
+
+    return 0;
+}
+
+static int BTreeSetObj_init(BTreeSetObj *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"iterable", "dtype", "backend", "key", NULL};
+    PyObject *obj = NULL, *dtype_name = NULL, *backend = NULL, *keyfunc = NULL;
+    if (!PyArg_ParseTupleAndKeywords(
+            args, kwargs, "|O$OOO:BTreeSet", kwlist, &obj, &dtype_name, &backend, &keyfunc))
+        return -1;
+
+    /* TreeSet(backend="btree") passes its arguments on */
+    if (backend && backend != Py_None && (!PyUnicode_Check(backend) ||
+        PyUnicode_CompareWithASCIIString(backend, "btree") != 0)) {
+        PyErr_Format(PyExc_ValueError, "backend of a BTreeSet must be \"btree\", not %R", backend);
+        return -1;
+    }
+    if (dtype_name) {
+        avl_dtype_t dtype;
+        if (avl_dtype_parse(dtype_name, &dtype) < 0)
+            return -1;
+        if (dtype != self->ctx.dtype) {
+            if (self->btree->size) {
+                PyErr_SetString(
+                    PyExc_ValueError, "Cannot change dtype of a non-empty BTreeSet."
+                );
+                return -1;
+            }
+            avl_ctx_init(&self->ctx, dtype);
+        }
+    }
+    if (keyfunc && btreeset_set_keyfunc(self, keyfunc) < 0)
+        return -1;
+    if (!obj)
+        return 0;
+    return btreeset_init_iterable(self, obj);
+}
+
+/* Iteration and order statistics */
+
+/**
+ * @brief The position of the last key, with a NULL leaf if the tree is empty.
+ */
+static btree_pos_t btreeset_last(BTreeSetObj *self) {
+    btree_leaf_t *last = self->btree->last;
+    btree_pos_t pos = {last, last? (int)last->head.n - 1: 0};
+    return pos;
+}
+
+/**
+ * @brief The position of the key before pos, which may be past the end.
+ */
+static btree_pos_t btreeset_before(BTreeSetObj *self, btree_pos_t pos) {
+    if (!pos.leaf) {
+        return btreeset_last(self);
+    }
+    btree_pos_prev(&pos);
+    return pos;
+}
+
+static PyObject* BTreeSetObj_iter(BTreeSetObj *self) {
+    btree_pos_t pos = {self->btree->first, 0};
+    return BTreeIter_New((PyObject *)self, pos, -1, 0, (btree_iter_getter)btreeset_getkey);
+}
+
+static PyObject* BTreeSetObj_reversed(BTreeSetObj *self) {
+    return BTreeIter_New(
+        (PyObject *)self, btreeset_last(self), -1, 1, (btree_iter_getter)btreeset_getkey
+    );
+}
+
+/**
+ * @brief Count the keys less than the key derived from an object, or not bigger
+ * if right, as btree_bisect.
+ *
+ * @return Return the count, -1 on errors.
+ */
+static Py_ssize_t
+btreeset_bisect(BTreeSetObj *self, PyObject *key, int right, int *found, btree_pos_t *pos) {
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return -1;
+    }
+    Py_ssize_t ret = btree_bisect(self->btree, &self->ctx, query, right, found, pos);
+    Py_DECREF(query);
+    return ret;
+}
+
+static PyObject* BTreeSetObj_iter_from(
+    BTreeSetObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"key", "inclusive", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args("iter_from", args, nargs, kwnames, kwlist, 1, 2, argv) < 0)
+        return NULL;
+    int inclusive = argv[1]? PyObject_IsTrue(argv[1]): 1;
+    if (inclusive < 0)
+        return NULL;
+    btree_pos_t pos;
+    if (btreeset_bisect(self, argv[0], !inclusive, NULL, &pos) < 0)
+        return NULL;
+    return BTreeIter_New((PyObject *)self, pos, -1, 0, (btree_iter_getter)btreeset_getkey);
+}
+
+static PyObject* BTreeSetObj_iter_before(
+    BTreeSetObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"key", "inclusive", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args("iter_before", args, nargs, kwnames, kwlist, 1, 2, argv) < 0)
+        return NULL;
+    int inclusive = argv[1]? PyObject_IsTrue(argv[1]): 0;
+    if (inclusive < 0)
+        return NULL;
+    btree_pos_t pos;
+    Py_ssize_t cnt = btreeset_bisect(self, argv[0], inclusive, NULL, &pos);
+    if (cnt < 0)
+        return NULL;
+    if (cnt == 0) {
+        pos.leaf = NULL;
+    } else {
+        pos = btreeset_before(self, pos);
+    }
+    return BTreeIter_New((PyObject *)self, pos, -1, 1, (btree_iter_getter)btreeset_getkey);
+}
+
+static PyObject* BTreeSetObj_min(BTreeSetObj *self) {
+    if (!self->btree->size) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "BTreeSet is empty"
+        );
+        return NULL;
+    }
+    btree_pos_t pos = {self->btree->first, 0};
+    return btreeset_getkey(pos, self);
+}
+
+static PyObject* BTreeSetObj_max(BTreeSetObj *self) {
+    if (!self->btree->size) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "BTreeSet is empty"
+        );
+        return NULL;
+    }
+    return btreeset_getkey(btreeset_last(self), self);
+}
+
+static PyObject* BTreeSetObj_loc(BTreeSetObj *self, PyObject *arg) {
+    Py_ssize_t loc = PyNumber_AsSsize_t(arg, PyExc_OverflowError);
+    if (loc == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    if (loc < 0) {
+        loc += btreeset_size(self);
+    }
+    btree_pos_t pos;
+    if (loc < 0 || !btree_loc(self->btree, loc, &pos)) {
+        PyErr_SetString(
+            PyExc_IndexError, "BTreeSet index out of range"
+        );
+        return NULL;
+    }
+    return btreeset_getkey(pos, self);
+}
+
+/**
+ * @brief Take out the entry at a position, negative ones counting from the end,
+ * descending by counts without comparing keys.
+ *
+ * @param empty The message of IndexError if the tree is empty.
+ * @param entry Set to the entry taken out, to release by btree_release.
+ * @return Return 0 on success, -1 with IndexError set if there is no such position.
+ */
+static int
+btreeset_take_at(BTreeSetObj *self, Py_ssize_t loc, const char *empty, avl_key_t *entry) {
+    if (loc < 0) {
+        loc += btreeset_size(self);
+    }
+    if (loc < 0 || !btree_delete_at(self->btree, &self->ctx, loc, entry)) {
+        PyErr_SetString(PyExc_IndexError, btreeset_size(self)? "BTreeSet index out of range": empty);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Remove and return the key at a position, the last one by default.
+ */
+static PyObject* BTreeSetObj_pop(
+    BTreeSetObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"index", NULL};
+    PyObject *argv[1];
+    if (pyavl_parse_args("pop", args, nargs, kwnames, kwlist, 0, 1, argv) < 0) {
+        return NULL;
+    }
+    Py_ssize_t loc = argv[0]? PyNumber_AsSsize_t(argv[0], PyExc_OverflowError): -1;
+    if (loc == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    avl_key_t entry[2];
+    if (btreeset_take_at(self, loc, "pop from an empty BTreeSet", entry) < 0) {
+        return NULL;
+    }
+    PyObject *key;
+    if (self->keyfunc) {
+        key = entry[1].obj;
+        Py_INCREF(key);
+    } else {
+        key = avl_key_to_object(self->ctx.dtype, entry[0]);
+    }
+    btree_release(self->btree, &self->ctx, entry);
+    return key;
+}
+
+/**
+ * @brief Clip a position to [0, size] as list slices do, negative ones counting from the end.
+ */
+static Py_ssize_t btreeset_clip(BTreeSetObj *self, Py_ssize_t loc) {
+    Py_ssize_t size = btreeset_size(self);
+    if (loc < 0) {
+        loc += size;
+        return loc < 0? 0: loc;
+    }
+    return loc > size? size: loc;
+}
+
+/**
+ * @brief Delete the keys at positions start to end, as `del lst[start:end]` does on a list.
+ */
+static PyObject* BTreeSetObj_delete_range(
+    BTreeSetObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"start", "end", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args("delete_range", args, nargs, kwnames, kwlist, 1, 2, argv) < 0) {
+        return NULL;
+    }
+    Py_ssize_t start = PyNumber_AsSsize_t(argv[0], NULL);
+    if (start == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    Py_ssize_t end = argv[1] && argv[1] != Py_None?
+        PyNumber_AsSsize_t(argv[1], NULL): btreeset_size(self);
+    if (end == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    start = btreeset_clip(self, start);
+    end = btreeset_clip(self, end);
+    if (start < end && btree_delete_range(self->btree, &self->ctx, start, end) < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static int
+btreeset_cursor_entry(BTreeSetObj *self, PyObject *obj, PyObject *val, avl_key_t *entry) {
+    return btreeset_new_entry(self, obj, entry);
+}
+
+static const pyavl_cursor_ops_t btreeset_cursor_ops = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    (btree_iter_getter)btreeset_getkey,
+    NULL,
+    (int (*)(PyObject *, PyObject *, PyObject *, avl_key_t *))btreeset_cursor_entry,
+    NULL
+};
+
+static PyObject* BTreeSetObj_cursor(BTreeSetObj *self) {
+    return TreeCursor_New((PyObject *)self, &btreeset_cursor_ops);
+}
+
+static PyObject* BTreeSetObj_bisect_left(BTreeSetObj *self, PyObject *key) {
+    Py_ssize_t ret = btreeset_bisect(self, key, 0, NULL, NULL);
+    if (ret < 0) {
+        return NULL;
+    }
+    return PyLong_FromSsize_t(ret);
+}
+
+static PyObject* BTreeSetObj_bisect_right(BTreeSetObj *self, PyObject *key) {
+    Py_ssize_t ret = btreeset_bisect(self, key, 1, NULL, NULL);
+    if (ret < 0) {
+        return NULL;
+    }
+    return PyLong_FromSsize_t(ret);
+}
+
+static PyObject* BTreeSetObj_index(BTreeSetObj *self, PyObject *key) {
+    int found;
+    Py_ssize_t ret = btreeset_bisect(self, key, 0, &found, NULL);
+    if (ret < 0) {
+        return NULL;
+    } else if (!found) {
+        PyErr_SetString(PyExc_ValueError, "key is not in BTreeSet");
+        return NULL;
+    }
+    return PyLong_FromSsize_t(ret);
+}
+
+static PyObject* BTreeSetObj_count_range(
+    BTreeSetObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    PyObject *lo, *hi;
+    int lo_inclusive, hi_inclusive;
+    if (pyavl_parse_range(
+            "count_range", args, nargs, kwnames, &lo, &hi, &lo_inclusive, &hi_inclusive) < 0)
+        return NULL;
+    Py_ssize_t start, end;
+    if (pyavl_range_bounds(
+            (PyAVLTreeObj *)self, lo, hi, lo_inclusive, hi_inclusive, &start, &end) < 0)
+        return NULL;
+    return PyLong_FromSsize_t(end - start);
+}
+
+static PyObject* BTreeSetObj_irange(
+    BTreeSetObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    PyObject *lo, *hi;
+    int lo_inclusive, hi_inclusive;
+    if (pyavl_parse_range(
+            "irange", args, nargs, kwnames, &lo, &hi, &lo_inclusive, &hi_inclusive) < 0)
+        return NULL;
+    return TreeRange_NewBTree(
+        (PyObject *)self, lo, hi, lo_inclusive, hi_inclusive, (btree_iter_getter)btreeset_getkey
+    );
+}
+
+static PyObject* BTreeSetObj_at_most(BTreeSetObj *self, PyObject *key) {
+    btree_pos_t pos;
+    Py_ssize_t ret = btreeset_bisect(self, key, 1, NULL, &pos);
+    if (ret < 0) {
+        return NULL;
+    } else if (ret == 0) {
+        Py_RETURN_NONE;
+    }
+    return btreeset_getkey(btreeset_before(self, pos), self);
+}
+
+static PyObject* BTreeSetObj_at_least(BTreeSetObj *self, PyObject *key) {
+    btree_pos_t pos;
+    if (btreeset_bisect(self, key, 0, NULL, &pos) < 0) {
+        return NULL;
+    } else if (!pos.leaf) {
+        Py_RETURN_NONE;
+    }
+    return btreeset_getkey(pos, self);
+}
+
+static PyObject* BTreeSetObj_contains_many(BTreeSetObj *self, PyObject *keys) {
+    return pyavl_lookup_many((PyObject *)self, keys, PYAVL_LOOKUP_FIND, NULL, NULL, NULL);
+}
+
+static PyObject* BTreeSetObj_at_most_many(BTreeSetObj *self, PyObject *keys) {
+    return pyavl_lookup_many(
+        (PyObject *)self, keys, PYAVL_LOOKUP_AT_MOST, NULL,
+        (btree_iter_getter)btreeset_getkey, Py_None
+    );
+}
+
+static PyObject* BTreeSetObj_at_least_many(BTreeSetObj *self, PyObject *keys) {
+    return pyavl_lookup_many(
+        (PyObject *)self, keys, PYAVL_LOOKUP_AT_LEAST, NULL,
+        (btree_iter_getter)btreeset_getkey, Py_None
+    );
+}
+
+static PyMethodDef BTreeSetObj_Methods[] = {
+    {
+        "__reduce__",
+        (PyCFunction)BTreeSetObj_reduce,
+        METH_NOARGS,
+        "Pickle the BTreeSet as a snapshot."
+    },
+    {
+        "_from_snapshot",
+        (PyCFunction)BTreeSetObj_from_snapshot,
+        METH_O | METH_CLASS,
+        "Create a BTreeSet from the bytes of a snapshot, for unpickling."
+    },
+    {
+        "__reversed__",
+        (PyCFunction)BTreeSetObj_reversed,
+        METH_NOARGS,
+        "Return an iterator over the BTreeSet in descending order."
+    },
+    {
+        "add",
+        (PyCFunction)BTreeSetObj_add,
+        METH_O,
+        "Add an object into the BTreeSet."
+    },
+    {
+        "at_most",
+        (PyCFunction)BTreeSetObj_at_most,
+        METH_O,
+        "Get the largest key in the BTreeSet that is not bigger than the given key."
+    },
+    {
+        "at_least",
+        (PyCFunction)BTreeSetObj_at_least,
+        METH_O,
+        "Get the smallest key in the BTreeSet that is not smaller than the given key."
+    },
+    {
+        "at_most_many",
+        (PyCFunction)BTreeSetObj_at_most_many,
+        METH_O,
+        "Return a list of at_most for each key of an iterable, fastest if the keys are sorted."
+    },
+    {
+        "at_least_many",
+        (PyCFunction)BTreeSetObj_at_least_many,
+        METH_O,
+        "Return a list of at_least for each key of an iterable, fastest if the keys are sorted."
+    },
+    {
+        "bisect_left",
+        (PyCFunction)BTreeSetObj_bisect_left,
+        METH_O,
+        "Return the number of keys in the BTreeSet less than the given key."
+    },
+    {
+        "bisect_right",
+        (PyCFunction)BTreeSetObj_bisect_right,
+        METH_O,
+        "Return the number of keys in the BTreeSet not bigger than the given key."
+    },
+    {
+        "clear",
+        (PyCFunction)BTreeSetObj_clear,
+        METH_NOARGS,
+        "Clear the BTreeSet."
+    },
+    {
+        "contains_many",
+        (PyCFunction)BTreeSetObj_contains_many,
+        METH_O,
+        "Return a list of whether each key of an iterable is in the BTreeSet."
+    },
+    {
+        "copy",
+        (PyCFunction)BTreeSetObj_copy,
+        METH_NOARGS,
+        "Return a shallow copy of the BTreeSet with full leaves, in O(n) without comparisons."
+    },
+    {
+        "__copy__",
+        (PyCFunction)BTreeSetObj_copy,
+        METH_NOARGS,
+        "Return a shallow copy of the BTreeSet, see copy()."
+    },
+    {
+        "count_range",
+        (PyCFunction)BTreeSetObj_count_range,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Count keys between lo and hi, inclusive by default. None means no bound."
+    },
+    {
+        "cursor",
+        (PyCFunction)BTreeSetObj_cursor,
+        METH_NOARGS,
+        "Return a cursor at the smallest key, which steps, inserts and erases in place."
+    },
+    {
+        "delete_range",
+        (PyCFunction)BTreeSetObj_delete_range,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Delete the keys at the given locations from start to end, exclusive, as del on a list slice."
+    },
+    {
+        "difference",
+        (PyCFunction)BTreeSetObj_difference,
+        METH_O,
+        "Return a new BTreeSet with keys in the BTreeSet but not in the other."
+    },
+    {
+        "difference_update",
+        (PyCFunction)BTreeSetObj_difference_update,
+        METH_O,
+        "Remove keys of the other from the BTreeSet."
+    },
+    {
+        "extend",
+        (PyCFunction)BTreeSetObj_extend,
+        METH_O,
+        "Extends the BTreeSet by an iterable."
+    },
+    {
+        "extend_sorted",
+        (PyCFunction)BTreeSetObj_extend_sorted,
+        METH_O,
+        "Add keys in ascending order, sorting them first if they are not. Many keys are merged with the BTreeSet in one pass."
+    },
+    {
+        "freeze",
+        (PyCFunction)BTreeSetObj_freeze,
+        METH_NOARGS,
+        "Return a read-only FrozenTreeSet of the keys, laid out for fast lookups."
+    },
+    {
+        "from_buffer",
+        (PyCFunction)BTreeSetObj_from_buffer,
+        METH_O | METH_CLASS,
+        "Create a BTreeSet from a contiguous buffer of integers, floats or fixed-width bytes."
+    },
+    {
+        "index",
+        (PyCFunction)BTreeSetObj_index,
+        METH_O,
+        "Return the location of the given key. Raises ValueError if it is not present."
+    },
+    {
+        "intersection",
+        (PyCFunction)BTreeSetObj_intersection,
+        METH_O,
+        "Return a new BTreeSet with keys common to the BTreeSet and the other."
+    },
+    {
+        "intersection_update",
+        (PyCFunction)BTreeSetObj_intersection_update,
+        METH_O,
+        "Keep only keys also found in the other."
+    },
+    {
+        "irange",
+        (PyCFunction)BTreeSetObj_irange,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Return a view of keys between lo and hi, inclusive by default. None means no bound."
+    },
+    {
+        "isdisjoint",
+        (PyCFunction)BTreeSetObj_isdisjoint,
+        METH_O,
+        "Return True if the BTreeSet has no keys in common with the other."
+    },
+    {
+        "issubset",
+        (PyCFunction)BTreeSetObj_issubset,
+        METH_O,
+        "Report whether the other contains the BTreeSet."
+    },
+    {
+        "issuperset",
+        (PyCFunction)BTreeSetObj_issuperset,
+        METH_O,
+        "Report whether the BTreeSet contains the other."
+    },
+    {
+        "iter_before",
+        (PyCFunction)BTreeSetObj_iter_before,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate in descending order over keys less than key, or equal if inclusive."
+    },
+    {
+        "iter_from",
+        (PyCFunction)BTreeSetObj_iter_from,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate in ascending order over keys greater than key, or equal if inclusive (default)."
+    },
+    {
+        "load",
+        (PyCFunction)BTreeSetObj_load,
+        METH_O | METH_CLASS,
+        "Load a BTreeSet from a snapshot saved to a path or a binary file by TreeSet or BTreeSet."
+    },
+    {
+        "loc",
+        (PyCFunction)BTreeSetObj_loc,
+        METH_O,
+        "Return the key at the given location."
+    },
+    {
+        "max",
+        (PyCFunction)BTreeSetObj_max,
+        METH_NOARGS,
+        "Get the max of the BTreeSet."
+    },
+    {
+        "min",
+        (PyCFunction)BTreeSetObj_min,
+        METH_NOARGS,
+        "Get the min of the BTreeSet."
+    },
+    {
+        "pop",
+        (PyCFunction)BTreeSetObj_pop,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Remove and return the key at the given location, the last one by default."
+    },
+    {
+        "rank",
+        (PyCFunction)BTreeSetObj_bisect_left,
+        METH_O,
+        "Return the number of keys in the BTreeSet less than the given key."
+    },
+    {
+        "remove",
+        (PyCFunction)BTreeSetObj_remove,
+        METH_O,
+        "Remove an object from the BTreeSet."
+    },
+    {
+        "save",
+        (PyCFunction)BTreeSetObj_save,
+        METH_O,
+        "Save the BTreeSet to a path or a binary file, in the snapshot format of TreeSet."
+    },
+    {
+        "stats",
+        (PyCFunction)BTreeSetObj_stats,
+        METH_NOARGS,
+        "Report the memory usage, leaf fill and key comparisons of the BTreeSet."
+    },
+    {
+        "symmetric_difference",
+        (PyCFunction)BTreeSetObj_symmetric_difference,
+        METH_O,
+        "Return a new BTreeSet with keys in either the BTreeSet or the other but not both."
+    },
+    {
+        "symmetric_difference_update",
+        (PyCFunction)BTreeSetObj_symmetric_difference_update,
+        METH_O,
+        "Update the BTreeSet with keys in either the BTreeSet or the other but not both."
+    },
+    {
+        "to_buffer",
+        (PyCFunction)BTreeSetObj_to_buffer,
+        METH_NOARGS,
+        "Return a memoryview of the keys in order, for dtype int64, float64 or bytes."
+    },
+    {
+        "union",
+        (PyCFunction)BTreeSetObj_union,
+        METH_O,
+        "Return a new BTreeSet with keys from the BTreeSet and the other."
+    },
+    {
+        "update",
+        (PyCFunction)BTreeSetObj_update,
+        METH_O,
+        "Add keys of the other to the BTreeSet."
+    },
+    {NULL}
+};
+
+static PyObject* BTreeSetObj_get_backend(BTreeSetObj *self, void *closure) {
+    return PyUnicode_FromString("btree");
+}
+
+/* dtype and key are those of TreeSet */
+static PyGetSetDef BTreeSetObj_GetSet[] = {
+    {
+        "backend",
+        (getter)BTreeSetObj_get_backend,
+        NULL,
+        "The engine of the BTreeSet, always \"btree\".",
+        NULL
+    },
+    {NULL}
+};
+
+/* sequence method */
+static Py_ssize_t BTreeSetObj_len(BTreeSetObj *self) {
+    return btreeset_size(self);
+}
+
+static int BTreeSetObj_contains(BTreeSetObj *self, PyObject *key) {
+    int found;
+    if (btreeset_bisect(self, key, 0, &found, NULL) < 0) {
+        return -1;
+    }
+    return found;
+}
+
+/* mapping method */
+static PyObject* BTreeSetObj_subscript(BTreeSetObj *self, PyObject *key) {
+    if (!PySlice_Check(key)) {
+        PyErr_Format(
+            PyExc_TypeError, "BTreeSet indices must be slices of keys, not %.200s",
+            Py_TYPE(key)->tp_name
+        );
+        return NULL;
+    }
+    PySliceObject *slice = (PySliceObject *)key;
+    if (slice->step != Py_None) {
+        PyErr_SetString(PyExc_ValueError, "BTreeSet slices do not support steps");
+        return NULL;
+    }
+    return TreeRange_NewBTree(
+        (PyObject *)self, slice->start, slice->stop, 1, 0, (btree_iter_getter)btreeset_getkey
+    );
+}
+
+/**
+ * @brief Delete the key at position i with `del ts[i]`, as pop(i) does, or the keys
+ * from lo to hi with `del ts[lo:hi]`, the same keys ts[lo:hi] views.
+ */
+static int BTreeSetObj_ass_subscript(BTreeSetObj *self, PyObject *key, PyObject *val) {
+    if (val) {
+        PyErr_SetString(PyExc_TypeError, "BTreeSet does not support item assignment");
+        return -1;
+    } else if (PyIndex_Check(key)) {
+        Py_ssize_t loc = PyNumber_AsSsize_t(key, PyExc_IndexError);
+        if (loc == -1 && PyErr_Occurred()) {
+            return -1;
+        }
+        avl_key_t entry[2];
+        if (btreeset_take_at(self, loc, "BTreeSet index out of range", entry) < 0) {
+            return -1;
+        }
+        btree_release(self->btree, &self->ctx, entry);
+        return 0;
+    } else if (!PySlice_Check(key)) {
+        PyErr_Format(
+            PyExc_TypeError, "BTreeSet deletions take positions or slices of keys, not %.200s",
+            Py_TYPE(key)->tp_name
+        );
+        return -1;
+    }
+    PySliceObject *slice = (PySliceObject *)key;
+    if (slice->step != Py_None) {
+        PyErr_SetString(PyExc_ValueError, "BTreeSet slices do not support steps");
+        return -1;
+    }
+    Py_ssize_t start, end;
+    if (pyavl_range_bounds((PyAVLTreeObj *)self, slice->start, slice->stop, 1, 0,
+        &start, &end) < 0) {
+        return -1;
+    }
+    if (start < end) {
+        return btree_delete_range(self->btree, &self->ctx, start, end);
+    }
+    return 0;
+}
+
+static PyMappingMethods BTreeSetObj_Mapping = {
+    .mp_length = (lenfunc)BTreeSetObj_len,
+    .mp_subscript = (binaryfunc)BTreeSetObj_subscript,
+    .mp_ass_subscript = (objobjargproc)BTreeSetObj_ass_subscript
+};
+
+/* number methods, with a TreeSet on the left handled by TreeSet */
+static PyObject* btreeset_number_op(PyObject *a, PyObject *b, avl_setop_t op) {
+    if (!BTreeSetObj_Check(a) || !PyObject_TypeCheck(b, &TreeSet_Type)) {
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+    return btreeset_binop((BTreeSetObj *)a, b, op);
+}
+
+static PyObject* btreeset_inplace_op(BTreeSetObj *self, PyObject *other, avl_setop_t op) {
+    if (!PyObject_TypeCheck(other, &TreeSet_Type)) {
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+    if (btreeset_update_op(self, other, op) < 0) {
+        return NULL;
+    }
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+static PyObject* BTreeSetObj_or(PyObject *a, PyObject *b) {
+    return btreeset_number_op(a, b, AVL_SETOP_UNION);
+}
+
+static PyObject* BTreeSetObj_and(PyObject *a, PyObject *b) {
+    return btreeset_number_op(a, b, AVL_SETOP_INTERSECTION);
+}
+
+static PyObject* BTreeSetObj_sub(PyObject *a, PyObject *b) {
+    return btreeset_number_op(a, b, AVL_SETOP_DIFFERENCE);
+}
+
+static PyObject* BTreeSetObj_xor(PyObject *a, PyObject *b) {
+    return btreeset_number_op(a, b, AVL_SETOP_SYMMETRIC_DIFFERENCE);
+}
+
+static PyObject* BTreeSetObj_ior(BTreeSetObj *self, PyObject *other) {
+    return btreeset_inplace_op(self, other, AVL_SETOP_UNION);
+}
+
+static PyObject* BTreeSetObj_iand(BTreeSetObj *self, PyObject *other) {
+    return btreeset_inplace_op(self, other, AVL_SETOP_INTERSECTION);
+}
+
+static PyObject* BTreeSetObj_isub(BTreeSetObj *self, PyObject *other) {
+    return btreeset_inplace_op(self, other, AVL_SETOP_DIFFERENCE);
+}
+
+static PyObject* BTreeSetObj_ixor(BTreeSetObj *self, PyObject *other) {
+    return btreeset_inplace_op(self, other, AVL_SETOP_SYMMETRIC_DIFFERENCE);
+}
+
+static PyNumberMethods BTreeSetObj_Num = {
+    .nb_or = (binaryfunc)BTreeSetObj_or,
+    .nb_and = (binaryfunc)BTreeSetObj_and,
+    .nb_subtract = (binaryfunc)BTreeSetObj_sub,
+    .nb_xor = (binaryfunc)BTreeSetObj_xor,
+    .nb_inplace_or = (binaryfunc)BTreeSetObj_ior,
+    .nb_inplace_and = (binaryfunc)BTreeSetObj_iand,
+    .nb_inplace_subtract = (binaryfunc)BTreeSetObj_isub,
+    .nb_inplace_xor = (binaryfunc)BTreeSetObj_ixor
+};
+
+static PySequenceMethods BTreeSetObj_Seq = {
+    .sq_length = (lenfunc)BTreeSetObj_len,
+    .sq_contains = (objobjproc)BTreeSetObj_contains
+};
+
+PyTypeObject BTreeSet_Type = {
+    /* The ob_type field must be initialized in the module init function
+     * to be portable to Windows without using C++. */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "pyavl.BTreeSet",           /*tp_name*/
+    0,                          /*tp_basicsize, that of TreeSet*/
+    0,                          /*tp_itemsize*/
+    /* methods */
+    (destructor)BTreeSetObj_free,/*tp_dealloc*/
+    0,                          /*tp_vectorcall_offset*/
+    (getattrfunc)0,             /*tp_getattr*/
+    (setattrfunc)0,             /*tp_setattr*/
+    0,                          /*tp_as_async*/
+    0,                          /*tp_repr*/
+    &BTreeSetObj_Num,           /*tp_as_number*/
+    &BTreeSetObj_Seq,           /*tp_as_sequence*/
+    &BTreeSetObj_Mapping,       /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    (getattrofunc)0,            /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    0,                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
+    0,                          /*tp_doc*/
+    0,                          /*tp_traverse*/
+    0,                          /*tp_clear*/
+    0,                          /*tp_richcompare*/
+    0,                          /*tp_weaklistoffset*/
+    (getiterfunc)BTreeSetObj_iter,/*tp_iter*/
+    0,                          /*tp_iternext*/
+    BTreeSetObj_Methods,        /*tp_methods*/
+    0,                          /*tp_members*/
+    BTreeSetObj_GetSet,         /*tp_getset*/
+    &TreeSet_Type,              /*tp_base*/
+    0,                          /*tp_dict*/
+    0,                          /*tp_descr_get*/
+    0,                          /*tp_descr_set*/
+    0,                          /*tp_dictoffset*/
+    (initproc)BTreeSetObj_init, /*tp_init*/
+    0,                          /*tp_alloc*/
+    BTreeSetObj_new,            /*tp_new*/
+    0,                          /*tp_free*/
+    0,                          /*tp_is_gc*/
+};
@@ -0,0 +1,359 @@
+#include "frozen.h"
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <math.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define _FZ_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define _FZ_PREFETCH(p)     __builtin_prefetch(p)
+#else
+#define _FZ_PREFETCH(p)
+#endif
+
+/*
+ * A lower bound descends the index from k = 1 to child 2k or 2k + 1, and ends
+ * past the leaves. Its last left turn is at the index entry of the answer, found
+ * by dropping the trailing right turns (ones) and that left turn (a zero) from k.
+ * If there is no left turn, every block is below the query.
+ */
+static inline size_t _frozen_unwind(size_t k) {
+#if defined(__GNUC__) || defined(__clang__)
+    return k >> __builtin_ffsll((long long)~k);
+#else
+    while (k & 1) {
+        k >>= 1;
+    }
+    return k >> 1;
+#endif
+}
+
+/* Memory Management */
+
+extern void frozen_init(frozen_t *tree) {
+    tree->keys = NULL;
+    tree->size = 0;
+    tree->nblocks = 0;
+    tree->index = NULL;
+    tree->blocks = NULL;
+}
+
+extern avl_key_t* frozen_alloc(frozen_t *tree, size_t n) {
+    size_t nblocks = (n + FROZEN_BLOCK - 1) / FROZEN_BLOCK;
+    if (nblocks > UINT32_MAX) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    tree->keys = PyMem_New(avl_key_t, nblocks? nblocks * FROZEN_BLOCK: 1);
+    if (!tree->keys) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    tree->size = n;
+    tree->nblocks = nblocks;
+    return tree->keys;
+}
+
+/**
+ * @brief Fill the subtree of the index at k in order, from block b.
+ * @return Return the block after the subtree.
+ */
+static size_t _frozen_fill(frozen_t *tree, size_t k, size_t b) {
+    if (k > tree->nblocks) {
+        return b;
+    }
+    b = _frozen_fill(tree, 2 * k, b);
+    size_t last = Py_MIN((b + 1) * FROZEN_BLOCK, tree->size) - 1;
+    tree->index[k] = tree->keys[last];
+    tree->blocks[k] = (uint32_t)b;
+    return _frozen_fill(tree, 2 * k + 1, b + 1);
+}
+
+extern int frozen_finish(frozen_t *tree, avl_dtype_t dtype) {
+    for (size_t i = tree->size; i < tree->nblocks * FROZEN_BLOCK; i++) {
+        if (dtype == AVL_DTYPE_INT64) {
+            tree->keys[i].i64 = INT64_MAX;
+        } else if (dtype == AVL_DTYPE_FLOAT64) {
+            tree->keys[i].f64 = Py_HUGE_VAL;
+        } else {
+            tree->keys[i].obj = NULL;
+        }
+    }
+    tree->index = PyMem_New(avl_key_t, tree->nblocks + 1);
+    tree->blocks = PyMem_New(uint32_t, tree->nblocks + 1);
+    if (!tree->index || !tree->blocks) {
+        PyMem_Free(tree->index);
+        PyMem_Free(tree->blocks);
+        tree->index = NULL;
+        tree->blocks = NULL;
+        PyErr_NoMemory();
+        return -1;
+    }
+    _frozen_fill(tree, 1, 0);
+    return 0;
+}
+
+extern void frozen_clear(frozen_t *tree, avl_dtype_t dtype) {
+    for (size_t i = 0; AVL_DTYPE_BOXED(dtype) && i < tree->size; i++) {
+        avl_key_release(dtype, tree->keys[i]);
+    }
+    PyMem_Free(tree->keys);
+    PyMem_Free(tree->index);
+    PyMem_Free(tree->blocks);
+    frozen_init(tree);
+}
+
+extern size_t frozen_bytes(frozen_t *tree) {
+    return tree->nblocks * (FROZEN_BLOCK * sizeof(avl_key_t) + sizeof(avl_key_t) + sizeof(uint32_t));
+}
+
+/* Counting in a Block */
+
+typedef size_t (*_frozen_count_i64)(const avl_key_t *block, int64_t x, int right);
+typedef size_t (*_frozen_count_f64)(const avl_key_t *block, double x, int right);
+
+static size_t _frozen_count_i64_scalar(const avl_key_t *block, int64_t x, int right) {
+    size_t cnt = 0;
+    if (right) {
+        for (int i = 0; i < FROZEN_BLOCK; i++) {
+            cnt += block[i].i64 <= x;
+        }
+    } else {
+        for (int i = 0; i < FROZEN_BLOCK; i++) {
+            cnt += block[i].i64 < x;
+        }
+    }
+    return cnt;
+}
+
+static size_t _frozen_count_f64_scalar(const avl_key_t *block, double x, int right) {
+    size_t cnt = 0;
+    if (right) {
+        for (int i = 0; i < FROZEN_BLOCK; i++) {
+            cnt += block[i].f64 <= x;
+        }
+    } else {
+        for (int i = 0; i < FROZEN_BLOCK; i++) {
+            cnt += block[i].f64 < x;
+        }
+    }
+    return cnt;
+}
+
+#ifdef _FZ_X86
+__attribute__((target("avx2,popcnt")))
+static size_t _frozen_count_i64_avx2(const avl_key_t *block, int64_t x, int right) {
+    __m256i vx = _mm256_set1_epi64x(x);
+    size_t cnt = 0;
+    for (int i = 0; i < FROZEN_BLOCK; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(block + i));
+        /* keys <= x are the keys not > x */
+        __m256i gt = right? _mm256_cmpgt_epi64(v, vx): _mm256_cmpgt_epi64(vx, v);
+        cnt += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(gt)));
+    }
+    return right? FROZEN_BLOCK - cnt: cnt;
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t _frozen_count_f64_avx2(const avl_key_t *block, double x, int right) {
+    __m256d vx = _mm256_set1_pd(x);
+    size_t cnt = 0;
+    for (int i = 0; i < FROZEN_BLOCK; i += 4) {
+        __m256d v = _mm256_loadu_pd((const double *)(block + i));
+        __m256d lt = right? _mm256_cmp_pd(v, vx, _CMP_LE_OQ): _mm256_cmp_pd(v, vx, _CMP_LT_OQ);
+        cnt += __builtin_popcount(_mm256_movemask_pd(lt));
+    }
+    return cnt;
+}
+
+__attribute__((target("sse4.2,popcnt")))
+static size_t _frozen_count_i64_sse42(const avl_key_t *block, int64_t x, int right) {
+    __m128i vx = _mm_set1_epi64x(x);
+    size_t cnt = 0;
+    for (int i = 0; i < FROZEN_BLOCK; i += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(block + i));
+        __m128i gt = right? _mm_cmpgt_epi64(v, vx): _mm_cmpgt_epi64(vx, v);
+        cnt += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(gt)));
+    }
+    return right? FROZEN_BLOCK - cnt: cnt;
+}
+
+__attribute__((target("sse4.2,popcnt")))
+static size_t _frozen_count_f64_sse42(const avl_key_t *block, double x, int right) {
+    __m128d vx = _mm_set1_pd(x);
+    size_t cnt = 0;
+    for (int i = 0; i < FROZEN_BLOCK; i += 2) {
+        __m128d v = _mm_loadu_pd((const double *)(block + i));
+        __m128d lt = right? _mm_cmple_pd(v, vx): _mm_cmplt_pd(v, vx);
+        cnt += __builtin_popcount(_mm_movemask_pd(lt));
+    }
+    return cnt;
+}
+#endif
+
+static const char *_frozen_isa = NULL;
+static _frozen_count_i64 _frozen_i64 = _frozen_count_i64_scalar;
+static _frozen_count_f64 _frozen_f64 = _frozen_count_f64_scalar;
+
+/**
+ * @brief Pick the vector instructions supported by the CPU, once.
+ */
+static void _frozen_dispatch(void) {
+    if (_frozen_isa) {
+        return;
+    }
+    _frozen_isa = "scalar";
+#ifdef _FZ_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        _frozen_isa = "avx2";
+        _frozen_i64 = _frozen_count_i64_avx2;
+        _frozen_f64 = _frozen_count_f64_avx2;
+    } else if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+        _frozen_isa = "sse4.2";
+        _frozen_i64 = _frozen_count_i64_sse42;
+        _frozen_f64 = _frozen_count_f64_sse42;
+    }
+#endif
+}
+
+extern const char* frozen_simd(void) {
+    _frozen_dispatch();
+    return _frozen_isa;
+}
+
+/* Search */
+
+static size_t _frozen_bisect_i64(frozen_t *tree, int64_t x, int right, int *found) {
+    const avl_key_t *index = tree->index;
+    size_t k = 1, m = tree->nblocks, pos = tree->size;
+    if (right) {
+        while (k <= m) {
+            _FZ_PREFETCH(index + 16 * k);
+            k = 2 * k + (index[k].i64 <= x);
+        }
+    } else {
+        while (k <= m) {
+            _FZ_PREFETCH(index + 16 * k);
+            k = 2 * k + (index[k].i64 < x);
+        }
+    }
+    k = _frozen_unwind(k);
+    if (k) {
+        size_t b = tree->blocks[k] * (size_t)FROZEN_BLOCK;
+        /* padding is counted only when right and x is the largest value */
+        pos = Py_MIN(b + _frozen_i64(tree->keys + b, x, right), tree->size);
+    }
+    if (found) {
+        *found = right? pos > 0 && tree->keys[pos - 1].i64 == x:
+            pos < tree->size && tree->keys[pos].i64 == x;
+    }
+    return pos;
+}
+
+static size_t _frozen_bisect_f64(frozen_t *tree, double x, int right, int *found) {
+    const avl_key_t *index = tree->index;
+    size_t k = 1, m = tree->nblocks, pos = tree->size;
+    if (right) {
+        while (k <= m) {
+            _FZ_PREFETCH(index + 16 * k);
+            k = 2 * k + (index[k].f64 <= x);
+        }
+    } else {
+        while (k <= m) {
+            _FZ_PREFETCH(index + 16 * k);
+            k = 2 * k + (index[k].f64 < x);
+        }
+    }
+    k = _frozen_unwind(k);
+    if (k) {
+        size_t b = tree->blocks[k] * (size_t)FROZEN_BLOCK;
+        /* padding is counted only when right and x is the largest value */
+        pos = Py_MIN(b + _frozen_f64(tree->keys + b, x, right), tree->size);
+    }
+    if (found) {
+        *found = right? pos > 0 && tree->keys[pos - 1].f64 == x:
+            pos < tree->size && tree->keys[pos].f64 == x;
+    }
+    return pos;
+}
+
+/**
+ * @brief Whether q goes after a key, for a bisection to the right or to the left.
+ * @return Return 1 or 0, -1 on errors.
+ */
+static inline int
+_frozen_after(avl_ctx_t *ctx, avl_cmpfunc cmpf, avl_key_t q, avl_key_t key, int right) {
+    ctx->ncmp++;
+    int cmp = cmpf(q, key);
+    if (cmp == -2) {
+        return -1;
+    }
+    return right? cmp >= 0: cmp > 0;
+}
+
+extern ptrdiff_t
+frozen_bisect(frozen_t *tree, avl_ctx_t *ctx, PyObject *key, int right, int *found) {
+    _frozen_dispatch();
+    if (found) {
+        *found = 0;
+    }
+    if (!tree->size) {
+        return 0;
+    }
+    if (ctx->dtype == AVL_DTYPE_INT64 && PyLong_Check(key)) {
+        int overflow;
+        long long x = PyLong_AsLongLongAndOverflow(key, &overflow);
+        if (x == -1 && PyErr_Occurred()) {
+            return -1;
+        } else if (!overflow) {
+            return _frozen_bisect_i64(tree, x, right, found);
+        }
+    } else if (ctx->dtype == AVL_DTYPE_FLOAT64 && PyFloat_Check(key) &&
+        !isnan(PyFloat_AS_DOUBLE(key))) {
+        return _frozen_bisect_f64(tree, PyFloat_AS_DOUBLE(key), right, found);
+    }
+
+    /* other keys are compared as in the AVL tree */
+    avl_key_t q;
+    avl_cmpfunc cmpf = avl_cmp_query(ctx, key, &q);
+    size_t k = 1, lo = tree->size, hi = tree->size;
+    while (k <= tree->nblocks) {
+        int after = _frozen_after(ctx, cmpf, q, tree->index[k], right);
+        if (after < 0) {
+            return -1;
+        }
+        k = 2 * k + after;
+    }
+    k = _frozen_unwind(k);
+    if (k) {
+        lo = tree->blocks[k] * (size_t)FROZEN_BLOCK;
+        hi = Py_MIN(lo + FROZEN_BLOCK, tree->size);
+    }
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int after = _frozen_after(ctx, cmpf, q, tree->keys[mid], right);
+        if (after < 0) {
+            return -1;
+        } else if (after) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    size_t near = right? lo - 1: lo;
+    if (found && (right? lo > 0: lo < tree->size)) {
+        ctx->ncmp++;
+        int cmp = cmpf(q, tree->keys[near]);
+        if (cmp == -2) {
+            return -1;
+        }
+        *found = cmp == 0;
+    }
+    return lo;
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+/**
+ * @file frozen.h
+ * @author wormtooth (ye@wormtooth.com)
+ * @brief Interfaces for frozen trees, a read-only engine for trees built once and queried often.
+ *
+ * Keys are stored sorted in one array, cut into blocks of `FROZEN_BLOCK` keys.
+ * The last key of each block is copied into a small index in Eytzinger order,
+ * the breadth-first order of a complete binary tree, which is searched without
+ * branches on unboxed keys while the next levels are prefetched. A search then
+ * counts the keys of one block below the query, with vector compares for int64
+ * and float64 keys when the CPU has them, picked at run time. Positions are
+ * indices into the array, so locations and ranges cost nothing more.
+ *
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#ifndef PY_FROZEN_H
+#define PY_FROZEN_H
+
+#include "avl.h"
+
+#define FROZEN_BLOCK        16      /* two cache lines of unboxed keys */
+
+typedef struct _frozen_tree {
+    avl_key_t *keys;        /* sorted, unboxed keys are padded to whole blocks */
+    size_t size;
+    size_t nblocks;
+    avl_key_t *index;       /* index[k], for k from 1 to nblocks, is the last key of block blocks[k] */
+    uint32_t *blocks;
+} frozen_t;
+
+/**
+ * @brief Initialize an empty tree.
+ *
+ */
+extern void frozen_init(frozen_t *tree);
+
+/**
+ * @brief Allocate the keys of an empty tree, to fill in order before frozen_finish.
+ *
+ * @param tree An empty tree.
+ * @param n The number of keys.
+ * @return Return the array of n keys, NULL with MemoryError set on failure.
+ */
+extern avl_key_t* frozen_alloc(frozen_t *tree, size_t n);
+
+/**
+ * @brief Build the index of a tree whose keys are filled, sorted and distinct.
+ *
+ * @param tree The tree.
+ * @param dtype The dtype of the keys.
+ * @return Return 0 on success, -1 with MemoryError set on failure.
+ */
+extern int frozen_finish(frozen_t *tree, avl_dtype_t dtype);
+
+/**
+ * @brief Release the keys of a tree and free its memory.
+ *
+ */
+extern void frozen_clear(frozen_t *tree, avl_dtype_t dtype);
+
+/**
+ * @brief Count the keys < key, or <= key if `right` is true, as avl_node_bisect.
+ *
+ * @param tree The tree.
+ * @param ctx The context of the tree, counting comparisons of boxed keys.
+ * @param key The key to compare.
+ * @param right Whether to count keys equal to key.
+ * @param found If not NULL, set to whether key is in the tree.
+ * @return Return the count, which is the position of the first key not counted; -1 on errors.
+ */
+extern ptrdiff_t
+frozen_bisect(frozen_t *tree, avl_ctx_t *ctx, PyObject *key, int right, int *found);
+
+/**
+ * @brief The number of bytes used by a tree.
+ *
+ */
+extern size_t frozen_bytes(frozen_t *tree);
+
+/**
+ * @brief The instruction set used to compare unboxed keys: "avx2", "sse4.2" or "scalar".
+ *
+ */
+extern const char* frozen_simd(void);
+
+#endif
\ No newline at end of file
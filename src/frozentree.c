@@ -0,0 +1,831 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "avl.h"
+#include "frozen.h"
+#include "pyavlmodule.h"
+
+/* shared by FrozenTreeSet and FrozenTreeMap */
+typedef struct {
+    PyObject_HEAD
+    frozen_t tree;
+    avl_ctx_t ctx;
+    avl_dtype_t vtype;
+    avl_key_t *values;      /* NULL for a FrozenTreeSet */
+} FrozenTreeObj;
+
+typedef enum {
+    FROZEN_KEYS,
+    FROZEN_VALUES,
+    FROZEN_ITEMS
+} frozen_yield_t;
+
+static PyObject*
+FrozenIter_New(FrozenTreeObj *owner, Py_ssize_t start, Py_ssize_t end, int reverse, frozen_yield_t what);
+
+static const char* frozentree_name(FrozenTreeObj *self) {
+    return FrozenTreeMapObj_Check(self)? "FrozenTreeMap": "FrozenTreeSet";
+}
+
+static PyObject* frozentree_getkey(FrozenTreeObj *self, Py_ssize_t pos) {
+    return avl_key_to_object(self->ctx.dtype, self->tree.keys[pos]);
+}
+
+static PyObject* frozentree_getval(FrozenTreeObj *self, Py_ssize_t pos) {
+    return avl_key_to_object(self->vtype, self->values[pos]);
+}
+
+static PyObject* frozentree_getitem(FrozenTreeObj *self, Py_ssize_t pos) {
+    PyObject *key = frozentree_getkey(self, pos);
+    if (!key) {
+        return NULL;
+    }
+    PyObject *val = frozentree_getval(self, pos);
+    if (!val) {
+        Py_DECREF(key);
+        return NULL;
+    }
+    return Py_BuildValue("(NN)", key, val);
+}
+
+/**
+ * @brief Get the entry at a position: the key of a FrozenTreeSet, the item of a FrozenTreeMap.
+ */
+static PyObject* frozentree_getentry(FrozenTreeObj *self, Py_ssize_t pos) {
+    return self->values? frozentree_getitem(self, pos): frozentree_getkey(self, pos);
+}
+
+static PyObject* FrozenTreeObj_new(PyTypeObject *type) {
+    FrozenTreeObj *self;
+    self = (FrozenTreeObj *)type->tp_alloc(type, 0);
+    if (self == NULL) {
+        return NULL;
+    }
+    frozen_init(&self->tree);
+    avl_ctx_init(&self->ctx, AVL_DTYPE_OBJECT);
+    self->vtype = AVL_DTYPE_OBJECT;
+    self->values = NULL;
+
+    return (PyObject *)self;
+}
+
+static void FrozenTreeObj_free(FrozenTreeObj *self) {
+    for (size_t i = 0; self->values && AVL_DTYPE_BOXED(self->vtype) && i < self->tree.size; i++) {
+        avl_key_release(self->vtype, self->values[i]);
+    }
+    PyMem_Free(self->values);
+    frozen_clear(&self->tree, self->ctx.dtype);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+typedef struct {
+    avl_key_t *out;
+    avl_dtype_t dtype;
+} frozen_copy_t;
+
+static void _frozen_copy(avl_key_t key, void *extra) {
+    frozen_copy_t *copy = (frozen_copy_t *)extra;
+    if (AVL_DTYPE_BOXED(copy->dtype)) {
+        Py_INCREF(key.obj);
+    }
+    *copy->out++ = key;
+}
+
+extern PyObject* FrozenTree_New(PyTypeObject *type, const pyavl_column_t *keys,
+    const pyavl_column_t *values, Py_ssize_t size, avl_ctx_t *ctx, avl_dtype_t vtype) {
+    FrozenTreeObj *self = (FrozenTreeObj *)FrozenTreeObj_new(type);
+    if (!self) {
+        return NULL;
+    }
+    /* comparisons are counted from the freeze, and there is nothing to augment */
+    self->ctx = *ctx;
+    self->ctx.ncmp = 0;
+    self->ctx.augment = NULL;
+    self->ctx.share = NULL;
+    self->vtype = vtype;
+
+    frozen_copy_t copy = {frozen_alloc(&self->tree, size), ctx->dtype};
+    if (!copy.out) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    if (values) {
+        self->values = PyMem_New(avl_key_t, size? size: 1);
+        if (!self->values) {
+            /* no key is held yet */
+            self->tree.size = 0;
+            Py_DECREF(self);
+            return PyErr_NoMemory();
+        }
+        frozen_copy_t vcopy = {self->values, vtype};
+        pyavl_column_foreach(values, _frozen_copy, &vcopy);
+    }
+    pyavl_column_foreach(keys, _frozen_copy, &copy);
+    if (frozen_finish(&self->tree, ctx->dtype) < 0) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    return (PyObject *)self;
+}
+
+/**
+ * @brief Freeze a new TreeSet or TreeMap made of the arguments of a frozen type.
+ */
+static PyObject* frozentree_from_args(PyObject *tree_type, PyObject *args, PyObject *kwargs) {
+    PyObject *tree = PyObject_Call(tree_type, args, kwargs);
+    if (!tree) {
+        return NULL;
+    }
+    PyObject *ret = PyObject_CallMethod(tree, "freeze", NULL);
+    Py_DECREF(tree);
+    return ret;
+}
+
+static PyObject* FrozenTreeSetObj_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    if (PyTuple_GET_SIZE(args) == 1 && (!kwargs || !PyDict_Size(kwargs)) &&
+        PyObject_TypeCheck(PyTuple_GET_ITEM(args, 0), &TreeSet_Type)) {
+        return PyObject_CallMethod(PyTuple_GET_ITEM(args, 0), "freeze", NULL);
+    }
+    return frozentree_from_args((PyObject *)&TreeSet_Type, args, kwargs);
+}
+
+static PyObject* FrozenTreeMapObj_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    if (PyTuple_GET_SIZE(args) == 1 && (!kwargs || !PyDict_Size(kwargs)) &&
+        (PyObject_TypeCheck(PyTuple_GET_ITEM(args, 0), &TreeMap_Type) ||
+        TreeMapSnapshotObj_Check(PyTuple_GET_ITEM(args, 0)))) {
+        return PyObject_CallMethod(PyTuple_GET_ITEM(args, 0), "freeze", NULL);
+    }
+    return frozentree_from_args((PyObject *)&TreeMap_Type, args, kwargs);
+}
+
+/* Lookups */
+
+/**
+ * @brief Locate a key, see frozen_bisect.
+ * @return Return the position, -1 on errors.
+ */
+static Py_ssize_t
+frozentree_bisect(FrozenTreeObj *self, PyObject *key, int right, int *found) {
+    return frozen_bisect(&self->tree, &self->ctx, key, right, found);
+}
+
+static PyObject* FrozenTreeObj_bisect_left(FrozenTreeObj *self, PyObject *key) {
+    Py_ssize_t ret = frozentree_bisect(self, key, 0, NULL);
+    if (ret < 0) {
+        return NULL;
+    }
+    return PyLong_FromSsize_t(ret);
+}
+
+static PyObject* FrozenTreeObj_bisect_right(FrozenTreeObj *self, PyObject *key) {
+    Py_ssize_t ret = frozentree_bisect(self, key, 1, NULL);
+    if (ret < 0) {
+        return NULL;
+    }
+    return PyLong_FromSsize_t(ret);
+}
+
+static PyObject* FrozenTreeObj_index(FrozenTreeObj *self, PyObject *key) {
+    int found;
+    Py_ssize_t ret = frozentree_bisect(self, key, 0, &found);
+    if (ret < 0) {
+        return NULL;
+    } else if (!found) {
+        PyErr_Format(PyExc_ValueError, "key is not in %s", frozentree_name(self));
+        return NULL;
+    }
+    return PyLong_FromSsize_t(ret);
+}
+
+static PyObject* FrozenTreeObj_at_most(FrozenTreeObj *self, PyObject *key) {
+    Py_ssize_t ret = frozentree_bisect(self, key, 1, NULL);
+    if (ret < 0) {
+        return NULL;
+    } else if (ret == 0) {
+        Py_RETURN_NONE;
+    }
+    return frozentree_getkey(self, ret - 1);
+}
+
+static PyObject* FrozenTreeObj_at_least(FrozenTreeObj *self, PyObject *key) {
+    Py_ssize_t ret = frozentree_bisect(self, key, 0, NULL);
+    if (ret < 0) {
+        return NULL;
+    } else if ((size_t)ret == self->tree.size) {
+        Py_RETURN_NONE;
+    }
+    return frozentree_getkey(self, ret);
+}
+
+static PyObject* FrozenTreeObj_min(FrozenTreeObj *self) {
+    if (!self->tree.size) {
+        PyErr_Format(PyExc_ValueError, "%s is empty", frozentree_name(self));
+        return NULL;
+    }
+    return frozentree_getentry(self, 0);
+}
+
+static PyObject* FrozenTreeObj_max(FrozenTreeObj *self) {
+    if (!self->tree.size) {
+        PyErr_Format(PyExc_ValueError, "%s is empty", frozentree_name(self));
+        return NULL;
+    }
+    return frozentree_getentry(self, self->tree.size - 1);
+}
+
+static PyObject* FrozenTreeObj_loc(FrozenTreeObj *self, PyObject *arg) {
+    Py_ssize_t loc = PyNumber_AsSsize_t(arg, PyExc_OverflowError);
+    if (loc == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    if (loc < 0) {
+        loc += self->tree.size;
+    }
+    if (loc < 0 || (size_t)loc >= self->tree.size) {
+        PyErr_Format(PyExc_IndexError, "%s index out of range", frozentree_name(self));
+        return NULL;
+    }
+    return frozentree_getentry(self, loc);
+}
+
+/**
+ * @brief Locate the keys between lo and hi by positions, as pyavl_range_bounds.
+ * @return Return 0 on success, -1 on errors.
+ */
+static int frozentree_range_bounds(FrozenTreeObj *self, PyObject *lo, PyObject *hi,
+    int lo_inclusive, int hi_inclusive, Py_ssize_t *start, Py_ssize_t *end) {
+    *start = 0;
+    *end = self->tree.size;
+    if (lo != Py_None && (*start = frozentree_bisect(self, lo, !lo_inclusive, NULL)) < 0) {
+        return -1;
+    }
+    if (hi != Py_None && (*end = frozentree_bisect(self, hi, hi_inclusive, NULL)) < 0) {
+        return -1;
+    }
+    if (*end < *start) {
+        *end = *start;
+    }
+    return 0;
+}
+
+static PyObject* FrozenTreeObj_count_range(
+    FrozenTreeObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    PyObject *lo, *hi;
+    int lo_inclusive, hi_inclusive;
+    Py_ssize_t start, end;
+    if (pyavl_parse_range(
+            "count_range", args, nargs, kwnames, &lo, &hi, &lo_inclusive, &hi_inclusive) < 0 ||
+        frozentree_range_bounds(self, lo, hi, lo_inclusive, hi_inclusive, &start, &end) < 0)
+        return NULL;
+    return PyLong_FromSsize_t(end - start);
+}
+
+static PyObject* FrozenTreeObj_irange(
+    FrozenTreeObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    PyObject *lo, *hi;
+    int lo_inclusive, hi_inclusive;
+    Py_ssize_t start, end;
+    if (pyavl_parse_range(
+            "irange", args, nargs, kwnames, &lo, &hi, &lo_inclusive, &hi_inclusive) < 0 ||
+        frozentree_range_bounds(self, lo, hi, lo_inclusive, hi_inclusive, &start, &end) < 0)
+        return NULL;
+    return FrozenIter_New(self, start, end, 0, FROZEN_KEYS);
+}
+
+static PyObject* FrozenTreeObj_iter(FrozenTreeObj *self) {
+    return FrozenIter_New(self, 0, self->tree.size, 0, FROZEN_KEYS);
+}
+
+static PyObject* FrozenTreeObj_reversed(FrozenTreeObj *self) {
+    return FrozenIter_New(self, 0, self->tree.size, 1, FROZEN_KEYS);
+}
+
+static PyObject* FrozenTreeObj_stats(FrozenTreeObj *self) {
+    size_t bytes = frozen_bytes(&self->tree) + (self->values? self->tree.size * sizeof(avl_key_t): 0);
+    return Py_BuildValue(
+        "{s:n,s:n,s:n,s:s,s:K}",
+        "size", (Py_ssize_t)self->tree.size,
+        "blocks", (Py_ssize_t)self->tree.nblocks,
+        "bytes", (Py_ssize_t)bytes,
+        "simd", frozen_simd(),
+        "comparisons", (unsigned long long)self->ctx.ncmp
+    );
+}
+
+static Py_ssize_t FrozenTreeObj_len(FrozenTreeObj *self) {
+    return self->tree.size;
+}
+
+static int FrozenTreeObj_contains(FrozenTreeObj *self, PyObject *key) {
+    int found;
+    if (frozentree_bisect(self, key, 0, &found) < 0) {
+        return -1;
+    }
+    return found;
+}
+
+static PySequenceMethods FrozenTreeObj_Seq = {
+    .sq_length = (lenfunc)FrozenTreeObj_len,
+    .sq_contains = (objobjproc)FrozenTreeObj_contains
+};
+
+/* FrozenTreeSet_Type */
+
+static PyMethodDef FrozenTreeSetObj_Methods[] = {
+    {
+        "__reversed__",
+        (PyCFunction)FrozenTreeObj_reversed,
+        METH_NOARGS,
+        "Return an iterator over the FrozenTreeSet in descending order."
+    },
+    {
+        "at_most",
+        (PyCFunction)FrozenTreeObj_at_most,
+        METH_O,
+        "Get the largest key in the FrozenTreeSet that is not bigger than the given key."
+    },
+    {
+        "at_least",
+        (PyCFunction)FrozenTreeObj_at_least,
+        METH_O,
+        "Get the smallest key in the FrozenTreeSet that is not smaller than the given key."
+    },
+    {
+        "bisect_left",
+        (PyCFunction)FrozenTreeObj_bisect_left,
+        METH_O,
+        "Return the number of keys in the FrozenTreeSet less than the given key."
+    },
+    {
+        "bisect_right",
+        (PyCFunction)FrozenTreeObj_bisect_right,
+        METH_O,
+        "Return the number of keys in the FrozenTreeSet not bigger than the given key."
+    },
+    {
+        "count_range",
+        (PyCFunction)FrozenTreeObj_count_range,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Count keys between lo and hi, inclusive by default. None means no bound."
+    },
+    {
+        "index",
+        (PyCFunction)FrozenTreeObj_index,
+        METH_O,
+        "Return the location of the given key. Raises ValueError if it is not present."
+    },
+    {
+        "irange",
+        (PyCFunction)FrozenTreeObj_irange,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate over keys between lo and hi, inclusive by default. None means no bound."
+    },
+    {
+        "loc",
+        (PyCFunction)FrozenTreeObj_loc,
+        METH_O,
+        "Return the key at the given location."
+    },
+    {
+        "max",
+        (PyCFunction)FrozenTreeObj_max,
+        METH_NOARGS,
+        "Get the max of the FrozenTreeSet."
+    },
+    {
+        "min",
+        (PyCFunction)FrozenTreeObj_min,
+        METH_NOARGS,
+        "Get the min of the FrozenTreeSet."
+    },
+    {
+        "rank",
+        (PyCFunction)FrozenTreeObj_bisect_left,
+        METH_O,
+        "Return the number of keys in the FrozenTreeSet less than the given key."
+    },
+    {
+        "stats",
+        (PyCFunction)FrozenTreeObj_stats,
+        METH_NOARGS,
+        "Report the memory usage, vector instructions and key comparisons of the FrozenTreeSet."
+    },
+    {NULL}
+};
+
+static PyObject* FrozenTreeObj_get_dtype(FrozenTreeObj *self, void *closure) {
+    return PyUnicode_FromString(avl_dtype_name(self->ctx.dtype));
+}
+
+static PyObject* FrozenTreeObj_get_value_dtype(FrozenTreeObj *self, void *closure) {
+    return PyUnicode_FromString(avl_dtype_name(self->vtype));
+}
+
+static PyGetSetDef FrozenTreeSetObj_GetSet[] = {
+    {
+        "dtype",
+        (getter)FrozenTreeObj_get_dtype,
+        NULL,
+        "The dtype of keys of the FrozenTreeSet.",
+        NULL
+    },
+    {NULL}
+};
+
+PyTypeObject FrozenTreeSet_Type = {
+    /* The ob_type field must be initialized in the module init function
+     * to be portable to Windows without using C++. */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "pyavl.FrozenTreeSet",      /*tp_name*/
+    sizeof(FrozenTreeObj),      /*tp_basicsize*/
+    0,                          /*tp_itemsize*/
+    /* methods */
+    (destructor)FrozenTreeObj_free,/*tp_dealloc*/
+    0,                          /*tp_vectorcall_offset*/
+    (getattrfunc)0,             /*tp_getattr*/
+    (setattrfunc)0,             /*tp_setattr*/
+    0,                          /*tp_as_async*/
+    0,                          /*tp_repr*/
+    0,                          /*tp_as_number*/
+    &FrozenTreeObj_Seq,         /*tp_as_sequence*/
+    0,                          /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    (getattrofunc)0,            /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    0,                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
+    0,                          /*tp_doc*/
+    0,                          /*tp_traverse*/
+    0,                          /*tp_clear*/
+    0,                          /*tp_richcompare*/
+    0,                          /*tp_weaklistoffset*/
+    (getiterfunc)FrozenTreeObj_iter,/*tp_iter*/
+    0,                          /*tp_iternext*/
+    FrozenTreeSetObj_Methods,   /*tp_methods*/
+    0,                          /*tp_members*/
+    FrozenTreeSetObj_GetSet,    /*tp_getset*/
+    0,                          /*tp_base*/
+    0,                          /*tp_dict*/
+    0,                          /*tp_descr_get*/
+    0,                          /*tp_descr_set*/
+    0,                          /*tp_dictoffset*/
+    0,                          /*tp_init*/
+    0,                          /*tp_alloc*/
+    FrozenTreeSetObj_new,       /*tp_new*/
+    0,                          /*tp_free*/
+    0,                          /*tp_is_gc*/
+};
+
+/* FrozenTreeMap_Type */
+
+static PyObject* FrozenTreeMapObj_get(FrozenTreeObj *self, PyObject *const *args, Py_ssize_t nargs) {
+    if (nargs == 0 || nargs > 2) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "FrozenTreeMap.get takes 1 or 2 positional arguments."
+        );
+        return NULL;
+    }
+    PyObject *ret = nargs == 2? args[1]: Py_None;
+    int found;
+    Py_ssize_t pos = frozentree_bisect(self, args[0], 0, &found);
+    if (pos < 0) {
+        PyErr_Clear();
+    } else if (found) {
+        return frozentree_getval(self, pos);
+    }
+
+    Py_INCREF(ret);
+    return ret;
+}
+
+/**
+ * @brief Iterate over the FrozenTreeMap, in descending order if the keyword `reverse` is true.
+ */
+static PyObject* frozentreemap_iter(FrozenTreeObj *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames, const char *name, frozen_yield_t what) {
+    static const char *const kwlist[] = {"reverse", NULL};
+    PyObject *argv[1];
+    if (pyavl_parse_args(name, args, nargs, kwnames, kwlist, 0, 0, argv) < 0)
+        return NULL;
+    int reverse = argv[0]? PyObject_IsTrue(argv[0]): 0;
+    if (reverse < 0)
+        return NULL;
+    return FrozenIter_New(self, 0, self->tree.size, reverse, what);
+}
+
+static PyObject* FrozenTreeMapObj_keys(
+    FrozenTreeObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    return frozentreemap_iter(self, args, nargs, kwnames, "keys", FROZEN_KEYS);
+}
+
+static PyObject* FrozenTreeMapObj_values(
+    FrozenTreeObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    return frozentreemap_iter(self, args, nargs, kwnames, "values", FROZEN_VALUES);
+}
+
+static PyObject* FrozenTreeMapObj_items(
+    FrozenTreeObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    return frozentreemap_iter(self, args, nargs, kwnames, "items", FROZEN_ITEMS);
+}
+
+static PyMethodDef FrozenTreeMapObj_Methods[] = {
+    {
+        "__reversed__",
+        (PyCFunction)FrozenTreeObj_reversed,
+        METH_NOARGS,
+        "Return an iterator over keys of the FrozenTreeMap in descending order."
+    },
+    {
+        "at_most",
+        (PyCFunction)FrozenTreeObj_at_most,
+        METH_O,
+        "Get the largest key in the FrozenTreeMap that is not bigger than the given key."
+    },
+    {
+        "at_least",
+        (PyCFunction)FrozenTreeObj_at_least,
+        METH_O,
+        "Get the smallest key in the FrozenTreeMap that is not smaller than the given key."
+    },
+    {
+        "bisect_left",
+        (PyCFunction)FrozenTreeObj_bisect_left,
+        METH_O,
+        "Return the number of keys in the FrozenTreeMap less than the given key."
+    },
+    {
+        "bisect_right",
+        (PyCFunction)FrozenTreeObj_bisect_right,
+        METH_O,
+        "Return the number of keys in the FrozenTreeMap not bigger than the given key."
+    },
+    {
+        "count_range",
+        (PyCFunction)FrozenTreeObj_count_range,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Count keys between lo and hi, inclusive by default. None means no bound."
+    },
+    {
+        "get",
+        (PyCFunction)FrozenTreeMapObj_get,
+        METH_FASTCALL,
+        "Return the value for key if key is in the FrozenTreeMap, else default."
+    },
+    {
+        "index",
+        (PyCFunction)FrozenTreeObj_index,
+        METH_O,
+        "Return the location of the given key. Raises ValueError if it is not present."
+    },
+    {
+        "irange",
+        (PyCFunction)FrozenTreeObj_irange,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate over keys between lo and hi, inclusive by default. None means no bound."
+    },
+    {
+        "items",
+        (PyCFunction)FrozenTreeMapObj_items,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate over (key, value) pairs, in descending order if reverse is true."
+    },
+    {
+        "keys",
+        (PyCFunction)FrozenTreeMapObj_keys,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate over keys, in descending order if reverse is true."
+    },
+    {
+        "loc",
+        (PyCFunction)FrozenTreeObj_loc,
+        METH_O,
+        "Return the (key, value) pair at the given location."
+    },
+    {
+        "max",
+        (PyCFunction)FrozenTreeObj_max,
+        METH_NOARGS,
+        "Get the (key, value) pair with the max key."
+    },
+    {
+        "min",
+        (PyCFunction)FrozenTreeObj_min,
+        METH_NOARGS,
+        "Get the (key, value) pair with the min key."
+    },
+    {
+        "rank",
+        (PyCFunction)FrozenTreeObj_bisect_left,
+        METH_O,
+        "Return the number of keys in the FrozenTreeMap less than the given key."
+    },
+    {
+        "stats",
+        (PyCFunction)FrozenTreeObj_stats,
+        METH_NOARGS,
+        "Report the memory usage, vector instructions and key comparisons of the FrozenTreeMap."
+    },
+    {
+        "values",
+        (PyCFunction)FrozenTreeMapObj_values,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate over values, in descending order of keys if reverse is true."
+    },
+    {NULL}
+};
+
+static PyGetSetDef FrozenTreeMapObj_GetSet[] = {
+    {
+        "key_dtype",
+        (getter)FrozenTreeObj_get_dtype,
+        NULL,
+        "The dtype of keys of the FrozenTreeMap.",
+        NULL
+    },
+    {
+        "value_dtype",
+        (getter)FrozenTreeObj_get_value_dtype,
+        NULL,
+        "The dtype of values of the FrozenTreeMap.",
+        NULL
+    },
+    {NULL}
+};
+
+static PyObject* FrozenTreeMapObj_subscript(FrozenTreeObj *self, PyObject *key) {
+    int found;
+    Py_ssize_t pos = frozentree_bisect(self, key, 0, &found);
+    if (pos < 0) {
+        return NULL;
+    } else if (!found) {
+        _PyErr_SetKeyError(key);
+        return NULL;
+    }
+    return frozentree_getval(self, pos);
+}
+
+static PyMappingMethods FrozenTreeMapObj_Mapping = {
+    .mp_length = (lenfunc)FrozenTreeObj_len,
+    .mp_subscript = (binaryfunc)FrozenTreeMapObj_subscript
+};
+
+PyTypeObject FrozenTreeMap_Type = {
+    /* The ob_type field must be initialized in the module init function
+     * to be portable to Windows without using C++. */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "pyavl.FrozenTreeMap",      /*tp_name*/
+    sizeof(FrozenTreeObj),      /*tp_basicsize*/
+    0,                          /*tp_itemsize*/
+    /* methods */
+    (destructor)FrozenTreeObj_free,/*tp_dealloc*/
+    0,                          /*tp_vectorcall_offset*/
+    (getattrfunc)0,             /*tp_getattr*/
+    (setattrfunc)0,             /*tp_setattr*/
+    0,                          /*tp_as_async*/
+    0,                          /*tp_repr*/
+    0,                          /*tp_as_number*/
+    &FrozenTreeObj_Seq,         /*tp_as_sequence*/
+    &FrozenTreeMapObj_Mapping,  /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    (getattrofunc)0,            /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    0,                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
+    0,                          /*tp_doc*/
+    0,                          /*tp_traverse*/
+    0,                          /*tp_clear*/
+    0,                          /*tp_richcompare*/
+    0,                          /*tp_weaklistoffset*/
+    (getiterfunc)FrozenTreeObj_iter,/*tp_iter*/
+    0,                          /*tp_iternext*/
+    FrozenTreeMapObj_Methods,   /*tp_methods*/
+    0,                          /*tp_members*/
+    FrozenTreeMapObj_GetSet,    /*tp_getset*/
+    0,                          /*tp_base*/
+    0,                          /*tp_dict*/
+    0,                          /*tp_descr_get*/
+    0,                          /*tp_descr_set*/
+    0,                          /*tp_dictoffset*/
+    0,                          /*tp_init*/
+    0,                          /*tp_alloc*/
+    FrozenTreeMapObj_new,       /*tp_new*/
+    0,                          /*tp_free*/
+    0,                          /*tp_is_gc*/
+};
+
+/* FrozenIter_Type */
+
+typedef struct {
+    PyObject_HEAD
+    FrozenTreeObj *owner;
+    Py_ssize_t pos;
+    Py_ssize_t stop;            /* the position after the last one to yield */
+    Py_ssize_t step;
+    frozen_yield_t what;
+} FrozenIterObj;
+
+static PyObject* FrozenIterObj_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    FrozenIterObj *self;
+    self = (FrozenIterObj *)type->tp_alloc(type, 0);
+    if (!self) {
+        return NULL;
+    }
+    self->owner = NULL;
+    self->pos = 0;
+    self->stop = 0;
+    self->step = 1;
+    self->what = FROZEN_KEYS;
+
+    return (PyObject *)self;
+}
+
+static void FrozenIterObj_free(FrozenIterObj *self) {
+    Py_XDECREF(self->owner);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/**
+ * @brief Create an iterator over positions from start to end of a frozen tree,
+ * which keeps the owner alive.
+ */
+static PyObject*
+FrozenIter_New(FrozenTreeObj *owner, Py_ssize_t start, Py_ssize_t end, int reverse, frozen_yield_t what) {
+    FrozenIterObj *self = (FrozenIterObj *)FrozenIterObj_new(&FrozenIter_Type, NULL, NULL);
+    if (!self) {
+        return NULL;
+    }
+    Py_INCREF(owner);
+    self->owner = owner;
+    self->pos = reverse? end - 1: start;
+    self->stop = reverse? start - 1: end;
+    self->step = reverse? -1: 1;
+    self->what = what;
+    return (PyObject *)self;
+}
+
+static PyObject* FrozenIter_next(FrozenIterObj *self) {
+    if (self->pos == self->stop) {
+        return NULL;
+    }
+    Py_ssize_t pos = self->pos;
+    self->pos += self->step;
+    switch (self->what) {
+    case FROZEN_VALUES:
+        return frozentree_getval(self->owner, pos);
+    case FROZEN_ITEMS:
+        return frozentree_getitem(self->owner, pos);
+    default:
+        return frozentree_getkey(self->owner, pos);
+    }
+}
+
+PyTypeObject FrozenIter_Type = {
+    /* The ob_type field must be initialized in the module init function
+     * to be portable to Windows without using C++. */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "pyavl._FrozenIter",        /*tp_name*/
+    sizeof(FrozenIterObj),      /*tp_basicsize*/
+    0,                          /*tp_itemsize*/
+    /* methods */
+    (destructor)FrozenIterObj_free,/*tp_dealloc*/
+    0,                          /*tp_vectorcall_offset*/
+    (getattrfunc)0,             /*tp_getattr*/
+    (setattrfunc)0,             /*tp_setattr*/
+    0,                          /*tp_as_async*/
+    0,                          /*tp_repr*/
+    0,                          /*tp_as_number*/
+    0,                          /*tp_as_sequence*/
+    0,                          /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    (getattrofunc)0,            /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    0,                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
+    0,                          /*tp_doc*/
+    0,                          /*tp_traverse*/
+    0,                          /*tp_clear*/
+    0,                          /*tp_richcompare*/
+    0,                          /*tp_weaklistoffset*/
+    PyObject_SelfIter,          /*tp_iter*/
+    (iternextfunc)FrozenIter_next,/*tp_iternext*/
+    0,                          /*tp_methods*/
+    0,                          /*tp_members*/
+    0,                          /*tp_getset*/
+    0,                          /*tp_base*/
+    0,                          /*tp_dict*/
+    0,                          /*tp_descr_get*/
+    0,                          /*tp_descr_set*/
+    0,                          /*tp_dictoffset*/
+    0,                          /*tp_init*/
+    0,                          /*tp_alloc*/
+    FrozenIterObj_new,          /*tp_new*/
+    0,                          /*tp_free*/
+    0,                          /*tp_is_gc*/
+};
\ No newline at end of file
@@ -15,6 +15,472 @@ static PyObject* pyavl_version(PyObject *self) {
     return Py_BuildValue("s", buff);
 }
 
+int pyavl_hugepages = 0;
+
+static PyObject* pyavl_set_hugepages(PyObject *self, PyObject *arg) {
+    int flag = PyObject_IsTrue(arg);
+    if (flag < 0) {
+        return NULL;
+    }
+    pyavl_hugepages = flag;
+    Py_RETURN_NONE;
+}
+
+extern PyObject* pyavl_tree_stats(avl_pool_t *pool, avl_ctx_t *ctx) {
+    size_t free_nodes = pool->capacity - pool->used;
+    return Py_BuildValue(
+        "{s:n,s:n,s:n,s:n,s:n,s:n,s:d,s:K}",
+        "node_size", (Py_ssize_t)pool->node_size,
+        "chunks", (Py_ssize_t)pool->nchunks,
+        "bytes", (Py_ssize_t)pool->bytes,
+        "capacity", (Py_ssize_t)pool->capacity,
+        "used", (Py_ssize_t)pool->used,
+        "free", (Py_ssize_t)free_nodes,
+        "fragmentation", pool->capacity? (double)free_nodes / pool->capacity: 0.0,
+        "comparisons", (unsigned long long)ctx->ncmp
+    );
+}
+
+extern PyObject* pyavl_btree_stats(btree_t *tree, avl_ctx_t *ctx) {
+    size_t bytes = tree->leaves.bytes + tree->inners.bytes;
+    return Py_BuildValue(
+        "{s:n,s:n,s:n,s:n,s:i,s:n,s:d,s:K}",
+        "leaf_size", (Py_ssize_t)tree->leaves.node_size,
+        "inner_size", (Py_ssize_t)tree->inners.node_size,
+        "leaves", (Py_ssize_t)tree->leaves.used,
+        "inners", (Py_ssize_t)tree->inners.used,
+        "height", tree->height,
+        "bytes", (Py_ssize_t)bytes,
+        "fill", tree->leaves.used?
+            (double)tree->size / (tree->leaves.used * BTREE_LEAF_KEYS): 0.0,
+        "comparisons", (unsigned long long)ctx->ncmp
+    );
+}
+
+extern int pyavl_parse_backend(PyObject *kwargs) {
+    PyObject *name = kwargs? PyDict_GetItemString(kwargs, "backend"): NULL;
+    if (!name || name == Py_None) {
+        return 0;
+    } else if (PyUnicode_Check(name) && PyUnicode_CompareWithASCIIString(name, "avl") == 0) {
+        return 0;
+    } else if (PyUnicode_Check(name) && PyUnicode_CompareWithASCIIString(name, "btree") == 0) {
+        return 1;
+    }
+    PyErr_Format(PyExc_ValueError, "backend must be \"avl\" or \"btree\", not %R", name);
+    return -1;
+}
+
+extern Py_ssize_t pyavl_tree_size(PyAVLTreeObj *tree) {
+    return tree->btree? (Py_ssize_t)tree->btree->size: tree->size;
+}
+
+extern PyObject* pyavl_tree_richcompare(PyObject *a, PyObject *b, int op, PyTypeObject *type,
+    const char *items) {
+    if ((op != Py_EQ && op != Py_NE) || !PyObject_TypeCheck(b, type)) {
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+    int equal = a == b;
+    if (!equal && pyavl_tree_size((PyAVLTreeObj *)a) != pyavl_tree_size((PyAVLTreeObj *)b)) {
+        return PyBool_FromLong(op == Py_NE);
+    }
+    PyObject *ita = NULL, *itb = NULL, *x = NULL, *y = NULL;
+    if (!equal) {
+        ita = items? PyObject_CallMethod(a, items, NULL): PyObject_GetIter(a);
+        itb = items? PyObject_CallMethod(b, items, NULL): PyObject_GetIter(b);
+        Py_XSETREF(ita, ita? PyObject_GetIter(ita): NULL);
+        Py_XSETREF(itb, itb? PyObject_GetIter(itb): NULL);
+        if (!ita || !itb) {
+            goto error;
+        }
+        equal = 1;
+    }
+    /* items compared may run code changing the trees, which stops the iterators */
+    while (equal && ita) {
+        x = PyIter_Next(ita);
+        y = x? PyIter_Next(itb): NULL;
+        if (!x || !y) {
+            equal = !x && !y;
+            break;
+        }
+        equal = PyObject_RichCompareBool(x, y, Py_EQ);
+        Py_CLEAR(x);
+        Py_CLEAR(y);
+        if (equal < 0) {
+            goto error;
+        }
+    }
+    Py_XDECREF(x);
+    Py_XDECREF(ita);
+    Py_XDECREF(itb);
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    return PyBool_FromLong(equal == (op == Py_EQ));
+error:
+    Py_XDECREF(ita);
+    Py_XDECREF(itb);
+    return NULL;
+}
+
+typedef struct {
+    void (*func)(avl_key_t, void *);
+    void *arg;
+    size_t offset;
+} column_foreach_t;
+
+static void _column_node(avl_node_t *node, void *extra) {
+    column_foreach_t *st = (column_foreach_t *)extra;
+    st->func(*(avl_key_t *)((char *)node + st->offset), st->arg);
+}
+
+extern void
+pyavl_column_foreach(const pyavl_column_t *col, void (*func)(avl_key_t, void *), void *arg) {
+    if (col->btree) {
+        for (btree_leaf_t *leaf = col->btree->first; leaf; leaf = leaf->next) {
+            avl_key_t *items = BTREE_LEAF_COLUMN(leaf, col->offset);
+            for (uint32_t i = 0; i < leaf->head.n; i++) {
+                func(items[i], arg);
+            }
+        }
+        return;
+    }
+    column_foreach_t st = {func, arg, col->offset};
+    avl_node_foreach(col->root, _column_node, &st);
+}
+
+extern int
+pyavl_parse_args(const char *name, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames,
+    const char *const *kwlist, int required, int maxpos, PyObject **out) {
+    int n = 0;
+    while (kwlist[n]) {
+        n ++;
+    }
+    if (nargs > maxpos && maxpos == 0) {
+        PyErr_Format(PyExc_TypeError, "%s() takes no positional arguments", name);
+        return -1;
+    } else if (nargs > maxpos) {
+        PyErr_Format(
+            PyExc_TypeError, "%s() takes at most %d positional argument%s (%zd given)",
+            name, maxpos, maxpos == 1? "": "s", nargs
+        );
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        out[i] = i < nargs? args[i]: NULL;
+    }
+    Py_ssize_t nkw = kwnames? PyTuple_GET_SIZE(kwnames): 0;
+    for (Py_ssize_t k = 0; k < nkw; k++) {
+        PyObject *kw = PyTuple_GET_ITEM(kwnames, k);
+        int i = 0;
+        while (i < n && PyUnicode_CompareWithASCIIString(kw, kwlist[i]) != 0) {
+            i ++;
+        }
+        if (i == n) {
+            PyErr_Format(
+                PyExc_TypeError, "'%U' is an invalid keyword argument for %s()", kw, name);
+            return -1;
+        } else if (out[i]) {
+            PyErr_Format(
+                PyExc_TypeError, "argument for %s() given by name ('%s') and position (%d)",
+                name, kwlist[i], i + 1
+            );
+            return -1;
+        }
+        out[i] = args[nargs + k];
+    }
+    for (int i = 0; i < required; i++) {
+        if (!out[i]) {
+            PyErr_Format(
+                PyExc_TypeError, "%s() missing required argument '%s' (pos %d)",
+                name, kwlist[i], i + 1
+            );
+            return -1;
+        }
+    }
+    return 0;
+}
+
+extern int pyavl_parse_inclusive(PyObject *obj, int *lo_inclusive, int *hi_inclusive) {
+    static const char *msg = "inclusive must be a pair of truth values";
+    PyObject *fast = PySequence_Fast(obj, msg);
+    if (!fast) {
+        return -1;
+    }
+    int ret = -1;
+    if (PySequence_Fast_GET_SIZE(fast) != 2) {
+        PyErr_SetString(PyExc_TypeError, msg);
+    } else {
+        int lo = PyObject_IsTrue(PySequence_Fast_GET_ITEM(fast, 0));
+        int hi = lo < 0? -1: PyObject_IsTrue(PySequence_Fast_GET_ITEM(fast, 1));
+        if (hi >= 0) {
+            *lo_inclusive = lo;
+            *hi_inclusive = hi;
+            ret = 0;
+        }
+    }
+    Py_DECREF(fast);
+    return ret;
+}
+
+extern int
+pyavl_parse_range(const char *name, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames,
+    PyObject **lo, PyObject **hi, int *lo_inclusive, int *hi_inclusive) {
+    static const char *const kwlist[] = {"lo", "hi", "inclusive", NULL};
+    PyObject *argv[3];
+    if (pyavl_parse_args(name, args, nargs, kwnames, kwlist, 0, 3, argv) < 0) {
+        return -1;
+    }
+    *lo = argv[0]? argv[0]: Py_None;
+    *hi = argv[1]? argv[1]: Py_None;
+    *lo_inclusive = *hi_inclusive = 1;
+    return argv[2]? pyavl_parse_inclusive(argv[2], lo_inclusive, hi_inclusive): 0;
+}
+
+#if PY_VERSION_HEX >= 0x03090000
+extern PyObject*
+pyavl_vectorcall_new(PyObject *type, PyObject *const *args, size_t nargsf, PyObject *kwnames) {
+    PyTypeObject *tp = (PyTypeObject *)type;
+    Py_ssize_t nargs = PyVectorcall_NARGS(nargsf);
+    Py_ssize_t nkw = kwnames? PyTuple_GET_SIZE(kwnames): 0;
+    PyObject *tuple = PyTuple_New(nargs);
+    PyObject *kwargs = nkw? PyDict_New(): NULL;
+    PyObject *self = NULL;
+    if (!tuple || (nkw && !kwargs)) {
+        goto done;
+    }
+    for (Py_ssize_t i = 0; i < nargs; i++) {
+        Py_INCREF(args[i]);
+        PyTuple_SET_ITEM(tuple, i, args[i]);
+    }
+    for (Py_ssize_t k = 0; k < nkw; k++) {
+        if (PyDict_SetItem(kwargs, PyTuple_GET_ITEM(kwnames, k), args[nargs + k]) < 0) {
+            goto done;
+        }
+    }
+    self = tp->tp_new(tp, tuple, kwargs);
+    /* like type_call, skip __init__ if __new__ returns an object of another type */
+    if (self && PyObject_TypeCheck(self, tp) &&
+        Py_TYPE(self)->tp_init(self, tuple, kwargs) < 0) {
+        Py_CLEAR(self);
+    }
+done:
+    Py_XDECREF(tuple);
+    Py_XDECREF(kwargs);
+    return self;
+}
+#endif
+
+extern PyObject* pyavl_derive_key(PyAVLTreeObj *tree, PyObject *obj) {
+    if (!tree->keyfunc) {
+        Py_INCREF(obj);
+        return obj;
+    }
+    return PyObject_CallFunctionObjArgs(tree->keyfunc, obj, NULL);
+}
+
+extern int pyavl_set_keyfunc(PyAVLTreeObj *tree, PyObject *func) {
+    if (func == Py_None) {
+        func = NULL;
+    } else if (!PyCallable_Check(func)) {
+        PyErr_Format(PyExc_TypeError, "key must be callable or None, not %.200s",
+            Py_TYPE(func)->tp_name);
+        return -1;
+    }
+    if (func == tree->keyfunc) {
+        return 0;
+    } else if (pyavl_tree_size(tree)) {
+        const char *name = strrchr(Py_TYPE(tree)->tp_name, '.');
+        PyErr_Format(PyExc_ValueError, "Cannot change key of a non-empty %s.",
+            name? name + 1: Py_TYPE(tree)->tp_name);
+        return -1;
+    }
+    Py_XINCREF(func);
+    Py_XSETREF(tree->keyfunc, func);
+    return 0;
+}
+
+extern int pyavl_sort_pairs(PyObject *pairs) {
+    static PyObject *itemgetter = NULL;
+    if (!itemgetter) {
+        PyObject *operator = PyImport_ImportModule("operator");
+        if (!operator) {
+            return -1;
+        }
+        itemgetter = PyObject_CallMethod(operator, "itemgetter", "i", 0);
+        Py_DECREF(operator);
+        if (!itemgetter) {
+            return -1;
+        }
+    }
+    PyObject *args = PyTuple_New(0);
+    PyObject *kwargs = Py_BuildValue("{s:O}", "key", itemgetter);
+    PyObject *sort = PyObject_GetAttrString(pairs, "sort");
+    PyObject *ret = NULL;
+    if (args && kwargs && sort) {
+        ret = PyObject_Call(sort, args, kwargs);
+    }
+    Py_XDECREF(args);
+    Py_XDECREF(kwargs);
+    Py_XDECREF(sort);
+    if (!ret) {
+        return -1;
+    }
+    Py_DECREF(ret);
+    return 0;
+}
+
+/**
+ * @brief Look up sorted keys of pyavl_lookup_many in a B+ tree, searching the leaf
+ * of the previous key first.
+ *
+ * @return Return 0 on success, -1 on errors.
+ */
+static int
+btree_lookup_many(PyObject *owner, PyObject *seq, int sorted, pyavl_lookup_t how,
+    btree_iter_getter getter, PyObject *missing, PyObject *ret) {
+    PyAVLTreeObj *tree = (PyAVLTreeObj *)owner;
+    btree_t *btree = tree->btree;
+    btree_pos_t pos = {NULL, 0};
+    uint64_t version = tree->ctx.version;
+    for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(seq); i++) {
+        if (!sorted || version != tree->ctx.version) {
+            /* restart at the root, also if the tree was changed by a comparison */
+            pos.leaf = NULL;
+            version = tree->ctx.version;
+        }
+        int found = btree_seek(btree, &tree->ctx, PyTuple_GET_ITEM(seq, i), &pos);
+        if (found < 0) {
+            return -1;
+        }
+        btree_pos_t at = pos;
+        if (how == PYAVL_LOOKUP_AT_MOST && !found) {
+            if (at.leaf) {
+                btree_pos_prev(&at);
+            } else if (btree->last) {
+                at.leaf = btree->last;
+                at.idx = btree->last->head.n - 1;
+            }
+        } else if (how == PYAVL_LOOKUP_FIND && !found) {
+            at.leaf = NULL;
+        }
+        PyObject *item;
+        if (!getter) {
+            item = PyBool_FromLong(at.leaf != NULL);
+        } else if (at.leaf) {
+            item = getter(at, owner);
+        } else {
+            Py_INCREF(missing);
+            item = missing;
+        }
+        if (!item) {
+            return -1;
+        }
+        PyList_SET_ITEM(ret, i, item);
+    }
+    return 0;
+}
+
+extern PyObject*
+pyavl_lookup_many(PyObject *owner, PyObject *keys, pyavl_lookup_t how,
+    avl_iter_getter getter, btree_iter_getter bgetter, PyObject *missing) {
+    PyAVLTreeObj *tree = (PyAVLTreeObj *)owner;
+    /* a tuple cannot shrink under comparisons calling back into Python */
+    PyObject *seq = PySequence_Tuple(keys);
+    if (!seq) {
+        return NULL;
+    }
+    Py_ssize_t n = PyTuple_GET_SIZE(seq);
+    if (tree->keyfunc) {
+        /* look up derived keys, into a new tuple, as the keys may be a tuple shared with the caller */
+        PyObject *derived = PyTuple_New(n);
+        for (Py_ssize_t i = 0; derived && i < n; i++) {
+            PyObject *key = pyavl_derive_key(tree, PyTuple_GET_ITEM(seq, i));
+            if (!key) {
+                Py_CLEAR(derived);
+                break;
+            }
+            PyTuple_SET_ITEM(derived, i, key);
+        }
+        Py_SETREF(seq, derived);
+        if (!seq) {
+            return NULL;
+        }
+    }
+    PyObject *ret = PyList_New(n);
+    if (!ret) {
+        Py_DECREF(seq);
+        return NULL;
+    }
+
+    /* Only sorted keys, in either order, are worth walking from the previous one. */
+    int sorted = 1, order = 0;
+    for (Py_ssize_t i = 1; i < n && sorted; i++) {
+        int cmp = avl_object_cmp(
+            &tree->ctx, PyTuple_GET_ITEM(seq, i - 1), PyTuple_GET_ITEM(seq, i));
+        if (cmp == -2) {
+            if (!PyErr_ExceptionMatches(PyExc_TypeError)) {
+                goto error;
+            }
+            PyErr_Clear();
+            sorted = 0;
+        } else if (cmp && order && cmp != order) {
+            sorted = 0;
+        } else if (cmp) {
+            order = cmp;
+        }
+    }
+
+    if (tree->btree) {
+        if (btree_lookup_many(owner, seq, sorted, how, bgetter, missing, ret) < 0) {
+            goto error;
+        }
+        Py_DECREF(seq);
+        return ret;
+    }
+
+    avl_finger_t finger;
+    avl_finger_init(&finger, tree->root);
+    Py_ssize_t size = tree->size;
+    for (Py_ssize_t i = 0; i < n; i++) {
+        if (!sorted || finger.root != tree->root || size != tree->size) {
+            /* restart at the root, also if the tree was changed by a comparison */
+            avl_finger_init(&finger, tree->root);
+            size = tree->size;
+        }
+        int found = avl_finger_seek(&finger, &tree->ctx, PyTuple_GET_ITEM(seq, i));
+        if (found < 0) {
+            goto error;
+        }
+        avl_node_t *node;
+        if (how == PYAVL_LOOKUP_AT_MOST) {
+            node = avl_finger_at_most(&finger);
+        } else if (how == PYAVL_LOOKUP_AT_LEAST) {
+            node = avl_finger_at_least(&finger);
+        } else {
+            node = found? avl_finger_at_most(&finger): NULL;
+        }
+        PyObject *item;
+        if (!getter) {
+            item = PyBool_FromLong(node != NULL);
+        } else if (node) {
+            item = getter(node, owner);
+        } else {
+            Py_INCREF(missing);
+            item = missing;
+        }
+        if (!item) {
+            goto error;
+        }
+        PyList_SET_ITEM(ret, i, item);
+    }
+    Py_DECREF(seq);
+    return ret;
+error:
+    Py_DECREF(seq);
+    Py_DECREF(ret);
+    return NULL;
+}
+
 static PyMethodDef pyavl_methods[] = {
     {
         "version",
@@ -22,6 +488,12 @@ static PyMethodDef pyavl_methods[] = {
         METH_NOARGS,
         "Return the version of PyAVL"
     },
+    {
+        "set_hugepages",
+        (PyCFunction)pyavl_set_hugepages,
+        METH_O,
+        "Back node pools of trees created afterwards by huge pages (Linux only)."
+    },
     {NULL}
 };
 
@@ -39,12 +511,42 @@ PyMODINIT_FUNC PyInit_pyavl() {
     if (PyType_Ready(&TreeIter_Type) < 0) {
         return NULL;
     }
+    if (PyType_Ready(&TreeRange_Type) < 0) {
+        return NULL;
+    }
     if (PyType_Ready(&TreeSet_Type) < 0) {
         return NULL;
     }
     if (PyType_Ready(&TreeMap_Type) < 0) {
         return NULL;
     }
+    if (PyType_Ready(&BTreeIter_Type) < 0) {
+        return NULL;
+    }
+    if (PyType_Ready(&BTreeSet_Type) < 0) {
+        return NULL;
+    }
+    if (PyType_Ready(&BTreeMap_Type) < 0) {
+        return NULL;
+    }
+    if (PyType_Ready(&KeyBuffer_Type) < 0) {
+        return NULL;
+    }
+    if (PyType_Ready(&FrozenIter_Type) < 0) {
+        return NULL;
+    }
+    if (PyType_Ready(&FrozenTreeSet_Type) < 0) {
+        return NULL;
+    }
+    if (PyType_Ready(&FrozenTreeMap_Type) < 0) {
+        return NULL;
+    }
+    if (PyType_Ready(&TreeMapSnapshot_Type) < 0) {
+        return NULL;
+    }
+    if (PyType_Ready(&TreeCursor_Type) < 0) {
+        return NULL;
+    }
 
     m = PyModule_Create(&pyavl_module);
     if (m == NULL) {
@@ -52,8 +554,18 @@ PyMODINIT_FUNC PyInit_pyavl() {
     }
 
     Py_INCREF(&TreeIter_Type);
+    Py_INCREF(&TreeRange_Type);
     Py_INCREF(&TreeSet_Type);
     Py_INCREF(&TreeMap_Type);
+    Py_INCREF(&BTreeIter_Type);
+    Py_INCREF(&BTreeSet_Type);
+    Py_INCREF(&BTreeMap_Type);
+    Py_INCREF(&KeyBuffer_Type);
+    Py_INCREF(&FrozenIter_Type);
+    Py_INCREF(&FrozenTreeSet_Type);
+    Py_INCREF(&FrozenTreeMap_Type);
+    Py_INCREF(&TreeMapSnapshot_Type);
+    Py_INCREF(&TreeCursor_Type);
     if (PyModule_AddObject(m, "TreeSet", (PyObject *)(&TreeSet_Type)) < 0) {
         goto error;
     }
@@ -61,11 +573,45 @@ PyMODINIT_FUNC PyInit_pyavl() {
     if (PyModule_AddObject(m, "TreeMap", (PyObject *)(&TreeMap_Type)) < 0) {
         goto error;
     }
+
+    if (PyModule_AddObject(m, "BTreeSet", (PyObject *)(&BTreeSet_Type)) < 0) {
+        goto error;
+    }
+
+    if (PyModule_AddObject(m, "BTreeMap", (PyObject *)(&BTreeMap_Type)) < 0) {
+        goto error;
+    }
+
+    if (PyModule_AddObject(m, "FrozenTreeSet", (PyObject *)(&FrozenTreeSet_Type)) < 0) {
+        goto error;
+    }
+
+    if (PyModule_AddObject(m, "FrozenTreeMap", (PyObject *)(&FrozenTreeMap_Type)) < 0) {
+        goto error;
+    }
+
+    if (PyModule_AddObject(m, "TreeMapSnapshot", (PyObject *)(&TreeMapSnapshot_Type)) < 0) {
+        goto error;
+    }
+
+    if (PyModule_AddObject(m, "TreeCursor", (PyObject *)(&TreeCursor_Type)) < 0) {
+        goto error;
+    }
     return m;
 error:
     Py_DECREF(&TreeIter_Type);
+    Py_DECREF(&TreeRange_Type);
     Py_DECREF(&TreeSet_Type);
     Py_DECREF(&TreeMap_Type);
+    Py_DECREF(&BTreeIter_Type);
+    Py_DECREF(&BTreeSet_Type);
+    Py_DECREF(&BTreeMap_Type);
+    Py_DECREF(&KeyBuffer_Type);
+    Py_DECREF(&FrozenIter_Type);
+    Py_DECREF(&FrozenTreeSet_Type);
+    Py_DECREF(&FrozenTreeMap_Type);
+    Py_DECREF(&TreeMapSnapshot_Type);
+    Py_DECREF(&TreeCursor_Type);
     Py_DECREF(m);
     return NULL;
 }
\ No newline at end of file
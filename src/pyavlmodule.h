@@ -1,28 +1,508 @@
 #ifndef PY_AVL_MODULE_H
 #define PY_AVL_MODULE_H
 
+#include "btree.h"
+
 #define PYAVL_VERSION_MAJOR 1
 #define PYAVL_VERSION_MINOR 1
 #define PYAVL_VERSION_MICRO 0
 
+/* methods take METH_FASTCALL | METH_KEYWORDS, which Python 3.7 made public */
+#if PY_VERSION_HEX < 0x03070000
+#error "PyAVL requires Python 3.7 or newer."
+#endif
+
+/**
+ * @brief Whether new trees back their node pools by huge pages.
+ * 
+ */
+extern int pyavl_hugepages;
+
+/**
+ * @brief Report the usage of the node pool and the key comparisons of a tree as a dict.
+ * 
+ */
+extern PyObject* pyavl_tree_stats(avl_pool_t *pool, avl_ctx_t *ctx);
+
+/**
+ * @brief Report the usage of the nodes, the fill of leaves and the key comparisons
+ * of a B+ tree as a dict.
+ *
+ */
+extern PyObject* pyavl_btree_stats(btree_t *tree, avl_ctx_t *ctx);
+
+/**
+ * @brief Get the backend asked for by the keyword arguments of TreeSet or TreeMap.
+ *
+ * @return Return 1 for "btree", 0 for "avl" or none and -1 with ValueError set otherwise.
+ */
+extern int pyavl_parse_backend(PyObject *kwargs);
+
+/**
+ * @brief The initial segment of TreeSet and TreeMap objects, read by views over them.
+ * 
+ */
+typedef struct {
+    PyObject_HEAD
+    avl_node_t *root;
+    Py_ssize_t size;
+    avl_ctx_t ctx;
+    PyObject *keyfunc;      /* NULL unless keys are derived by a key function */
+    btree_t *btree;         /* the B+ tree holding the keys instead of root, NULL for AVL trees */
+} PyAVLTreeObj;
+
+/**
+ * @brief The number of keys of a TreeSet or a TreeMap on either engine.
+ * 
+ */
+extern Py_ssize_t pyavl_tree_size(PyAVLTreeObj *tree);
+
+/**
+ * @brief Compare two trees for equality, as the same items in the same order.
+ * Only == and != between objects of the type are supported.
+ * 
+ * @param items The name of the method iterating over items, NULL to iterate the trees.
+ */
+extern PyObject* pyavl_tree_richcompare(PyObject *a, PyObject *b, int op, PyTypeObject *type,
+    const char *items);
+
+/**
+ * @brief The object a key was derived from by the key function of a tree, kept
+ * in the last pointer of a node of `node_size` bytes.
+ * 
+ */
+#define PYAVL_NODE_ITEM(node, node_size) \
+    (*(PyObject **)((char *)(node) + (node_size) - sizeof(PyObject *)))
+
+/**
+ * @brief Derive the key of an object by the key function of a TreeSet or a TreeMap.
+ * 
+ * @param tree The tree, starting like PyAVLTreeObj.
+ * @param obj The object.
+ * @return Return a new reference, to obj itself if the tree has no key function; NULL on errors.
+ */
+extern PyObject* pyavl_derive_key(PyAVLTreeObj *tree, PyObject *obj);
+
+/**
+ * @brief Parse the key function given to a TreeSet or a TreeMap, None for no key function.
+ * A non-empty tree only accepts its current key function.
+ * 
+ * @return Return 0 on success, -1 with TypeError or ValueError set on failure.
+ */
+extern int pyavl_set_keyfunc(PyAVLTreeObj *tree, PyObject *func);
+
+/**
+ * @brief Stably sort a list of tuples by their first items.
+ * 
+ */
+extern int pyavl_sort_pairs(PyObject *pairs);
+
 extern PyTypeObject TreeSet_Type;
 #define TreeSetObj_Check(obj)    (Py_TYPE(obj) == &TreeSet_Type)
 
+/**
+ * @brief Create a TreeSet with the keys of a TreeSet or a TreeMap, copied with the
+ * same shape in O(n) without comparisons, see avl_node_copy_shape.
+ * 
+ * @param root The root of the tree.
+ * @param size The number of nodes in the tree.
+ * @param ctx The context of the tree, for the dtype and the kind of keys.
+ * @param keyfunc The key function of the tree, NULL if none.
+ * @param keyed_size The node size of the tree if it has a key function, see PYAVL_NODE_ITEM.
+ * @return Return a new reference, NULL on errors.
+ */
+extern PyObject* TreeSet_FromTree(avl_node_t *root, Py_ssize_t size, avl_ctx_t *ctx,
+    PyObject *keyfunc, size_t keyed_size);
+
 extern PyTypeObject TreeMap_Type;
 #define TreeMapObj_Check(obj)    (Py_TYPE(obj) == &TreeMap_Type)
 
+/**
+ * @brief Create a TreeMap from columns of sorted distinct keys and their values,
+ * linking nodes bottom-up without comparisons.
+ *
+ * @param ktype The dtype of keys.
+ * @param vtype The dtype of values.
+ * @param keyfunc The key function, NULL if none.
+ * @param columns The keys, the values, then the objects keys are derived from if keyfunc.
+ * The TreeMap takes over the keys and the values on success, and holds its own
+ * references to the objects.
+ * @param n The number of keys.
+ * @return Return a new reference, NULL on errors.
+ */
+extern PyObject* TreeMap_FromColumns(avl_dtype_t ktype, avl_dtype_t vtype, PyObject *keyfunc,
+    avl_key_t *const *columns, Py_ssize_t n);
+
+/**
+ * @brief Iterate over the (key, value) pairs of a dict, a mapping with keys() and
+ * items(), or an iterable of pairs, for updates of TreeMap and BTreeMap.
+ *
+ */
+extern PyObject* pyavl_map_pairs(PyObject *mapping);
+
+/**
+ * @brief Get the next pair of an iterator of pyavl_map_pairs, as dict.update checks it.
+ *
+ * @param idx The position of the pair, for error messages.
+ * @return Return 1 with new references in key and val, 0 at the end and -1 on errors.
+ */
+extern int pyavl_map_next_pair(PyObject *iter, Py_ssize_t idx, PyObject **key, PyObject **val);
+
+/* TreeMapSnapshot_Type, read-only views sharing nodes with a TreeMap, see avl_share_t */
+
+extern PyTypeObject TreeMapSnapshot_Type;
+#define TreeMapSnapshotObj_Check(obj)    (Py_TYPE(obj) == &TreeMapSnapshot_Type)
+
+/* BTreeSet_Type, a TreeSet with the B+ tree of btree.h as its engine */
+
+extern PyTypeObject BTreeSet_Type;
+#define BTreeSetObj_Check(obj)    (Py_TYPE(obj) == &BTreeSet_Type)
+
+/**
+ * @brief Create a BTreeSet with the keys of a BTreeSet or a BTreeMap, packed into
+ * full leaves in O(n) without comparisons.
+ *
+ * @param src The B+ tree, whose last column holds the objects keys are derived from
+ * if there is a key function.
+ * @param ctx The context of the tree, for the dtype and the kind of keys.
+ * @param keyfunc The key function of the tree, NULL if none.
+ * @return Return a new reference, NULL on errors.
+ */
+extern PyObject* BTreeSet_FromTree(btree_t *src, avl_ctx_t *ctx, PyObject *keyfunc);
+
+/* BTreeMap_Type, a TreeMap with the B+ tree of btree.h as its engine */
+
+extern PyTypeObject BTreeMap_Type;
+#define BTreeMapObj_Check(obj)    (Py_TYPE(obj) == &BTreeMap_Type)
+
+/* Columns */
+
+/**
+ * @brief A column of keys or values of a tree on either engine.
+ * 
+ */
+typedef struct {
+    avl_node_t *root;
+    btree_t *btree;         /* the B+ tree holding the column instead of root, or NULL */
+    size_t offset;          /* of the avl_key_t in a node, or the column of the B+ tree */
+} pyavl_column_t;
+
+/**
+ * @brief Call a function on each item of a column, in order.
+ * 
+ */
+extern void
+pyavl_column_foreach(const pyavl_column_t *col, void (*func)(avl_key_t, void *), void *arg);
+
+/* FrozenTreeSet_Type and FrozenTreeMap_Type, read-only trees on the engine of frozen.h */
+
+extern PyTypeObject FrozenTreeSet_Type;
+#define FrozenTreeSetObj_Check(obj)    (Py_TYPE(obj) == &FrozenTreeSet_Type)
+
+extern PyTypeObject FrozenTreeMap_Type;
+#define FrozenTreeMapObj_Check(obj)    (Py_TYPE(obj) == &FrozenTreeMap_Type)
+
+extern PyTypeObject FrozenIter_Type;
+
+/**
+ * @brief Copy the keys, and values if any, of a TreeSet or a TreeMap into a new frozen tree.
+ * 
+ * @param type FrozenTreeSet_Type or FrozenTreeMap_Type.
+ * @param keys The keys of the tree.
+ * @param values The values of the tree, NULL for a set.
+ * @param size The number of keys in the tree.
+ * @param ctx The context of the tree.
+ * @param vtype The dtype of values.
+ * @return Return a new reference, NULL on errors.
+ */
+extern PyObject* FrozenTree_New(PyTypeObject *type, const pyavl_column_t *keys,
+    const pyavl_column_t *values, Py_ssize_t size, avl_ctx_t *ctx, avl_dtype_t vtype);
+
+/* Calling conventions */
+
+/**
+ * @brief Parse the arguments of a METH_FASTCALL method, or of a vectorcall, into
+ * borrowed references, as PyArg_ParseTupleAndKeywords with "O" for every parameter.
+ * 
+ * @param name The name of the function, for error messages.
+ * @param args The positional arguments, followed by the values of keyword arguments.
+ * @param nargs The number of positional arguments.
+ * @param kwnames The names of keyword arguments, NULL if there is none.
+ * @param kwlist The names of parameters, ending with NULL.
+ * @param required The number of leading parameters that are required.
+ * @param maxpos The number of leading parameters that can be passed by position.
+ * @param out Set to the arguments, NULL for parameters not passed.
+ * @return Return 0 on success, -1 with TypeError set on failure.
+ */
+extern int
+pyavl_parse_args(const char *name, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames,
+    const char *const *kwlist, int required, int maxpos, PyObject **out);
+
+/**
+ * @brief Parse the inclusive argument of ranges, a pair of truth values for both bounds.
+ * 
+ * @return Return 0 on success, -1 on errors.
+ */
+extern int pyavl_parse_inclusive(PyObject *obj, int *lo_inclusive, int *hi_inclusive);
+
+/**
+ * @brief Parse the arguments (lo=None, hi=None, inclusive=(True, True)) of a range.
+ * 
+ * @return Return 0 on success, -1 on errors.
+ */
+extern int
+pyavl_parse_range(const char *name, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames,
+    PyObject **lo, PyObject **hi, int *lo_inclusive, int *hi_inclusive);
+
+#if PY_VERSION_HEX >= 0x03090000
+/**
+ * @brief Construct an object of a type by tp_new and tp_init, as calling the type
+ * does, for vectorcalls not handled by the type itself.
+ * 
+ */
+extern PyObject*
+pyavl_vectorcall_new(PyObject *type, PyObject *const *args, size_t nargsf, PyObject *kwnames);
+#endif
+
 /* TreeIter_Type */
 
 /**
- * @brief Getter function, should return a new reference
+ * @brief Getter function, should return a new reference.
+ * The second argument is the tree object owning the node.
  * 
  */
-typedef PyObject* (*avl_iter_getter)(avl_node_t *);
+typedef PyObject* (*avl_iter_getter)(avl_node_t *, PyObject *);
 
 extern PyTypeObject TreeIter_Type;
 #define TreeIterObj_Check(obj)    (Py_TYPE(obj) == &TreeIter_Type)
 
+/**
+ * @brief Create an iterator over an AVL tree, which keeps the owner alive.
+ * The owner is a TreeSet or a TreeMap, see PyAVLTreeObj; the iterator raises
+ * RuntimeError once the shape of its tree changes.
+ */
+extern PyObject*
+TreeIter_NewFromRoot(PyObject *owner, avl_node_t *root, avl_iter_getter getter);
+
+/**
+ * @brief Create an iterator yielding at most `count` nodes of an avl_iter_t, which
+ * it takes over. A negative count means no limit.
+ * If iter is NULL, return NULL with the pending exception or MemoryError set.
+ */
+extern PyObject*
+TreeIter_New(PyObject *owner, avl_iter_t *iter, Py_ssize_t count, avl_iter_getter getter);
+
+/* BTreeIter_Type */
+
+/**
+ * @brief Getter function of trees on the B+ tree engine, should return a new reference.
+ * The second argument is the tree object owning the position.
+ * 
+ */
+typedef PyObject* (*btree_iter_getter)(btree_pos_t, PyObject *);
+
+extern PyTypeObject BTreeIter_Type;
+
+/**
+ * @brief Create an iterator over a B+ tree from a position, yielding at most `count`
+ * keys, or all of them if it is negative. As TreeIter_New, the iterator keeps the
+ * owner alive and raises RuntimeError once the tree changes.
+ */
+extern PyObject*
+BTreeIter_New(PyObject *owner, btree_pos_t pos, Py_ssize_t count, int reverse,
+    btree_iter_getter getter);
+
+/* TreeRange_Type */
+
+extern PyTypeObject TreeRange_Type;
+#define TreeRangeObj_Check(obj)    (Py_TYPE(obj) == &TreeRange_Type)
+
+/**
+ * @brief Create a lazy view over the keys of a TreeSet or a TreeMap between lo and hi.
+ * 
+ * @param owner The tree, starting like PyAVLTreeObj.
+ * @param lo The lower bound, None for no bound.
+ * @param hi The upper bound, None for no bound.
+ * @param lo_inclusive Whether lo is in the range.
+ * @param hi_inclusive Whether hi is in the range.
+ * @param getter The getter of keys of owner.
+ */
+extern PyObject*
+TreeRange_New(PyObject *owner, PyObject *lo, PyObject *hi, int lo_inclusive, int hi_inclusive,
+    avl_iter_getter getter);
+
+/**
+ * @brief Create a lazy view over the keys of a tree on the B+ tree engine, see TreeRange_New.
+ * 
+ */
+extern PyObject*
+TreeRange_NewBTree(PyObject *owner, PyObject *lo, PyObject *hi, int lo_inclusive,
+    int hi_inclusive, btree_iter_getter getter);
+
+/**
+ * @brief Locate the keys between lo and hi in a TreeSet or a TreeMap by positions.
+ * The bounds are objects like those inserted, see pyavl_derive_key.
+ * 
+ * @param tree The tree.
+ * @param lo The lower bound, None for no bound.
+ * @param hi The upper bound, None for no bound.
+ * @param lo_inclusive Whether lo is in the range.
+ * @param hi_inclusive Whether hi is in the range.
+ * @param start The position of the first key in the range.
+ * @param end The position after the last key in the range, at least start.
+ * @return Return 0 on success, -1 on errors.
+ */
+extern int
+pyavl_range_bounds(PyAVLTreeObj *tree, PyObject *lo, PyObject *hi, int lo_inclusive,
+    int hi_inclusive, Py_ssize_t *start, Py_ssize_t *end);
+
+/* TreeCursor_Type */
+
+/**
+ * @brief How a cursor reads and changes the nodes of a TreeSet or a TreeMap.
+ * A read-only tree has no new_node, free_node and set_val. Trees on the B+ tree
+ * engine have the operations on entries instead of those on nodes.
+ */
+typedef struct {
+    avl_iter_getter getkey;
+    avl_iter_getter getval;     /* NULL for sets */
+    /* create a node for an object and its value, NULL for sets; NULL on errors */
+    avl_node_t* (*new_node)(PyObject *tree, PyObject *key, PyObject *val);
+    /* release what a node holds and return it to the pool of the tree */
+    void (*free_node)(avl_node_t *node, PyObject *tree);
+    /* replace the value of a node, NULL for sets; return 0 on success, -1 on errors */
+    int (*set_val)(avl_node_t *node, PyObject *tree, PyObject *val);
+    btree_iter_getter bgetkey;
+    btree_iter_getter bgetval;  /* NULL for sets */
+    /* fill an entry of the B+ tree for an object and its value; return 0 on success, -1 on errors */
+    int (*new_entry)(PyObject *tree, PyObject *key, PyObject *val, avl_key_t *entry);
+    /* replace the value at a position, NULL for sets; return 0 on success, -1 on errors */
+    int (*set_entry_val)(btree_pos_t pos, PyObject *tree, PyObject *val);
+} pyavl_cursor_ops_t;
+
+extern PyTypeObject TreeCursor_Type;
+#define TreeCursorObj_Check(obj)    (Py_TYPE(obj) == &TreeCursor_Type)
+
+/**
+ * @brief Create a cursor at the first key of a TreeSet or a TreeMap, keeping it alive.
+ * 
+ * @param tree The tree, starting like PyAVLTreeObj.
+ * @param ops The operations on nodes of the tree, kept for the lifetime of the cursor.
+ */
+extern PyObject* TreeCursor_New(PyObject *tree, const pyavl_cursor_ops_t *ops);
+
+/* Batched lookups */
+
+typedef enum {
+    PYAVL_LOOKUP_FIND,
+    PYAVL_LOOKUP_AT_MOST,
+    PYAVL_LOOKUP_AT_LEAST
+} pyavl_lookup_t;
+
+/**
+ * @brief Look up many keys in a TreeSet or a TreeMap with one finger, so that
+ * sorted keys do not restart each search at the root.
+ * 
+ * @param owner The tree, starting like PyAVLTreeObj.
+ * @param keys An iterable of keys, derived by the key function of owner if any.
+ * @param how The node to look up for each key.
+ * @param getter Convert the node looked up, NULL to report whether there is one.
+ * @param bgetter Convert the position looked up instead, for the B+ tree engine.
+ * @param missing The result if there is no node, a borrowed reference.
+ * @return Return a new list of results, NULL on errors.
+ */
 extern PyObject*
-TreeIter_NewFromRoot(avl_node_t *root, avl_iter_getter getter);
+pyavl_lookup_many(PyObject *owner, PyObject *keys, pyavl_lookup_t how,
+    avl_iter_getter getter, btree_iter_getter bgetter, PyObject *missing);
+
+/* Buffers */
+
+extern PyTypeObject KeyBuffer_Type;
+
+/**
+ * @brief Copy the keys or values of a tree in order into a new contiguous buffer,
+ * with format "q" for int64, "d" for float64 and "<w>s" for bytes, padded with NUL
+ * to the longest width w.
+ * 
+ * @param col The keys or values of the tree.
+ * @param size The number of keys in the tree.
+ * @param dtype The dtype of the keys or values, anything but object.
+ * @return Return a new memoryview, NULL on errors.
+ */
+extern PyObject*
+pyavl_export_keys(const pyavl_column_t *col, Py_ssize_t size, avl_dtype_t dtype);
+
+/**
+ * @brief Read the items of a C-contiguous buffer into keys without creating Python
+ * objects, except for bytes. Integers are read as int64, floats as float64 and
+ * fixed-width strings as bytes without trailing NUL.
+ * 
+ * @param obj An object supporting the buffer protocol.
+ * @param dtype Set to the dtype of the keys.
+ * @param n Set to the number of keys.
+ * @return Return a new array of keys to free by PyMem_Free, NULL on errors.
+ */
+extern avl_key_t*
+pyavl_import_keys(PyObject *obj, avl_dtype_t *dtype, Py_ssize_t *n);
+
+/* Snapshots */
+
+#define PYAVL_SNAPSHOT_SET          0
+#define PYAVL_SNAPSHOT_MAP          1
+
+#define PYAVL_SNAPSHOT_KEYED        0x1     /* nodes keep the objects keys are derived from */
+#define PYAVL_SNAPSHOT_AGGREGATE    0x2     /* a TreeMap with aggregate=True */
+
+#define PYAVL_SNAPSHOT_COLUMNS      3
+
+/**
+ * @brief A snapshot read back in memory, as columns of keys in order: the keys,
+ * the values of a map, then the objects keys are derived from if keyed.
+ * 
+ */
+typedef struct {
+    int flags;
+    PyObject *keyfunc;      /* NULL unless PYAVL_SNAPSHOT_KEYED */
+    Py_ssize_t size;
+    int ncolumns;
+    avl_dtype_t dtypes[PYAVL_SNAPSHOT_COLUMNS];
+    avl_key_t *columns[PYAVL_SNAPSHOT_COLUMNS];
+} pyavl_snapshot_t;
+
+/**
+ * @brief Write a TreeSet or a TreeMap in the versioned and checksummed snapshot format,
+ * column by column in order. int, float, str and bytes columns have raw encodings,
+ * other objects are pickled. The key function, if any, is pickled too.
+ * 
+ * @param file A path, a binary file object, or NULL to return the snapshot as bytes.
+ * @param tree The tree, starting like PyAVLTreeObj.
+ * @param kind PYAVL_SNAPSHOT_SET or PYAVL_SNAPSHOT_MAP.
+ * @param flags PYAVL_SNAPSHOT_AGGREGATE or 0, PYAVL_SNAPSHOT_KEYED is added for keyed trees.
+ * @param ncolumns The number of columns.
+ * @param dtypes The dtype of each column.
+ * @param columns The columns.
+ * @return Return None, or the bytes if file is NULL; NULL on errors.
+ */
+extern PyObject*
+pyavl_snapshot_save(PyObject *file, PyAVLTreeObj *tree, int kind, int flags, int ncolumns,
+    const avl_dtype_t *dtypes, const pyavl_column_t *columns);
+
+/**
+ * @brief Read a snapshot written by pyavl_snapshot_save, streaming from a file.
+ * 
+ * @param src A path or a binary file object, or a bytes-like object if in_memory.
+ * @param in_memory Whether src holds the snapshot itself.
+ * @param kind The kind of tree expected.
+ * @param snap Set to the snapshot read, to free by pyavl_snapshot_free.
+ * @return Return 0 on success, -1 with ValueError set if the snapshot is corrupted.
+ */
+extern int pyavl_snapshot_load(PyObject *src, int in_memory, int kind, pyavl_snapshot_t *snap);
+
+/**
+ * @brief Free the columns of a snapshot, releasing the keys left in them if release.
+ * Columns taken over by a tree are set to NULL beforehand.
+ * 
+ */
+extern void pyavl_snapshot_free(pyavl_snapshot_t *snap, int release);
 
 #endif
\ No newline at end of file
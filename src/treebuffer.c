@@ -0,0 +1,278 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <math.h>
+#include <string.h>
+
+#include "avl.h"
+#include "pyavlmodule.h"
+
+/**
+ * @brief A contiguous one-dimensional array exported by the buffer protocol,
+ * owning the memory behind the memoryviews returned by pyavl_export_keys.
+ *
+ */
+typedef struct {
+    PyObject_HEAD
+    char *data;
+    Py_ssize_t len;             /* number of items */
+    Py_ssize_t itemsize;
+    char format[24];
+} KeyBufferObj;
+
+static void KeyBufferObj_free(KeyBufferObj *self) {
+    PyMem_Free(self->data);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int KeyBuffer_getbuffer(KeyBufferObj *self, Py_buffer *view, int flags) {
+    view->obj = (PyObject *)self;
+    Py_INCREF(self);
+    view->buf = self->data;
+    view->len = self->len * self->itemsize;
+    view->readonly = 0;
+    view->itemsize = self->itemsize;
+    view->format = (flags & PyBUF_FORMAT)? self->format: NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND)? &self->len: NULL;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES)? &self->itemsize: NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static PyBufferProcs KeyBuffer_as_buffer = {
+    (getbufferproc)KeyBuffer_getbuffer,
+    0,
+};
+
+PyTypeObject KeyBuffer_Type = {
+    /* The ob_type field must be initialized in the module init function
+     * to be portable to Windows without using C++. */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "pyavl._KeyBuffer",         /*tp_name*/
+    sizeof(KeyBufferObj),       /*tp_basicsize*/
+    0,                          /*tp_itemsize*/
+    /* methods */
+    (destructor)KeyBufferObj_free,/*tp_dealloc*/
+    0,                          /*tp_vectorcall_offset*/
+    (getattrfunc)0,             /*tp_getattr*/
+    (setattrfunc)0,             /*tp_setattr*/
+    0,                          /*tp_as_async*/
+    0,                          /*tp_repr*/
+    0,                          /*tp_as_number*/
+    0,                          /*tp_as_sequence*/
+    0,                          /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    (getattrofunc)0,            /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    &KeyBuffer_as_buffer,       /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
+    0,                          /*tp_doc*/
+};
+
+typedef struct {
+    char *out;
+    Py_ssize_t width;
+} key_export_t;
+
+static void _key_width(avl_key_t key, void *extra) {
+    key_export_t *ex = (key_export_t *)extra;
+    Py_ssize_t len = PyBytes_GET_SIZE(key.obj);
+    if (len > ex->width) {
+        ex->width = len;
+    }
+}
+
+static void _key_export_bytes(avl_key_t key, void *extra) {
+    key_export_t *ex = (key_export_t *)extra;
+    Py_ssize_t len = PyBytes_GET_SIZE(key.obj);
+    memcpy(ex->out, PyBytes_AS_STRING(key.obj), len);
+    memset(ex->out + len, 0, ex->width - len);
+    ex->out += ex->width;
+}
+
+static void _key_export_raw(avl_key_t key, void *extra) {
+    key_export_t *ex = (key_export_t *)extra;
+    memcpy(ex->out, &key, sizeof(avl_key_t));
+    ex->out += sizeof(avl_key_t);
+}
+
+extern PyObject*
+pyavl_export_keys(const pyavl_column_t *col, Py_ssize_t size, avl_dtype_t dtype) {
+    if (dtype == AVL_DTYPE_OBJECT) {
+        PyErr_SetString(PyExc_TypeError, "Cannot export objects to a buffer, only dtype int64, float64 or bytes.");
+        return NULL;
+    }
+    key_export_t ex = {NULL, sizeof(avl_key_t)};
+    if (dtype == AVL_DTYPE_BYTES) {
+        /* a zero width is not a valid format */
+        ex.width = 1;
+        pyavl_column_foreach(col, _key_width, &ex);
+    }
+
+    KeyBufferObj *buf = PyObject_New(KeyBufferObj, &KeyBuffer_Type);
+    if (!buf) {
+        return NULL;
+    }
+    buf->len = size;
+    buf->itemsize = ex.width;
+    buf->data = PyMem_Malloc(size? size * ex.width: 1);
+    if (!buf->data) {
+        Py_DECREF(buf);
+        return PyErr_NoMemory();
+    }
+    ex.out = buf->data;
+    if (dtype == AVL_DTYPE_BYTES) {
+        PyOS_snprintf(buf->format, sizeof(buf->format), "%zds", ex.width);
+        pyavl_column_foreach(col, _key_export_bytes, &ex);
+    } else {
+        strcpy(buf->format, dtype == AVL_DTYPE_INT64? "q": "d");
+        pyavl_column_foreach(col, _key_export_raw, &ex);
+    }
+
+    PyObject *view = PyMemoryView_FromObject((PyObject *)buf);
+    Py_DECREF(buf);
+    return view;
+}
+
+/**
+ * @brief Whether the byte order of a buffer format is the one of this machine.
+ *
+ */
+static int _native_order(char order) {
+    switch (order) {
+    case '@':
+    case '=':
+        return 1;
+    case '<':
+        return PY_LITTLE_ENDIAN;
+    case '>':
+    case '!':
+        return !PY_LITTLE_ENDIAN;
+    default:
+        return 0;
+    }
+}
+
+static int64_t _read_int(const char *p, Py_ssize_t itemsize, int is_signed) {
+    switch (itemsize) {
+    case 1:
+        return is_signed? (int64_t)*(const int8_t *)p: (int64_t)*(const uint8_t *)p;
+    case 2: {
+        int16_t v; memcpy(&v, p, 2);
+        return is_signed? (int64_t)v: (int64_t)(uint16_t)v;
+    }
+    case 4: {
+        int32_t v; memcpy(&v, p, 4);
+        return is_signed? (int64_t)v: (int64_t)(uint32_t)v;
+    }
+    default: {
+        int64_t v; memcpy(&v, p, 8);
+        return v;
+    }
+    }
+}
+
+extern avl_key_t*
+pyavl_import_keys(PyObject *obj, avl_dtype_t *dtype, Py_ssize_t *n) {
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) < 0) {
+        return NULL;
+    } else if (view.ndim > 1) {
+        PyErr_Format(PyExc_TypeError, "Expected a one-dimensional buffer, got %d dimensions.",
+            view.ndim);
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+
+    /* format: [byte order][count]code, a missing format means unsigned bytes */
+    const char *fmt = view.format? view.format: "B";
+    char order = '@';
+    if (*fmt && strchr("@=<>!", *fmt)) {
+        order = *fmt++;
+    }
+    int count = 0;
+    while (*fmt >= '0' && *fmt <= '9') {
+        count = count * 10 + (*fmt++ - '0');
+    }
+    char code = *fmt;
+    int is_signed = code && strchr("bhilqn", code) != NULL;
+    int is_unsigned = code && strchr("BHILQN", code) != NULL;
+    int is_float = (code == 'f' && view.itemsize == 4) || (code == 'd' && view.itemsize == 8);
+    int is_bytes = code == 's';
+    if (!code || fmt[1] || (count > 1 && !is_bytes) || view.itemsize <= 0 ||
+        !(is_signed || is_unsigned || is_float || is_bytes) ||
+        ((is_signed || is_unsigned) && view.itemsize != 1 && view.itemsize != 2 &&
+        view.itemsize != 4 && view.itemsize != 8)) {
+        PyErr_Format(PyExc_TypeError, "Unsupported buffer format '%s', expected integers, "
+            "floats or fixed-width bytes.", view.format? view.format: "B");
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    if (!_native_order(order) && view.itemsize > 1 && !is_bytes) {
+        PyErr_Format(PyExc_TypeError, "Unsupported byte order of buffer format '%s'.", view.format);
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+
+    Py_ssize_t len = view.len / view.itemsize;
+    avl_key_t *keys = PyMem_New(avl_key_t, len? len: 1);
+    if (!keys) {
+        PyBuffer_Release(&view);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    const char *p = (const char *)view.buf;
+    if (is_float) {
+        *dtype = AVL_DTYPE_FLOAT64;
+        for (Py_ssize_t i = 0; i < len; i++, p += view.itemsize) {
+            if (view.itemsize == 4) {
+                float v; memcpy(&v, p, 4);
+                keys[i].f64 = v;
+            } else {
+                memcpy(&keys[i].f64, p, 8);
+            }
+            if (isnan(keys[i].f64)) {
+                PyErr_SetString(PyExc_ValueError, "NaN cannot be a float64 key");
+                PyMem_Free(keys);
+                PyBuffer_Release(&view);
+                return NULL;
+            }
+        }
+    } else if (is_bytes) {
+        *dtype = AVL_DTYPE_BYTES;
+        for (Py_ssize_t i = 0; i < len; i++, p += view.itemsize) {
+            /* fixed-width strings are padded with NUL, as numpy does */
+            Py_ssize_t size = view.itemsize;
+            while (size > 0 && p[size - 1] == '\0') {
+                size--;
+            }
+            keys[i].obj = PyBytes_FromStringAndSize(p, size);
+            if (!keys[i].obj) {
+                while (i--) {
+                    Py_DECREF(keys[i].obj);
+                }
+                PyMem_Free(keys);
+                PyBuffer_Release(&view);
+                return NULL;
+            }
+        }
+    } else {
+        *dtype = AVL_DTYPE_INT64;
+        for (Py_ssize_t i = 0; i < len; i++, p += view.itemsize) {
+            keys[i].i64 = _read_int(p, view.itemsize, is_signed);
+            if (is_unsigned && view.itemsize == 8 && keys[i].i64 < 0) {
+                PyErr_SetString(PyExc_OverflowError, "int too large to convert to int64");
+                PyMem_Free(keys);
+                PyBuffer_Release(&view);
+                return NULL;
+            }
+        }
+    }
+    *n = len;
+    PyBuffer_Release(&view);
+    return keys;
+}
\ No newline at end of file
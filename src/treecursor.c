@@ -0,0 +1,522 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "avl.h"
+#include "pyavlmodule.h"
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *tree;                 /* starts like PyAVLTreeObj */
+    const pyavl_cursor_ops_t *ops;
+    uint64_t version;               /* the version of the tree the path was recorded at */
+    avl_cursor_t cursor;            /* the path in an AVL tree, only loc for a B+ tree */
+    btree_pos_t pos;                /* the position in a B+ tree */
+} TreeCursorObj;
+
+#define TREECURSOR_TREE(self) ((PyAVLTreeObj *)(self)->tree)
+#define TREECURSOR_BTREE(self) (TREECURSOR_TREE(self)->btree)
+
+static void TreeCursorObj_free(TreeCursorObj *self) {
+    Py_XDECREF(self->tree);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/**
+ * @brief Record the path of a cursor as up to date with its tree.
+ */
+static void treecursor_sync(TreeCursorObj *self) {
+    self->version = TREECURSOR_TREE(self)->ctx.version;
+}
+
+/**
+ * @brief Whether a cursor is at a key rather than off the tree.
+ */
+static int treecursor_at(TreeCursorObj *self) {
+    return TREECURSOR_BTREE(self)? self->pos.leaf != NULL: self->cursor.depth != 0;
+}
+
+/**
+ * @brief Place a cursor at a position, off the tree if it is out of range, as avl_cursor_seek_loc.
+ *
+ * @return Return whether the cursor is at a key.
+ */
+static int treecursor_seek_loc(TreeCursorObj *self, ptrdiff_t loc) {
+    PyAVLTreeObj *tree = TREECURSOR_TREE(self);
+    if (!tree->btree) {
+        return avl_cursor_seek_loc(&self->cursor, tree->root, loc) != NULL;
+    }
+    ptrdiff_t size = tree->btree->size;
+    self->cursor.loc = loc < 0? -1: loc > size? size: loc;
+    return btree_loc(tree->btree, loc, &self->pos);
+}
+
+/**
+ * @brief Check that the tree has not changed shape since the path of a cursor was recorded.
+ *
+ * @param at Whether the cursor must also be at a node.
+ * @return Return 0 on success, -1 with an exception set on failure.
+ */
+static int treecursor_check(TreeCursorObj *self, int at) {
+    if (self->version != TREECURSOR_TREE(self)->ctx.version) {
+        PyErr_SetString(
+            PyExc_RuntimeError, "The tree changed after the cursor was placed; seek again."
+        );
+        return -1;
+    } else if (at && !treecursor_at(self)) {
+        PyErr_SetString(PyExc_IndexError, "The cursor is not at a key.");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Check that the tree of a cursor can be changed through it.
+ */
+static int treecursor_check_writable(TreeCursorObj *self) {
+    if (!self->ops->new_node && !self->ops->new_entry) {
+        PyErr_SetString(PyExc_TypeError, "The tree of the cursor is read-only.");
+        return -1;
+    }
+    return 0;
+}
+
+extern PyObject* TreeCursor_New(PyObject *tree, const pyavl_cursor_ops_t *ops) {
+    TreeCursorObj *self = (TreeCursorObj *)TreeCursor_Type.tp_alloc(&TreeCursor_Type, 0);
+    if (!self) {
+        return NULL;
+    }
+    Py_INCREF(tree);
+    self->tree = tree;
+    self->ops = ops;
+    treecursor_seek_loc(self, 0);
+    treecursor_sync(self);
+    return (PyObject *)self;
+}
+
+static PyObject* TreeCursorObj_seek(TreeCursorObj *self, PyObject *key) {
+    PyAVLTreeObj *tree = TREECURSOR_TREE(self);
+    PyObject *query = pyavl_derive_key(tree, key);
+    if (!query) {
+        return NULL;
+    }
+    int ret;
+    if (tree->btree) {
+        int found;
+        ptrdiff_t loc = btree_bisect(tree->btree, &tree->ctx, query, 0, &found, &self->pos);
+        self->cursor.loc = loc < 0? -1: loc;
+        ret = loc < 0? -1: found;
+    } else {
+        ret = avl_cursor_seek(&self->cursor, tree->root, &tree->ctx, query);
+    }
+    Py_DECREF(query);
+    treecursor_sync(self);
+    if (ret < 0) {
+        return NULL;
+    }
+    return PyBool_FromLong(ret);
+}
+
+static PyObject* TreeCursorObj_seek_rank(TreeCursorObj *self, PyObject *arg) {
+    PyAVLTreeObj *tree = TREECURSOR_TREE(self);
+    Py_ssize_t loc = PyNumber_AsSsize_t(arg, PyExc_OverflowError);
+    if (loc == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    if (loc < 0) {
+        loc += pyavl_tree_size(tree);
+    }
+    int at = treecursor_seek_loc(self, loc);
+    treecursor_sync(self);
+    return PyBool_FromLong(at);
+}
+
+static PyObject* treecursor_step(TreeCursorObj *self, int dir) {
+    if (treecursor_check(self, 0) < 0) {
+        return NULL;
+    }
+    btree_t *btree = TREECURSOR_BTREE(self);
+    if (!btree) {
+        avl_node_t *node = avl_cursor_step(&self->cursor, TREECURSOR_TREE(self)->root, dir);
+        return PyBool_FromLong(node != NULL);
+    }
+    if (!self->pos.leaf) {
+        /* off the tree, onto the end towards it */
+        if (dir > 0 && self->cursor.loc < 0) {
+            return PyBool_FromLong(treecursor_seek_loc(self, 0));
+        } else if (dir < 0 && self->cursor.loc >= 0) {
+            return PyBool_FromLong(treecursor_seek_loc(self, (ptrdiff_t)btree->size - 1));
+        }
+        Py_RETURN_FALSE;
+    }
+    if (dir > 0) {
+        btree_pos_next(&self->pos);
+    } else {
+        btree_pos_prev(&self->pos);
+    }
+    self->cursor.loc += dir > 0? 1: -1;
+    return PyBool_FromLong(self->pos.leaf != NULL);
+}
+
+static PyObject* TreeCursorObj_next(TreeCursorObj *self) {
+    return treecursor_step(self, 1);
+}
+
+static PyObject* TreeCursorObj_prev(TreeCursorObj *self) {
+    return treecursor_step(self, -1);
+}
+
+/**
+ * @brief Insert into a B+ tree next to the key at the cursor, as treecursor_insert.
+ * The entry is compared with the keys around its location, then inserted there.
+ */
+static PyObject* treecursor_insert_entry(TreeCursorObj *self, PyObject **argv, int after) {
+    const pyavl_cursor_ops_t *ops = self->ops;
+    PyAVLTreeObj *tree = TREECURSOR_TREE(self);
+    avl_key_t entry[BTREE_MAX_COLUMNS];
+    if (ops->new_entry(self->tree, argv[0], argv[1], entry) < 0) {
+        return NULL;
+    } else if (treecursor_check(self, 0) < 0) {
+        /* the key function or a conversion changed the tree, so the position is stale */
+        btree_release(tree->btree, &tree->ctx, entry);
+        return NULL;
+    }
+
+    btree_t *btree = tree->btree;
+    int off = !self->pos.leaf, side = after, c = after? 1: -1;
+    ptrdiff_t loc = self->cursor.loc;
+    if (btree->size) {
+        if (off) {
+            after = loc >= 0;
+            treecursor_seek_loc(self, after? loc - 1: 0);
+        }
+        /* the key goes between the key at the cursor and its neighbour on that side */
+        btree_pos_t next = self->pos;
+        if (after) {
+            btree_pos_next(&next);
+        } else {
+            btree_pos_prev(&next);
+        }
+        c = avl_key_cmp(&tree->ctx, entry[0], BTREE_POS_KEY(self->pos));
+        if (c == (after? 1: -1) && next.leaf) {
+            c = -avl_key_cmp(&tree->ctx, entry[0], BTREE_POS_KEY(next));
+        }
+    }
+    int ret = c == -2 || c == 2? -1: c != (after? 1: -1)? 0:
+        btree_insert_at(btree, &tree->ctx, btree->size? self->cursor.loc + after: 0, entry);
+    treecursor_sync(self);
+    if (off) {
+        /* back to the same end of the tree */
+        treecursor_seek_loc(self, loc < 0? -1: (ptrdiff_t)btree->size);
+    } else if (ret == 1) {
+        /* the position moved, but the cursor stays at its key */
+        treecursor_seek_loc(self, self->cursor.loc + !after);
+    }
+    if (ret != 1) {
+        btree_release(btree, &tree->ctx, entry);
+        if (ret == 0) {
+            PyErr_Format(
+                PyExc_ValueError, "The key does not go %s the cursor.", side? "after": "before"
+            );
+        }
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+/**
+ * @brief Insert a key, and a value for maps, next to the node at the cursor, comparing
+ * it with the two keys it goes between only. A cursor off the tree inserts next to
+ * the nearest end and stays off the tree.
+ */
+static PyObject* treecursor_insert(TreeCursorObj *self, PyObject *const *args,
+    Py_ssize_t nargs, PyObject *kwnames, const char *name, int after) {
+    static const char *const kwlist[] = {"key", "value", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args(name, args, nargs, kwnames, kwlist, 1, 2, argv) < 0) {
+        return NULL;
+    }
+    if (treecursor_check(self, 0) < 0 || treecursor_check_writable(self) < 0) {
+        return NULL;
+    }
+    const pyavl_cursor_ops_t *ops = self->ops;
+    int is_map = ops->getval || ops->bgetval;
+    if (!is_map != !argv[1]) {
+        PyErr_Format(
+            PyExc_TypeError, is_map? "%s() missing the value": "%s() takes no value", name
+        );
+        return NULL;
+    }
+    if (TREECURSOR_BTREE(self)) {
+        return treecursor_insert_entry(self, argv, after);
+    }
+    avl_node_t *node = ops->new_node(self->tree, argv[0], argv[1]);
+    if (!node) {
+        return NULL;
+    } else if (treecursor_check(self, 0) < 0) {
+        /* the key function or a conversion changed the tree, so the path is stale */
+        ops->free_node(node, self->tree);
+        return NULL;
+    }
+
+    PyAVLTreeObj *tree = TREECURSOR_TREE(self);
+    avl_cursor_t *cursor = &self->cursor;
+    int ret, off = !cursor->depth, side = after;
+    ptrdiff_t loc = cursor->loc;
+    if (!tree->root) {
+        tree->root = avl_node_insert(tree->root, &tree->ctx, node, &ret, NULL);
+    } else {
+        if (off) {
+            after = loc >= 0;
+            avl_cursor_seek_loc(cursor, tree->root, after? loc - 1: 0);
+        }
+        tree->root = avl_cursor_insert(cursor, tree->root, &tree->ctx, node, after, &ret);
+    }
+    treecursor_sync(self);
+    if (off) {
+        /* back to the same end of the tree */
+        avl_cursor_seek_loc(cursor, tree->root, loc < 0? -1: tree->size + (ret == 1));
+    }
+    if (ret != 1) {
+        ops->free_node(node, self->tree);
+        if (ret == 0) {
+            PyErr_Format(
+                PyExc_ValueError, "The key does not go %s the cursor.", side? "after": "before"
+            );
+        }
+        return NULL;
+    }
+    tree->size ++;
+    Py_RETURN_NONE;
+}
+
+static PyObject* TreeCursorObj_insert_before(
+    TreeCursorObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    return treecursor_insert(self, args, nargs, kwnames, "insert_before", 0);
+}
+
+static PyObject* TreeCursorObj_insert_after(
+    TreeCursorObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    return treecursor_insert(self, args, nargs, kwnames, "insert_after", 1);
+}
+
+static PyObject* TreeCursorObj_erase(TreeCursorObj *self) {
+    if (treecursor_check(self, 1) < 0 || treecursor_check_writable(self) < 0) {
+        return NULL;
+    }
+    PyAVLTreeObj *tree = TREECURSOR_TREE(self);
+    if (tree->btree) {
+        avl_key_t entry[BTREE_MAX_COLUMNS];
+        ptrdiff_t loc = self->cursor.loc;
+        btree_delete_at(tree->btree, &tree->ctx, loc, entry);
+        treecursor_seek_loc(self, loc);
+        treecursor_sync(self);
+        btree_release(tree->btree, &tree->ctx, entry);
+        Py_RETURN_NONE;
+    }
+    avl_node_t *deleted;
+    int ret;
+    tree->root = avl_cursor_delete(&self->cursor, tree->root, &tree->ctx, &ret, &deleted);
+    treecursor_sync(self);
+    if (ret != 1) {
+        return NULL;
+    }
+    tree->size --;
+    self->ops->free_node(deleted, self->tree);
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef TreeCursorObj_Methods[] = {
+    {
+        "seek",
+        (PyCFunction)TreeCursorObj_seek,
+        METH_O,
+        "Move to the smallest key not smaller than key, or off the end of the tree if there is none. Return whether key is in the tree."
+    },
+    {
+        "seek_rank",
+        (PyCFunction)TreeCursorObj_seek_rank,
+        METH_O,
+        "Move to the key at a position, counting from the end if it is negative. Return whether there is a key there."
+    },
+    {
+        "next",
+        (PyCFunction)TreeCursorObj_next,
+        METH_NOARGS,
+        "Move to the next key. Return False if the cursor moved off the end of the tree."
+    },
+    {
+        "prev",
+        (PyCFunction)TreeCursorObj_prev,
+        METH_NOARGS,
+        "Move to the previous key. Return False if the cursor moved off the start of the tree."
+    },
+    {
+        "insert_before",
+        (PyCFunction)(void(*)(void))TreeCursorObj_insert_before,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Insert a key, with a value for TreeMap, right before the cursor, which stays at its key. Raise ValueError if the key does not go there."
+    },
+    {
+        "insert_after",
+        (PyCFunction)(void(*)(void))TreeCursorObj_insert_after,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Insert a key, with a value for TreeMap, right after the cursor, which stays at its key. Raise ValueError if the key does not go there."
+    },
+    {
+        "erase",
+        (PyCFunction)TreeCursorObj_erase,
+        METH_NOARGS,
+        "Remove the key at the cursor and move to the next key."
+    },
+    {NULL, NULL}
+};
+
+static PyObject* TreeCursorObj_get_key(TreeCursorObj *self, void *closure) {
+    if (treecursor_check(self, 1) < 0) {
+        return NULL;
+    }
+    if (TREECURSOR_BTREE(self)) {
+        return self->ops->bgetkey(self->pos, self->tree);
+    }
+    return self->ops->getkey(AVL_CURSOR_NODE(&self->cursor), self->tree);
+}
+
+static PyObject* TreeCursorObj_get_value(TreeCursorObj *self, void *closure) {
+    if (!self->ops->getval && !self->ops->bgetval) {
+        PyErr_SetString(PyExc_AttributeError, "A cursor of a TreeSet has no value.");
+        return NULL;
+    } else if (treecursor_check(self, 1) < 0) {
+        return NULL;
+    } else if (TREECURSOR_BTREE(self)) {
+        return self->ops->bgetval(self->pos, self->tree);
+    }
+    return self->ops->getval(AVL_CURSOR_NODE(&self->cursor), self->tree);
+}
+
+static int TreeCursorObj_set_value(TreeCursorObj *self, PyObject *val, void *closure) {
+    if (!val) {
+        PyErr_SetString(PyExc_AttributeError, "Cannot delete the value at a cursor.");
+        return -1;
+    } else if (!self->ops->getval && !self->ops->bgetval) {
+        PyErr_SetString(PyExc_AttributeError, "A cursor of a TreeSet has no value.");
+        return -1;
+    } else if (treecursor_check(self, 1) < 0 || treecursor_check_writable(self) < 0) {
+        return -1;
+    } else if (TREECURSOR_BTREE(self)) {
+        /* values are not compared, so the position stays valid */
+        return self->ops->set_entry_val(self->pos, self->tree, val);
+    }
+    PyAVLTreeObj *tree = TREECURSOR_TREE(self);
+    avl_node_t *node = avl_cursor_own(&self->cursor, &tree->root, &tree->ctx);
+    treecursor_sync(self);
+    if (!node) {
+        return -1;
+    }
+    if (self->ops->set_val(node, self->tree, val) < 0) {
+        return -1;
+    }
+    avl_cursor_refresh(&self->cursor, &tree->ctx);
+    return 0;
+}
+
+static PyObject* TreeCursorObj_get_rank(TreeCursorObj *self, void *closure) {
+    if (treecursor_check(self, 0) < 0) {
+        return NULL;
+    }
+    return PyLong_FromSsize_t(self->cursor.loc);
+}
+
+static PyObject* TreeCursorObj_get_tree(TreeCursorObj *self, void *closure) {
+    Py_INCREF(self->tree);
+    return self->tree;
+}
+
+static PyGetSetDef TreeCursorObj_GetSet[] = {
+    {
+        "key",
+        (getter)TreeCursorObj_get_key,
+        NULL,
+        "The key at the cursor.",
+        NULL
+    },
+    {
+        "value",
+        (getter)TreeCursorObj_get_value,
+        (setter)TreeCursorObj_set_value,
+        "The value at the cursor of a TreeMap, settable in place.",
+        NULL
+    },
+    {
+        "rank",
+        (getter)TreeCursorObj_get_rank,
+        NULL,
+        "The position of the cursor: -1 before the first key and the size of the tree after the last.",
+        NULL
+    },
+    {
+        "tree",
+        (getter)TreeCursorObj_get_tree,
+        NULL,
+        "The tree of the cursor.",
+        NULL
+    },
+    {NULL}
+};
+
+static int TreeCursorObj_bool(TreeCursorObj *self) {
+    if (treecursor_check(self, 0) < 0) {
+        return -1;
+    }
+    return treecursor_at(self);
+}
+
+static PyNumberMethods TreeCursorObj_Num = {
+    .nb_bool = (inquiry)TreeCursorObj_bool,
+};
+
+PyTypeObject TreeCursor_Type = {
+    /* The ob_type field must be initialized in the module init function
+     * to be portable to Windows without using C++. */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "pyavl.TreeCursor",         /*tp_name*/
+    sizeof(TreeCursorObj),      /*tp_basicsize*/
+    0,                          /*tp_itemsize*/
+    /* methods */
+    (destructor)TreeCursorObj_free,/*tp_dealloc*/
+    0,                          /*tp_vectorcall_offset*/
+    (getattrfunc)0,             /*tp_getattr*/
+    (setattrfunc)0,             /*tp_setattr*/
+    0,                          /*tp_as_async*/
+    0,                          /*tp_repr*/
+    &TreeCursorObj_Num,         /*tp_as_number*/
+    0,                          /*tp_as_sequence*/
+    0,                          /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    (getattrofunc)0,            /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    0,                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
+    "A position in a TreeSet or a TreeMap that steps, inserts and erases without searching from the root.",
+                                /*tp_doc*/
+    0,                          /*tp_traverse*/
+    0,                          /*tp_clear*/
+    0,                          /*tp_richcompare*/
+    0,                          /*tp_weaklistoffset*/
+    0,                          /*tp_iter*/
+    0,                          /*tp_iternext*/
+    TreeCursorObj_Methods,      /*tp_methods*/
+    0,                          /*tp_members*/
+    TreeCursorObj_GetSet,       /*tp_getset*/
+    0,                          /*tp_base*/
+    0,                          /*tp_dict*/
+    0,                          /*tp_descr_get*/
+    0,                          /*tp_descr_set*/
+    0,                          /*tp_dictoffset*/
+    0,                          /*tp_init*/
+    0,                          /*tp_alloc*/
+    0,                          /*tp_new*/
+    0,                          /*tp_free*/
+    0,                          /*tp_is_gc*/
+};
\ No newline at end of file
@@ -8,6 +8,9 @@ typedef struct {
     PyObject_HEAD
     avl_iter_t *iter;
     avl_iter_getter getter;
+    PyObject *owner;
+    Py_ssize_t remaining;       /* number of nodes left to yield, -1 for all */
+    uint64_t version;           /* of the tree when the iterator was created */
 } TreeIterObj;
 
 static PyObject* TreeIterObj_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
@@ -18,37 +21,66 @@ static PyObject* TreeIterObj_new(PyTypeObject *type, PyObject *args, PyObject *k
     }
     self->iter = NULL;
     self->getter = NULL;
+    self->owner = NULL;
+    self->remaining = -1;
+    self->version = 0;
 
     return (PyObject *)self;
 }
 
 static void TreeIterObj_free(TreeIterObj *self) {
     avl_iter_free(self->iter);
+    Py_XDECREF(self->owner);
     Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
 extern PyObject*
-TreeIter_NewFromRoot(avl_node_t *root, avl_iter_getter getter) {
+TreeIter_NewFromRoot(PyObject *owner, avl_node_t *root, avl_iter_getter getter) {
+    return TreeIter_New(owner, avl_iter_new(root), -1, getter);
+}
+
+extern PyObject*
+TreeIter_New(PyObject *owner, avl_iter_t *iter, Py_ssize_t count, avl_iter_getter getter) {
+    if (!iter) {
+        return PyErr_Occurred()? NULL: PyErr_NoMemory();
+    }
     TreeIterObj *self = (TreeIterObj *)TreeIterObj_new(&TreeIter_Type, NULL, NULL);
     if (!self) {
+        avl_iter_free(iter);
         return NULL;
     }
-    self->iter = avl_iter_new(root);
+    self->iter = iter;
     self->getter = getter;
+    self->remaining = count;
+    self->version = ((PyAVLTreeObj *)owner)->ctx.version;
+    Py_INCREF(owner);
+    self->owner = owner;
     return (PyObject *)self;
 }
 
 static PyObject* TreeIter_next(TreeIterObj *self) {
-    if (!(self->iter) || !(self->getter)) {
+    if (!(self->iter) || !(self->getter) || self->remaining == 0) {
+        return NULL;
+    }
+    /* nodes of a changed tree may be freed, so the path is lost */
+    if (self->version != ((PyAVLTreeObj *)self->owner)->ctx.version) {
+        avl_iter_free(self->iter);
+        self->iter = NULL;
+        PyErr_Format(
+            PyExc_RuntimeError, "%s changed during iteration", Py_TYPE(self->owner)->tp_name
+        );
         return NULL;
     }
     avl_node_t *node = avl_iter_next(self->iter);
     if (!node) {
         return NULL;
     }
+    if (self->remaining > 0) {
+        self->remaining --;
+    }
     
     avl_iter_getter getter = self->getter;
-    return getter(node);
+    return getter(node, self->owner);
 }
 
 PyTypeObject TreeIter_Type = {
@@ -95,4 +127,126 @@ PyTypeObject TreeIter_Type = {
     TreeIterObj_new,            /*tp_new*/
     0,                          /*tp_free*/
     0,                          /*tp_is_gc*/
-};
\ No newline at end of file
+};
+/* BTreeIter_Type */
+
+typedef struct {
+    PyObject_HEAD
+    btree_pos_t pos;
+    btree_iter_getter getter;
+    PyObject *owner;
+    Py_ssize_t remaining;       /* number of keys left to yield, -1 for all */
+    uint64_t version;           /* of the tree when the iterator was created */
+    int reverse;
+} BTreeIterObj;
+
+static PyObject* BTreeIterObj_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    BTreeIterObj *self;
+    self = (BTreeIterObj *)type->tp_alloc(type, 0);
+    if (!self) {
+        return NULL;
+    }
+    self->pos.leaf = NULL;
+    self->pos.idx = 0;
+    self->getter = NULL;
+    self->owner = NULL;
+    self->remaining = -1;
+    self->version = 0;
+    self->reverse = 0;
+
+    return (PyObject *)self;
+}
+
+static void BTreeIterObj_free(BTreeIterObj *self) {
+    Py_XDECREF(self->owner);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+extern PyObject*
+BTreeIter_New(PyObject *owner, btree_pos_t pos, Py_ssize_t count, int reverse,
+    btree_iter_getter getter) {
+    BTreeIterObj *self = (BTreeIterObj *)BTreeIterObj_new(&BTreeIter_Type, NULL, NULL);
+    if (!self) {
+        return NULL;
+    }
+    self->pos = pos;
+    self->getter = getter;
+    self->remaining = count;
+    self->version = ((PyAVLTreeObj *)owner)->ctx.version;
+    self->reverse = reverse;
+    Py_INCREF(owner);
+    self->owner = owner;
+    return (PyObject *)self;
+}
+
+static PyObject* BTreeIter_next(BTreeIterObj *self) {
+    if (!(self->pos.leaf) || !(self->getter) || self->remaining == 0) {
+        return NULL;
+    }
+    /* leaves of a changed tree may be freed, so the position is lost */
+    if (self->version != ((PyAVLTreeObj *)self->owner)->ctx.version) {
+        self->pos.leaf = NULL;
+        PyErr_Format(
+            PyExc_RuntimeError, "%s changed during iteration", Py_TYPE(self->owner)->tp_name
+        );
+        return NULL;
+    }
+    btree_pos_t pos = self->pos;
+    if (self->reverse) {
+        btree_pos_prev(&self->pos);
+    } else {
+        btree_pos_next(&self->pos);
+    }
+    if (self->remaining > 0) {
+        self->remaining --;
+    }
+
+    btree_iter_getter getter = self->getter;
+    return getter(pos, self->owner);
+}
+
+PyTypeObject BTreeIter_Type = {
+    /* The ob_type field must be initialized in the module init function
+     * to be portable to Windows without using C++. */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "pyavl._BTreeIter",         /*tp_name*/
+    sizeof(BTreeIterObj),       /*tp_basicsize*/
+    0,                          /*tp_itemsize*/
+    /* methods */
+    (destructor)BTreeIterObj_free,/*tp_dealloc*/
+    0,                          /*tp_vectorcall_offset*/
+    (getattrfunc)0,             /*tp_getattr*/
+    (setattrfunc)0,             /*tp_setattr*/
+    0,                          /*tp_as_async*/
+    0,                          /*tp_repr*/
+    0,                          /*tp_as_number*/
+    0,                          /*tp_as_sequence*/
+    0,                          /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    (getattrofunc)0,            /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    0,                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
+    0,                          /*tp_doc*/
+    0,                          /*tp_traverse*/
+    0,                          /*tp_clear*/
+    0,                          /*tp_richcompare*/
+    0,                          /*tp_weaklistoffset*/
+    PyObject_SelfIter,          /*tp_iter*/
+    (iternextfunc)BTreeIter_next,/*tp_iternext*/
+    0,                          /*tp_methods*/
+    0,                          /*tp_members*/
+    0,                          /*tp_getset*/
+    0,                          /*tp_base*/
+    0,                          /*tp_dict*/
+    0,                          /*tp_descr_get*/
+    0,                          /*tp_descr_set*/
+    0,                          /*tp_dictoffset*/
+    0,                          /*tp_init*/
+    0,                          /*tp_alloc*/
+    BTreeIterObj_new,           /*tp_new*/
+    0,                          /*tp_free*/
+    0,                          /*tp_is_gc*/
+};
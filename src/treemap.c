@@ -6,35 +6,157 @@
 
 typedef struct {
     AVL_NODE_HEAD
-    PyObject *val;
+    avl_key_t val;
 } avl_map_t;
 
-static avl_map_t* avl_map_new(PyObject *key, PyObject *val) {
-    avl_map_t *obj = (avl_map_t *)malloc(sizeof(avl_map_t));
+/**
+ * @brief Node of a TreeMap with aggregate=True, with aggregates of the float64
+ * values in its subtree.
+ */
+typedef struct {
+    avl_map_t _;
+    double sum;
+    double min;
+    double max;
+} avl_aggmap_t;
+
+static void treemap_augment(avl_aggmap_t *node) {
+    avl_aggmap_t *left = (avl_aggmap_t *)AVL_LEFT(node);
+    avl_aggmap_t *right = (avl_aggmap_t *)AVL_RIGHT(node);
+    double val = node->_.val.f64;
+    node->sum = val;
+    node->min = val;
+    node->max = val;
+    if (left) {
+        node->sum += left->sum;
+        node->min = left->min < node->min? left->min: node->min;
+        node->max = left->max > node->max? left->max: node->max;
+    }
+    if (right) {
+        node->sum += right->sum;
+        node->min = right->min < node->min? right->min: node->min;
+        node->max = right->max > node->max? right->max: node->max;
+    }
+}
+
+/* starts like PyAVLTreeObj */
+typedef struct {
+    PyObject_HEAD
+    avl_map_t *root;
+    Py_ssize_t size;
+    avl_ctx_t ctx;
+    PyObject *keyfunc;
+    btree_t *btree;         /* NULL, the keys are in root */
+    avl_dtype_t vtype;
+    avl_pool_t pool;
+    avl_share_t share;      /* the snapshots of a TreeMap, set as ctx.share while there are any */
+    PyObject *owner;        /* the TreeMap of a TreeMapSnapshot, whose pool holds its nodes */
+} TreeMapObj;
+
+/**
+ * @brief Create a map node, taking over the references held by key and val.
+ * With a key function, the node also keeps a reference to item, the key was derived from.
+ */
+static avl_map_t* avl_map_new(TreeMapObj *self, avl_key_t key, avl_key_t val, PyObject *item) {
+    avl_map_t *obj = (avl_map_t *)avl_pool_alloc(&self->pool);
     if (obj) {
         avl_node_init((avl_node_t *)obj, key);
-        Py_INCREF(val);
         obj->val = val;
+        if (self->keyfunc) {
+            Py_INCREF(item);
+            PYAVL_NODE_ITEM(obj, self->pool.node_size) = item;
+        }
     }
     return obj;
 }
 
-static void avl_map_free(avl_map_t *root) {
+static void avl_map_free(TreeMapObj *self, avl_map_t *root) {
     if (!root) return;
-    avl_node_clear((avl_node_t *)root);
-    Py_DECREF(root->val);
-    avl_map_free((avl_map_t *)AVL_LEFT(root));
-    avl_map_free((avl_map_t *)AVL_RIGHT(root));
-    free(root);
+    avl_node_clear((avl_node_t *)root, &self->ctx);
+    avl_key_release(self->vtype, root->val);
+    if (self->keyfunc) {
+        Py_DECREF(PYAVL_NODE_ITEM(root, self->pool.node_size));
+    }
+    avl_map_free(self, (avl_map_t *)AVL_LEFT(root));
+    avl_map_free(self, (avl_map_t *)AVL_RIGHT(root));
+    avl_pool_free(&self->pool, root);
 }
 
 typedef struct {
-    PyObject_HEAD
-    avl_map_t *root;
-    Py_ssize_t size;
-} TreeMapObj;
+    avl_dtype_t ktype;
+    avl_dtype_t vtype;
+    size_t keyed_size;      /* the node size if nodes keep the objects keys are derived from */
+} treemap_dtypes_t;
+
+/**
+ * @brief Reset the context for a key dtype, keeping the aggregation and the snapshots.
+ */
+static void treemap_reset_ctx(TreeMapObj *self, avl_dtype_t ktype) {
+    avl_augment_func augment = self->ctx.augment;
+    avl_share_t *share = self->ctx.share;
+    avl_ctx_init(&self->ctx, ktype);
+    self->ctx.augment = augment;
+    self->ctx.share = share;
+}
+
+/**
+ * @brief Take the references held by a node copied from a node shared with snapshots.
+ */
+static void treemap_retain_item(avl_map_t *node, TreeMapObj *self) {
+    if (AVL_DTYPE_BOXED(self->ctx.dtype)) {
+        Py_INCREF(AVL_RAWKEY(node).obj);
+    }
+    if (AVL_DTYPE_BOXED(self->vtype)) {
+        Py_INCREF(node->val.obj);
+    }
+    if (self->keyfunc) {
+        Py_INCREF(PYAVL_NODE_ITEM(node, self->pool.node_size));
+    }
+}
+
+static void treemap_release_item(avl_map_t *node, treemap_dtypes_t *dtypes) {
+    avl_key_release(dtypes->ktype, AVL_RAWKEY(node));
+    avl_key_release(dtypes->vtype, node->val);
+    if (dtypes->keyed_size) {
+        Py_DECREF(PYAVL_NODE_ITEM(node, dtypes->keyed_size));
+    }
+}
+
+/**
+ * @brief Remove all nodes: drop references held by items, then release chunks at once.
+ * The tree is emptied first, in case releasing items runs code touching it.
+ * Nodes shared with snapshots stay in the pool, see avl_node_unref.
+ */
+static void treemap_drop(TreeMapObj *self) {
+    avl_map_t *root = self->root;
+    treemap_dtypes_t dtypes = {
+        self->ctx.dtype, self->vtype, self->keyfunc? self->pool.node_size: 0
+    };
+    self->root = NULL;
+    self->size = 0;
+    treemap_reset_ctx(self, dtypes.ktype);
+    if (self->share.snapshots) {
+        avl_node_unref((avl_node_t *)root, &self->pool, (avl_func)treemap_release_item, &dtypes);
+        return;
+    }
+    avl_pool_t pool = self->pool;
+    avl_pool_init(&self->pool, pool.node_size, pool.hugepages);
+
+    if (AVL_DTYPE_BOXED(dtypes.ktype) || AVL_DTYPE_BOXED(dtypes.vtype) || dtypes.keyed_size) {
+        avl_node_foreach((avl_node_t *)root, (avl_func)treemap_release_item, &dtypes);
+    }
+    avl_pool_clear(&pool);
+}
 
 static PyObject* TreeMapObj_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    int backend = pyavl_parse_backend(kwargs);
+    if (backend < 0) {
+        return NULL;
+    } else if (backend == 1) {
+        /* a BTreeMap is a TreeMap, so BTreeMap.__init__ runs on it next */
+        return BTreeMap_Type.tp_new(&BTreeMap_Type, args, kwargs);
+    }
+
     TreeMapObj *self;
     self = (TreeMapObj *)type->tp_alloc(type, 0);
     if (!self) {
@@ -43,390 +165,1806 @@ static PyObject* TreeMapObj_new(PyTypeObject *type, PyObject *args, PyObject *kw
     }
     self->root = NULL;
     self->size = 0;
+    avl_ctx_init(&self->ctx, AVL_DTYPE_OBJECT);
+    self->keyfunc = NULL;
+    self->btree = NULL;
+    self->vtype = AVL_DTYPE_OBJECT;
+    avl_pool_init(&self->pool, sizeof(avl_map_t), pyavl_hugepages);
+    self->share.pool = &self->pool;
+    self->share.retain = (avl_func)treemap_retain_item;
+    self->share.extra = self;
+    self->share.snapshots = 0;
+    self->owner = NULL;
     return (PyObject *)self;
 }
 
 static void TreeMapObj_free(TreeMapObj *self) {
-    avl_map_free(self->root);
+    treemap_drop(self);
+    Py_CLEAR(self->keyfunc);
     Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
 /* Methods Declaration */
 
 static PyObject* TreeMapObj_clear(TreeMapObj *self) {
-    avl_map_free(self->root);
-    self->root = NULL;
-    self->size = 0;
+    treemap_drop(self);
     Py_RETURN_NONE;
 }
 
-static PyObject* TreeMapObj_get(TreeMapObj *self, PyObject *args) {
-    int argc = args? PyTuple_Size(args): 0;
-    if (argc == 0 || argc > 2) {
+static PyObject* TreeMapObj_stats(TreeMapObj *self) {
+    return pyavl_tree_stats(&self->pool, &self->ctx);
+}
+
+static PyObject* TreeMapObj_freeze(TreeMapObj *self) {
+    if (self->keyfunc) {
+        PyErr_SetString(PyExc_ValueError, "Cannot freeze a TreeMap with a key function.");
+        return NULL;
+    }
+    pyavl_column_t keys = {(avl_node_t *)self->root, NULL, offsetof(avl_node_t, key)};
+    pyavl_column_t values = {(avl_node_t *)self->root, NULL, offsetof(avl_map_t, val)};
+    return FrozenTree_New(&FrozenTreeMap_Type, &keys, &values, self->size, &self->ctx,
+        self->vtype);
+}
+
+static PyObject* TreeMapObj_snapshot(TreeMapObj *self) {
+    if (self->owner) {
+        Py_INCREF(self);
+        return (PyObject *)self;
+    } else if (self->share.snapshots >= AVL_MAX_SNAPSHOTS) {
+        PyErr_SetString(PyExc_OverflowError, "Too many snapshots of a TreeMap.");
+        return NULL;
+    }
+    TreeMapObj *snap = (TreeMapObj *)TreeMapSnapshot_Type.tp_alloc(&TreeMapSnapshot_Type, 0);
+    if (!snap) {
+        return NULL;
+    }
+    snap->root = self->root;
+    if (snap->root) {
+        AVL_REFS(snap->root) += 1;
+    }
+    snap->size = self->size;
+    snap->ctx = self->ctx;
+    snap->ctx.ncmp = 0;
+    snap->ctx.share = NULL;
+    Py_XINCREF(self->keyfunc);
+    snap->keyfunc = self->keyfunc;
+    snap->btree = NULL;
+    snap->vtype = self->vtype;
+    avl_pool_init(&snap->pool, self->pool.node_size, self->pool.hugepages);
+    snap->share.pool = NULL;
+    snap->share.retain = NULL;
+    snap->share.extra = NULL;
+    snap->share.snapshots = 0;
+    Py_INCREF(self);
+    snap->owner = (PyObject *)self;
+    self->share.snapshots ++;
+    self->ctx.share = &self->share;
+    return (PyObject *)snap;
+}
+
+/**
+ * @brief Create an empty TreeMap with the dtypes, the aggregation and the key function of like.
+ */
+static TreeMapObj* treemap_empty(TreeMapObj *like) {
+    TreeMapObj *self = (TreeMapObj *)TreeMapObj_new(&TreeMap_Type, NULL, NULL);
+    if (self) {
+        avl_ctx_init(&self->ctx, like->ctx.dtype);
+        self->ctx.augment = like->ctx.augment;
+        self->vtype = like->vtype;
+        Py_XINCREF(like->keyfunc);
+        self->keyfunc = like->keyfunc;
+        avl_pool_init(&self->pool, like->pool.node_size, like->pool.hugepages);
+    }
+    return self;
+}
+
+static PyObject* TreeMapObj_copy(TreeMapObj *self) {
+    TreeMapObj *copy = treemap_empty(self);
+    if (!copy) {
+        return NULL;
+    }
+    int ret;
+    copy->root = (avl_map_t *)avl_node_copy((avl_node_t *)self->root, &copy->pool, &ret);
+    if (ret < 0) {
+        Py_DECREF(copy);
+        return NULL;
+    }
+    avl_node_foreach((avl_node_t *)copy->root, (avl_func)treemap_retain_item, copy);
+    copy->size = self->size;
+    copy->ctx.kind = self->ctx.kind;
+    return (PyObject *)copy;
+}
+
+static PyObject* TreeMapObj_keyset(TreeMapObj *self) {
+    return TreeSet_FromTree((avl_node_t *)self->root, self->size, &self->ctx, self->keyfunc,
+        self->keyfunc? self->pool.node_size: 0);
+}
+
+static PyObject* TreeMapObj_keys_array(TreeMapObj *self) {
+    if (self->keyfunc) {
+        PyErr_SetString(PyExc_ValueError, "Cannot export keys of a TreeMap with a key function to a buffer.");
+        return NULL;
+    }
+    pyavl_column_t keys = {(avl_node_t *)self->root, NULL, offsetof(avl_node_t, key)};
+    return pyavl_export_keys(&keys, self->size, self->ctx.dtype);
+}
+
+static PyObject* TreeMapObj_values_array(TreeMapObj *self) {
+    pyavl_column_t values = {(avl_node_t *)self->root, NULL, offsetof(avl_map_t, val)};
+    return pyavl_export_keys(&values, self->size, self->vtype);
+}
+
+static PyObject* TreeMapObj_get(TreeMapObj *self, PyObject *const *args, Py_ssize_t nargs) {
+    if (nargs == 0 || nargs > 2) {
         PyErr_SetString(
             PyExc_ValueError,
             "TreeMap.get takes 1 or 2 positional arguments."
         );
         return NULL;
     }
-    PyObject *key;
-    PyObject *ret = Py_None;
-    int parse;
-    if (argc == 1) {
-        parse = PyArg_ParseTuple(args, "O:get", &key);
-    } else {
-        parse = PyArg_ParseTuple(args, "OO:get", &key, &ret);
-    }
-    if (!parse) {
+    PyObject *key = args[0];
+    PyObject *ret = nargs == 2? args[1]: Py_None;
+
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
         return NULL;
     }
-
     int code;
     avl_map_t *found = (avl_map_t *)avl_node_find(
-        (avl_node_t *)self->root, key, &code);
+        (avl_node_t *)self->root, &self->ctx, query, &code);
+    Py_DECREF(query);
     if (code == -1) {
         PyErr_Clear();
     } else if (code == 1) {
-        ret = found->val;
+        return avl_key_to_object(self->vtype, found->val);
     }
 
     Py_INCREF(ret);
     return ret;
 }
 
-static PyObject* treemap_getkey(avl_map_t *node) {
+static PyObject* treemap_getkey(avl_map_t *node, TreeMapObj *owner) {
     if (!node) {
         return NULL;
+    } else if (owner->keyfunc) {
+        PyObject *key = PYAVL_NODE_ITEM(node, owner->pool.node_size);
+        Py_INCREF(key);
+        return key;
     }
-    PyObject *key = AVL_KEY(node);
-    Py_INCREF(key);
-    return key;
+    return avl_key_to_object(owner->ctx.dtype, AVL_RAWKEY(node));
+}
+
+/**
+ * @brief Iterate over the TreeMap, in descending order if the keyword `reverse` is true.
+ */
+static PyObject* treemap_iter(TreeMapObj *self, PyObject *const *args, Py_ssize_t nargs,
+    PyObject *kwnames, const char *name, avl_iter_getter getter) {
+    static const char *const kwlist[] = {"reverse", NULL};
+    PyObject *argv[1];
+    if (pyavl_parse_args(name, args, nargs, kwnames, kwlist, 0, 0, argv) < 0)
+        return NULL;
+    int reverse = argv[0]? PyObject_IsTrue(argv[0]): 0;
+    if (reverse < 0)
+        return NULL;
+    avl_node_t *root = (avl_node_t *)self->root;
+    return TreeIter_New(
+        (PyObject *)self,
+        reverse? avl_iter_new_at(root, self->size - 1, 1): avl_iter_new(root), -1, getter
+    );
 }
 
-static PyObject* TreeMapObj_keys(TreeMapObj *self) {
+static PyObject* TreeMapObj_iter(TreeMapObj *self) {
     return TreeIter_NewFromRoot(
-        (avl_node_t *)self->root, (avl_iter_getter)treemap_getkey
+        (PyObject *)self, (avl_node_t *)self->root, (avl_iter_getter)treemap_getkey
     );
 }
 
-static PyObject* treemap_getval(avl_map_t *node) {
+static PyObject* TreeMapObj_reversed(TreeMapObj *self) {
+    return TreeIter_New(
+        (PyObject *)self, avl_iter_new_at((avl_node_t *)self->root, self->size - 1, 1), -1,
+        (avl_iter_getter)treemap_getkey
+    );
+}
+
+static PyObject* TreeMapObj_keys(
+    TreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    return treemap_iter(self, args, nargs, kwnames, "keys", (avl_iter_getter)treemap_getkey);
+}
+
+static PyObject* treemap_getval(avl_map_t *node, TreeMapObj *owner) {
     if (!node) {
         return NULL;
     }
-    PyObject *val = node->val;
-    Py_INCREF(val);
-    return val;
+    return avl_key_to_object(owner->vtype, node->val);
 }
 
-static PyObject* TreeMapObj_values(TreeMapObj *self) {
-    return TreeIter_NewFromRoot(
-        (avl_node_t *)self->root, (avl_iter_getter)treemap_getval
-    );
+static PyObject* TreeMapObj_values(
+    TreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    return treemap_iter(self, args, nargs, kwnames, "values", (avl_iter_getter)treemap_getval);
 }
 
-static PyObject* treemap_getitem(avl_map_t *node) {
+static PyObject* treemap_getitem(avl_map_t *node, TreeMapObj *owner) {
     if (!node) {
         return NULL;
     }
-    PyObject *key = AVL_KEY(node);
-    PyObject *val = node->val;
-    return Py_BuildValue("(OO)", key, val);
+    PyObject *key = treemap_getkey(node, owner);
+    if (!key) {
+        return NULL;
+    }
+    PyObject *val = treemap_getval(node, owner);
+    if (!val) {
+        Py_DECREF(key);
+        return NULL;
+    }
+    return Py_BuildValue("(NN)", key, val);
 }
 
-static PyObject* TreeMapObj_items(TreeMapObj *self) {
-    return TreeIter_NewFromRoot(
-        (avl_node_t *)self->root, (avl_iter_getter)treemap_getitem
-    );
+static PyObject* TreeMapObj_items(
+    TreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    return treemap_iter(self, args, nargs, kwnames, "items", (avl_iter_getter)treemap_getitem);
 }
 
-static int treemap_insert(TreeMapObj *self, PyObject *key, PyObject *val) {
-    avl_map_t *node = avl_map_new(key, val);
+/**
+ * @brief Create a node for a key, whose key is derived already, and a value.
+ * 
+ * @return Return the node, NULL on errors.
+ */
+static avl_map_t* treemap_node_from(TreeMapObj *self, PyObject *derived, PyObject *key,
+    PyObject *val) {
+    avl_key_t k, v;
+    if (avl_key_import(self->ctx.dtype, derived, &k) < 0) {
+        return NULL;
+    }
+    if (avl_key_from_object(self->vtype, val, &v) < 0) {
+        avl_key_release(self->ctx.dtype, k);
+        return NULL;
+    }
+    avl_map_t *node = avl_map_new(self, k, v, key);
     if (!node) {
-        PyErr_NoMemory();
-        return -1;
+        avl_key_release(self->ctx.dtype, k);
+        avl_key_release(self->vtype, v);
     }
-    int ret;
+    return node;
+}
+
+/**
+ * @brief Create a node for a key, with the key derived from it, and a value.
+ * 
+ * @return Return the node, NULL on errors.
+ */
+static avl_map_t* treemap_new_node(TreeMapObj *self, PyObject *key, PyObject *val) {
+    PyObject *derived = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!derived) {
+        return NULL;
+    }
+    avl_map_t *node = treemap_node_from(self, derived, key, val);
+    Py_DECREF(derived);
+    return node;
+}
+
+/**
+ * @brief Insert a node, or move its value into the node with the same key and free it.
+ * 
+ * @return Return the node holding the key, NULL on errors.
+ */
+static avl_map_t* treemap_insert_node(TreeMapObj *self, avl_map_t *node) {
     avl_map_t *found;
+    int ret;
     self->root = (avl_map_t *)avl_node_insert(
-        (avl_node_t *)self->root, (avl_node_t *)node,
+        (avl_node_t *)self->root, &self->ctx, (avl_node_t *)node,
         &ret, (avl_node_t **)&found
     );
     if (ret == -1) {
-        return -1;
+        avl_map_free(self, node);
+        return NULL;
     } else if (ret == 0) {
-        avl_map_free(node);
-        Py_DECREF(found->val);
-        Py_INCREF(val);
-        found->val = val;
-    } else {
-        self->size ++;
+        avl_key_t v = found->val;
+        found->val = node->val;
+        node->val = v;
+        avl_map_free(self, node);
+        if (avl_node_refresh((avl_node_t *)self->root, &self->ctx, (avl_node_t *)found) < 0) {
+            return NULL;
+        }
+        return found;
     }
-    return 0;
+    self->size ++;
+    return node;
 }
 
-static int treemap_update(TreeMapObj *self, PyObject *mapping) {
-    if (!mapping) return 0;
+/**
+ * @brief Find the place of a derived key, see avl_node_locate.
+ * 
+ * @return Return 1 if the key is found, 0 if not and -1 on errors.
+ */
+static int treemap_locate(TreeMapObj *self, PyObject *derived, avl_slot_t *slot, avl_map_t **found) {
     int ret;
-    if (!PyDict_Check(mapping)) {
-        PyObject *mp = PyDict_New();
-        ret = -1;
-        if (PyDict_MergeFromSeq2(mp, mapping, 1) == 0) {
-            ret = treemap_update(self, mp);
-        } else {
-            PyErr_SetString(
-                PyExc_ValueError,
-                "Fails to convert argument to a dict."
-            );
-        }
-        Py_DECREF(mp);
-        return ret;
-    }
-    PyObject *key, *val;
-    Py_ssize_t pos = 0;
-    while (PyDict_Next(mapping, &pos, &key, &val)) {
-        ret = treemap_insert(self, key, val);
-        if (ret < 0) {
-            return ret;
-        }
-    }
-    return 0;
+    self->root = (avl_map_t *)avl_node_locate(
+        (avl_node_t *)self->root, &self->ctx, derived, slot, &ret, (avl_node_t **)found
+    );
+    return ret;
 }
 
-static PyObject* TreeMapObj_update(TreeMapObj *self, PyObject *args) {
-    PyObject *obj;
-    if (!PyArg_ParseTuple(args, "O:update", &obj)) {
+/**
+ * @brief Set the value of the node found at a slot in place. If the slot is stale,
+ * the key is set again from the root.
+ * 
+ * @return Return the node holding the key, NULL on errors.
+ */
+static avl_map_t* treemap_store(TreeMapObj *self, avl_slot_t *slot, avl_map_t *found,
+    PyObject *key, PyObject *val) {
+    avl_key_t v;
+    if (avl_key_from_object(self->vtype, val, &v) < 0) {
         return NULL;
     }
-    if (treemap_update(self, obj) < 0) {
-        return NULL;
+    if (!avl_slot_valid(slot, &self->ctx)) {
+        avl_key_release(self->vtype, v);
+        avl_map_t *node = treemap_new_node(self, key, val);
+        return node? treemap_insert_node(self, node): NULL;
     }
-    Py_RETURN_NONE;
+    avl_key_t old = found->val;
+    found->val = v;
+    avl_slot_refresh(slot, &self->ctx);
+    avl_key_release(self->vtype, old);
+    return found;
 }
 
-static PyObject* TreeMapObj_min(TreeMapObj *self) {
-    avl_map_t *root = self->root;
-    if (!root) {
-        PyErr_SetString(
-            PyExc_ValueError,
-            "TreeSet is empty"
-        );
+/**
+ * @brief Link a new node at a slot where the key is missing. If the slot is stale,
+ * the node is inserted from the root.
+ * 
+ * @return Return the node holding the key, NULL on errors.
+ */
+static avl_map_t* treemap_add(TreeMapObj *self, avl_slot_t *slot, PyObject *derived,
+    PyObject *key, PyObject *val) {
+    avl_map_t *node = treemap_node_from(self, derived, key, val);
+    if (!node) {
         return NULL;
+    } else if (!avl_slot_valid(slot, &self->ctx)) {
+        return treemap_insert_node(self, node);
     }
-    while (AVL_LEFT(root)) {
-        root = (avl_map_t *)AVL_LEFT(root);
-    }
-    PyObject *key = AVL_KEY(root);
-    PyObject *val = root->val;
-    return Py_BuildValue("(OO)", key, val);
+    self->root = (avl_map_t *)avl_slot_link(
+        (avl_node_t *)self->root, &self->ctx, slot, (avl_node_t *)node
+    );
+    self->size ++;
+    return node;
 }
 
-static PyObject* TreeMapObj_max(TreeMapObj *self) {
-    avl_map_t *root = self->root;
-    if (!root) {
-        PyErr_SetString(
-            PyExc_ValueError,
-            "TreeSet is empty"
-        );
-        return NULL;
+/**
+ * @brief Set a key to a value in one descent, allocating a node only if the key is missing.
+ */
+static int treemap_insert(TreeMapObj *self, PyObject *key, PyObject *val) {
+    PyObject *derived = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!derived) {
+        return -1;
     }
-    while (AVL_RIGHT(root)) {
-        root = (avl_map_t *)AVL_RIGHT(root);
+    avl_slot_t slot;
+    avl_map_t *found;
+    int ret = treemap_locate(self, derived, &slot, &found);
+    if (ret == 1) {
+        found = treemap_store(self, &slot, found, key, val);
+    } else if (ret == 0) {
+        found = treemap_add(self, &slot, derived, key, val);
     }
-    PyObject *key = AVL_KEY(root);
-    PyObject *val = root->val;
-    return Py_BuildValue("(OO)", key, val);
+    Py_DECREF(derived);
+    return ret < 0 || !found? -1: 0;
 }
 
-static PyObject* TreeMapObj_loc(TreeMapObj *self, PyObject *args) {
-    int idx;
-    if (!PyArg_ParseTuple(args, "i:loc", &idx)) {
+/**
+ * @brief Return the value of a key, setting it to default first if the key is missing,
+ * in one descent.
+ */
+static PyObject* TreeMapObj_setdefault(
+    TreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"key", "default", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args("setdefault", args, nargs, kwnames, kwlist, 1, 2, argv) < 0) {
         return NULL;
     }
-    int loc = idx;
-    if (loc < 0) {
-        loc += (int)self->size;
-    }
-    avl_map_t *node = (avl_map_t *)avl_node_loc((avl_node_t *)self->root, loc);
-    if (!node) {
-        PyErr_SetString(
-            PyExc_IndexError, "TreeMap index out of range"
-        );
+    PyObject *key = argv[0], *dflt = argv[1]? argv[1]: Py_None;
+    PyObject *derived = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!derived) {
         return NULL;
     }
-    PyObject *key = AVL_KEY(node);
-    PyObject *val = node->val;
-    return Py_BuildValue("(OO)", key, val);
+    avl_slot_t slot;
+    avl_map_t *found;
+    int ret = treemap_locate(self, derived, &slot, &found);
+    if (ret == 0) {
+        found = treemap_add(self, &slot, derived, key, dflt);
+    }
+    Py_DECREF(derived);
+    return ret < 0 || !found? NULL: treemap_getval(found, self);
 }
 
-static PyObject* TreeMapObj_at_most(TreeMapObj *self, PyObject *args) {
-    PyObject *key;
-    if (!PyArg_ParseTuple(args, "O:at_most", &key)) {
+/**
+ * @brief Return the value of a key, setting it to factory() first if the key is missing,
+ * in one descent. The factory is only called for missing keys.
+ */
+static PyObject* TreeMapObj_get_or_insert(
+    TreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"key", "factory", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args("get_or_insert", args, nargs, kwnames, kwlist, 2, 2, argv) < 0) {
         return NULL;
     }
-    int ret;
-    avl_map_t *node = (avl_map_t *)avl_node_at_most(
-        (avl_node_t *)self->root, key, &ret);
-    if (ret < 0) {
+    PyObject *key = argv[0];
+    PyObject *derived = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!derived) {
         return NULL;
-    } else if (ret == 0) {
-        Py_RETURN_NONE;
     }
-    key = AVL_KEY(node);
-    Py_INCREF(key);
-    return key;
+    avl_slot_t slot;
+    avl_map_t *found;
+    int ret = treemap_locate(self, derived, &slot, &found);
+    if (ret == 0) {
+        PyObject *val = PyObject_CallFunctionObjArgs(argv[1], NULL);
+        found = val? treemap_add(self, &slot, derived, key, val): NULL;
+        Py_XDECREF(val);
+    }
+    Py_DECREF(derived);
+    return ret < 0 || !found? NULL: treemap_getval(found, self);
 }
 
-static PyObject* TreeMapObj_at_least(TreeMapObj *self, PyObject *args) {
-    PyObject *key;
-    if (!PyArg_ParseTuple(args, "O:at_least", &key)) {
+/**
+ * @brief Add delta to the value of a key, setting it to delta if the key is missing,
+ * in one descent. Values of dtype int64 and float64 are added in place; int64 sums
+ * that overflow raise OverflowError.
+ */
+static PyObject* TreeMapObj_increment(
+    TreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"key", "delta", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args("increment", args, nargs, kwnames, kwlist, 1, 2, argv) < 0) {
         return NULL;
     }
-    int ret;
-    avl_map_t *node = (avl_map_t *)avl_node_at_least(
-        (avl_node_t *)self->root, key, &ret);
-    if (ret < 0) {
-        return NULL;
-    } else if (ret == 0) {
-        Py_RETURN_NONE;
+    PyObject *key = argv[0], *delta = argv[1];
+    avl_key_t d;
+    if (!delta) {
+        delta = PyLong_FromLong(1);
+    } else {
+        Py_INCREF(delta);
     }
-    key = AVL_KEY(node);
-    Py_INCREF(key);
-    return key;
-}
-
-/* init */
-static PyObject*
-TreeMapObj_init(TreeMapObj *self, PyObject *args, PyObject *kwargs) {
-    int argc = args? PyTuple_Size(args): 0;
-    if (argc > 1) {
-        PyErr_SetString(
-            PyExc_ValueError,
-            "TreeMap.__init__ takes at most 1 positional argument."
-        );
+    if (!delta) {
         return NULL;
     }
-
-    if (argc == 1) {
-        PyObject *obj;
-        if (!PyArg_ParseTuple(args, "O:__init__", &obj)) {
-            return NULL;
-        }
-        if (treemap_update(self, obj) < 0) {
+    /* unboxed deltas are converted before the descent, which no Python code may follow */
+    if (self->vtype == AVL_DTYPE_INT64 || self->vtype == AVL_DTYPE_FLOAT64) {
+        PyObject *num = self->vtype == AVL_DTYPE_INT64?
+            PyNumber_Index(delta): PyNumber_Float(delta);
+        Py_DECREF(delta);
+        delta = num;
+        if (!delta || avl_key_from_object(self->vtype, delta, &d) < 0) {
+            Py_XDECREF(delta);
             return NULL;
         }
     }
-
-    if (treemap_update(self, kwargs) < 0) {
+    PyObject *derived = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!derived) {
+        Py_DECREF(delta);
         return NULL;
     }
 
-    Py_RETURN_NONE;
+    avl_slot_t slot;
+    avl_map_t *found;
+    int ret = treemap_locate(self, derived, &slot, &found);
+    if (ret == 0) {
+        found = treemap_add(self, &slot, derived, key, delta);
+    } else if (ret == 1 && self->vtype == AVL_DTYPE_INT64) {
+        int64_t v = found->val.i64;
+        if ((d.i64 > 0 && v > INT64_MAX - d.i64) || (d.i64 < 0 && v < INT64_MIN - d.i64)) {
+            PyErr_SetString(PyExc_OverflowError, "TreeMap.increment overflows int64.");
+            found = NULL;
+        } else {
+            found->val.i64 = v + d.i64;
+            avl_slot_refresh(&slot, &self->ctx);
+        }
+    } else if (ret == 1 && self->vtype == AVL_DTYPE_FLOAT64) {
+        found->val.f64 += d.f64;
+        avl_slot_refresh(&slot, &self->ctx);
+    } else if (ret == 1) {
+        PyObject *val = PyNumber_Add(found->val.obj, delta);
+        found = val? treemap_store(self, &slot, found, key, val): NULL;
+        Py_XDECREF(val);
+    }
+    Py_DECREF(derived);
+    Py_DECREF(delta);
+    return ret < 0 || !found? NULL: treemap_getval(found, self);
 }
 
-/* Mapping Protocol */
-
-static Py_ssize_t TreeMapObj_length(TreeMapObj *self) {
-    return self->size;
+/**
+ * @brief Set the value of a key to func(value), or to func(default) if the key is
+ * missing, in one descent unless func changes the tree. Return the new value.
+ */
+static PyObject* TreeMapObj_update_with(
+    TreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"key", "func", "default", NULL};
+    PyObject *argv[3];
+    if (pyavl_parse_args("update_with", args, nargs, kwnames, kwlist, 2, 3, argv) < 0) {
+        return NULL;
+    }
+    PyObject *key = argv[0], *func = argv[1];
+    PyObject *derived = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!derived) {
+        return NULL;
+    }
+    avl_slot_t slot;
+    avl_map_t *found;
+    int ret = treemap_locate(self, derived, &slot, &found);
+    if (ret >= 0) {
+        PyObject *old = ret? treemap_getval(found, self): argv[2]? argv[2]: Py_None;
+        if (!ret) {
+            Py_INCREF(old);
+        }
+        PyObject *val = old? PyObject_CallFunctionObjArgs(func, old, NULL): NULL;
+        Py_XDECREF(old);
+        if (!val) {
+            found = NULL;
+        } else if (ret) {
+            found = treemap_store(self, &slot, found, key, val);
+        } else {
+            found = treemap_add(self, &slot, derived, key, val);
+        }
+        Py_XDECREF(val);
+    }
+    Py_DECREF(derived);
+    return ret < 0 || !found? NULL: treemap_getval(found, self);
 }
 
-static PyObject* TreeMapObj_subscript(TreeMapObj *self, PyObject *key) {
-    int ret;
-    avl_map_t *found = (avl_map_t *)avl_node_find(
-        (avl_node_t *)self->root, key, &ret
-    );
-
-    if (ret <= 0) {
-        _PyErr_SetKeyError(key);
-        return NULL;
+extern PyObject* pyavl_map_pairs(PyObject *mapping) {
+    if (PyDict_Check(mapping) || PyObject_HasAttrString(mapping, "keys")) {
+        PyObject *items = PyObject_CallMethod(mapping, "items", NULL);
+        PyObject *iter = items? PyObject_GetIter(items): NULL;
+        Py_XDECREF(items);
+        return iter;
     }
-    PyObject *val = found->val;
-    Py_INCREF(val);
-    return val;
+    return PyObject_GetIter(mapping);
 }
 
-static int treemap_delete(TreeMapObj *self, PyObject *key, avl_map_t **deleted) {
-    int ret;
-    avl_map_t *tmp = NULL;
-    self->root = (avl_map_t *)avl_node_delete(
-        (avl_node_t *)self->root, key,
-        &ret, (avl_node_t **)&tmp
-    );
-    if (ret == -1) {
-        return -1;
-    } else if (ret == 0) {
-        _PyErr_SetKeyError(key);
+extern int pyavl_map_next_pair(PyObject *iter, Py_ssize_t idx, PyObject **key, PyObject **val) {
+    PyObject *item = PyIter_Next(iter);
+    if (!item) {
+        return PyErr_Occurred()? -1: 0;
+    }
+    PyObject *fast = PyTuple_CheckExact(item)? item: PySequence_Fast(item, "");
+    if (!fast) {
+        Py_DECREF(item);
+        PyErr_Format(
+            PyExc_TypeError,
+            "cannot convert TreeMap update sequence element #%zd to a sequence",
+            idx
+        );
         return -1;
     }
-    if (deleted) {
-        *deleted = tmp;
+    Py_ssize_t len = PySequence_Fast_GET_SIZE(fast);
+    int ret = -1;
+    if (len == 2) {
+        *key = PySequence_Fast_GET_ITEM(fast, 0);
+        *val = PySequence_Fast_GET_ITEM(fast, 1);
+        Py_INCREF(*key);
+        Py_INCREF(*val);
+        ret = 1;
     } else {
-        avl_map_free(tmp);
+        PyErr_Format(
+            PyExc_ValueError,
+            "TreeMap update sequence element #%zd has length %zd; 2 is required",
+            idx, len
+        );
     }
-    self->size --;
-    return 0;
+    if (fast != item) {
+        Py_DECREF(fast);
+    }
+    Py_DECREF(item);
+    return ret;
 }
 
-static int TreeMapObj_ass_sub(TreeMapObj *self, PyObject *key, PyObject *val) {
-    if (!val) {
-        return treemap_delete(self, key, NULL);
-    }
-    return treemap_insert(self, key, val);
+/**
+ * @brief Move the value of a node into the node of the tree with the same key and free it.
+ */
+static void treemap_merge_value(avl_map_t *kept, avl_map_t *node, TreeMapObj *self) {
+    avl_key_t v = kept->val;
+    kept->val = node->val;
+    node->val = v;
+    avl_map_free(self, node);
 }
 
-static PyMappingMethods TreeMapObj_Mapping = {
-    (lenfunc)TreeMapObj_length,         // mp_length
-    (binaryfunc)TreeMapObj_subscript,   // mp_subscript
-    (objobjargproc)TreeMapObj_ass_sub,  // mp_ass_subscript
-};
+/* a batch of at least 1/TREEMAP_MERGE_RATIO of the tree is merged rather than inserted */
+#define TREEMAP_MERGE_RATIO     16
+
+/**
+ * @brief Add nodes sorted by key without equal keys, taking them over. Values of
+ * keys in the tree are replaced. An empty tree is built from the nodes in O(m), and a
+ * large batch is merged in O(n + m) by avl_node_merge, unless comparisons may run
+ * Python code or nodes are shared with snapshots. Other nodes are inserted one by one.
+ * 
+ * @return Return 0 on success, -1 on errors.
+ */
+static int treemap_add_nodes(TreeMapObj *self, avl_map_t **nodes, Py_ssize_t m) {
+    Py_ssize_t i = 0;
+    int ret = 0;
+    if (!self->root) {
+        self->root = (avl_map_t *)avl_node_build((avl_node_t **)nodes, m, &self->ctx);
+        self->size = m;
+        return 0;
+    } else if (m * TREEMAP_MERGE_RATIO >= self->size &&
+        !self->ctx.share && !avl_ctx_fallible(&self->ctx)) {
+        self->root = (avl_map_t *)avl_node_merge(
+            (avl_node_t *)self->root, (avl_node_t **)nodes, m, &self->ctx,
+            (avl_merge_func)treemap_merge_value, self, &ret
+        );
+        self->size = AVL_SIZE0(self->root);
+        i = ret < 0? 0: m;
+    } else {
+        while (i < m && treemap_insert_node(self, nodes[i])) {
+            i ++;
+        }
+        if (i < m) {
+            /* the failed node is freed already */
+            ret = -1;
+            i ++;
+        }
+    }
+    for (; i < m; i++) {
+        avl_map_free(self, nodes[i]);
+    }
+    return ret;
+}
+
+typedef struct {
+    TreeMapObj *self;
+    TreeMapObj *src;
+    avl_map_t **nodes;
+    Py_ssize_t m;
+    int failed;
+} treemap_copy_t;
+
+/**
+ * @brief Copy a node of another TreeMap of the same dtypes and key function,
+ * taking references to its items.
+ */
+static void treemap_copy_node(avl_map_t *node, treemap_copy_t *st) {
+    TreeMapObj *self = st->self;
+    if (st->failed) {
+        return;
+    }
+    PyObject *item = self->keyfunc? PYAVL_NODE_ITEM(node, st->src->pool.node_size): NULL;
+    avl_map_t *copy = avl_map_new(self, AVL_RAWKEY(node), node->val, item);
+    if (!copy) {
+        st->failed = 1;
+        return;
+    }
+    if (AVL_DTYPE_BOXED(self->ctx.dtype)) {
+        Py_INCREF(AVL_RAWKEY(node).obj);
+    }
+    if (AVL_DTYPE_BOXED(self->vtype)) {
+        Py_INCREF(node->val.obj);
+    }
+    st->nodes[st->m++] = copy;
+}
+
+/**
+ * @brief Set the pairs of another TreeMap, or a snapshot, of the same dtypes and key
+ * function. Its nodes are copied in order, without comparisons nor Python objects.
+ */
+static int treemap_update_from(TreeMapObj *self, TreeMapObj *src) {
+    if (src == self || !src->root) {
+        return 0;
+    }
+    treemap_copy_t st = {self, src, PyMem_New(avl_map_t *, src->size), 0, 0};
+    if (!st.nodes) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    avl_node_foreach((avl_node_t *)src->root, (avl_func)treemap_copy_node, &st);
+    int ret = -1;
+    if (st.failed) {
+        for (Py_ssize_t i = 0; i < st.m; i++) {
+            avl_map_free(self, st.nodes[i]);
+        }
+    } else {
+        avl_ctx_merge(&self->ctx, &src->ctx);
+        ret = treemap_add_nodes(self, st.nodes, st.m);
+    }
+    PyMem_Free(st.nodes);
+    return ret;
+}
+
+/* pairs streamed in by treemap_update, converted to stored keys and values */
+typedef struct {
+    avl_key_t *keys;
+    avl_key_t *vals;
+    PyObject **items;       /* the keys the stored ones are derived from, with a key function */
+    Py_ssize_t n;
+    Py_ssize_t cap;
+    int sorted;
+} treemap_batch_t;
+
+/**
+ * @brief Release the pairs of a batch from start on, and its arrays.
+ */
+static void treemap_batch_free(TreeMapObj *self, treemap_batch_t *batch, Py_ssize_t start) {
+    for (Py_ssize_t i = start; i < batch->n; i++) {
+        avl_key_release(self->ctx.dtype, batch->keys[i]);
+        avl_key_release(self->vtype, batch->vals[i]);
+        Py_XDECREF(batch->items[i]);
+    }
+    PyMem_Free(batch->keys);
+    PyMem_Free(batch->vals);
+    PyMem_Free(batch->items);
+}
+
+/**
+ * @brief Convert a pair and append it to a batch, noting whether keys still come sorted.
+ * 
+ * @return Return 0 on success, -1 on errors.
+ */
+static int treemap_batch_push(TreeMapObj *self, treemap_batch_t *batch, PyObject *key, PyObject *val) {
+    if (batch->n == batch->cap) {
+        Py_ssize_t cap = batch->cap? batch->cap * 2: 64;
+        avl_key_t *keys = PyMem_Resize(batch->keys, avl_key_t, cap);
+        batch->keys = keys? keys: batch->keys;
+        avl_key_t *vals = keys? PyMem_Resize(batch->vals, avl_key_t, cap): NULL;
+        batch->vals = vals? vals: batch->vals;
+        PyObject **items = vals? PyMem_Resize(batch->items, PyObject *, cap): NULL;
+        batch->items = items? items: batch->items;
+        if (!items) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        batch->cap = cap;
+    }
+    avl_key_t k, v;
+    PyObject *derived = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!derived) {
+        return -1;
+    }
+    int ret = avl_key_import(self->ctx.dtype, derived, &k);
+    Py_DECREF(derived);
+    if (ret < 0) {
+        return -1;
+    } else if (avl_key_from_object(self->vtype, val, &v) < 0) {
+        avl_key_release(self->ctx.dtype, k);
+        return -1;
+    }
+    avl_ctx_observe(&self->ctx, k);
+    int cmp = batch->sorted && batch->n?
+        avl_key_cmp(&self->ctx, batch->keys[batch->n - 1], k): -1;
+    if (cmp == -2) {
+        avl_key_release(self->ctx.dtype, k);
+        avl_key_release(self->vtype, v);
+        return -1;
+    } else if (cmp == 1) {
+        batch->sorted = 0;
+    }
+    batch->keys[batch->n] = k;
+    batch->vals[batch->n] = v;
+    batch->items[batch->n] = self->keyfunc? key: NULL;
+    Py_XINCREF(batch->items[batch->n]);
+    batch->n ++;
+    return 0;
+}
+
+/**
+ * @brief Create the nodes of a batch in key order, sorting it unless it came sorted,
+ * so that nodes are laid out in order. Of equal keys, the first key and the last value
+ * are kept. The batch is released.
+ * 
+ * @param out Set to a new array of the nodes, to release by PyMem_Free.
+ * @return Return the number of nodes, -1 on errors.
+ */
+static Py_ssize_t treemap_batch_nodes(TreeMapObj *self, treemap_batch_t *batch, avl_map_t ***out) {
+    Py_ssize_t n = batch->n, m = 0, i = 0;
+    size_t *order = batch->sorted? NULL: PyMem_New(size_t, n);
+    avl_map_t **nodes = PyMem_New(avl_map_t *, n? n: 1);
+    if (!nodes || (!batch->sorted && !order)) {
+        PyErr_NoMemory();
+        goto error;
+    } else if (order && avl_keys_argsort(&self->ctx, batch->keys, n, (size_t *)order) < 0) {
+        goto error;
+    }
+    for (; i < n; i++) {
+        Py_ssize_t j = order? (Py_ssize_t)order[i]: i;
+        avl_key_t k = batch->keys[j], v = batch->vals[j];
+        PyObject *item = batch->items[j];
+        int cmp = m? avl_key_cmp(&self->ctx, AVL_RAWKEY(nodes[m - 1]), k): -1;
+        if (cmp == -2) {
+            goto error;
+        } else if (cmp == 0) {
+            avl_key_release(self->vtype, nodes[m - 1]->val);
+            nodes[m - 1]->val = v;
+            avl_key_release(self->ctx.dtype, k);
+        } else if ((nodes[m] = avl_map_new(self, k, v, item))) {
+            m ++;
+        } else {
+            goto error;
+        }
+        Py_XDECREF(item);
+        /* taken over, so that errors release only the rest */
+        batch->items[j] = NULL;
+        batch->keys[j].obj = NULL;
+        batch->vals[j].obj = NULL;
+    }
+    batch->n = 0;
+    treemap_batch_free(self, batch, 0);
+    PyMem_Free(order);
+    *out = nodes;
+    return m;
+
+error:
+    for (Py_ssize_t k = 0; k < m; k++) {
+        avl_map_free(self, nodes[k]);
+    }
+    PyMem_Free(nodes);
+    PyMem_Free(order);
+    treemap_batch_free(self, batch, 0);
+    return -1;
+}
+
+/**
+ * @brief Set the pairs of a mapping or an iterable of pairs, streamed without a
+ * temporary dict or list of pairs. A TreeMap of the same dtypes and key function hands
+ * over its nodes in order. Other pairs are converted as they come into arrays of keys
+ * and values, sorted unless they came sorted, and added in bulk as nodes, see
+ * treemap_add_nodes.
+ */
+static int treemap_update(TreeMapObj *self, PyObject *mapping) {
+    if (!mapping) return 0;
+    if (TreeMapObj_Check(mapping) || TreeMapSnapshotObj_Check(mapping)) {
+        TreeMapObj *src = (TreeMapObj *)mapping;
+        if (src->ctx.dtype == self->ctx.dtype && src->vtype == self->vtype &&
+            src->keyfunc == self->keyfunc) {
+            return treemap_update_from(self, src);
+        }
+    }
+    PyObject *iter = pyavl_map_pairs(mapping);
+    if (!iter) {
+        return -1;
+    }
+    treemap_batch_t batch = {NULL, NULL, NULL, 0, 0, 1};
+    int ret;
+    for (Py_ssize_t idx = 0; ; idx++) {
+        PyObject *key = NULL, *val = NULL;
+        if ((ret = pyavl_map_next_pair(iter, idx, &key, &val)) <= 0) {
+            break;
+        }
+        ret = treemap_batch_push(self, &batch, key, val);
+        Py_DECREF(key);
+        Py_DECREF(val);
+        if (ret < 0) {
+            break;
+        }
+    }
+    Py_DECREF(iter);
+    if (ret < 0) {
+        treemap_batch_free(self, &batch, 0);
+    } else {
+        avl_map_t **nodes;
+        Py_ssize_t m = treemap_batch_nodes(self, &batch, &nodes);
+        if (m < 0) {
+            ret = -1;
+        } else {
+            ret = treemap_add_nodes(self, nodes, m);
+            PyMem_Free(nodes);
+        }
+    }
+    if (ret < 0 && !self->root) {
+        treemap_reset_ctx(self, self->ctx.dtype);
+    }
+    return ret;
+}
+
+static PyObject* TreeMapObj_update(TreeMapObj *self, PyObject *obj) {
+    if (treemap_update(self, obj) < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* TreeMapObj_min(TreeMapObj *self) {
+    avl_map_t *root = self->root;
+    if (!root) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "TreeSet is empty"
+        );
+        return NULL;
+    }
+    root = (avl_map_t *)avl_node_end((avl_node_t *)root, &self->ctx, 0);
+    return treemap_getitem(root, self);
+}
+
+static PyObject* TreeMapObj_max(TreeMapObj *self) {
+    avl_map_t *root = self->root;
+    if (!root) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "TreeSet is empty"
+        );
+        return NULL;
+    }
+    root = (avl_map_t *)avl_node_end((avl_node_t *)root, &self->ctx, 1);
+    return treemap_getitem(root, self);
+}
+
+static PyObject* TreeMapObj_loc(TreeMapObj *self, PyObject *arg) {
+    Py_ssize_t loc = PyNumber_AsSsize_t(arg, PyExc_OverflowError);
+    if (loc == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    if (loc < 0) {
+        loc += self->size;
+    }
+    avl_map_t *node = (avl_map_t *)avl_node_loc((avl_node_t *)self->root, loc);
+    if (!node) {
+        PyErr_SetString(
+            PyExc_IndexError, "TreeMap index out of range"
+        );
+        return NULL;
+    }
+    return treemap_getitem(node, self);
+}
+
+/**
+ * @brief Remove and return the (key, val) pair at a position, the last one by default,
+ * descending by subtree sizes without comparing keys.
+ */
+static PyObject* TreeMapObj_popitem(
+    TreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"index", NULL};
+    PyObject *argv[1];
+    if (pyavl_parse_args("popitem", args, nargs, kwnames, kwlist, 0, 1, argv) < 0) {
+        return NULL;
+    }
+    Py_ssize_t loc = argv[0]? PyNumber_AsSsize_t(argv[0], PyExc_OverflowError): -1;
+    if (loc == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    if (loc < 0) {
+        loc += self->size;
+    }
+    avl_map_t *deleted;
+    int ret;
+    self->root = (avl_map_t *)avl_node_delete_at(
+        (avl_node_t *)self->root, &self->ctx, loc, &ret, (avl_node_t **)&deleted
+    );
+    if (ret == -1) {
+        return NULL;
+    } else if (ret == 0) {
+        if (self->size) {
+            PyErr_SetString(PyExc_IndexError, "TreeMap index out of range");
+        } else {
+            PyErr_SetString(PyExc_KeyError, "popitem(): TreeMap is empty");
+        }
+        return NULL;
+    }
+    self->size --;
+    PyObject *item = treemap_getitem(deleted, self);
+    avl_map_free(self, deleted);
+    return item;
+}
+
+static void treemap_free_node(avl_map_t *node, TreeMapObj *self) {
+    avl_map_free(self, node);
+}
+
+/**
+ * @brief Replace the value of a node, releasing the old one after the node holds the new one.
+ */
+static int treemap_set_val(avl_map_t *node, TreeMapObj *self, PyObject *val) {
+    avl_key_t v;
+    if (avl_key_from_object(self->vtype, val, &v) < 0) {
+        return -1;
+    }
+    avl_key_t old = node->val;
+    node->val = v;
+    avl_key_release(self->vtype, old);
+    return 0;
+}
+
+static const pyavl_cursor_ops_t treemap_cursor_ops = {
+    (avl_iter_getter)treemap_getkey,
+    (avl_iter_getter)treemap_getval,
+    (avl_node_t* (*)(PyObject *, PyObject *, PyObject *))treemap_new_node,
+    (void (*)(avl_node_t *, PyObject *))treemap_free_node,
+    (int (*)(avl_node_t *, PyObject *, PyObject *))treemap_set_val,
+};
+
+/* snapshots never change */
+static const pyavl_cursor_ops_t treemap_snapshot_cursor_ops = {
+    (avl_iter_getter)treemap_getkey,
+    (avl_iter_getter)treemap_getval,
+    NULL,
+    NULL,
+    NULL,
+};
+
+static PyObject* TreeMapObj_cursor(TreeMapObj *self) {
+    return TreeCursor_New(
+        (PyObject *)self, self->owner? &treemap_snapshot_cursor_ops: &treemap_cursor_ops
+    );
+}
+
+static PyObject* TreeMapObj_at_most(TreeMapObj *self, PyObject *key) {
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return NULL;
+    }
+    ptrdiff_t ret;
+    avl_map_t *node = (avl_map_t *)avl_node_at_most(
+        (avl_node_t *)self->root, &self->ctx, query, &ret);
+    Py_DECREF(query);
+    if (ret < 0) {
+        return NULL;
+    } else if (ret == 0) {
+        Py_RETURN_NONE;
+    }
+    return treemap_getkey(node, self);
+}
+
+static PyObject* TreeMapObj_bisect_left(TreeMapObj *self, PyObject *key) {
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return NULL;
+    }
+    Py_ssize_t ret = avl_node_bisect((avl_node_t *)self->root, &self->ctx, query, 0, NULL);
+    Py_DECREF(query);
+    if (ret < 0) {
+        return NULL;
+    }
+    return PyLong_FromSsize_t(ret);
+}
+
+static PyObject* TreeMapObj_bisect_right(TreeMapObj *self, PyObject *key) {
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return NULL;
+    }
+    Py_ssize_t ret = avl_node_bisect((avl_node_t *)self->root, &self->ctx, query, 1, NULL);
+    Py_DECREF(query);
+    if (ret < 0) {
+        return NULL;
+    }
+    return PyLong_FromSsize_t(ret);
+}
+
+static PyObject* TreeMapObj_index(TreeMapObj *self, PyObject *key) {
+    int found;
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return NULL;
+    }
+    Py_ssize_t ret = avl_node_bisect((avl_node_t *)self->root, &self->ctx, query, 0, &found);
+    Py_DECREF(query);
+    if (ret < 0) {
+        return NULL;
+    } else if (!found) {
+        PyErr_SetObject(PyExc_KeyError, key);
+        return NULL;
+    }
+    return PyLong_FromSsize_t(ret);
+}
+
+static PyObject* TreeMapObj_count_range(
+    TreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    PyObject *lo, *hi;
+    int lo_inclusive, hi_inclusive;
+    if (pyavl_parse_range(
+            "count_range", args, nargs, kwnames, &lo, &hi, &lo_inclusive, &hi_inclusive) < 0)
+        return NULL;
+    Py_ssize_t start, end;
+    if (pyavl_range_bounds(
+            (PyAVLTreeObj *)self, lo, hi, lo_inclusive, hi_inclusive, &start, &end) < 0)
+        return NULL;
+    return PyLong_FromSsize_t(end - start);
+}
+
+typedef struct {
+    Py_ssize_t count;
+    double sum;
+    double min;
+    double max;
+} treemap_agg_t;
+
+static void treemap_agg_node(avl_aggmap_t *node, treemap_agg_t *agg) {
+    double val = node->_.val.f64;
+    if (!agg->count || val < agg->min) agg->min = val;
+    if (!agg->count || val > agg->max) agg->max = val;
+    agg->sum += val;
+    agg->count += 1;
+}
+
+static void treemap_agg_tree(avl_aggmap_t *node, treemap_agg_t *agg) {
+    if (!agg->count || node->min < agg->min) agg->min = node->min;
+    if (!agg->count || node->max > agg->max) agg->max = node->max;
+    agg->sum += node->sum;
+    agg->count += AVL_SIZE(node);
+}
+
+static PyObject* TreeMapObj_aggregate(
+    TreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"lo", "hi", "op", "inclusive", NULL};
+    PyObject *argv[4];
+    if (pyavl_parse_args("aggregate", args, nargs, kwnames, kwlist, 0, 4, argv) < 0)
+        return NULL;
+    PyObject *lo = argv[0]? argv[0]: Py_None, *hi = argv[1]? argv[1]: Py_None;
+    const char *op = "sum";
+    int lo_inclusive = 1, hi_inclusive = 1;
+    if (argv[2] && !PyUnicode_Check(argv[2])) {
+        PyErr_Format(
+            PyExc_TypeError, "aggregate() argument 'op' must be str, not %.200s",
+            Py_TYPE(argv[2])->tp_name
+        );
+        return NULL;
+    } else if (argv[2] && !(op = PyUnicode_AsUTF8(argv[2]))) {
+        return NULL;
+    } else if (argv[3] && pyavl_parse_inclusive(argv[3], &lo_inclusive, &hi_inclusive) < 0) {
+        return NULL;
+    }
+    int count = strcmp(op, "count") == 0;
+    if (!count && strcmp(op, "sum") && strcmp(op, "min") && strcmp(op, "max")) {
+        PyErr_Format(
+            PyExc_ValueError, "aggregate op must be 'sum', 'min', 'max' or 'count', not '%.100s'", op
+        );
+        return NULL;
+    }
+    if (count) {
+        Py_ssize_t start, end;
+        if (pyavl_range_bounds(
+                (PyAVLTreeObj *)self, lo, hi, lo_inclusive, hi_inclusive, &start, &end) < 0)
+            return NULL;
+        return PyLong_FromSsize_t(end - start);
+    }
+    if (!self->ctx.augment) {
+        PyErr_SetString(
+            PyExc_ValueError, "TreeMap keeps no aggregates of values without aggregate=True."
+        );
+        return NULL;
+    }
+
+    PyObject *bounds[2] = {NULL, NULL};
+    for (int i = 0; i < 2; i++) {
+        PyObject *bound = i? hi: lo;
+        if (bound != Py_None && !(bounds[i] = pyavl_derive_key((PyAVLTreeObj *)self, bound))) {
+            Py_XDECREF(bounds[0]);
+            return NULL;
+        }
+    }
+    treemap_agg_t agg = {0, 0.0, 0.0, 0.0};
+    int ret = avl_node_cover(
+        (avl_node_t *)self->root, &self->ctx, bounds[0], bounds[1], lo_inclusive, hi_inclusive,
+        (avl_func)treemap_agg_node, (avl_func)treemap_agg_tree, &agg);
+    Py_XDECREF(bounds[0]);
+    Py_XDECREF(bounds[1]);
+    if (ret < 0)
+        return NULL;
+    if (op[1] == 'u') {
+        return PyFloat_FromDouble(agg.sum);
+    } else if (!agg.count) {
+        Py_RETURN_NONE;
+    }
+    return PyFloat_FromDouble(op[1] == 'i'? agg.min: agg.max);
+}
+
+static PyObject* TreeMapObj_irange(
+    TreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    PyObject *lo, *hi;
+    int lo_inclusive, hi_inclusive;
+    if (pyavl_parse_range(
+            "irange", args, nargs, kwnames, &lo, &hi, &lo_inclusive, &hi_inclusive) < 0)
+        return NULL;
+    return TreeRange_New(
+        (PyObject *)self, lo, hi, lo_inclusive, hi_inclusive, (avl_iter_getter)treemap_getkey
+    );
+}
+
+static PyObject* TreeMapObj_iter_from(
+    TreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"key", "inclusive", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args("iter_from", args, nargs, kwnames, kwlist, 1, 2, argv) < 0)
+        return NULL;
+    PyObject *key = argv[0];
+    int inclusive = argv[1]? PyObject_IsTrue(argv[1]): 1;
+    if (inclusive < 0)
+        return NULL;
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return NULL;
+    }
+    avl_iter_t *iter = avl_iter_new_from(
+        (avl_node_t *)self->root, &self->ctx, query, inclusive, 0);
+    Py_DECREF(query);
+    return TreeIter_New((PyObject *)self, iter, -1, (avl_iter_getter)treemap_getkey);
+}
+
+static PyObject* TreeMapObj_iter_before(
+    TreeMapObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"key", "inclusive", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args("iter_before", args, nargs, kwnames, kwlist, 1, 2, argv) < 0)
+        return NULL;
+    PyObject *key = argv[0];
+    int inclusive = argv[1]? PyObject_IsTrue(argv[1]): 0;
+    if (inclusive < 0)
+        return NULL;
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return NULL;
+    }
+    avl_iter_t *iter = avl_iter_new_from(
+        (avl_node_t *)self->root, &self->ctx, query, inclusive, 1);
+    Py_DECREF(query);
+    return TreeIter_New((PyObject *)self, iter, -1, (avl_iter_getter)treemap_getkey);
+}
+
+static PyObject* TreeMapObj_at_least(TreeMapObj *self, PyObject *key) {
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return NULL;
+    }
+    ptrdiff_t ret;
+    avl_map_t *node = (avl_map_t *)avl_node_at_least(
+        (avl_node_t *)self->root, &self->ctx, query, &ret);
+    Py_DECREF(query);
+    if (ret < 0) {
+        return NULL;
+    } else if (ret == 0) {
+        Py_RETURN_NONE;
+    }
+    return treemap_getkey(node, self);
+}
+
+/* init */
+
+/**
+ * @brief The size of nodes with or without aggregates of values and the key derived from:
+ * aggregates of values follow the value, and the key derived from goes last.
+ */
+static size_t treemap_node_size(int aggregate, int keyed) {
+    return (aggregate? sizeof(avl_aggmap_t): sizeof(avl_map_t)) + (keyed? sizeof(PyObject *): 0);
+}
+
+/**
+ * @brief Size nodes of an empty TreeMap for its aggregation and key function.
+ */
+static void treemap_size_nodes(TreeMapObj *self) {
+    size_t node_size = treemap_node_size(self->ctx.augment != NULL, self->keyfunc != NULL);
+    if (node_size != self->pool.node_size) {
+        treemap_drop(self);
+        avl_pool_init(&self->pool, node_size, self->pool.hugepages);
+    }
+}
+
+/**
+ * @brief Switch an empty TreeMap to nodes with or without aggregates of values.
+ */
+static void treemap_set_aggregate(TreeMapObj *self, int aggregate) {
+    self->ctx.augment = aggregate? (avl_augment_func)treemap_augment: NULL;
+    treemap_size_nodes(self);
+}
+
+/**
+ * @brief Set the dtypes, the aggregation and the key function of an empty TreeMap
+ * from the keyword arguments of __init__. "key_dtype", "value_dtype", "aggregate",
+ * "key" and "backend", which __new__ has handled, are removed from kwargs, which
+ * becomes a new reference.
+ */
+static int treemap_init_options(TreeMapObj *self, PyObject **kwargs) {
+    static const char *names[5] = {"key_dtype", "value_dtype", "aggregate", "key", "backend"};
+    PyObject *opts[5] = {NULL, NULL, NULL, NULL, NULL};
+    if (*kwargs) {
+        for (int i = 0; i < 5; i++) {
+            opts[i] = PyDict_GetItemString(*kwargs, names[i]);
+        }
+    }
+    if (!opts[0] && !opts[1] && !opts[2] && !opts[3] && !opts[4]) {
+        Py_XINCREF(*kwargs);
+        return 0;
+    }
+
+    avl_dtype_t dtypes[2] = {self->ctx.dtype, self->vtype};
+    for (int i = 0; i < 2; i++) {
+        if (opts[i] && avl_dtype_parse(opts[i], &dtypes[i]) < 0) {
+            return -1;
+        }
+    }
+    int aggregate = self->ctx.augment != NULL;
+    if (opts[2]) {
+        aggregate = PyObject_IsTrue(opts[2]);
+        if (aggregate < 0) {
+            return -1;
+        } else if (aggregate && !opts[1]) {
+            dtypes[1] = AVL_DTYPE_FLOAT64;
+        }
+    }
+    if (aggregate && dtypes[1] != AVL_DTYPE_FLOAT64) {
+        PyErr_SetString(
+            PyExc_ValueError, "TreeMap with aggregate=True needs value_dtype='float64'."
+        );
+        return -1;
+    }
+    /* snapshots keep their nodes in the pool, so its node size is fixed */
+    int keyed = opts[3]? opts[3] != Py_None: self->keyfunc != NULL;
+    if (self->share.snapshots && treemap_node_size(aggregate, keyed) != self->pool.node_size) {
+        PyErr_SetString(
+            PyExc_ValueError, "Cannot change aggregate or key of a TreeMap with snapshots."
+        );
+        return -1;
+    }
+    if (dtypes[0] != self->ctx.dtype || dtypes[1] != self->vtype ||
+        aggregate != (self->ctx.augment != NULL)) {
+        if (self->size) {
+            PyErr_SetString(
+                PyExc_ValueError, "Cannot change dtypes of a non-empty TreeMap."
+            );
+            return -1;
+        }
+        treemap_reset_ctx(self, dtypes[0]);
+        self->vtype = dtypes[1];
+        if (aggregate != (self->ctx.augment != NULL)) {
+            treemap_set_aggregate(self, aggregate);
+        }
+    }
+    if (opts[3]) {
+        if (pyavl_set_keyfunc((PyAVLTreeObj *)self, opts[3]) < 0) {
+            return -1;
+        }
+        treemap_size_nodes(self);
+    }
+
+    *kwargs = PyDict_Copy(*kwargs);
+    if (!*kwargs) {
+        return -1;
+    }
+    for (int i = 0; i < 5; i++) {
+        if (opts[i] && PyDict_DelItemString(*kwargs, names[i]) < 0) {
+            Py_CLEAR(*kwargs);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static PyObject* treemap_save(TreeMapObj *self, PyObject *file) {
+    avl_dtype_t dtypes[3] = {self->ctx.dtype, self->vtype, AVL_DTYPE_OBJECT};
+    avl_node_t *root = (avl_node_t *)self->root;
+    pyavl_column_t columns[3] = {
+        {root, NULL, offsetof(avl_node_t, key)},
+        {root, NULL, offsetof(avl_map_t, val)},
+        {root, NULL, self->pool.node_size - sizeof(PyObject *)}
+    };
+    return pyavl_snapshot_save(file, (PyAVLTreeObj *)self, PYAVL_SNAPSHOT_MAP,
+        self->ctx.augment? PYAVL_SNAPSHOT_AGGREGATE: 0, self->keyfunc? 3: 2, dtypes, columns);
+}
+
+/**
+ * @brief Link nodes bottom-up without comparisons from columns of sorted distinct keys,
+ * their values and the objects keys are derived from, into an empty TreeMap.
+ * The tree takes over the keys and the values on success, and holds its own references
+ * to objects.
+ *
+ * @return Return 0 on success, -1 on errors.
+ */
+static int treemap_link_columns(TreeMapObj *self, avl_key_t *const *columns, Py_ssize_t n) {
+    avl_key_t *keys = columns[0], *vals = columns[1], *items = self->keyfunc? columns[2]: NULL;
+    avl_node_t **nodes = PyMem_New(avl_node_t *, n? n: 1);
+    if (!nodes) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (Py_ssize_t i = 0; i < n; i++) {
+        nodes[i] = (avl_node_t *)avl_map_new(self, keys[i], vals[i], items? items[i].obj: NULL);
+        if (!nodes[i]) {
+            while (i--) {
+                avl_pool_free(&self->pool, nodes[i]);
+                Py_XDECREF(items? items[i].obj: NULL);
+            }
+            PyMem_Free(nodes);
+            return -1;
+        }
+        avl_ctx_observe(&self->ctx, keys[i]);
+    }
+    self->root = (avl_map_t *)avl_node_build(nodes, n, &self->ctx);
+    self->size = n;
+    PyMem_Free(nodes);
+    return 0;
+}
+
+extern PyObject* TreeMap_FromColumns(avl_dtype_t ktype, avl_dtype_t vtype, PyObject *keyfunc,
+    avl_key_t *const *columns, Py_ssize_t n) {
+    TreeMapObj *self = (TreeMapObj *)TreeMapObj_new(&TreeMap_Type, NULL, NULL);
+    if (!self) {
+        return NULL;
+    }
+    treemap_reset_ctx(self, ktype);
+    self->vtype = vtype;
+    if (keyfunc) {
+        if (pyavl_set_keyfunc((PyAVLTreeObj *)self, keyfunc) < 0) {
+            Py_DECREF(self);
+            return NULL;
+        }
+        treemap_size_nodes(self);
+    }
+    if (treemap_link_columns(self, columns, n) < 0) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    return (PyObject *)self;
+}
+
+/**
+ * @brief Create a TreeMap from a snapshot, linking nodes bottom-up without comparisons.
+ */
+static PyObject* treemap_load_snapshot(PyTypeObject *type, PyObject *src, int in_memory) {
+    pyavl_snapshot_t snap;
+    if (pyavl_snapshot_load(src, in_memory, PYAVL_SNAPSHOT_MAP, &snap) < 0) {
+        return NULL;
+    }
+    TreeMapObj *self = (TreeMapObj *)TreeMapObj_new(type, NULL, NULL);
+    if (!self) {
+        goto error;
+    }
+    int aggregate = (snap.flags & PYAVL_SNAPSHOT_AGGREGATE) != 0;
+    if (aggregate && snap.dtypes[1] != AVL_DTYPE_FLOAT64) {
+        PyErr_SetString(PyExc_ValueError, "Invalid TreeSet or TreeMap snapshot: bad dtype.");
+        goto error;
+    }
+    treemap_reset_ctx(self, snap.dtypes[0]);
+    self->vtype = snap.dtypes[1];
+    treemap_set_aggregate(self, aggregate);
+    if (snap.keyfunc) {
+        if (pyavl_set_keyfunc((PyAVLTreeObj *)self, snap.keyfunc) < 0) {
+            goto error;
+        }
+        treemap_size_nodes(self);
+    }
+    if (treemap_link_columns(self, snap.columns, snap.size) < 0) {
+        goto error;
+    }
+    /* the tree took over the keys and the values */
+    PyMem_Free(snap.columns[0]);
+    PyMem_Free(snap.columns[1]);
+    snap.columns[0] = snap.columns[1] = NULL;
+    pyavl_snapshot_free(&snap, 1);
+    return (PyObject *)self;
+
+error:
+    pyavl_snapshot_free(&snap, 1);
+    Py_XDECREF(self);
+    return NULL;
+}
+
+static PyObject* TreeMapObj_save(TreeMapObj *self, PyObject *file) {
+    return treemap_save(self, file);
+}
+
+static PyObject* TreeMapObj_load(PyTypeObject *type, PyObject *file) {
+    return treemap_load_snapshot(type, file, 0);
+}
+
+static PyObject* TreeMapObj_from_snapshot(PyTypeObject *type, PyObject *data) {
+    return treemap_load_snapshot(type, data, 1);
+}
+
+static PyObject* TreeMapObj_reduce(TreeMapObj *self) {
+    /* a TreeMapSnapshot is restored as a TreeMap */
+    PyTypeObject *type = self->owner? &TreeMap_Type: Py_TYPE(self);
+    PyObject *restore = PyObject_GetAttrString((PyObject *)type, "_from_snapshot");
+    PyObject *data = restore? treemap_save(self, NULL): NULL;
+    if (!data) {
+        Py_XDECREF(restore);
+        return NULL;
+    }
+    return Py_BuildValue("(N(N))", restore, data);
+}
+
+static int
+TreeMapObj_init(TreeMapObj *self, PyObject *args, PyObject *kwargs) {
+    int argc = args? PyTuple_Size(args): 0;
+    if (argc > 1) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "TreeMap.__init__ takes at most 1 positional argument."
+        );
+        return -1;
+    }
+
+    if (treemap_init_options(self, &kwargs) < 0) {
+        return -1;
+    }
+
+    int ret = 0;
+    if (argc == 1) {
+        PyObject *obj;
+        if (!PyArg_ParseTuple(args, "O:__init__", &obj) ||
+            treemap_update(self, obj) < 0) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && kwargs && PyDict_Size(kwargs) && treemap_update(self, kwargs) < 0) {
+        ret = -1;
+    }
+    Py_XDECREF(kwargs);
 
-/* Sequence Protocol */
-static int TreeMapObj_contains(TreeMapObj *self, PyObject *key) {
-    int ret;
-    avl_node_find((avl_node_t *)self->root, key, &ret);
     return ret;
 }
 
-static PySequenceMethods TreeMapObj_Sequence = {
-    .sq_contains = (objobjproc)TreeMapObj_contains
-};
-
+#if PY_VERSION_HEX >= 0x03090000
+/**
+ * @brief Call TreeMap without packing arguments into a tuple for TreeMap() and
+ * TreeMap(mapping). Other calls go through __new__ and __init__.
+ */
+static PyObject* TreeMapObj_vectorcall(
+    PyObject *type, PyObject *const *args, size_t nargsf, PyObject *kwnames) {
+    Py_ssize_t nargs = PyVectorcall_NARGS(nargsf);
+    if (kwnames || nargs > 1) {
+        return pyavl_vectorcall_new(type, args, nargsf, kwnames);
+    }
+    TreeMapObj *self = (TreeMapObj *)TreeMapObj_new((PyTypeObject *)type, NULL, NULL);
+    if (self && nargs == 1 && treemap_update(self, args[0]) < 0) {
+        Py_CLEAR(self);
+    }
+    return (PyObject *)self;
+}
+#endif
+
+/* Mapping Protocol */
+
+static Py_ssize_t TreeMapObj_length(TreeMapObj *self) {
+    return self->size;
+}
+
+static PyObject* TreeMapObj_subscript(TreeMapObj *self, PyObject *key) {
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return NULL;
+    }
+    int ret;
+    avl_map_t *found = (avl_map_t *)avl_node_find(
+        (avl_node_t *)self->root, &self->ctx, query, &ret
+    );
+    Py_DECREF(query);
+
+    if (ret <= 0) {
+        _PyErr_SetKeyError(key);
+        return NULL;
+    }
+    return treemap_getval(found, self);
+}
+
+static int treemap_delete(TreeMapObj *self, PyObject *key, avl_map_t **deleted) {
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return -1;
+    }
+    int ret;
+    avl_map_t *tmp = NULL;
+    self->root = (avl_map_t *)avl_node_delete(
+        (avl_node_t *)self->root, &self->ctx, query,
+        &ret, (avl_node_t **)&tmp
+    );
+    Py_DECREF(query);
+    if (ret == -1) {
+        return -1;
+    } else if (ret == 0) {
+        _PyErr_SetKeyError(key);
+        return -1;
+    }
+    if (deleted) {
+        *deleted = tmp;
+    } else {
+        avl_map_free(self, tmp);
+    }
+    self->size --;
+    return 0;
+}
+
+static int TreeMapObj_ass_sub(TreeMapObj *self, PyObject *key, PyObject *val) {
+    if (!val) {
+        return treemap_delete(self, key, NULL);
+    }
+    return treemap_insert(self, key, val);
+}
+
+static PyMappingMethods TreeMapObj_Mapping = {
+    (lenfunc)TreeMapObj_length,         // mp_length
+    (binaryfunc)TreeMapObj_subscript,   // mp_subscript
+    (objobjargproc)TreeMapObj_ass_sub,  // mp_ass_subscript
+};
+
+/* Sequence Protocol */
+static int TreeMapObj_contains(TreeMapObj *self, PyObject *key) {
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return -1;
+    }
+    int ret;
+    avl_node_find((avl_node_t *)self->root, &self->ctx, query, &ret);
+    Py_DECREF(query);
+    return ret;
+}
+
+static PySequenceMethods TreeMapObj_Sequence = {
+    .sq_contains = (objobjproc)TreeMapObj_contains
+};
+
+static PyObject* TreeMapObj_contains_many(TreeMapObj *self, PyObject *keys) {
+    return pyavl_lookup_many((PyObject *)self, keys, PYAVL_LOOKUP_FIND, NULL, NULL, NULL);
+}
+
+static PyObject* TreeMapObj_get_many(TreeMapObj *self, PyObject *const *args, Py_ssize_t nargs) {
+    static const char *const kwlist[] = {"keys", "default", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args("get_many", args, nargs, NULL, kwlist, 1, 2, argv) < 0) {
+        return NULL;
+    }
+    return pyavl_lookup_many(
+        (PyObject *)self, argv[0], PYAVL_LOOKUP_FIND, (avl_iter_getter)treemap_getval, NULL,
+        argv[1]? argv[1]: Py_None
+    );
+}
+
+static PyObject* TreeMapObj_at_most_many(TreeMapObj *self, PyObject *keys) {
+    return pyavl_lookup_many(
+        (PyObject *)self, keys, PYAVL_LOOKUP_AT_MOST, (avl_iter_getter)treemap_getkey, NULL, Py_None
+    );
+}
+
+static PyObject* TreeMapObj_at_least_many(TreeMapObj *self, PyObject *keys) {
+    return pyavl_lookup_many(
+        (PyObject *)self, keys, PYAVL_LOOKUP_AT_LEAST, (avl_iter_getter)treemap_getkey, NULL, Py_None
+    );
+}
+
 static PyMethodDef TreeMapObj_Methods[] = {
+    {
+        "__reduce__",
+        (PyCFunction)TreeMapObj_reduce,
+        METH_NOARGS,
+        "Pickle the TreeMap as a snapshot."
+    },
+    {
+        "_from_snapshot",
+        (PyCFunction)TreeMapObj_from_snapshot,
+        METH_O | METH_CLASS,
+        "Create a TreeMap from the bytes of a snapshot, for unpickling."
+    },
+    {
+        "__reversed__",
+        (PyCFunction)TreeMapObj_reversed,
+        METH_NOARGS,
+        "Return an iterator over keys of the TreeMap in descending order."
+    },
     {
         "clear",
         (PyCFunction)TreeMapObj_clear,
         METH_NOARGS,
         "Remove all items from the TreeMap."
     },
+    {
+        "freeze",
+        (PyCFunction)TreeMapObj_freeze,
+        METH_NOARGS,
+        "Return a read-only FrozenTreeMap of the items, laid out for fast lookups."
+    },
     {
         "get",
         (PyCFunction)TreeMapObj_get,
-        METH_VARARGS,
+        METH_FASTCALL,
         "Return the value for key if key is in the TreeMap, else default."
     },
+    {
+        "get_many",
+        (PyCFunction)TreeMapObj_get_many,
+        METH_FASTCALL,
+        "Return a list of get for each key of an iterable, fastest if the keys are sorted."
+    },
+    {
+        "contains_many",
+        (PyCFunction)TreeMapObj_contains_many,
+        METH_O,
+        "Return a list of whether each key of an iterable is in the TreeMap."
+    },
     {
         "keys",
         (PyCFunction)TreeMapObj_keys,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate over keys of the TreeMap in order, descending if reverse."
+    },
+    {
+        "keys_array",
+        (PyCFunction)TreeMapObj_keys_array,
         METH_NOARGS,
-        "Get all keys of the TreeMap in an sorted list."
+        "Return a memoryview of the keys in order, for key dtype int64, float64 or bytes."
+    },
+    {
+        "load",
+        (PyCFunction)TreeMapObj_load,
+        METH_O | METH_CLASS,
+        "Load a TreeMap saved to a path or a binary file."
     },
     {
         "loc",
         (PyCFunction)TreeMapObj_loc,
-        METH_VARARGS,
+        METH_O,
         "Return the (key, val) pair at the given location."
     },
+    {
+        "aggregate",
+        (PyCFunction)TreeMapObj_aggregate,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Return the sum, min, max or count (op) of values with keys between lo and hi, inclusive by default."
+    },
     {
         "at_most",
         (PyCFunction)TreeMapObj_at_most,
-        METH_VARARGS,
+        METH_O,
         "Get the largest key in the TreeMap that is not bigger than the given key."
     },
+    {
+        "iter_from",
+        (PyCFunction)TreeMapObj_iter_from,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate in ascending order over keys greater than key, or equal if inclusive (default)."
+    },
+    {
+        "iter_before",
+        (PyCFunction)TreeMapObj_iter_before,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate in descending order over keys less than key, or equal if inclusive."
+    },
+    {
+        "irange",
+        (PyCFunction)TreeMapObj_irange,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Return a view of keys between lo and hi, inclusive by default. None means no bound."
+    },
     {
         "at_least",
         (PyCFunction)TreeMapObj_at_least,
-        METH_VARARGS,
+        METH_O,
         "Get the smallest key in the TreeMap that is not smaller than the given key."
     },
+    {
+        "at_most_many",
+        (PyCFunction)TreeMapObj_at_most_many,
+        METH_O,
+        "Return a list of at_most for each key of an iterable, fastest if the keys are sorted."
+    },
+    {
+        "at_least_many",
+        (PyCFunction)TreeMapObj_at_least_many,
+        METH_O,
+        "Return a list of at_least for each key of an iterable, fastest if the keys are sorted."
+    },
+    {
+        "rank",
+        (PyCFunction)TreeMapObj_bisect_left,
+        METH_O,
+        "Return the number of keys in the TreeMap less than the given key."
+    },
+    {
+        "bisect_left",
+        (PyCFunction)TreeMapObj_bisect_left,
+        METH_O,
+        "Return the number of keys in the TreeMap less than the given key."
+    },
+    {
+        "bisect_right",
+        (PyCFunction)TreeMapObj_bisect_right,
+        METH_O,
+        "Return the number of keys in the TreeMap not bigger than the given key."
+    },
+    {
+        "index",
+        (PyCFunction)TreeMapObj_index,
+        METH_O,
+        "Return the location of the given key. Raises KeyError if it is not present."
+    },
+    {
+        "count_range",
+        (PyCFunction)TreeMapObj_count_range,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Count keys between lo and hi, inclusive by default. None means no bound."
+    },
     {
         "max",
         (PyCFunction)TreeMapObj_max,
@@ -442,24 +1980,158 @@ static PyMethodDef TreeMapObj_Methods[] = {
     {
         "values",
         (PyCFunction)TreeMapObj_values,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate over values of the TreeMap, ordered by their keys, descending if reverse."
+    },
+    {
+        "values_array",
+        (PyCFunction)TreeMapObj_values_array,
         METH_NOARGS,
-        "Get all values of the TreeMap, ordered by their keys."
+        "Return a memoryview of the values ordered by their keys, for value dtype int64, float64 or bytes."
     },
     {
         "items",
         (PyCFunction)TreeMapObj_items,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate over (key, value) pairs of the TreeMap, ordered by key, descending if reverse."
+    },
+    {
+        "popitem",
+        (PyCFunction)TreeMapObj_popitem,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Remove and return the (key, val) pair at the given location, the last one by default."
+    },
+    {
+        "save",
+        (PyCFunction)TreeMapObj_save,
+        METH_O,
+        "Save the TreeMap to a path or a binary file, in a compact checksummed format."
+    },
+    {
+        "snapshot",
+        (PyCFunction)TreeMapObj_snapshot,
+        METH_NOARGS,
+        "Return a read-only view of the TreeMap as it is now, in O(1). The TreeMap copies nodes it shares with views before changing them."
+    },
+    {
+        "cursor",
+        (PyCFunction)TreeMapObj_cursor,
+        METH_NOARGS,
+        "Return a cursor at the smallest key, which steps, inserts, erases and sets values in place without searching from the root."
+    },
+    {
+        "copy",
+        (PyCFunction)TreeMapObj_copy,
+        METH_NOARGS,
+        "Return a shallow copy of the TreeMap, with the same shape, in O(n) without comparisons."
+    },
+    {
+        "__copy__",
+        (PyCFunction)TreeMapObj_copy,
+        METH_NOARGS,
+        "Return a shallow copy of the TreeMap, see copy()."
+    },
+    {
+        "keyset",
+        (PyCFunction)TreeMapObj_keyset,
+        METH_NOARGS,
+        "Return a TreeSet of the keys, with the same shape, in O(n) without comparisons."
+    },
+    {
+        "setdefault",
+        (PyCFunction)(void(*)(void))TreeMapObj_setdefault,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Return the value of the key, setting it to default first if the key is missing, in one descent."
+    },
+    {
+        "get_or_insert",
+        (PyCFunction)(void(*)(void))TreeMapObj_get_or_insert,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Return the value of the key, setting it to factory() first if the key is missing, in one descent."
+    },
+    {
+        "increment",
+        (PyCFunction)(void(*)(void))TreeMapObj_increment,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Add delta, 1 by default, to the value of the key, setting it to delta if the key is missing, in one descent. Return the new value."
+    },
+    {
+        "update_with",
+        (PyCFunction)(void(*)(void))TreeMapObj_update_with,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Set the value of the key to func(value), or to func(default) if the key is missing, in one descent. Return the new value."
+    },
+    {
+        "stats",
+        (PyCFunction)TreeMapObj_stats,
         METH_NOARGS,
-        "Get all (key, value) pairs of the TreeMap, ordered by key."
+        "Report the memory usage and key comparisons of the TreeMap."
     },
     {
         "update",
         (PyCFunction)TreeMapObj_update,
-        METH_VARARGS,
+        METH_O,
         "Update the TreeMap by a dict, the argument will be converted to a dict if needed."
     },
     {NULL}
 };
 
+static PyObject* TreeMapObj_get_key_dtype(TreeMapObj *self, void *closure) {
+    return PyUnicode_FromString(avl_dtype_name(self->ctx.dtype));
+}
+
+static PyObject* TreeMapObj_get_value_dtype(TreeMapObj *self, void *closure) {
+    return PyUnicode_FromString(avl_dtype_name(self->vtype));
+}
+
+static PyObject* TreeMapObj_get_key(TreeMapObj *self, void *closure) {
+    PyObject *func = self->keyfunc? self->keyfunc: Py_None;
+    Py_INCREF(func);
+    return func;
+}
+
+static PyObject* TreeMapObj_get_backend(TreeMapObj *self, void *closure) {
+    return PyUnicode_FromString("avl");
+}
+
+static PyGetSetDef TreeMapObj_GetSet[] = {
+    {
+        "backend",
+        (getter)TreeMapObj_get_backend,
+        NULL,
+        "The engine of the TreeMap, \"avl\" unless created as a BTreeMap.",
+        NULL
+    },
+    {
+        "key",
+        (getter)TreeMapObj_get_key,
+        NULL,
+        "The function deriving the order of keys of the TreeMap, or None.",
+        NULL
+    },
+    {
+        "key_dtype",
+        (getter)TreeMapObj_get_key_dtype,
+        NULL,
+        "The dtype of keys of the TreeMap.",
+        NULL
+    },
+    {
+        "value_dtype",
+        (getter)TreeMapObj_get_value_dtype,
+        NULL,
+        "The dtype of values of the TreeMap.",
+        NULL
+    },
+
+    {NULL}
+};
+
+/* equal to a TreeMap of either engine with the same items in the same order */
+static PyObject* TreeMapObj_richcompare(PyObject *a, PyObject *b, int op) {
+    return pyavl_tree_richcompare(a, b, op, &TreeMap_Type, "items");
+}
+
 PyTypeObject TreeMap_Type = {
     /* The ob_type field must be initialized in the module init function
      * to be portable to Windows without using C++. */
@@ -477,7 +2149,7 @@ PyTypeObject TreeMap_Type = {
     0,                          /*tp_as_number*/
     &TreeMapObj_Sequence,       /*tp_as_sequence*/
     &TreeMapObj_Mapping,        /*tp_as_mapping*/
-    0,                          /*tp_hash*/
+    PyObject_HashNotImplemented,/*tp_hash*/
     0,                          /*tp_call*/
     0,                          /*tp_str*/
     (getattrofunc)0,            /*tp_getattro*/
@@ -487,13 +2159,13 @@ PyTypeObject TreeMap_Type = {
     0,                          /*tp_doc*/
     0,                          /*tp_traverse*/
     0,                          /*tp_clear*/
-    0,                          /*tp_richcompare*/
+    TreeMapObj_richcompare,     /*tp_richcompare*/
     0,                          /*tp_weaklistoffset*/
-    (getiterfunc)TreeMapObj_keys,/*tp_iter*/
+    (getiterfunc)TreeMapObj_iter,/*tp_iter*/
     0,                          /*tp_iternext*/
     TreeMapObj_Methods,         /*tp_methods*/
     0,                          /*tp_members*/
-    0,                          /*tp_getset*/
+    TreeMapObj_GetSet,          /*tp_getset*/
     0,                          /*tp_base*/
     0,                          /*tp_dict*/
     0,                          /*tp_descr_get*/
@@ -504,4 +2176,326 @@ PyTypeObject TreeMap_Type = {
     TreeMapObj_new,             /*tp_new*/
     0,                          /*tp_free*/
     0,                          /*tp_is_gc*/
+#if PY_VERSION_HEX >= 0x03090000
+    0,                          /*tp_bases*/
+    0,                          /*tp_mro*/
+    0,                          /*tp_cache*/
+    0,                          /*tp_subclasses*/
+    0,                          /*tp_weaklist*/
+    0,                          /*tp_del*/
+    0,                          /*tp_version_tag*/
+    0,                          /*tp_finalize*/
+    TreeMapObj_vectorcall,      /*tp_vectorcall*/
+#endif
+};
+
+
+/* TreeMapSnapshot */
+
+static void TreeMapSnapshot_free(TreeMapObj *self) {
+    TreeMapObj *owner = (TreeMapObj *)self->owner;
+    avl_node_t *root = (avl_node_t *)self->root;
+    treemap_dtypes_t dtypes = {
+        self->ctx.dtype, self->vtype, self->keyfunc? self->pool.node_size: 0
+    };
+    self->root = NULL;
+    self->size = 0;
+    avl_node_unref(root, &owner->pool, (avl_func)treemap_release_item, &dtypes);
+    if (-- owner->share.snapshots == 0) {
+        owner->ctx.share = NULL;
+    }
+    Py_CLEAR(self->keyfunc);
+    Py_CLEAR(self->owner);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject* TreeMapSnapshot_stats(TreeMapObj *self) {
+    return pyavl_tree_stats(&((TreeMapObj *)self->owner)->pool, &self->ctx);
+}
+
+static PyObject* TreeMapSnapshot_get_owner(TreeMapObj *self, void *closure) {
+    Py_INCREF(self->owner);
+    return self->owner;
+}
+
+static PyMethodDef TreeMapSnapshot_Methods[] = {
+    {
+        "__reduce__",
+        (PyCFunction)TreeMapObj_reduce,
+        METH_NOARGS,
+        "Pickle the snapshot as a TreeMap."
+    },
+    {
+        "__reversed__",
+        (PyCFunction)TreeMapObj_reversed,
+        METH_NOARGS,
+        "Return an iterator over keys of the snapshot in descending order."
+    },
+    {
+        "freeze",
+        (PyCFunction)TreeMapObj_freeze,
+        METH_NOARGS,
+        "Return a read-only FrozenTreeMap of the items, laid out for fast lookups."
+    },
+    {
+        "get",
+        (PyCFunction)TreeMapObj_get,
+        METH_FASTCALL,
+        "Return the value for key if key is in the snapshot, else default."
+    },
+    {
+        "get_many",
+        (PyCFunction)TreeMapObj_get_many,
+        METH_FASTCALL,
+        "Return a list of get for each key of an iterable, fastest if the keys are sorted."
+    },
+    {
+        "contains_many",
+        (PyCFunction)TreeMapObj_contains_many,
+        METH_O,
+        "Return a list of whether each key of an iterable is in the snapshot."
+    },
+    {
+        "keys",
+        (PyCFunction)TreeMapObj_keys,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate over keys of the snapshot in order, descending if reverse."
+    },
+    {
+        "keys_array",
+        (PyCFunction)TreeMapObj_keys_array,
+        METH_NOARGS,
+        "Return a memoryview of the keys in order, for key dtype int64, float64 or bytes."
+    },
+    {
+        "loc",
+        (PyCFunction)TreeMapObj_loc,
+        METH_O,
+        "Return the (key, val) pair at the given location."
+    },
+    {
+        "aggregate",
+        (PyCFunction)TreeMapObj_aggregate,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Return the sum, min, max or count (op) of values with keys between lo and hi, inclusive by default."
+    },
+    {
+        "at_most",
+        (PyCFunction)TreeMapObj_at_most,
+        METH_O,
+        "Get the largest key in the snapshot that is not bigger than the given key."
+    },
+    {
+        "iter_from",
+        (PyCFunction)TreeMapObj_iter_from,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate in ascending order over keys greater than key, or equal if inclusive (default)."
+    },
+    {
+        "iter_before",
+        (PyCFunction)TreeMapObj_iter_before,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate in descending order over keys less than key, or equal if inclusive."
+    },
+    {
+        "irange",
+        (PyCFunction)TreeMapObj_irange,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Return a view of keys between lo and hi, inclusive by default. None means no bound."
+    },
+    {
+        "at_least",
+        (PyCFunction)TreeMapObj_at_least,
+        METH_O,
+        "Get the smallest key in the snapshot that is not smaller than the given key."
+    },
+    {
+        "at_most_many",
+        (PyCFunction)TreeMapObj_at_most_many,
+        METH_O,
+        "Return a list of at_most for each key of an iterable, fastest if the keys are sorted."
+    },
+    {
+        "at_least_many",
+        (PyCFunction)TreeMapObj_at_least_many,
+        METH_O,
+        "Return a list of at_least for each key of an iterable, fastest if the keys are sorted."
+    },
+    {
+        "rank",
+        (PyCFunction)TreeMapObj_bisect_left,
+        METH_O,
+        "Return the number of keys in the snapshot less than the given key."
+    },
+    {
+        "bisect_left",
+        (PyCFunction)TreeMapObj_bisect_left,
+        METH_O,
+        "Return the number of keys in the snapshot less than the given key."
+    },
+    {
+        "bisect_right",
+        (PyCFunction)TreeMapObj_bisect_right,
+        METH_O,
+        "Return the number of keys in the snapshot not bigger than the given key."
+    },
+    {
+        "index",
+        (PyCFunction)TreeMapObj_index,
+        METH_O,
+        "Return the location of the given key. Raises KeyError if it is not present."
+    },
+    {
+        "count_range",
+        (PyCFunction)TreeMapObj_count_range,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Count keys between lo and hi, inclusive by default. None means no bound."
+    },
+    {
+        "max",
+        (PyCFunction)TreeMapObj_max,
+        METH_NOARGS,
+        "Get the (key, val) pair with maximal key in the snapshot."
+    },
+    {
+        "min",
+        (PyCFunction)TreeMapObj_min,
+        METH_NOARGS,
+        "Get the (key, val) pair with minimal key in the snapshot."
+    },
+    {
+        "values",
+        (PyCFunction)TreeMapObj_values,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate over values of the snapshot, ordered by their keys, descending if reverse."
+    },
+    {
+        "values_array",
+        (PyCFunction)TreeMapObj_values_array,
+        METH_NOARGS,
+        "Return a memoryview of the values ordered by their keys, for value dtype int64, float64 or bytes."
+    },
+    {
+        "items",
+        (PyCFunction)TreeMapObj_items,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate over (key, value) pairs of the snapshot, ordered by key, descending if reverse."
+    },
+    {
+        "save",
+        (PyCFunction)TreeMapObj_save,
+        METH_O,
+        "Save the snapshot to a path or a binary file, to load as a TreeMap."
+    },
+    {
+        "snapshot",
+        (PyCFunction)TreeMapObj_snapshot,
+        METH_NOARGS,
+        "Return the snapshot itself, which never changes."
+    },
+    {
+        "cursor",
+        (PyCFunction)TreeMapObj_cursor,
+        METH_NOARGS,
+        "Return a read-only cursor at the smallest key."
+    },
+    {
+        "copy",
+        (PyCFunction)TreeMapObj_copy,
+        METH_NOARGS,
+        "Return a TreeMap with the items of the snapshot, with the same shape, in O(n) without comparisons."
+    },
+    {
+        "__copy__",
+        (PyCFunction)TreeMapObj_copy,
+        METH_NOARGS,
+        "Return a TreeMap with the items of the snapshot, see copy()."
+    },
+    {
+        "keyset",
+        (PyCFunction)TreeMapObj_keyset,
+        METH_NOARGS,
+        "Return a TreeSet of the keys, with the same shape, in O(n) without comparisons."
+    },
+    {
+        "stats",
+        (PyCFunction)TreeMapSnapshot_stats,
+        METH_NOARGS,
+        "Report the memory usage of the pool shared with the TreeMap, and key comparisons of the snapshot."
+    },
+    {NULL}
+};
+
+static PyGetSetDef TreeMapSnapshot_GetSet[] = {
+    {
+        "key",
+        (getter)TreeMapObj_get_key,
+        NULL,
+        "The function deriving the order of keys of the snapshot, or None.",
+        NULL
+    },
+    {
+        "key_dtype",
+        (getter)TreeMapObj_get_key_dtype,
+        NULL,
+        "The dtype of keys of the snapshot.",
+        NULL
+    },
+    {
+        "value_dtype",
+        (getter)TreeMapObj_get_value_dtype,
+        NULL,
+        "The dtype of values of the snapshot.",
+        NULL
+    },
+    {
+        "owner",
+        (getter)TreeMapSnapshot_get_owner,
+        NULL,
+        "The TreeMap the snapshot was taken of.",
+        NULL
+    },
+
+    {NULL}
+};
+
+static PyMappingMethods TreeMapSnapshot_Mapping = {
+    (lenfunc)TreeMapObj_length,         // mp_length
+    (binaryfunc)TreeMapObj_subscript,   // mp_subscript
+    0,                                  // mp_ass_subscript
 };
+
+PyTypeObject TreeMapSnapshot_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "pyavl.TreeMapSnapshot",    /*tp_name*/
+    sizeof(TreeMapObj),         /*tp_basicsize*/
+    0,                          /*tp_itemsize*/
+    /* methods */
+    (destructor)TreeMapSnapshot_free,/*tp_dealloc*/
+    0,                          /*tp_vectorcall_offset*/
+    (getattrfunc)0,             /*tp_getattr*/
+    (setattrfunc)0,             /*tp_setattr*/
+    0,                          /*tp_as_async*/
+    0,                          /*tp_repr*/
+    0,                          /*tp_as_number*/
+    &TreeMapObj_Sequence,       /*tp_as_sequence*/
+    &TreeMapSnapshot_Mapping,   /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    (getattrofunc)0,            /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    0,                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
+    "Read-only view of a TreeMap, sharing nodes with it. Created by TreeMap.snapshot().",
+                                /*tp_doc*/
+    0,                          /*tp_traverse*/
+    0,                          /*tp_clear*/
+    0,                          /*tp_richcompare*/
+    0,                          /*tp_weaklistoffset*/
+    (getiterfunc)TreeMapObj_iter,/*tp_iter*/
+    0,                          /*tp_iternext*/
+    TreeMapSnapshot_Methods,    /*tp_methods*/
+    0,                          /*tp_members*/
+    TreeMapSnapshot_GetSet,     /*tp_getset*/
+};
\ No newline at end of file
@@ -0,0 +1,218 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "avl.h"
+#include "pyavlmodule.h"
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *owner;
+    PyObject *lo;
+    PyObject *hi;
+    int lo_inclusive;
+    int hi_inclusive;
+    avl_iter_getter getter;
+    btree_iter_getter bgetter;  /* instead of getter for trees on the B+ tree engine */
+} TreeRangeObj;
+
+static PyObject* TreeRangeObj_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    TreeRangeObj *self;
+    self = (TreeRangeObj *)type->tp_alloc(type, 0);
+    if (!self) {
+        return NULL;
+    }
+    self->owner = NULL;
+    self->lo = NULL;
+    self->hi = NULL;
+    self->lo_inclusive = 1;
+    self->hi_inclusive = 1;
+    self->getter = NULL;
+    self->bgetter = NULL;
+
+    return (PyObject *)self;
+}
+
+static void TreeRangeObj_free(TreeRangeObj *self) {
+    Py_XDECREF(self->owner);
+    Py_XDECREF(self->lo);
+    Py_XDECREF(self->hi);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+extern PyObject*
+TreeRange_New(PyObject *owner, PyObject *lo, PyObject *hi, int lo_inclusive, int hi_inclusive,
+    avl_iter_getter getter) {
+    TreeRangeObj *self = (TreeRangeObj *)TreeRangeObj_new(&TreeRange_Type, NULL, NULL);
+    if (!self) {
+        return NULL;
+    }
+    Py_INCREF(owner);
+    self->owner = owner;
+    Py_INCREF(lo);
+    self->lo = lo;
+    Py_INCREF(hi);
+    self->hi = hi;
+    self->lo_inclusive = lo_inclusive;
+    self->hi_inclusive = hi_inclusive;
+    self->getter = getter;
+    return (PyObject *)self;
+}
+
+extern PyObject*
+TreeRange_NewBTree(PyObject *owner, PyObject *lo, PyObject *hi, int lo_inclusive,
+    int hi_inclusive, btree_iter_getter getter) {
+    TreeRangeObj *self = (TreeRangeObj *)TreeRange_New(
+        owner, lo, hi, lo_inclusive, hi_inclusive, NULL);
+    if (self) {
+        self->bgetter = getter;
+    }
+    return (PyObject *)self;
+}
+
+static Py_ssize_t
+range_bisect(PyAVLTreeObj *tree, PyObject *key, int right) {
+    if (tree->btree) {
+        return btree_bisect(tree->btree, &tree->ctx, key, right, NULL, NULL);
+    }
+    return avl_node_bisect(tree->root, &tree->ctx, key, right, NULL);
+}
+
+extern int
+pyavl_range_bounds(PyAVLTreeObj *tree, PyObject *lo, PyObject *hi, int lo_inclusive,
+    int hi_inclusive, Py_ssize_t *start, Py_ssize_t *end) {
+    *start = 0;
+    *end = pyavl_tree_size(tree);
+    if (lo != Py_None) {
+        PyObject *key = pyavl_derive_key(tree, lo);
+        if (!key) {
+            return -1;
+        }
+        *start = range_bisect(tree, key, !lo_inclusive);
+        Py_DECREF(key);
+        if (*start < 0) {
+            return -1;
+        }
+    }
+    if (hi != Py_None) {
+        PyObject *key = pyavl_derive_key(tree, hi);
+        if (!key) {
+            return -1;
+        }
+        *end = range_bisect(tree, key, hi_inclusive);
+        Py_DECREF(key);
+        if (*end < 0) {
+            return -1;
+        }
+    }
+    if (*end < *start) {
+        *end = *start;
+    }
+    return 0;
+}
+
+static int treerange_bounds(TreeRangeObj *self, Py_ssize_t *start, Py_ssize_t *end) {
+    return pyavl_range_bounds(
+        (PyAVLTreeObj *)self->owner, self->lo, self->hi, self->lo_inclusive, self->hi_inclusive,
+        start, end
+    );
+}
+
+static Py_ssize_t TreeRangeObj_len(TreeRangeObj *self) {
+    Py_ssize_t start, end;
+    if (treerange_bounds(self, &start, &end) < 0) {
+        return -1;
+    }
+    return end - start;
+}
+
+static PyObject* TreeRangeObj_iter(TreeRangeObj *self) {
+    Py_ssize_t start, end;
+    if (treerange_bounds(self, &start, &end) < 0) {
+        return NULL;
+    }
+    PyAVLTreeObj *tree = (PyAVLTreeObj *)self->owner;
+    if (tree->btree) {
+        btree_pos_t pos;
+        btree_loc(tree->btree, start, &pos);
+        return BTreeIter_New(self->owner, pos, end - start, 0, self->bgetter);
+    }
+    return TreeIter_New(
+        self->owner, avl_iter_new_at(tree->root, start, 0), end - start, self->getter
+    );
+}
+
+static PyObject* TreeRangeObj_reversed(TreeRangeObj *self) {
+    Py_ssize_t start, end;
+    if (treerange_bounds(self, &start, &end) < 0) {
+        return NULL;
+    }
+    PyAVLTreeObj *tree = (PyAVLTreeObj *)self->owner;
+    if (tree->btree) {
+        btree_pos_t pos;
+        btree_loc(tree->btree, end - 1, &pos);
+        return BTreeIter_New(self->owner, pos, end - start, 1, self->bgetter);
+    }
+    return TreeIter_New(
+        self->owner, avl_iter_new_at(tree->root, end - 1, 1), end - start, self->getter
+    );
+}
+
+static PyMethodDef TreeRangeObj_Methods[] = {
+    {
+        "__reversed__",
+        (PyCFunction)TreeRangeObj_reversed,
+        METH_NOARGS,
+        "Return an iterator over the keys of the range in descending order."
+    },
+    {NULL}
+};
+
+static PySequenceMethods TreeRangeObj_Seq = {
+    .sq_length = (lenfunc)TreeRangeObj_len
+};
+
+PyTypeObject TreeRange_Type = {
+    /* The ob_type field must be initialized in the module init function
+     * to be portable to Windows without using C++. */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "pyavl._TreeRange",         /*tp_name*/
+    sizeof(TreeRangeObj),       /*tp_basicsize*/
+    0,                          /*tp_itemsize*/
+    /* methods */
+    (destructor)TreeRangeObj_free,/*tp_dealloc*/
+    0,                          /*tp_vectorcall_offset*/
+    (getattrfunc)0,             /*tp_getattr*/
+    (setattrfunc)0,             /*tp_setattr*/
+    0,                          /*tp_as_async*/
+    0,                          /*tp_repr*/
+    0,                          /*tp_as_number*/
+    &TreeRangeObj_Seq,          /*tp_as_sequence*/
+    0,                          /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    (getattrofunc)0,            /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    0,                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
+    0,                          /*tp_doc*/
+    0,                          /*tp_traverse*/
+    0,                          /*tp_clear*/
+    0,                          /*tp_richcompare*/
+    0,                          /*tp_weaklistoffset*/
+    (getiterfunc)TreeRangeObj_iter,/*tp_iter*/
+    0,                          /*tp_iternext*/
+    TreeRangeObj_Methods,       /*tp_methods*/
+    0,                          /*tp_members*/
+    0,                          /*tp_getset*/
+    0,                          /*tp_base*/
+    0,                          /*tp_dict*/
+    0,                          /*tp_descr_get*/
+    0,                          /*tp_descr_set*/
+    0,                          /*tp_dictoffset*/
+    0,                          /*tp_init*/
+    0,                          /*tp_alloc*/
+    TreeRangeObj_new,           /*tp_new*/
+    0,                          /*tp_free*/
+    0,                          /*tp_is_gc*/
+};
\ No newline at end of file
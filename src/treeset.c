@@ -4,13 +4,37 @@
 #include "avl.h"
 #include "pyavlmodule.h"
 
+/* starts like PyAVLTreeObj */
 typedef struct {
     PyObject_HEAD
     avl_node_t *root;
     Py_ssize_t size;
+    avl_ctx_t ctx;
+    PyObject *keyfunc;
+    btree_t *btree;         /* NULL, unless a BTreeSet keeps its keys there */
+    avl_pool_t pool;
 } TreeSetObj;
 
+/* the references held by nodes of a TreeSet */
+typedef struct {
+    avl_dtype_t dtype;
+    size_t keyed_size;      /* the node size if nodes keep the objects keys are derived from */
+} treeset_layout_t;
+
+static treeset_layout_t treeset_layout(TreeSetObj *self) {
+    treeset_layout_t layout = {self->ctx.dtype, self->keyfunc? self->pool.node_size: 0};
+    return layout;
+}
+
 static PyObject* TreeSetObj_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    int backend = pyavl_parse_backend(kwargs);
+    if (backend < 0) {
+        return NULL;
+    } else if (backend == 1) {
+        /* a BTreeSet is a TreeSet, so BTreeSet.__init__ runs on it next */
+        return BTreeSet_Type.tp_new(&BTreeSet_Type, args, kwargs);
+    }
+
     TreeSetObj *self;
     self = (TreeSetObj *)type->tp_alloc(type, 0);
     if (self == NULL) {
@@ -18,68 +42,369 @@ static PyObject* TreeSetObj_new(PyTypeObject *type, PyObject *args, PyObject *kw
     }
     self->root = NULL;
     self->size = 0;
+    avl_ctx_init(&self->ctx, AVL_DTYPE_OBJECT);
+    self->keyfunc = NULL;
+    self->btree = NULL;
+    avl_pool_init(&self->pool, sizeof(avl_node_t), pyavl_hugepages);
 
     return (PyObject *)self;
 }
 
+static void treeset_release_node(avl_node_t *node, treeset_layout_t *layout) {
+    avl_key_release(layout->dtype, AVL_RAWKEY(node));
+    if (layout->keyed_size) {
+        Py_DECREF(PYAVL_NODE_ITEM(node, layout->keyed_size));
+    }
+}
+
+/**
+ * @brief Remove all nodes: drop references held by keys, then release chunks at once.
+ * The tree is emptied first, in case releasing keys runs code touching it.
+ */
+static void treeset_drop(TreeSetObj *self) {
+    avl_node_t *root = self->root;
+    treeset_layout_t layout = treeset_layout(self);
+    avl_pool_t pool = self->pool;
+    self->root = NULL;
+    self->size = 0;
+    avl_ctx_init(&self->ctx, layout.dtype);
+    avl_pool_init(&self->pool, pool.node_size, pool.hugepages);
+
+    if (AVL_DTYPE_BOXED(layout.dtype) || layout.keyed_size) {
+        avl_node_foreach(root, (avl_func)treeset_release_node, &layout);
+    }
+    avl_pool_clear(&pool);
+}
+
+/**
+ * @brief Set the key function of an empty tree, sizing nodes to keep the objects
+ * keys are derived from, see PYAVL_NODE_ITEM.
+ */
+static int treeset_set_keyfunc(TreeSetObj *self, PyObject *func) {
+    if (pyavl_set_keyfunc((PyAVLTreeObj *)self, func) < 0) {
+        return -1;
+    }
+    size_t node_size = sizeof(avl_node_t) + (self->keyfunc? sizeof(PyObject *): 0);
+    if (node_size != self->pool.node_size) {
+        /* no node is in use, but chunks may remain after removals */
+        int hugepages = self->pool.hugepages;
+        avl_pool_clear(&self->pool);
+        avl_pool_init(&self->pool, node_size, hugepages);
+    }
+    return 0;
+}
+
+/**
+ * @brief Release the key, and the object it is derived from, of a node and return
+ * the node to the pool.
+ */
+static void treeset_free_node(avl_node_t *node, TreeSetObj *self) {
+    treeset_layout_t layout = treeset_layout(self);
+    treeset_release_node(node, &layout);
+    avl_pool_free(&self->pool, node);
+}
+
 static void TreeSetObj_free(TreeSetObj *self) {
-    avl_node_free(self->root);
+    treeset_drop(self);
+    Py_CLEAR(self->keyfunc);
     Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
-static PyObject* TreeSetObj_add(TreeSetObj *self, PyObject *args) {
-    PyObject *key;
-    if (!PyArg_ParseTuple(args, "O:add", &key))
+/**
+ * @brief Create a node for a Python object, with the key derived from it.
+ * 
+ * @return Return the node, NULL on errors.
+ */
+static avl_node_t* treeset_new_node(TreeSetObj *self, PyObject *obj) {
+    PyObject *derived = pyavl_derive_key((PyAVLTreeObj *)self, obj);
+    if (!derived) {
+        return NULL;
+    }
+    avl_key_t key;
+    int ret = avl_key_import(self->ctx.dtype, derived, &key);
+    Py_DECREF(derived);
+    if (ret < 0) {
         return NULL;
+    }
+    avl_node_t *node = avl_node_new(&self->pool, key);
+    if (!node) {
+        avl_key_release(self->ctx.dtype, key);
+        return NULL;
+    }
+    if (self->keyfunc) {
+        Py_INCREF(obj);
+        PYAVL_NODE_ITEM(node, self->pool.node_size) = obj;
+    }
+    return node;
+}
+
+/**
+ * @brief Insert a Python object into the tree.
+ * 
+ * @return Return -1 on errors, 0 if the key is presented already and 1 if inserted.
+ */
+static int treeset_insert(TreeSetObj *self, PyObject *obj) {
+    avl_node_t *node = treeset_new_node(self, obj);
+    if (!node) {
+        return -1;
+    }
     int ret;
-    avl_node_t *node = avl_node_new(key);
-    self->root = avl_node_insert(self->root, node, &ret, NULL);
-    if (ret == -1) {
+    self->root = avl_node_insert(self->root, &self->ctx, node, &ret, NULL);
+    if (ret == 1) {
+        self->size ++;
+    } else {
+        treeset_free_node(node, self);
+    }
+    return ret;
+}
+
+static PyObject* TreeSetObj_add(TreeSetObj *self, PyObject *key) {
+    if (treeset_insert(self, key) < 0) {
         return NULL;
-    } else if (ret == 0) {
-        avl_node_free(node);
     }
-    self->size += ret;
     Py_RETURN_NONE;
 }
 
-static PyObject* TreeSetObj_remove(TreeSetObj *self, PyObject *args) {
-    PyObject *key;
-    if (!PyArg_ParseTuple(args, "O:remove", &key))
+static PyObject* TreeSetObj_remove(TreeSetObj *self, PyObject *key) {
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
         return NULL;
+    }
     avl_node_t *deleted;
     int ret;
-    self->root = avl_node_delete(self->root, key, &ret, &deleted);
+    self->root = avl_node_delete(self->root, &self->ctx, query, &ret, &deleted);
+    Py_DECREF(query);
     if (ret == -1) {
         return NULL;
     } else if (ret == 1) {
-        avl_node_free(deleted);
+        treeset_free_node(deleted, self);
     }
     self->size -= ret;
     Py_RETURN_NONE;
 }
 
+/**
+ * @brief Remove the keys at positions from start to end, exclusive: the tree is split
+ * twice by position and the rest joined, without comparing keys.
+ */
+static void treeset_delete_range(TreeSetObj *self, Py_ssize_t start, Py_ssize_t end) {
+    avl_node_t *left, *mid, *right;
+    avl_node_split_at(self->root, &self->ctx, start, &left, &right);
+    avl_node_split_at(right, &self->ctx, end - start, &mid, &right);
+    self->root = avl_node_join2(left, right, &self->ctx);
+    self->size -= end - start;
+    avl_node_drain(mid, (avl_func)treeset_free_node, self);
+}
+
+/**
+ * @brief Add sorted keys to the tree, keeping the first of equal keys. Keys above
+ * the maximum of the tree, all of them if it is empty, are built into a balanced
+ * tree in O(n) and joined to it in O(log n). The others are inserted one by one.
+ * 
+ * @param keys The keys, observed by the context. The tree takes over their references,
+ * which are released on errors.
+ * @param n The number of keys.
+ * @param pairs For a tree with a key function, the list of (key, object) pairs the
+ * keys come from, in the same order. NULL otherwise.
+ * @return Return 0 on success, -1 on errors.
+ */
+static int treeset_build(TreeSetObj *self, avl_key_t *keys, Py_ssize_t n, PyObject *pairs) {
+    avl_dtype_t dtype = self->ctx.dtype;
+    avl_node_t **nodes = NULL;
+    Py_ssize_t m = 0;
+    for (Py_ssize_t i = 0; i < n; i++) {
+        int cmp = m? avl_key_cmp(&self->ctx, keys[m - 1], keys[i]): -1;
+        if (cmp == -2) {
+            for (; i < n; i++) {
+                avl_key_release(dtype, keys[i]);
+            }
+            goto error;
+        } else if (cmp == 0) {
+            avl_key_release(dtype, keys[i]);
+        } else {
+            if (pairs) {
+                /* move the pair along with its key */
+                PyObject *pair = PyList_GET_ITEM(pairs, m);
+                PyList_SET_ITEM(pairs, m, PyList_GET_ITEM(pairs, i));
+                PyList_SET_ITEM(pairs, i, pair);
+            }
+            keys[m++] = keys[i];
+        }
+    }
+
+    /* the run above the maximum starts at the first key greater than it */
+    Py_ssize_t start = 0;
+    if (self->root) {
+        avl_key_t last = AVL_RAWKEY(avl_node_end(self->root, &self->ctx, 1));
+        for (Py_ssize_t hi = m; start < hi;) {
+            Py_ssize_t mid = start + (hi - start) / 2;
+            int cmp = avl_key_cmp(&self->ctx, keys[mid], last);
+            if (cmp == -2) {
+                goto error;
+            } else if (cmp > 0) {
+                hi = mid;
+            } else {
+                start = mid + 1;
+            }
+        }
+    }
+
+    nodes = PyMem_New(avl_node_t *, m);
+    if (!nodes) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    for (Py_ssize_t i = 0; i < m; i++) {
+        nodes[i] = avl_node_new(&self->pool, keys[i]);
+        if (!nodes[i]) {
+            while (i--) {
+                avl_pool_free(&self->pool, nodes[i]);
+            }
+            goto error;
+        }
+    }
+    for (Py_ssize_t i = 0; i < m && pairs; i++) {
+        PyObject *obj = PyTuple_GET_ITEM(PyList_GET_ITEM(pairs, i), 1);
+        Py_INCREF(obj);
+        PYAVL_NODE_ITEM(nodes[i], self->pool.node_size) = obj;
+    }
+    for (Py_ssize_t i = 0; i < start; i++) {
+        int ret;
+        self->root = avl_node_insert(self->root, &self->ctx, nodes[i], &ret, NULL);
+        if (ret == 1) {
+            self->size ++;
+            continue;
+        }
+        treeset_free_node(nodes[i], self);
+        if (ret == -1) {
+            while (++i < m) {
+                treeset_free_node(nodes[i], self);
+            }
+            PyMem_Free(nodes);
+            return -1;
+        }
+    }
+    avl_node_t *run = avl_node_build(nodes + start, m - start, &self->ctx);
+    self->root = avl_node_join2(self->root, run, &self->ctx);
+    self->size += m - start;
+    PyMem_Free(nodes);
+    return 0;
+
+error:
+    for (Py_ssize_t i = 0; i < m; i++) {
+        avl_key_release(dtype, keys[i]);
+    }
+    PyMem_Free(nodes);
+    return -1;
+}
+
+/**
+ * @brief The object to derive the i-th key from in treeset_load.
+ */
+static PyObject* treeset_load_key(TreeSetObj *self, PyObject *list, Py_ssize_t i) {
+    PyObject *obj = PyList_GET_ITEM(list, i);
+    return self->keyfunc? PyTuple_GET_ITEM(obj, 0): obj;
+}
+
+/**
+ * @brief Load an iterator into an empty tree.
+ * Keys are sorted unless they are sorted already, and then built into a
+ * balanced tree in O(n). The first of equal keys is kept. With a key function,
+ * objects are paired with their keys, derived once, and sorted along.
+ */
+static int treeset_load(TreeSetObj *self, PyObject *iter) {
+    PyObject *list = PySequence_List(iter);
+    if (!list) {
+        return -1;
+    }
+    Py_ssize_t n = PyList_GET_SIZE(list);
+    avl_dtype_t dtype = self->ctx.dtype;
+    avl_key_t *keys = PyMem_New(avl_key_t, n);
+    Py_ssize_t cnt = 0;
+    int ret = -1;
+    if (!keys) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    for (Py_ssize_t i = 0; i < n && self->keyfunc; i++) {
+        PyObject *obj = PyList_GET_ITEM(list, i);
+        PyObject *derived = pyavl_derive_key((PyAVLTreeObj *)self, obj);
+        PyObject *pair = derived? PyTuple_Pack(2, derived, obj): NULL;
+        Py_XDECREF(derived);
+        if (!pair) {
+            goto done;
+        }
+        PyList_SET_ITEM(list, i, pair);
+        Py_DECREF(obj);
+    }
+    for (; cnt < n; cnt++) {
+        if (avl_key_import(dtype, treeset_load_key(self, list, cnt), &keys[cnt]) < 0) {
+            goto done;
+        }
+        avl_ctx_observe(&self->ctx, keys[cnt]);
+    }
+    int sorted = avl_keys_sorted(&self->ctx, keys, n);
+    if (sorted < 0) {
+        goto done;
+    } else if (!sorted && !self->keyfunc) {
+        if (avl_keys_sort(&self->ctx, keys, n) < 0) {
+            goto done;
+        }
+    } else if (!sorted) {
+        if (pyavl_sort_pairs(list) < 0) {
+            goto done;
+        }
+        for (Py_ssize_t i = 0; i < n; i++) {
+            avl_key_release(dtype, keys[i]);
+            if (avl_key_import(dtype, treeset_load_key(self, list, i), &keys[i]) < 0) {
+                for (Py_ssize_t j = i + 1; j < n; j++) {
+                    avl_key_release(dtype, keys[j]);
+                }
+                cnt = i;
+                goto done;
+            }
+        }
+    }
+
+    ret = treeset_build(self, keys, n, self->keyfunc? list: NULL);
+    cnt = 0;
+
+done:
+    for (Py_ssize_t i = 0; i < cnt; i++) {
+        avl_key_release(dtype, keys[i]);
+    }
+    if (ret < 0 && !self->root) {
+        avl_ctx_init(&self->ctx, dtype);
+    }
+    PyMem_Free(keys);
+    Py_DECREF(list);
+    return ret;
+}
+
 static PyObject* TreeSetObj_extend_iter(TreeSetObj *self, PyObject *iter) {
+    if (self->size == 0) {
+        if (treeset_load(self, iter) < 0) {
+            return NULL;
+        }
+        Py_RETURN_NONE;
+    }
+
     PyObject *key;
     while ((key = PyIter_Next(iter))) {
-        int ret;
-        avl_node_t *node = avl_node_new(key);
-        self->root = avl_node_insert(self->root, node, &ret, NULL);
+        int ret = treeset_insert(self, key);
         Py_DECREF(key);
         if (ret == -1) {
             return NULL;
-        } else if (ret == 0) {
-            avl_node_free(node);
         }
-        self->size += ret;
+    }
+    if (PyErr_Occurred()) {
+        return NULL;
     }
     Py_RETURN_NONE;
 }
 
-static PyObject* TreeSetObj_extend(TreeSetObj *self, PyObject *args) {
-    PyObject *obj;
-    if (!PyArg_ParseTuple(args, "O:extend", &obj))
-        return NULL;
+static PyObject* TreeSetObj_extend(TreeSetObj *self, PyObject *obj) {
     PyObject *iter = PyObject_GetIter(obj);
     if (iter == NULL) {
         PyErr_SetString(
@@ -92,28 +417,479 @@ static PyObject* TreeSetObj_extend(TreeSetObj *self, PyObject *args) {
     return ret;
 }
 
-static PyObject* TreeSetObj_clear(TreeSetObj *self) {
-    avl_node_free(self->root);
-    self->root = NULL;
-    self->size = 0;
+static PyObject* TreeSetObj_extend_sorted(TreeSetObj *self, PyObject *obj) {
+    PyObject *iter = PyObject_GetIter(obj);
+    if (iter == NULL) {
+        return NULL;
+    }
+    int ret = treeset_load(self, iter);
+    Py_DECREF(iter);
+    if (ret < 0) {
+        return NULL;
+    }
     Py_RETURN_NONE;
 }
 
-static int TreeSetObj_init(TreeSetObj *self, PyObject *args) {
-    
-    if (args == NULL || PyTuple_Size(args) == 0)
-        return 0;
-    if (PyTuple_Size(args) != 1) {
-        PyErr_SetString(
-            PyExc_TypeError, "AVLTree.__init__ takes at most 1 positional argument."
-        );
+static void treeset_incref_node(avl_node_t *node, treeset_layout_t *layout) {
+    if (AVL_DTYPE_BOXED(layout->dtype)) {
+        Py_INCREF(AVL_KEY(node));
+    }
+    if (layout->keyed_size) {
+        Py_INCREF(PYAVL_NODE_ITEM(node, layout->keyed_size));
+    }
+}
+
+/**
+ * @brief Copy a tree of the same dtype and key function into the pool of self,
+ * taking references to its keys.
+ */
+static avl_node_t* treeset_copy_nodes(TreeSetObj *self, avl_node_t *root, int *ret) {
+    avl_node_t *copy = avl_node_copy(root, &self->pool, ret);
+    if (*ret < 0) {
+        return NULL;
+    }
+    treeset_layout_t layout = treeset_layout(self);
+    if (AVL_DTYPE_BOXED(layout.dtype) || layout.keyed_size) {
+        avl_node_foreach(copy, (avl_func)treeset_incref_node, &layout);
+    }
+    return copy;
+}
+
+/**
+ * @brief Create an empty TreeSet with the dtype and the key function of like.
+ */
+static TreeSetObj* treeset_empty(TreeSetObj *like) {
+    TreeSetObj *self = (TreeSetObj *)TreeSetObj_new(&TreeSet_Type, NULL, NULL);
+    if (self) {
+        avl_ctx_init(&self->ctx, like->ctx.dtype);
+        treeset_set_keyfunc(self, like->keyfunc? like->keyfunc: Py_None);
+    }
+    return self;
+}
+
+static TreeSetObj* treeset_copy(TreeSetObj *self) {
+    TreeSetObj *copy = treeset_empty(self);
+    if (!copy) {
+        return NULL;
+    }
+    int ret;
+    copy->root = treeset_copy_nodes(copy, self->root, &ret);
+    if (ret < 0) {
+        Py_DECREF(copy);
+        return NULL;
+    }
+    copy->size = self->size;
+    copy->ctx.kind = self->ctx.kind;
+    return copy;
+}
+
+static PyObject* TreeSetObj_copy(TreeSetObj *self) {
+    return (PyObject *)treeset_copy(self);
+}
+
+typedef struct {
+    treeset_layout_t layout;
+    size_t from_size;       /* the node size of the tree copied from, if keyed */
+} treeset_keys_t;
+
+/**
+ * @brief Take the key, and the object it is derived from, of a node copied by shape.
+ */
+static void treeset_take_key(avl_node_t *copy, avl_node_t *node, treeset_keys_t *keys) {
+    if (AVL_DTYPE_BOXED(keys->layout.dtype)) {
+        Py_INCREF(AVL_KEY(copy));
+    }
+    if (keys->layout.keyed_size) {
+        PyObject *item = PYAVL_NODE_ITEM(node, keys->from_size);
+        Py_INCREF(item);
+        PYAVL_NODE_ITEM(copy, keys->layout.keyed_size) = item;
+    }
+}
+
+extern PyObject* TreeSet_FromTree(avl_node_t *root, Py_ssize_t size, avl_ctx_t *ctx,
+    PyObject *keyfunc, size_t keyed_size) {
+    TreeSetObj *self = (TreeSetObj *)TreeSetObj_new(&TreeSet_Type, NULL, NULL);
+    if (!self) {
+        return NULL;
+    }
+    avl_ctx_init(&self->ctx, ctx->dtype);
+    self->ctx.kind = ctx->kind;
+    if (keyfunc && treeset_set_keyfunc(self, keyfunc) < 0) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    treeset_keys_t keys = {treeset_layout(self), keyed_size};
+    int ret;
+    self->root = avl_node_copy_shape(root, &self->pool, (avl_copy_func)treeset_take_key, &keys, &ret);
+    if (ret < 0) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    self->size = size;
+    return (PyObject *)self;
+}
+
+/**
+ * @brief Get a TreeSet with the dtype and the key function of self holding the keys of an iterable.
+ * 
+ * @return Return a new reference, to other itself if it is such a TreeSet.
+ */
+static TreeSetObj* treeset_coerce(TreeSetObj *self, PyObject *other) {
+    if (TreeSetObj_Check(other) &&
+        ((TreeSetObj *)other)->ctx.dtype == self->ctx.dtype &&
+        ((TreeSetObj *)other)->keyfunc == self->keyfunc) {
+        Py_INCREF(other);
+        return (TreeSetObj *)other;
+    }
+    PyObject *iter = PyObject_GetIter(other);
+    if (!iter) {
+        return NULL;
+    }
+    TreeSetObj *tmp = treeset_empty(self);
+    if (tmp && treeset_load(tmp, iter) < 0) {
+        Py_CLEAR(tmp);
+    }
+    Py_DECREF(iter);
+    return tmp;
+}
+
+/**
+ * @brief Replace the keys of self by the result of a set operation with other.
+ * The nodes of other are copied into the pool of self, then both trees are
+ * consumed by avl_node_setop. On errors, self is left empty.
+ */
+static int treeset_setop_unsafe(TreeSetObj *self, TreeSetObj *other, avl_setop_t op) {
+    int ret;
+    avl_node_t *copy = treeset_copy_nodes(self, other->root, &ret);
+    if (ret < 0) {
+        return -1;
+    }
+    avl_ctx_t ctx = self->ctx;
+    avl_ctx_merge(&ctx, &other->ctx);
+    avl_node_t *dropped;
+    avl_node_t *root = avl_node_setop(op, self->root, copy, &ctx, &dropped, &ret);
+    self->ctx.ncmp = ctx.ncmp;
+    self->ctx.version = ctx.version;
+    if (op == AVL_SETOP_UNION || op == AVL_SETOP_SYMMETRIC_DIFFERENCE) {
+        self->ctx.kind = ctx.kind;
+    }
+    self->root = ret < 0? NULL: root;
+    self->size = AVL_SIZE0(self->root);
+    avl_node_drain(dropped, (avl_func)treeset_free_node, self);
+    if (ret < 0) {
+        avl_node_drain(root, (avl_func)treeset_free_node, self);
+    }
+    return ret;
+}
+
+/**
+ * @brief Apply a set operation with other to self in place.
+ * When comparisons may run Python code, the operation is done on a copy that
+ * replaces self on success, so self is never seen half-way nor lost on errors.
+ */
+static int treeset_setop(TreeSetObj *self, TreeSetObj *other, avl_setop_t op) {
+    avl_ctx_t ctx = self->ctx;
+    avl_ctx_merge(&ctx, &other->ctx);
+    if (!avl_ctx_fallible(&ctx)) {
+        return treeset_setop_unsafe(self, other, op);
+    }
+
+    TreeSetObj *tmp = treeset_copy(self);
+    if (!tmp) {
         return -1;
     }
+    tmp->ctx.ncmp = self->ctx.ncmp;
+    int ret = treeset_setop_unsafe(tmp, other, op);
+    if (ret == 0) {
+        avl_node_t *root = self->root;
+        Py_ssize_t size = self->size;
+        avl_ctx_t ctx = self->ctx;
+        avl_pool_t pool = self->pool;
+        self->root = tmp->root;
+        self->size = tmp->size;
+        self->ctx = tmp->ctx;
+        self->pool = tmp->pool;
+        tmp->root = root;
+        tmp->size = size;
+        tmp->ctx = ctx;
+        tmp->pool = pool;
+    }
+    Py_DECREF(tmp);
+    return ret;
+}
 
-    PyObject *obj;
-    if (!PyArg_ParseTuple(args, "O", &obj))
+/**
+ * @brief Return a new TreeSet with the result of a set operation of self with an iterable.
+ */
+static PyObject* treeset_binop(TreeSetObj *self, PyObject *other, avl_setop_t op) {
+    TreeSetObj *rhs = treeset_coerce(self, other);
+    if (!rhs) {
+        return NULL;
+    }
+    TreeSetObj *res = treeset_copy(self);
+    if (res && treeset_setop_unsafe(res, rhs, op) < 0) {
+        Py_CLEAR(res);
+    }
+    Py_DECREF(rhs);
+    return (PyObject *)res;
+}
+
+/**
+ * @brief Update self by a set operation with an iterable.
+ */
+static int treeset_update_op(TreeSetObj *self, PyObject *other, avl_setop_t op) {
+    TreeSetObj *rhs = treeset_coerce(self, other);
+    if (!rhs) {
         return -1;
-    
+    }
+    int ret = treeset_setop(self, rhs, op);
+    Py_DECREF(rhs);
+    return ret;
+}
+
+static PyObject* TreeSetObj_union(TreeSetObj *self, PyObject *other) {
+    return treeset_binop(self, other, AVL_SETOP_UNION);
+}
+
+static PyObject* TreeSetObj_intersection(TreeSetObj *self, PyObject *other) {
+    return treeset_binop(self, other, AVL_SETOP_INTERSECTION);
+}
+
+static PyObject* TreeSetObj_difference(TreeSetObj *self, PyObject *other) {
+    return treeset_binop(self, other, AVL_SETOP_DIFFERENCE);
+}
+
+static PyObject* TreeSetObj_symmetric_difference(TreeSetObj *self, PyObject *other) {
+    return treeset_binop(self, other, AVL_SETOP_SYMMETRIC_DIFFERENCE);
+}
+
+static PyObject* TreeSetObj_update(TreeSetObj *self, PyObject *other) {
+    if (treeset_update_op(self, other, AVL_SETOP_UNION) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject* TreeSetObj_intersection_update(TreeSetObj *self, PyObject *other) {
+    if (treeset_update_op(self, other, AVL_SETOP_INTERSECTION) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject* TreeSetObj_difference_update(TreeSetObj *self, PyObject *other) {
+    if (treeset_update_op(self, other, AVL_SETOP_DIFFERENCE) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject* TreeSetObj_symmetric_difference_update(TreeSetObj *self, PyObject *other) {
+    if (treeset_update_op(self, other, AVL_SETOP_SYMMETRIC_DIFFERENCE) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+/**
+ * @brief Check whether the keys of a are in b (subset) or none of them is (disjoint).
+ */
+static PyObject* treeset_relation(TreeSetObj *self, TreeSetObj *a, TreeSetObj *b, int disjoint) {
+    avl_ctx_t ctx = a->ctx;
+    avl_ctx_merge(&ctx, &b->ctx);
+    ctx.ncmp = self->ctx.ncmp;
+    int ret = disjoint?
+        avl_node_isdisjoint(a->root, b->root, &ctx):
+        avl_node_issubset(a->root, b->root, &ctx);
+    self->ctx.ncmp = ctx.ncmp;
+    if (ret < 0) {
+        return NULL;
+    }
+    return PyBool_FromLong(ret);
+}
+
+static PyObject* TreeSetObj_issubset(TreeSetObj *self, PyObject *other) {
+    TreeSetObj *rhs = treeset_coerce(self, other);
+    if (!rhs)
+        return NULL;
+    PyObject *ret = treeset_relation(self, self, rhs, 0);
+    Py_DECREF(rhs);
+    return ret;
+}
+
+static PyObject* TreeSetObj_issuperset(TreeSetObj *self, PyObject *other) {
+    TreeSetObj *rhs = treeset_coerce(self, other);
+    if (!rhs)
+        return NULL;
+    PyObject *ret = treeset_relation(self, rhs, self, 0);
+    Py_DECREF(rhs);
+    return ret;
+}
+
+static PyObject* TreeSetObj_isdisjoint(TreeSetObj *self, PyObject *other) {
+    TreeSetObj *rhs = treeset_coerce(self, other);
+    if (!rhs)
+        return NULL;
+    PyObject *ret = rhs->size < self->size?
+        treeset_relation(self, rhs, self, 1):
+        treeset_relation(self, self, rhs, 1);
+    Py_DECREF(rhs);
+    return ret;
+}
+
+static PyObject* TreeSetObj_clear(TreeSetObj *self) {
+    treeset_drop(self);
+    Py_RETURN_NONE;
+}
+
+static PyObject* TreeSetObj_stats(TreeSetObj *self) {
+    return pyavl_tree_stats(&self->pool, &self->ctx);
+}
+
+static PyObject* TreeSetObj_freeze(TreeSetObj *self) {
+    if (self->keyfunc) {
+        PyErr_SetString(PyExc_ValueError, "Cannot freeze a TreeSet with a key function.");
+        return NULL;
+    }
+    pyavl_column_t keys = {self->root, NULL, offsetof(avl_node_t, key)};
+    return FrozenTree_New(&FrozenTreeSet_Type, &keys, NULL, self->size, &self->ctx,
+        AVL_DTYPE_OBJECT);
+}
+
+static PyObject* TreeSetObj_to_buffer(TreeSetObj *self) {
+    if (self->keyfunc) {
+        PyErr_SetString(PyExc_ValueError, "Cannot export a TreeSet with a key function to a buffer.");
+        return NULL;
+    }
+    pyavl_column_t keys = {self->root, NULL, offsetof(avl_node_t, key)};
+    return pyavl_export_keys(&keys, self->size, self->ctx.dtype);
+}
+
+static PyObject* TreeSetObj_from_buffer(PyTypeObject *type, PyObject *buffer) {
+    avl_dtype_t dtype;
+    Py_ssize_t n;
+    avl_key_t *keys = pyavl_import_keys(buffer, &dtype, &n);
+    if (!keys) {
+        return NULL;
+    }
+    TreeSetObj *self = (TreeSetObj *)TreeSetObj_new(type, NULL, NULL);
+    int sorted = -1;
+    if (self) {
+        avl_ctx_init(&self->ctx, dtype);
+        for (Py_ssize_t i = 0; i < n; i++) {
+            avl_ctx_observe(&self->ctx, keys[i]);
+        }
+        sorted = avl_keys_sorted(&self->ctx, keys, n);
+    }
+    if (sorted < 0 || (!sorted && avl_keys_sort(&self->ctx, keys, n) < 0)) {
+        for (Py_ssize_t i = 0; i < n; i++) {
+            avl_key_release(dtype, keys[i]);
+        }
+        Py_XDECREF(self);
+        self = NULL;
+    } else if (treeset_build(self, keys, n, NULL) < 0) {
+        Py_CLEAR(self);
+    }
+    PyMem_Free(keys);
+    return (PyObject *)self;
+}
+
+static PyObject* treeset_save(TreeSetObj *self, PyObject *file) {
+    avl_dtype_t dtypes[2] = {self->ctx.dtype, AVL_DTYPE_OBJECT};
+    pyavl_column_t columns[2] = {
+        {self->root, NULL, offsetof(avl_node_t, key)},
+        {self->root, NULL, self->pool.node_size - sizeof(PyObject *)}
+    };
+    return pyavl_snapshot_save(file, (PyAVLTreeObj *)self, PYAVL_SNAPSHOT_SET, 0,
+        self->keyfunc? 2: 1, dtypes, columns);
+}
+
+/**
+ * @brief Create a TreeSet from a snapshot, linking nodes bottom-up without comparisons.
+ */
+static PyObject* treeset_load_snapshot(PyTypeObject *type, PyObject *src, int in_memory) {
+    pyavl_snapshot_t snap;
+    if (pyavl_snapshot_load(src, in_memory, PYAVL_SNAPSHOT_SET, &snap) < 0) {
+        return NULL;
+    }
+    avl_key_t *keys = snap.columns[0], *items = snap.columns[1];
+    Py_ssize_t n = snap.size;
+    avl_node_t **nodes = NULL;
+    TreeSetObj *self = (TreeSetObj *)TreeSetObj_new(type, NULL, NULL);
+    if (!self) {
+        goto error;
+    }
+    avl_ctx_init(&self->ctx, snap.dtypes[0]);
+    if (snap.keyfunc && treeset_set_keyfunc(self, snap.keyfunc) < 0) {
+        goto error;
+    }
+    nodes = PyMem_New(avl_node_t *, n? n: 1);
+    if (!nodes) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    for (Py_ssize_t i = 0; i < n; i++) {
+        nodes[i] = avl_node_new(&self->pool, keys[i]);
+        if (!nodes[i]) {
+            while (i--) {
+                avl_pool_free(&self->pool, nodes[i]);
+            }
+            goto error;
+        }
+        avl_ctx_observe(&self->ctx, keys[i]);
+        if (items) {
+            PYAVL_NODE_ITEM(nodes[i], self->pool.node_size) = items[i].obj;
+        }
+    }
+    /* the tree takes over the keys and the objects */
+    self->root = avl_node_build(nodes, n, &self->ctx);
+    self->size = n;
+    PyMem_Free(nodes);
+    pyavl_snapshot_free(&snap, 0);
+    return (PyObject *)self;
+
+error:
+    PyMem_Free(nodes);
+    pyavl_snapshot_free(&snap, 1);
+    Py_XDECREF(self);
+    return NULL;
+}
+
+static PyObject* TreeSetObj_save(TreeSetObj *self, PyObject *file) {
+    return treeset_save(self, file);
+}
+
+static PyObject* TreeSetObj_load(PyTypeObject *type, PyObject *file) {
+    return treeset_load_snapshot(type, file, 0);
+}
+
+static PyObject* TreeSetObj_from_snapshot(PyTypeObject *type, PyObject *data) {
+    return treeset_load_snapshot(type, data, 1);
+}
+
+static PyObject* TreeSetObj_reduce(TreeSetObj *self) {
+    PyObject *restore = PyObject_GetAttrString((PyObject *)Py_TYPE(self), "_from_snapshot");
+    PyObject *data = restore? treeset_save(self, NULL): NULL;
+    if (!data) {
+        Py_XDECREF(restore);
+        return NULL;
+    }
+    return Py_BuildValue("(N(N))", restore, data);
+}
+
+static int treeset_init_iterable(TreeSetObj *self, PyObject *obj) {
+    if (!self->size && TreeSetObj_Check(obj) &&
+        ((TreeSetObj *)obj)->ctx.dtype == self->ctx.dtype &&
+        ((TreeSetObj *)obj)->keyfunc == self->keyfunc) {
+        /* copied by shape, without comparisons */
+        TreeSetObj *other = (TreeSetObj *)obj;
+        int ret;
+        avl_node_t *root = treeset_copy_nodes(self, other->root, &ret);
+        if (ret < 0) {
+            return -1;
+        }
+        avl_ctx_init(&self->ctx, self->ctx.dtype);
+        self->ctx.kind = other->ctx.kind;
+        self->root = root;
+        self->size = other->size;
+        return 0;
+    }
     PyObject *iter = PyObject_GetIter(obj);
     if (!iter) {
         PyErr_SetString(
@@ -130,19 +906,113 @@ static int TreeSetObj_init(TreeSetObj *self, PyObject *args) {
     return 0;
 }
 
-static PyObject* treeset_getkey(avl_node_t *node) {
-    if (!node) {
+static int TreeSetObj_init(TreeSetObj *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"iterable", "dtype", "backend", "key", NULL};
+    PyObject *obj = NULL, *dtype_name = NULL, *backend = NULL, *keyfunc = NULL;
+    if (!PyArg_ParseTupleAndKeywords(
+            args, kwargs, "|O$OOO:TreeSet", kwlist, &obj, &dtype_name, &backend, &keyfunc))
+        return -1;
+
+    if (dtype_name) {
+        avl_dtype_t dtype;
+        if (avl_dtype_parse(dtype_name, &dtype) < 0)
+            return -1;
+        if (dtype != self->ctx.dtype) {
+            if (self->size) {
+                PyErr_SetString(
+                    PyExc_ValueError, "Cannot change dtype of a non-empty TreeSet."
+                );
+                return -1;
+            }
+            avl_ctx_init(&self->ctx, dtype);
+        }
+    }
+    if (keyfunc && treeset_set_keyfunc(self, keyfunc) < 0)
+        return -1;
+    if (!obj)
+        return 0;
+    return treeset_init_iterable(self, obj);
+}
+
+#if PY_VERSION_HEX >= 0x03090000
+/**
+ * @brief Call TreeSet without packing arguments into a tuple for TreeSet() and
+ * TreeSet(iterable). Other calls go through __new__ and __init__.
+ */
+static PyObject* TreeSetObj_vectorcall(
+    PyObject *type, PyObject *const *args, size_t nargsf, PyObject *kwnames) {
+    Py_ssize_t nargs = PyVectorcall_NARGS(nargsf);
+    if (kwnames || nargs > 1) {
+        return pyavl_vectorcall_new(type, args, nargsf, kwnames);
+    }
+    TreeSetObj *self = (TreeSetObj *)TreeSetObj_new((PyTypeObject *)type, NULL, NULL);
+    if (self && nargs == 1 && treeset_init_iterable(self, args[0]) < 0) {
+        Py_CLEAR(self);
+    }
+    return (PyObject *)self;
+}
+#endif
+
+static PyObject* treeset_getkey(avl_node_t *node, TreeSetObj *owner) {
+    if (!node) {
+        return NULL;
+    } else if (owner->keyfunc) {
+        PyObject *obj = PYAVL_NODE_ITEM(node, owner->pool.node_size);
+        Py_INCREF(obj);
+        return obj;
+    }
+    return avl_key_to_object(owner->ctx.dtype, AVL_RAWKEY(node));
+}
+
+static PyObject* TreeSetObj_iter(TreeSetObj *self) {
+    return TreeIter_NewFromRoot(
+        (PyObject *)self, self->root, (avl_iter_getter)treeset_getkey
+    );
+}
+
+static PyObject* TreeSetObj_reversed(TreeSetObj *self) {
+    return TreeIter_New(
+        (PyObject *)self, avl_iter_new_at(self->root, self->size - 1, 1), -1,
+        (avl_iter_getter)treeset_getkey
+    );
+}
+
+static PyObject* TreeSetObj_iter_from(
+    TreeSetObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"key", "inclusive", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args("iter_from", args, nargs, kwnames, kwlist, 1, 2, argv) < 0)
+        return NULL;
+    PyObject *key = argv[0];
+    int inclusive = argv[1]? PyObject_IsTrue(argv[1]): 1;
+    if (inclusive < 0)
+        return NULL;
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
         return NULL;
     }
-    PyObject *key = AVL_KEY(node);
-    Py_INCREF(key);
-    return key;
+    avl_iter_t *iter = avl_iter_new_from(self->root, &self->ctx, query, inclusive, 0);
+    Py_DECREF(query);
+    return TreeIter_New((PyObject *)self, iter, -1, (avl_iter_getter)treeset_getkey);
 }
 
-static PyObject* TreeSetObj_iter(TreeSetObj *self) {
-    return TreeIter_NewFromRoot(
-        self->root, (avl_iter_getter)treeset_getkey
-    );
+static PyObject* TreeSetObj_iter_before(
+    TreeSetObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"key", "inclusive", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args("iter_before", args, nargs, kwnames, kwlist, 1, 2, argv) < 0)
+        return NULL;
+    PyObject *key = argv[0];
+    int inclusive = argv[1]? PyObject_IsTrue(argv[1]): 0;
+    if (inclusive < 0)
+        return NULL;
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return NULL;
+    }
+    avl_iter_t *iter = avl_iter_new_from(self->root, &self->ctx, query, inclusive, 1);
+    Py_DECREF(query);
+    return TreeIter_New((PyObject *)self, iter, -1, (avl_iter_getter)treeset_getkey);
 }
 
 static PyObject* TreeSetObj_min(TreeSetObj *self) {
@@ -154,12 +1024,7 @@ static PyObject* TreeSetObj_min(TreeSetObj *self) {
         );
         return NULL;
     }
-    while (AVL_LEFT(root)) {
-        root = AVL_LEFT(root);
-    }
-    PyObject *ret = AVL_KEY(root);
-    Py_INCREF(ret);
-    return ret;
+    return treeset_getkey(avl_node_end(root, &self->ctx, 0), self);
 }
 
 static PyObject* TreeSetObj_max(TreeSetObj *self) {
@@ -171,22 +1036,16 @@ static PyObject* TreeSetObj_max(TreeSetObj *self) {
         );
         return NULL;
     }
-    while (AVL_RIGHT(root)) {
-        root = AVL_RIGHT(root);
-    }
-    PyObject *ret = AVL_KEY(root);
-    Py_INCREF(ret);
-    return ret;
+    return treeset_getkey(avl_node_end(root, &self->ctx, 1), self);
 }
 
-static PyObject* TreeSetObj_loc(TreeSetObj *self, PyObject *args) {
-    int idx;
-    if (!PyArg_ParseTuple(args, "i:loc", &idx)) {
+static PyObject* TreeSetObj_loc(TreeSetObj *self, PyObject *arg) {
+    Py_ssize_t loc = PyNumber_AsSsize_t(arg, PyExc_OverflowError);
+    if (loc == -1 && PyErr_Occurred()) {
         return NULL;
     }
-    int loc = idx;
     if (loc < 0) {
-        loc += (int)self->size;
+        loc += self->size;
     }
     avl_node_t *node = avl_node_loc(self->root, loc);
     if (!node) {
@@ -195,80 +1054,423 @@ static PyObject* TreeSetObj_loc(TreeSetObj *self, PyObject *args) {
         );
         return NULL;
     }
-    PyObject *ret = AVL_KEY(node);
-    Py_INCREF(ret);
-    return ret;
+    return treeset_getkey(node, self);
 }
 
-static PyObject* TreeSetObj_at_most(TreeSetObj *self, PyObject *args) {
-    PyObject *key;
-    if (!PyArg_ParseTuple(args, "O:at_most", &key)) {
-        return NULL;
+/**
+ * @brief Unlink the node at a position, negative ones counting from the end,
+ * descending by subtree sizes without comparing keys.
+ *
+ * @return Return the unlinked node, to free with treeset_free_node; NULL with
+ * an exception set on failure.
+ */
+static avl_node_t* treeset_unlink_at(TreeSetObj *self, Py_ssize_t loc, const char *empty) {
+    if (loc < 0) {
+        loc += self->size;
     }
+    avl_node_t *deleted;
     int ret;
-    avl_node_t *node = avl_node_at_most(self->root, key, &ret);
+    self->root = avl_node_delete_at(self->root, &self->ctx, loc, &ret, &deleted);
+    if (ret == -1) {
+        return NULL;
+    } else if (ret == 0) {
+        PyErr_SetString(PyExc_IndexError, self->size? "TreeSet index out of range": empty);
+        return NULL;
+    }
+    self->size --;
+    return deleted;
+}
+
+/**
+ * @brief Remove and return the key at a position, the last one by default.
+ */
+static PyObject* TreeSetObj_pop(
+    TreeSetObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"index", NULL};
+    PyObject *argv[1];
+    if (pyavl_parse_args("pop", args, nargs, kwnames, kwlist, 0, 1, argv) < 0) {
+        return NULL;
+    }
+    Py_ssize_t loc = argv[0]? PyNumber_AsSsize_t(argv[0], PyExc_OverflowError): -1;
+    if (loc == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    avl_node_t *deleted = treeset_unlink_at(self, loc, "pop from an empty TreeSet");
+    if (!deleted) {
+        return NULL;
+    }
+    PyObject *key = treeset_getkey(deleted, self);
+    treeset_free_node(deleted, self);
+    return key;
+}
+
+/**
+ * @brief Clip a position to [0, size] as list slices do, negative ones counting from the end.
+ */
+static Py_ssize_t treeset_clip(TreeSetObj *self, Py_ssize_t loc) {
+    if (loc < 0) {
+        loc += self->size;
+        return loc < 0? 0: loc;
+    }
+    return loc > self->size? self->size: loc;
+}
+
+/**
+ * @brief Delete the keys at positions start to end, as `del lst[start:end]` does on a list.
+ */
+static PyObject* TreeSetObj_delete_range(
+    TreeSetObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *const kwlist[] = {"start", "end", NULL};
+    PyObject *argv[2];
+    if (pyavl_parse_args("delete_range", args, nargs, kwnames, kwlist, 1, 2, argv) < 0) {
+        return NULL;
+    }
+    Py_ssize_t start = PyNumber_AsSsize_t(argv[0], NULL);
+    if (start == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    Py_ssize_t end = argv[1] && argv[1] != Py_None? PyNumber_AsSsize_t(argv[1], NULL): self->size;
+    if (end == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    start = treeset_clip(self, start);
+    end = treeset_clip(self, end);
+    if (start < end) {
+        treeset_delete_range(self, start, end);
+    }
+    Py_RETURN_NONE;
+}
+
+static avl_node_t* treeset_cursor_node(TreeSetObj *self, PyObject *obj, PyObject *val) {
+    return treeset_new_node(self, obj);
+}
+
+static const pyavl_cursor_ops_t treeset_cursor_ops = {
+    (avl_iter_getter)treeset_getkey,
+    NULL,
+    (avl_node_t* (*)(PyObject *, PyObject *, PyObject *))treeset_cursor_node,
+    (void (*)(avl_node_t *, PyObject *))treeset_free_node,
+    NULL,
+};
+
+static PyObject* TreeSetObj_cursor(TreeSetObj *self) {
+    return TreeCursor_New((PyObject *)self, &treeset_cursor_ops);
+}
+
+static PyObject* TreeSetObj_bisect_left(TreeSetObj *self, PyObject *key) {
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return NULL;
+    }
+    Py_ssize_t ret = avl_node_bisect(self->root, &self->ctx, query, 0, NULL);
+    Py_DECREF(query);
+    if (ret < 0) {
+        return NULL;
+    }
+    return PyLong_FromSsize_t(ret);
+}
+
+static PyObject* TreeSetObj_bisect_right(TreeSetObj *self, PyObject *key) {
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return NULL;
+    }
+    Py_ssize_t ret = avl_node_bisect(self->root, &self->ctx, query, 1, NULL);
+    Py_DECREF(query);
+    if (ret < 0) {
+        return NULL;
+    }
+    return PyLong_FromSsize_t(ret);
+}
+
+static PyObject* TreeSetObj_index(TreeSetObj *self, PyObject *key) {
+    int found;
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return NULL;
+    }
+    Py_ssize_t ret = avl_node_bisect(self->root, &self->ctx, query, 0, &found);
+    Py_DECREF(query);
+    if (ret < 0) {
+        return NULL;
+    } else if (!found) {
+        PyErr_SetString(PyExc_ValueError, "key is not in TreeSet");
+        return NULL;
+    }
+    return PyLong_FromSsize_t(ret);
+}
+
+static PyObject* TreeSetObj_count_range(
+    TreeSetObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    PyObject *lo, *hi;
+    int lo_inclusive, hi_inclusive;
+    if (pyavl_parse_range(
+            "count_range", args, nargs, kwnames, &lo, &hi, &lo_inclusive, &hi_inclusive) < 0)
+        return NULL;
+    Py_ssize_t start, end;
+    if (pyavl_range_bounds(
+            (PyAVLTreeObj *)self, lo, hi, lo_inclusive, hi_inclusive, &start, &end) < 0)
+        return NULL;
+    return PyLong_FromSsize_t(end - start);
+}
+
+static PyObject* TreeSetObj_irange(
+    TreeSetObj *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    PyObject *lo, *hi;
+    int lo_inclusive, hi_inclusive;
+    if (pyavl_parse_range(
+            "irange", args, nargs, kwnames, &lo, &hi, &lo_inclusive, &hi_inclusive) < 0)
+        return NULL;
+    return TreeRange_New(
+        (PyObject *)self, lo, hi, lo_inclusive, hi_inclusive, (avl_iter_getter)treeset_getkey
+    );
+}
+
+static PyObject* TreeSetObj_at_most(TreeSetObj *self, PyObject *key) {
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return NULL;
+    }
+    ptrdiff_t ret;
+    avl_node_t *node = avl_node_at_most(self->root, &self->ctx, query, &ret);
+    Py_DECREF(query);
     if (ret < 0) {
         return NULL;
     } else if (ret == 0) {
         Py_RETURN_NONE;
     }
-    key = AVL_KEY(node);
-    Py_INCREF(key);
-    return key;
+    return treeset_getkey(node, self);
 }
 
-static PyObject* TreeSetObj_at_least(TreeSetObj *self, PyObject *args) {
-    PyObject *key;
-    if (!PyArg_ParseTuple(args, "O:at_least", &key)) {
+static PyObject* TreeSetObj_at_least(TreeSetObj *self, PyObject *key) {
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
         return NULL;
     }
-    int ret;
-    avl_node_t *node = avl_node_at_least(self->root, key, &ret);
+    ptrdiff_t ret;
+    avl_node_t *node = avl_node_at_least(self->root, &self->ctx, query, &ret);
+    Py_DECREF(query);
     if (ret < 0) {
         return NULL;
     } else if (ret == 0) {
         Py_RETURN_NONE;
     }
-    key = AVL_KEY(node);
-    Py_INCREF(key);
-    return key;
+    return treeset_getkey(node, self);
+}
+
+static PyObject* TreeSetObj_contains_many(TreeSetObj *self, PyObject *keys) {
+    return pyavl_lookup_many((PyObject *)self, keys, PYAVL_LOOKUP_FIND, NULL, NULL, NULL);
+}
+
+static PyObject* TreeSetObj_at_most_many(TreeSetObj *self, PyObject *keys) {
+    return pyavl_lookup_many(
+        (PyObject *)self, keys, PYAVL_LOOKUP_AT_MOST, (avl_iter_getter)treeset_getkey, NULL, Py_None
+    );
+}
+
+static PyObject* TreeSetObj_at_least_many(TreeSetObj *self, PyObject *keys) {
+    return pyavl_lookup_many(
+        (PyObject *)self, keys, PYAVL_LOOKUP_AT_LEAST, (avl_iter_getter)treeset_getkey, NULL, Py_None
+    );
 }
 
 static PyMethodDef TreeSetObj_Methods[] = {
+    {
+        "__reduce__",
+        (PyCFunction)TreeSetObj_reduce,
+        METH_NOARGS,
+        "Pickle the TreeSet as a snapshot."
+    },
+    {
+        "_from_snapshot",
+        (PyCFunction)TreeSetObj_from_snapshot,
+        METH_O | METH_CLASS,
+        "Create a TreeSet from the bytes of a snapshot, for unpickling."
+    },
+    {
+        "__reversed__",
+        (PyCFunction)TreeSetObj_reversed,
+        METH_NOARGS,
+        "Return an iterator over the TreeSet in descending order."
+    },
     {
         "add",
         (PyCFunction)TreeSetObj_add,
-        METH_VARARGS,
+        METH_O,
         "Add an object into the TreeSet."
     },
     {
         "at_most",
         (PyCFunction)TreeSetObj_at_most,
-        METH_VARARGS,
+        METH_O,
         "Get the largest key in the TreeSet that is not bigger than the given key."
     },
     {
         "at_least",
         (PyCFunction)TreeSetObj_at_least,
-        METH_VARARGS,
+        METH_O,
         "Get the smallest key in the TreeSet that is not smaller than the given key."
     },
+    {
+        "at_most_many",
+        (PyCFunction)TreeSetObj_at_most_many,
+        METH_O,
+        "Return a list of at_most for each key of an iterable, fastest if the keys are sorted."
+    },
+    {
+        "at_least_many",
+        (PyCFunction)TreeSetObj_at_least_many,
+        METH_O,
+        "Return a list of at_least for each key of an iterable, fastest if the keys are sorted."
+    },
+    {
+        "bisect_left",
+        (PyCFunction)TreeSetObj_bisect_left,
+        METH_O,
+        "Return the number of keys in the TreeSet less than the given key."
+    },
+    {
+        "bisect_right",
+        (PyCFunction)TreeSetObj_bisect_right,
+        METH_O,
+        "Return the number of keys in the TreeSet not bigger than the given key."
+    },
     {
         "clear",
         (PyCFunction)TreeSetObj_clear,
         METH_NOARGS,
         "Clear the TreeSet."
     },
+    {
+        "contains_many",
+        (PyCFunction)TreeSetObj_contains_many,
+        METH_O,
+        "Return a list of whether each key of an iterable is in the TreeSet."
+    },
+    {
+        "count_range",
+        (PyCFunction)TreeSetObj_count_range,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Count keys between lo and hi, inclusive by default. None means no bound."
+    },
+    {
+        "difference",
+        (PyCFunction)TreeSetObj_difference,
+        METH_O,
+        "Return a new TreeSet with keys in the TreeSet but not in the other."
+    },
+    {
+        "difference_update",
+        (PyCFunction)TreeSetObj_difference_update,
+        METH_O,
+        "Remove keys of the other from the TreeSet."
+    },
     {
         "extend",
         (PyCFunction)TreeSetObj_extend,
-        METH_VARARGS,
+        METH_O,
         "Extends the TreeSet by an iterable."
     },
+    {
+        "extend_sorted",
+        (PyCFunction)TreeSetObj_extend_sorted,
+        METH_O,
+        "Add keys in ascending order, sorting them first if they are not. Keys above the maximum are built into a balanced tree and joined in one piece."
+    },
+    {
+        "copy",
+        (PyCFunction)TreeSetObj_copy,
+        METH_NOARGS,
+        "Return a shallow copy of the TreeSet, with the same shape, in O(n) without comparisons."
+    },
+    {
+        "__copy__",
+        (PyCFunction)TreeSetObj_copy,
+        METH_NOARGS,
+        "Return a shallow copy of the TreeSet, see copy()."
+    },
+    {
+        "freeze",
+        (PyCFunction)TreeSetObj_freeze,
+        METH_NOARGS,
+        "Return a read-only FrozenTreeSet of the keys, laid out for fast lookups."
+    },
+    {
+        "from_buffer",
+        (PyCFunction)TreeSetObj_from_buffer,
+        METH_O | METH_CLASS,
+        "Create a TreeSet from a contiguous buffer of integers, floats or fixed-width bytes."
+    },
+    {
+        "index",
+        (PyCFunction)TreeSetObj_index,
+        METH_O,
+        "Return the location of the given key. Raises ValueError if it is not present."
+    },
+    {
+        "intersection",
+        (PyCFunction)TreeSetObj_intersection,
+        METH_O,
+        "Return a new TreeSet with keys common to the TreeSet and the other."
+    },
+    {
+        "intersection_update",
+        (PyCFunction)TreeSetObj_intersection_update,
+        METH_O,
+        "Keep only keys also found in the other."
+    },
+    {
+        "irange",
+        (PyCFunction)TreeSetObj_irange,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Return a view of keys between lo and hi, inclusive by default. None means no bound."
+    },
+    {
+        "iter_before",
+        (PyCFunction)TreeSetObj_iter_before,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate in descending order over keys less than key, or equal if inclusive."
+    },
+    {
+        "iter_from",
+        (PyCFunction)TreeSetObj_iter_from,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Iterate in ascending order over keys greater than key, or equal if inclusive (default)."
+    },
+    {
+        "isdisjoint",
+        (PyCFunction)TreeSetObj_isdisjoint,
+        METH_O,
+        "Return True if the TreeSet has no keys in common with the other."
+    },
+    {
+        "issubset",
+        (PyCFunction)TreeSetObj_issubset,
+        METH_O,
+        "Report whether the other contains the TreeSet."
+    },
+    {
+        "issuperset",
+        (PyCFunction)TreeSetObj_issuperset,
+        METH_O,
+        "Report whether the TreeSet contains the other."
+    },
+    {
+        "load",
+        (PyCFunction)TreeSetObj_load,
+        METH_O | METH_CLASS,
+        "Load a TreeSet saved to a path or a binary file."
+    },
+    {
+        "cursor",
+        (PyCFunction)TreeSetObj_cursor,
+        METH_NOARGS,
+        "Return a cursor at the smallest key, which steps, inserts and erases in place without searching from the root."
+    },
     {
         "loc",
         (PyCFunction)TreeSetObj_loc,
-        METH_VARARGS,
+        METH_O,
         "Return the key at the given location."
     },
     {
@@ -283,12 +1485,111 @@ static PyMethodDef TreeSetObj_Methods[] = {
         METH_NOARGS,
         "Get the min of the TreeSet."
     },
+    {
+        "rank",
+        (PyCFunction)TreeSetObj_bisect_left,
+        METH_O,
+        "Return the number of keys in the TreeSet less than the given key."
+    },
+    {
+        "pop",
+        (PyCFunction)TreeSetObj_pop,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Remove and return the key at the given location, the last one by default."
+    },
+    {
+        "delete_range",
+        (PyCFunction)TreeSetObj_delete_range,
+        METH_FASTCALL | METH_KEYWORDS,
+        "Delete the keys at the given locations from start to end, exclusive, as del on a list slice."
+    },
     {
         "remove",
         (PyCFunction)TreeSetObj_remove,
-        METH_VARARGS,
+        METH_O,
         "Remove an object from the TreeSet."
     },
+    {
+        "save",
+        (PyCFunction)TreeSetObj_save,
+        METH_O,
+        "Save the TreeSet to a path or a binary file, in a compact checksummed format."
+    },
+    {
+        "stats",
+        (PyCFunction)TreeSetObj_stats,
+        METH_NOARGS,
+        "Report the memory usage and key comparisons of the TreeSet."
+    },
+    {
+        "symmetric_difference",
+        (PyCFunction)TreeSetObj_symmetric_difference,
+        METH_O,
+        "Return a new TreeSet with keys in either the TreeSet or the other but not both."
+    },
+    {
+        "symmetric_difference_update",
+        (PyCFunction)TreeSetObj_symmetric_difference_update,
+        METH_O,
+        "Update the TreeSet with keys in either the TreeSet or the other but not both."
+    },
+    {
+        "to_buffer",
+        (PyCFunction)TreeSetObj_to_buffer,
+        METH_NOARGS,
+        "Return a memoryview of the keys in order, for dtype int64, float64 or bytes."
+    },
+    {
+        "union",
+        (PyCFunction)TreeSetObj_union,
+        METH_O,
+        "Return a new TreeSet with keys from the TreeSet and the other."
+    },
+    {
+        "update",
+        (PyCFunction)TreeSetObj_update,
+        METH_O,
+        "Add keys of the other to the TreeSet."
+    },
+    {NULL}
+};
+
+static PyObject* TreeSetObj_get_dtype(TreeSetObj *self, void *closure) {
+    return PyUnicode_FromString(avl_dtype_name(self->ctx.dtype));
+}
+
+static PyObject* TreeSetObj_get_key(TreeSetObj *self, void *closure) {
+    PyObject *func = self->keyfunc? self->keyfunc: Py_None;
+    Py_INCREF(func);
+    return func;
+}
+
+static PyObject* TreeSetObj_get_backend(TreeSetObj *self, void *closure) {
+    return PyUnicode_FromString("avl");
+}
+
+static PyGetSetDef TreeSetObj_GetSet[] = {
+    {
+        "backend",
+        (getter)TreeSetObj_get_backend,
+        NULL,
+        "The engine of the TreeSet, \"avl\" unless created as a BTreeSet.",
+        NULL
+    },
+    {
+        "dtype",
+        (getter)TreeSetObj_get_dtype,
+        NULL,
+        "The dtype of keys of the TreeSet.",
+        NULL
+    },
+    {
+        "key",
+        (getter)TreeSetObj_get_key,
+        NULL,
+        "The function deriving keys from objects added to the TreeSet, or None.",
+        NULL
+    },
     {NULL}
 };
 
@@ -298,16 +1599,155 @@ static Py_ssize_t TreeSetObj_len(TreeSetObj *self) {
 }
 
 static int TreeSetObj_contains(TreeSetObj *self, PyObject *key) {
+    PyObject *query = pyavl_derive_key((PyAVLTreeObj *)self, key);
+    if (!query) {
+        return -1;
+    }
     int ret;
-    avl_node_find(self->root, key, &ret);
+    avl_node_find(self->root, &self->ctx, query, &ret);
+    Py_DECREF(query);
     return ret;
 }
 
+/* mapping method */
+static PyObject* TreeSetObj_subscript(TreeSetObj *self, PyObject *key) {
+    if (!PySlice_Check(key)) {
+        PyErr_Format(
+            PyExc_TypeError, "TreeSet indices must be slices of keys, not %.200s",
+            Py_TYPE(key)->tp_name
+        );
+        return NULL;
+    }
+    PySliceObject *slice = (PySliceObject *)key;
+    if (slice->step != Py_None) {
+        PyErr_SetString(PyExc_ValueError, "TreeSet slices do not support steps");
+        return NULL;
+    }
+    return TreeRange_New(
+        (PyObject *)self, slice->start, slice->stop, 1, 0, (avl_iter_getter)treeset_getkey
+    );
+}
+
+/**
+ * @brief Delete the key at position i with `del ts[i]`, as pop(i) does, or the keys
+ * from lo to hi with `del ts[lo:hi]`, the same keys ts[lo:hi] views.
+ */
+static int TreeSetObj_ass_subscript(TreeSetObj *self, PyObject *key, PyObject *val) {
+    if (val) {
+        PyErr_SetString(PyExc_TypeError, "TreeSet does not support item assignment");
+        return -1;
+    } else if (PyIndex_Check(key)) {
+        Py_ssize_t loc = PyNumber_AsSsize_t(key, PyExc_IndexError);
+        if (loc == -1 && PyErr_Occurred()) {
+            return -1;
+        }
+        avl_node_t *deleted = treeset_unlink_at(self, loc, "TreeSet index out of range");
+        if (!deleted) {
+            return -1;
+        }
+        treeset_free_node(deleted, self);
+        return 0;
+    } else if (!PySlice_Check(key)) {
+        PyErr_Format(
+            PyExc_TypeError, "TreeSet deletions take positions or slices of keys, not %.200s",
+            Py_TYPE(key)->tp_name
+        );
+        return -1;
+    }
+    PySliceObject *slice = (PySliceObject *)key;
+    if (slice->step != Py_None) {
+        PyErr_SetString(PyExc_ValueError, "TreeSet slices do not support steps");
+        return -1;
+    }
+    Py_ssize_t start, end;
+    if (pyavl_range_bounds((PyAVLTreeObj *)self, slice->start, slice->stop, 1, 0,
+        &start, &end) < 0) {
+        return -1;
+    }
+    if (start < end) {
+        treeset_delete_range(self, start, end);
+    }
+    return 0;
+}
+
+static PyMappingMethods TreeSetObj_Mapping = {
+    .mp_length = (lenfunc)TreeSetObj_len,
+    .mp_subscript = (binaryfunc)TreeSetObj_subscript,
+    .mp_ass_subscript = (objobjargproc)TreeSetObj_ass_subscript
+};
+
+/* number methods */
+static PyObject* treeset_number_op(PyObject *a, PyObject *b, avl_setop_t op) {
+    if (!TreeSetObj_Check(a) || !PyObject_TypeCheck(b, &TreeSet_Type)) {
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+    return treeset_binop((TreeSetObj *)a, b, op);
+}
+
+static PyObject* treeset_inplace_op(TreeSetObj *self, PyObject *other, avl_setop_t op) {
+    if (!PyObject_TypeCheck(other, &TreeSet_Type)) {
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+    if (treeset_update_op(self, other, op) < 0) {
+        return NULL;
+    }
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+static PyObject* TreeSetObj_or(PyObject *a, PyObject *b) {
+    return treeset_number_op(a, b, AVL_SETOP_UNION);
+}
+
+static PyObject* TreeSetObj_and(PyObject *a, PyObject *b) {
+    return treeset_number_op(a, b, AVL_SETOP_INTERSECTION);
+}
+
+static PyObject* TreeSetObj_sub(PyObject *a, PyObject *b) {
+    return treeset_number_op(a, b, AVL_SETOP_DIFFERENCE);
+}
+
+static PyObject* TreeSetObj_xor(PyObject *a, PyObject *b) {
+    return treeset_number_op(a, b, AVL_SETOP_SYMMETRIC_DIFFERENCE);
+}
+
+static PyObject* TreeSetObj_ior(TreeSetObj *self, PyObject *other) {
+    return treeset_inplace_op(self, other, AVL_SETOP_UNION);
+}
+
+static PyObject* TreeSetObj_iand(TreeSetObj *self, PyObject *other) {
+    return treeset_inplace_op(self, other, AVL_SETOP_INTERSECTION);
+}
+
+static PyObject* TreeSetObj_isub(TreeSetObj *self, PyObject *other) {
+    return treeset_inplace_op(self, other, AVL_SETOP_DIFFERENCE);
+}
+
+static PyObject* TreeSetObj_ixor(TreeSetObj *self, PyObject *other) {
+    return treeset_inplace_op(self, other, AVL_SETOP_SYMMETRIC_DIFFERENCE);
+}
+
+static PyNumberMethods TreeSetObj_Num = {
+    .nb_or = (binaryfunc)TreeSetObj_or,
+    .nb_and = (binaryfunc)TreeSetObj_and,
+    .nb_subtract = (binaryfunc)TreeSetObj_sub,
+    .nb_xor = (binaryfunc)TreeSetObj_xor,
+    .nb_inplace_or = (binaryfunc)TreeSetObj_ior,
+    .nb_inplace_and = (binaryfunc)TreeSetObj_iand,
+    .nb_inplace_subtract = (binaryfunc)TreeSetObj_isub,
+    .nb_inplace_xor = (binaryfunc)TreeSetObj_ixor
+};
+
 static PySequenceMethods TreeSetObj_Seq = {
     .sq_length = (lenfunc)TreeSetObj_len,
     .sq_contains = (objobjproc)TreeSetObj_contains
 };
 
+/* equal to a TreeSet of either engine with the same keys in the same order */
+static PyObject* TreeSetObj_richcompare(PyObject *a, PyObject *b, int op) {
+    return pyavl_tree_richcompare(a, b, op, &TreeSet_Type, NULL);
+}
+
 PyTypeObject TreeSet_Type = {
     /* The ob_type field must be initialized in the module init function
      * to be portable to Windows without using C++. */
@@ -322,10 +1762,10 @@ PyTypeObject TreeSet_Type = {
     (setattrfunc)0,             /*tp_setattr*/
     0,                          /*tp_as_async*/
     0,                          /*tp_repr*/
-    0,                          /*tp_as_number*/
+    &TreeSetObj_Num,            /*tp_as_number*/
     &TreeSetObj_Seq,            /*tp_as_sequence*/
-    0,                          /*tp_as_mapping*/
-    0,                          /*tp_hash*/
+    &TreeSetObj_Mapping,        /*tp_as_mapping*/
+    PyObject_HashNotImplemented,/*tp_hash*/
     0,                          /*tp_call*/
     0,                          /*tp_str*/
     (getattrofunc)0,            /*tp_getattro*/
@@ -335,13 +1775,13 @@ PyTypeObject TreeSet_Type = {
     0,                          /*tp_doc*/
     0,                          /*tp_traverse*/
     0,                          /*tp_clear*/
-    0,                          /*tp_richcompare*/
+    TreeSetObj_richcompare,     /*tp_richcompare*/
     0,                          /*tp_weaklistoffset*/
     (getiterfunc)TreeSetObj_iter,/*tp_iter*/
     0,                          /*tp_iternext*/
     TreeSetObj_Methods,         /*tp_methods*/
     0,                          /*tp_members*/
-    0,                          /*tp_getset*/
+    TreeSetObj_GetSet,          /*tp_getset*/
     0,                          /*tp_base*/
     0,                          /*tp_dict*/
     0,                          /*tp_descr_get*/
@@ -352,4 +1792,15 @@ PyTypeObject TreeSet_Type = {
     TreeSetObj_new,             /*tp_new*/
     0,                          /*tp_free*/
     0,                          /*tp_is_gc*/
+#if PY_VERSION_HEX >= 0x03090000
+    0,                          /*tp_bases*/
+    0,                          /*tp_mro*/
+    0,                          /*tp_cache*/
+    0,                          /*tp_subclasses*/
+    0,                          /*tp_weaklist*/
+    0,                          /*tp_del*/
+    0,                          /*tp_version_tag*/
+    0,                          /*tp_finalize*/
+    TreeSetObj_vectorcall,      /*tp_vectorcall*/
+#endif
 };
\ No newline at end of file
@@ -0,0 +1,670 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <string.h>
+
+#include "avl.h"
+#include "pyavlmodule.h"
+
+/*
+ * Snapshot format, little-endian:
+ *
+ *   "PAVL", version u8, kind u8, flags u8, ncolumns u8, size u64
+ *   [u64 length, pickled key function]     if PYAVL_SNAPSHOT_KEYED
+ *   per column: dtype u8, encoding u8, payload
+ *   CRC-32 u32 of everything before
+ *
+ * Payloads by encoding: SNAP_INT64 is size zigzag varints of the differences
+ * between consecutive values, a byte or two per key for dense sorted keys.
+ * SNAP_FLOAT64 is size 8-byte values. SNAP_STR (UTF-8) and SNAP_BYTES are size
+ * items of a varint length and the data. SNAP_PICKLE is a u64 length and a
+ * pickled list.
+ *
+ * Loading checks the CRC over all input before parsing it, so that corrupted
+ * data is never unpickled, and every key takes at least a byte, which bounds
+ * size before anything is allocated.
+ */
+
+#define SNAP_MAGIC      "PAVL"
+#define SNAP_VERSION    1
+#define SNAP_CHUNK      (1 << 16)
+
+enum {
+    SNAP_INT64 = 1,
+    SNAP_FLOAT64,
+    SNAP_STR,
+    SNAP_BYTES,
+    SNAP_PICKLE
+};
+
+static uint32_t crc_table[256];
+
+static uint32_t crc_update(uint32_t crc, const unsigned char *p, size_t n) {
+    if (!crc_table[1]) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1)? 0xEDB88320u ^ (c >> 1): c >> 1;
+            }
+            crc_table[i] = c;
+        }
+    }
+    crc = ~crc;
+    while (n--) {
+        crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static PyObject* pickle_call(const char *name, PyObject *arg) {
+    PyObject *pickle = PyImport_ImportModule("pickle");
+    if (!pickle) {
+        return NULL;
+    }
+    PyObject *ret = strcmp(name, "dumps") == 0?
+        PyObject_CallMethod(pickle, name, "Oi", arg, -1):
+        PyObject_CallMethod(pickle, name, "O", arg);
+    Py_DECREF(pickle);
+    return ret;
+}
+
+/**
+ * @brief Open a path, unless obj is a file object already, and get a method of the file.
+ *
+ * @param file Set to the file opened, to close when done, or NULL.
+ */
+static PyObject* snap_open(PyObject *obj, const char *mode, const char *method, PyObject **file) {
+    *file = NULL;
+    if (PyObject_HasAttrString(obj, method)) {
+        return PyObject_GetAttrString(obj, method);
+    }
+    PyObject *io = PyImport_ImportModule("io");
+    if (!io) {
+        return NULL;
+    }
+    *file = PyObject_CallMethod(io, "open", "Os", obj, mode);
+    Py_DECREF(io);
+    return *file? PyObject_GetAttrString(*file, method): NULL;
+}
+
+/**
+ * @brief Close a file opened by snap_open, keeping the pending exception if any.
+ */
+static int snap_close(PyObject *file) {
+    if (!file) {
+        return 0;
+    }
+    PyObject *type, *value, *traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    PyObject *ret = PyObject_CallMethod(file, "close", NULL);
+    Py_DECREF(file);
+    Py_XDECREF(ret);
+    if (type) {
+        PyErr_Restore(type, value, traceback);
+        return -1;
+    }
+    return ret? 0: -1;
+}
+
+/* Writing */
+
+typedef struct {
+    PyObject *write;    /* write method of the file, NULL to keep all output in buf */
+    char *buf;
+    size_t len;
+    size_t cap;
+    uint32_t crc;
+    int failed;
+} snap_writer_t;
+
+static int snap_flush(snap_writer_t *w) {
+    if (w->failed) {
+        return -1;
+    } else if (w->write && w->len) {
+        PyObject *ret = PyObject_CallFunction(w->write, "y#", w->buf, (Py_ssize_t)w->len);
+        if (!ret) {
+            w->failed = 1;
+            return -1;
+        }
+        Py_DECREF(ret);
+        w->len = 0;
+    }
+    return 0;
+}
+
+static int snap_put(snap_writer_t *w, const void *data, size_t n) {
+    if (w->failed) {
+        return -1;
+    }
+    w->crc = crc_update(w->crc, (const unsigned char *)data, n);
+    if (w->len + n > w->cap && (snap_flush(w) < 0 || w->len + n > w->cap)) {
+        if (w->failed) {
+            return -1;
+        }
+        size_t cap = Py_MAX(Py_MAX(w->cap * 2, w->len + n), SNAP_CHUNK);
+        char *buf = PyMem_Realloc(w->buf, cap);
+        if (!buf) {
+            PyErr_NoMemory();
+            w->failed = 1;
+            return -1;
+        }
+        w->buf = buf;
+        w->cap = cap;
+    }
+    memcpy(w->buf + w->len, data, n);
+    w->len += n;
+    return 0;
+}
+
+static int snap_put_u8(snap_writer_t *w, int v) {
+    unsigned char b = (unsigned char)v;
+    return snap_put(w, &b, 1);
+}
+
+static int snap_put_u64(snap_writer_t *w, uint64_t v) {
+    unsigned char b[8];
+    for (int i = 0; i < 8; i++) {
+        b[i] = (unsigned char)(v >> (8 * i));
+    }
+    return snap_put(w, b, 8);
+}
+
+static int snap_put_varint(snap_writer_t *w, uint64_t v) {
+    unsigned char b[10];
+    int k = 0;
+    do {
+        b[k++] = (unsigned char)((v & 0x7f) | (v > 0x7f? 0x80: 0));
+        v >>= 7;
+    } while (v);
+    return snap_put(w, b, k);
+}
+
+static int snap_put_data(snap_writer_t *w, const char *data, Py_ssize_t n) {
+    return snap_put_varint(w, (uint64_t)n) < 0? -1: snap_put(w, data, n);
+}
+
+/**
+ * @brief Write a pickled object as a u64 length and the data.
+ */
+static int snap_put_pickle(snap_writer_t *w, PyObject *obj) {
+    PyObject *data = pickle_call("dumps", obj);
+    if (!data) {
+        w->failed = 1;
+        return -1;
+    }
+    int ret = snap_put_u64(w, PyBytes_GET_SIZE(data));
+    if (ret == 0) {
+        ret = snap_put(w, PyBytes_AS_STRING(data), PyBytes_GET_SIZE(data));
+    }
+    Py_DECREF(data);
+    return ret;
+}
+
+typedef struct {
+    snap_writer_t *w;
+    avl_dtype_t dtype;
+    int encoding;
+    int64_t prev;       /* the last integer written */
+    PyObject *list;     /* objects to pickle */
+} snap_column_t;
+
+static int snap_encoding_of(PyObject *obj) {
+    if (PyLong_CheckExact(obj)) {
+        int overflow;
+        PyLong_AsLongLongAndOverflow(obj, &overflow);
+        return overflow? SNAP_PICKLE: SNAP_INT64;
+    } else if (PyFloat_CheckExact(obj)) {
+        return SNAP_FLOAT64;
+    } else if (PyUnicode_CheckExact(obj)) {
+        return SNAP_STR;
+    } else if (PyBytes_CheckExact(obj)) {
+        return SNAP_BYTES;
+    }
+    return SNAP_PICKLE;
+}
+
+static void _snap_scan(avl_key_t key, void *extra) {
+    snap_column_t *col = (snap_column_t *)extra;
+    if (col->encoding == SNAP_PICKLE) {
+        return;
+    }
+    int encoding = snap_encoding_of(key.obj);
+    col->encoding = (!col->encoding || col->encoding == encoding)? encoding: SNAP_PICKLE;
+}
+
+static void _snap_write(avl_key_t key, void *extra) {
+    snap_column_t *col = (snap_column_t *)extra;
+    if (col->w->failed) {
+        return;
+    }
+    switch (col->encoding) {
+    case SNAP_INT64: {
+        int64_t v = col->dtype == AVL_DTYPE_OBJECT? PyLong_AsLongLong(key.obj): key.i64;
+        uint64_t delta = (uint64_t)v - (uint64_t)col->prev;
+        col->prev = v;
+        snap_put_varint(col->w, (delta << 1) ^ (uint64_t)-(int64_t)(delta >> 63));
+        break;
+    }
+    case SNAP_FLOAT64: {
+        double v = col->dtype == AVL_DTYPE_OBJECT? PyFloat_AS_DOUBLE(key.obj): key.f64;
+        uint64_t bits;
+        memcpy(&bits, &v, 8);
+        snap_put_u64(col->w, bits);
+        break;
+    }
+    case SNAP_STR:
+        if (PyUnicode_IS_ASCII(key.obj)) {
+            snap_put_data(col->w, (const char *)PyUnicode_DATA(key.obj),
+                PyUnicode_GET_LENGTH(key.obj));
+        } else {
+            /* lone surrogates survive a round trip, as in pickle */
+            PyObject *data = PyUnicode_AsEncodedString(key.obj, "utf-8", "surrogatepass");
+            if (!data) {
+                col->w->failed = 1;
+                return;
+            }
+            snap_put_data(col->w, PyBytes_AS_STRING(data), PyBytes_GET_SIZE(data));
+            Py_DECREF(data);
+        }
+        break;
+    case SNAP_BYTES:
+        snap_put_data(col->w, PyBytes_AS_STRING(key.obj), PyBytes_GET_SIZE(key.obj));
+        break;
+    default:
+        if (PyList_Append(col->list, key.obj) < 0) {
+            col->w->failed = 1;
+        }
+    }
+}
+
+static int
+snap_write_column(snap_writer_t *w, const pyavl_column_t *column, avl_dtype_t dtype) {
+    snap_column_t col = {w, dtype, 0, 0, NULL};
+    switch (dtype) {
+    case AVL_DTYPE_INT64:
+        col.encoding = SNAP_INT64;
+        break;
+    case AVL_DTYPE_FLOAT64:
+        col.encoding = SNAP_FLOAT64;
+        break;
+    case AVL_DTYPE_BYTES:
+        col.encoding = SNAP_BYTES;
+        break;
+    default:
+        pyavl_column_foreach(column, _snap_scan, &col);
+        if (!col.encoding) {
+            col.encoding = SNAP_PICKLE;
+        }
+    }
+    if (col.encoding == SNAP_PICKLE && !(col.list = PyList_New(0))) {
+        return -1;
+    }
+    snap_put_u8(w, dtype);
+    snap_put_u8(w, col.encoding);
+    pyavl_column_foreach(column, _snap_write, &col);
+    if (col.list) {
+        snap_put_pickle(w, col.list);
+        Py_DECREF(col.list);
+    }
+    return w->failed? -1: 0;
+}
+
+extern PyObject*
+pyavl_snapshot_save(PyObject *file, PyAVLTreeObj *tree, int kind, int flags, int ncolumns,
+    const avl_dtype_t *dtypes, const pyavl_column_t *columns) {
+    snap_writer_t w = {NULL, NULL, 0, 0, 0, 0};
+    PyObject *opened = NULL;
+    if (file && !(w.write = snap_open(file, "wb", "write", &opened))) {
+        snap_close(opened);
+        return NULL;
+    }
+    if (tree->keyfunc) {
+        flags |= PYAVL_SNAPSHOT_KEYED;
+    }
+
+    snap_put(&w, SNAP_MAGIC, 4);
+    snap_put_u8(&w, SNAP_VERSION);
+    snap_put_u8(&w, kind);
+    snap_put_u8(&w, flags);
+    snap_put_u8(&w, ncolumns);
+    snap_put_u64(&w, pyavl_tree_size(tree));
+    if (tree->keyfunc) {
+        snap_put_pickle(&w, tree->keyfunc);
+    }
+    for (int i = 0; i < ncolumns && !w.failed; i++) {
+        snap_write_column(&w, &columns[i], dtypes[i]);
+    }
+    uint32_t crc = w.crc;
+    unsigned char b[4] = {crc & 0xff, (crc >> 8) & 0xff, (crc >> 16) & 0xff, crc >> 24};
+    snap_put(&w, b, 4);
+    snap_flush(&w);
+
+    PyObject *ret = NULL;
+    if (!w.failed && file) {
+        Py_INCREF(Py_None);
+        ret = Py_None;
+    } else if (!w.failed) {
+        ret = PyBytes_FromStringAndSize(w.buf, w.len);
+    }
+    PyMem_Free(w.buf);
+    Py_XDECREF(w.write);
+    if (snap_close(opened) < 0) {
+        Py_CLEAR(ret);
+    }
+    return ret;
+}
+
+/* Reading */
+
+typedef struct {
+    const char *buf;    /* all input, checksum verified before parsing */
+    size_t len;         /* excluding the checksum */
+    size_t pos;
+} snap_reader_t;
+
+static int snap_corrupted(const char *reason) {
+    PyErr_Format(PyExc_ValueError, "Invalid TreeSet or TreeMap snapshot: %s.", reason);
+    return -1;
+}
+
+/**
+ * @brief Read n contiguous bytes, valid while the input is.
+ */
+static const char* snap_view(snap_reader_t *r, size_t n) {
+    if (r->len - r->pos < n) {
+        snap_corrupted("truncated");
+        return NULL;
+    }
+    const char *p = r->buf + r->pos;
+    r->pos += n;
+    return p;
+}
+
+static int snap_get(snap_reader_t *r, void *dst, size_t n) {
+    const char *p = snap_view(r, n);
+    if (!p) {
+        return -1;
+    }
+    memcpy(dst, p, n);
+    return 0;
+}
+
+static int snap_get_u8(snap_reader_t *r, int *v) {
+    unsigned char b;
+    if (snap_get(r, &b, 1) < 0) {
+        return -1;
+    }
+    *v = b;
+    return 0;
+}
+
+static int snap_get_u64(snap_reader_t *r, uint64_t *v) {
+    unsigned char b[8];
+    if (snap_get(r, b, 8) < 0) {
+        return -1;
+    }
+    *v = 0;
+    for (int i = 0; i < 8; i++) {
+        *v |= (uint64_t)b[i] << (8 * i);
+    }
+    return 0;
+}
+
+static int snap_get_varint(snap_reader_t *r, uint64_t *v) {
+    uint64_t n = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        const unsigned char *b = (const unsigned char *)snap_view(r, 1);
+        if (!b) {
+            return -1;
+        }
+        n |= (uint64_t)(*b & 0x7f) << shift;
+        if (!(*b & 0x80)) {
+            *v = n;
+            return 0;
+        }
+    }
+    return snap_corrupted("bad varint");
+}
+
+/**
+ * @brief Read n bytes into a new bytes object.
+ */
+static PyObject* snap_get_bytes(snap_reader_t *r, Py_ssize_t n) {
+    PyObject *data = PyBytes_FromStringAndSize(NULL, n);
+    if (data && snap_get(r, PyBytes_AS_STRING(data), n) < 0) {
+        Py_CLEAR(data);
+    }
+    return data;
+}
+
+/**
+ * @brief Read an object pickled by snap_put_pickle.
+ */
+static PyObject* snap_get_pickle(snap_reader_t *r) {
+    uint64_t n;
+    if (snap_get_u64(r, &n) < 0) {
+        return NULL;
+    } else if (n > PY_SSIZE_T_MAX) {
+        snap_corrupted("bad length");
+        return NULL;
+    }
+    PyObject *data = snap_get_bytes(r, (Py_ssize_t)n);
+    PyObject *obj = data? pickle_call("loads", data): NULL;
+    Py_XDECREF(data);
+    return obj;
+}
+
+/**
+ * @brief Read a column of n keys of a dtype into keys, which hold new references
+ * for boxed dtypes.
+ */
+static int snap_read_column(snap_reader_t *r, avl_key_t *keys, Py_ssize_t n, avl_dtype_t dtype) {
+    int encoding;
+    if (snap_get_u8(r, &encoding) < 0) {
+        return -1;
+    }
+    int valid = encoding >= SNAP_INT64 && encoding <= SNAP_PICKLE;
+    if ((dtype == AVL_DTYPE_INT64 && encoding != SNAP_INT64) ||
+        (dtype == AVL_DTYPE_FLOAT64 && encoding != SNAP_FLOAT64) ||
+        (dtype == AVL_DTYPE_BYTES && encoding != SNAP_BYTES) || !valid) {
+        return snap_corrupted("bad encoding");
+    }
+
+    if (encoding == SNAP_PICKLE) {
+        PyObject *list = snap_get_pickle(r);
+        if (!list) {
+            return -1;
+        } else if (!PyList_CheckExact(list) || PyList_GET_SIZE(list) != n) {
+            Py_DECREF(list);
+            return snap_corrupted("bad column");
+        }
+        for (Py_ssize_t i = 0; i < n; i++) {
+            keys[i].obj = PyList_GET_ITEM(list, i);
+            Py_INCREF(keys[i].obj);
+        }
+        Py_DECREF(list);
+        return 0;
+    }
+
+    Py_ssize_t i = 0;
+    uint64_t prev = 0;
+    for (; i < n; i++) {
+        uint64_t bits = 0;
+        if (encoding == SNAP_INT64) {
+            if (snap_get_varint(r, &bits) < 0) {
+                break;
+            }
+            prev += (bits >> 1) ^ (uint64_t)-(int64_t)(bits & 1);
+            bits = prev;
+        } else if (encoding == SNAP_FLOAT64 && snap_get_u64(r, &bits) < 0) {
+            break;
+        }
+        if (encoding == SNAP_INT64 || encoding == SNAP_FLOAT64) {
+            memcpy(&keys[i], &bits, 8);
+            if (dtype != AVL_DTYPE_OBJECT) {
+                continue;
+            }
+            keys[i].obj = encoding == SNAP_INT64?
+                PyLong_FromLongLong(keys[i].i64): PyFloat_FromDouble(keys[i].f64);
+        } else {
+            uint64_t len;
+            const char *data;
+            if (snap_get_varint(r, &len) < 0) {
+                break;
+            } else if (len > PY_SSIZE_T_MAX) {
+                snap_corrupted("bad length");
+                break;
+            } else if (!(data = snap_view(r, (size_t)len))) {
+                break;
+            }
+            keys[i].obj = encoding == SNAP_STR?
+                PyUnicode_DecodeUTF8(data, (Py_ssize_t)len, "surrogatepass"):
+                PyBytes_FromStringAndSize(data, (Py_ssize_t)len);
+        }
+        if (!keys[i].obj) {
+            break;
+        }
+    }
+    if (i < n) {
+        while (i--) {
+            avl_key_release(dtype, keys[i]);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+static int snap_read(snap_reader_t *r, int kind, pyavl_snapshot_t *snap) {
+    char magic[4];
+    int version, snap_kind, flags, ncolumns;
+    uint64_t size;
+    if (snap_get(r, magic, 4) < 0 || snap_get_u8(r, &version) < 0) {
+        return -1;
+    } else if (memcmp(magic, SNAP_MAGIC, 4) != 0) {
+        return snap_corrupted("bad magic");
+    } else if (version > SNAP_VERSION) {
+        PyErr_Format(PyExc_ValueError, "Unsupported snapshot version %d.", version);
+        return -1;
+    }
+    if (snap_get_u8(r, &snap_kind) < 0 || snap_get_u8(r, &flags) < 0 ||
+        snap_get_u8(r, &ncolumns) < 0 || snap_get_u64(r, &size) < 0) {
+        return -1;
+    } else if (snap_kind != PYAVL_SNAPSHOT_SET && snap_kind != PYAVL_SNAPSHOT_MAP) {
+        return snap_corrupted("bad kind");
+    } else if (snap_kind != kind) {
+        PyErr_Format(PyExc_ValueError, "Snapshot of a %s, not a %s.",
+            snap_kind == PYAVL_SNAPSHOT_MAP? "TreeMap": "TreeSet",
+            kind == PYAVL_SNAPSHOT_MAP? "TreeMap": "TreeSet");
+        return -1;
+    }
+    int expected = (kind == PYAVL_SNAPSHOT_MAP? 2: 1) + !!(flags & PYAVL_SNAPSHOT_KEYED);
+    if (ncolumns != expected) {
+        return snap_corrupted("bad header");
+    } else if (size > (r->len - r->pos) / ncolumns) {
+        /* every encoding takes at least a byte per key */
+        return snap_corrupted("bad size");
+    }
+    snap->flags = flags;
+    snap->size = (Py_ssize_t)size;
+    if ((flags & PYAVL_SNAPSHOT_KEYED) && !(snap->keyfunc = snap_get_pickle(r))) {
+        return -1;
+    }
+
+    for (int i = 0; i < ncolumns; i++) {
+        int dtype;
+        if (snap_get_u8(r, &dtype) < 0) {
+            return -1;
+        } else if (dtype > AVL_DTYPE_BYTES) {
+            return snap_corrupted("bad dtype");
+        }
+        avl_key_t *keys = PyMem_New(avl_key_t, snap->size? snap->size: 1);
+        if (!keys) {
+            PyErr_NoMemory();
+            return -1;
+        } else if (snap_read_column(r, keys, snap->size, (avl_dtype_t)dtype) < 0) {
+            PyMem_Free(keys);
+            return -1;
+        }
+        snap->dtypes[i] = (avl_dtype_t)dtype;
+        snap->columns[i] = keys;
+        snap->ncolumns = i + 1;
+    }
+
+    if (r->pos != r->len) {
+        return snap_corrupted("trailing data");
+    }
+    return 0;
+}
+
+/**
+ * @brief Check the CRC-32 at the end of the input, before anything is parsed or
+ * unpickled.
+ */
+static int snap_check(snap_reader_t *r, const char *buf, size_t len) {
+    if (len < 4) {
+        return snap_corrupted("truncated");
+    }
+    const unsigned char *b = (const unsigned char *)buf + len - 4;
+    uint32_t crc = (uint32_t)b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+    if (crc_update(0, (const unsigned char *)buf, len - 4) != crc) {
+        return snap_corrupted("checksum mismatch");
+    }
+    r->buf = buf;
+    r->len = len - 4;
+    r->pos = 0;
+    return 0;
+}
+
+extern int pyavl_snapshot_load(PyObject *src, int in_memory, int kind, pyavl_snapshot_t *snap) {
+    memset(snap, 0, sizeof(*snap));
+    snap_reader_t r = {NULL, 0, 0};
+    PyObject *opened = NULL, *data = NULL;
+    if (!in_memory) {
+        /* the whole file is read first, so that nothing is unpickled before the checksum is verified */
+        PyObject *read = snap_open(src, "rb", "read", &opened);
+        data = read? PyObject_CallFunctionObjArgs(read, NULL): NULL;
+        Py_XDECREF(read);
+        if (snap_close(opened) < 0) {
+            Py_CLEAR(data);
+        }
+        if (!data) {
+            return -1;
+        } else if (!PyBytes_Check(data)) {
+            PyErr_SetString(PyExc_TypeError, "Snapshots are read from files opened in binary mode.");
+            Py_DECREF(data);
+            return -1;
+        }
+        src = data;
+    }
+    Py_buffer view;
+    if (PyObject_GetBuffer(src, &view, PyBUF_SIMPLE) < 0) {
+        Py_XDECREF(data);
+        return -1;
+    }
+
+    int ret = snap_check(&r, (const char *)view.buf, view.len);
+    if (ret == 0) {
+        ret = snap_read(&r, kind, snap);
+    }
+    PyBuffer_Release(&view);
+    Py_XDECREF(data);
+    if (ret < 0) {
+        pyavl_snapshot_free(snap, 1);
+    }
+    return ret;
+}
+
+extern void pyavl_snapshot_free(pyavl_snapshot_t *snap, int release) {
+    for (int i = 0; i < snap->ncolumns; i++) {
+        if (!snap->columns[i]) {
+            continue;
+        }
+        for (Py_ssize_t j = 0; release && j < snap->size; j++) {
+            avl_key_release(snap->dtypes[i], snap->columns[i][j]);
+        }
+        PyMem_Free(snap->columns[i]);
+        snap->columns[i] = NULL;
+    }
+    snap->ncolumns = 0;
+    Py_CLEAR(snap->keyfunc);
+}
\ No newline at end of file
@@ -1,7 +1,12 @@
 import unittest
 from pyavl import TreeSet, TreeMap
 import random
+from array import array
 import time
+from timeit import repeat
+import os
+import pickle
+import tempfile
 
 def timeit(n, func, *args, **kwargs):
     start = time.time()
@@ -26,6 +31,65 @@ class TreeSetBenchmarkTest(unittest.TestCase):
             print(f"Initialization with {len(data)} numbers ({len(s)} unique), run {cnt} times")
             print(f"TreeSet: {t1:.2f}ms, set: {t2:.2f}ms, TreeSet/set: {t1/t2:.2f}\n")
     
+    def test_treeset_init_sorted(self):
+        def f(data):
+            TreeSet(data)
+        def g(data):
+            set(data)
+        cnt = 10
+        print()
+        for i in range(3):
+            N = 10000 * (10 ** i)
+            data = list(range(N))
+            t1 = timeit(cnt, f, data)
+            t2 = timeit(cnt, g, data)
+            print(f"Initialization with {N} sorted numbers, run {cnt} times")
+            print(f"TreeSet: {t1:.2f}ms, set: {t2:.2f}ms, TreeSet/set: {t1/t2:.2f}\n")
+
+    def test_treemap_aggregate(self):
+        def f(m, lo, hi):
+            m.aggregate(lo, hi)
+        def g(m, lo, hi):
+            sum(v for k, v in m.items() if lo <= k <= hi)
+        cnt = 10
+        print()
+        for i in range(3):
+            N = 1000 * (10 ** i)
+            m = TreeMap(((k, float(k)) for k in range(N)), aggregate=True)
+            lo, hi = N // 4, 3 * N // 4
+            t1 = timeit(cnt, f, m, lo, hi)
+            t2 = timeit(cnt, g, m, lo, hi)
+            print(f"Sum of {hi - lo + 1} values in {N} pairs, run {cnt} times")
+            print(f"aggregate: {t1:.2f}ms, items: {t2:.2f}ms, items/aggregate: {t2/t1:.2f}\n")
+
+    def test_treemap_snapshot(self):
+        def load_items(path):
+            with open(path, "rb") as f:
+                TreeMap(pickle.load(f))
+        def save_items(m, path):
+            with open(path, "wb") as f:
+                pickle.dump(list(m.items()), f, -1)
+        cnt = 3
+        print()
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, "snapshot")
+            for i in range(3):
+                N = 10000 * (10 ** i)
+                for name, keys in [
+                    ("int", random.sample(range(10 * N), N)),
+                    ("str", [f"user:{random.randint(0, 10 * N)}" for _ in range(N)]),
+                ]:
+                    m = TreeMap(zip(keys, range(N)))
+                    t1 = timeit(cnt, m.save, path)
+                    size1 = os.path.getsize(path)
+                    t2 = timeit(cnt, TreeMap.load, path)
+                    t3 = timeit(cnt, save_items, m, path)
+                    size2 = os.path.getsize(path)
+                    t4 = timeit(cnt, load_items, path)
+                    print(f"Save and load {len(m)} {name} keys, run {cnt} times")
+                    print(f"save: {t1:.2f}ms ({size1} bytes), pickled items: {t3:.2f}ms ({size2} bytes)")
+                    print(f"load: {t2:.2f}ms, pickled items: {t4:.2f}ms, items/load: {t4/t2:.2f}\n")
+    
     def test_treeset_contain(self):
         def f(container, n):
             return n in container
@@ -40,6 +104,170 @@ class TreeSetBenchmarkTest(unittest.TestCase):
             print(f"Lookup missing target with {N} numbers, run {cnt} times")
             print(f"TreeSet: {t1:.2f}ms, set: {t2:.2f}ms, TreeSet/set: {t1/t2:.2f}\n")
     
+    def test_treeset_contain_types(self):
+        # A single key of a subclass forces the generic comparison path.
+        class Int(int): pass
+        class Float(float): pass
+        class Str(str): pass
+        class Tuple(tuple): pass
+        def f(ts, keys):
+            for k in keys:
+                k in ts
+        cnt = 10
+        N = 100000
+        cases = [
+            ("int", lambda n: 2 * n, Int),
+            ("float", lambda n: 2.0 * n, Float),
+            ("str", lambda n: f"{2 * n:08d}", Str),
+            ("tuple", lambda n: (n, 2 * n), Tuple),
+        ]
+        print()
+        for name, make, sub in cases:
+            data = [make(n) for n in range(N)]
+            missing = [make(n) for n in range(N, N + 1000)]
+            if name == "tuple":
+                missing = [(n, 2 * n + 1) for n in range(1000)]
+            ts = TreeSet(data)
+            generic = TreeSet(data)
+            generic.add(sub(make(-1)))
+            t1 = timeit(cnt, f, ts, missing)
+            t2 = timeit(cnt, f, generic, missing)
+            print(f"Lookup {len(missing)} missing {name} keys with {N} keys, run {cnt} times")
+            print(f"Specialized: {t1:.2f}ms, generic: {t2:.2f}ms, generic/specialized: {t2/t1:.2f}\n")
+
+    def test_treeset_dtype(self):
+        def f(data, dtype):
+            TreeSet(data, dtype=dtype)
+        def g(ts, keys):
+            for k in keys:
+                k in ts
+        cnt = 10
+        N = 100000
+        data = [random.randint(-2 ** 40, 2 ** 40) for _ in range(N)]
+        keys = [random.randint(-2 ** 40, 2 ** 40) for _ in range(1000)]
+        print()
+        t1 = timeit(cnt, f, data, "int64")
+        t2 = timeit(cnt, f, data, None)
+        print(f"Initialization with {N} int64 numbers, run {cnt} times")
+        print(f"int64: {t1:.2f}ms, object: {t2:.2f}ms, object/int64: {t2/t1:.2f}\n")
+        t1 = timeit(cnt, g, TreeSet(data, dtype="int64"), keys)
+        t2 = timeit(cnt, g, TreeSet(data), keys)
+        print(f"Lookup {len(keys)} int64 numbers in {N} numbers, run {cnt} times")
+        print(f"int64: {t1:.2f}ms, object: {t2:.2f}ms, object/int64: {t2/t1:.2f}\n")
+
+    def test_treeset_comparisons(self):
+        cnt = 1
+        print()
+        for i in range(3):
+            N = 10000 * (10 ** i)
+            data = random.sample(range(10 * N), N)
+            ts = TreeSet()
+            t1 = timeit(cnt, lambda: [ts.add(x) for x in data])
+            c1 = ts.stats()["comparisons"]
+            t2 = timeit(cnt, lambda: [ts.remove(x) for x in data])
+            c2 = ts.stats()["comparisons"] - c1
+            print(f"Insert then delete {N} random numbers, run {cnt} times")
+            print(f"insert: {t1:.2f}ms, {c1 / N:.2f} comparisons/key; "
+                  f"delete: {t2:.2f}ms, {c2 / N:.2f} comparisons/key\n")
+
+    def test_treeset_union(self):
+        def f(ts, delta):
+            ts |= delta
+        def g(ts, delta):
+            for x in delta:
+                ts.add(x)
+        N = 1000000
+        base = range(0, 2 * N, 2)
+        print()
+        for i in range(3):
+            M = 1000 * (10 ** i)
+            data = random.sample(range(2 * N), M)
+            ts, delta = TreeSet(base), TreeSet(data)
+            c1 = ts.stats()["comparisons"]
+            t1 = timeit(1, f, ts, delta)
+            c1 = ts.stats()["comparisons"] - c1
+            ts = TreeSet(base)
+            c2 = ts.stats()["comparisons"]
+            t2 = timeit(1, g, ts, data)
+            c2 = ts.stats()["comparisons"] - c2
+            print(f"Union of {M} numbers into {N} numbers")
+            print(f"|=: {t1:.2f}ms, {c1} comparisons; add: {t2:.2f}ms, {c2} comparisons, add/|=: {t2/t1:.2f}\n")
+
+    def test_treeset_irange(self):
+        def f(ts, windows):
+            for lo in windows:
+                len(ts[lo:lo + 100])
+                for _ in ts[lo:lo + 100]:
+                    pass
+        def g(ts, windows):
+            for lo in windows:
+                n = ts.at_least(lo)
+                while n is not None and n < lo + 100:
+                    n = ts.at_least(n + 1)
+        cnt = 1
+        print()
+        for i in range(3):
+            N = 10000 * (10 ** i)
+            ts = TreeSet(range(N))
+            windows = [random.randint(0, N) for _ in range(1000)]
+            t1 = timeit(cnt, f, ts, windows)
+            t2 = timeit(cnt, g, ts, windows)
+            print(f"Count and scan {len(windows)} windows of 100 keys in {N} numbers, run {cnt} times")
+            print(f"slice: {t1:.2f}ms, at_least: {t2:.2f}ms, at_least/slice: {t2/t1:.2f}\n")
+
+    def test_treeset_tail(self):
+        def f(ts):
+            it = reversed(ts)
+            for _ in range(10):
+                next(it)
+        def g(ts):
+            list(ts)[-10:]
+        cnt = 10
+        print()
+        for i in range(3):
+            N = 10000 * (10 ** i)
+            ts = TreeSet(range(N))
+            t1 = timeit(cnt, f, ts)
+            t2 = timeit(cnt, g, ts)
+            print(f"Last 10 of {N} numbers, run {cnt} times")
+            print(f"reversed: {t1:.2f}ms, list: {t2:.2f}ms, list/reversed: {t2/t1:.2f}\n")
+
+    def test_treeset_rank(self):
+        def f(ts, keys):
+            for k in keys:
+                ts.rank(k)
+        def g(ts, keys):
+            for k in keys:
+                ts.at_least(k)
+                len(ts[:k])
+        cnt = 10
+        print()
+        for i in range(3):
+            N = 10000 * (10 ** i)
+            ts = TreeSet(range(0, 2 * N, 2))
+            keys = [random.randint(0, 2 * N) for _ in range(1000)]
+            t1 = timeit(cnt, f, ts, keys)
+            t2 = timeit(cnt, g, ts, keys)
+            print(f"Rank of 1000 keys in {N} numbers, run {cnt} times")
+            print(f"rank: {t1:.2f}ms, at_least+len: {t2:.2f}ms, (at_least+len)/rank: {t2/t1:.2f}\n")
+
+    def test_treeset_at_most_many(self):
+        def f(ts, keys):
+            ts.at_most_many(keys)
+        def g(ts, keys):
+            for k in keys:
+                ts.at_most(k)
+        cnt = 10
+        print()
+        for i in range(3):
+            N = 10000 * (10 ** i)
+            ts = TreeSet(range(0, 2 * N, 2))
+            keys = sorted(random.randint(0, 2 * N) for _ in range(10000))
+            t1 = timeit(cnt, f, ts, keys)
+            t2 = timeit(cnt, g, ts, keys)
+            print(f"at_most of 10000 sorted keys in {N} numbers, run {cnt} times")
+            print(f"at_most_many: {t1:.2f}ms, at_most: {t2:.2f}ms, at_most/at_most_many: {t2/t1:.2f}\n")
+
     def test_treeset_min(self):
         def f(ts):
             ts.min()
@@ -56,6 +284,189 @@ class TreeSetBenchmarkTest(unittest.TestCase):
             print(f"Find min in {N} numbers, run {cnt} times")
             print(f"TreeSet: {t1:.2f}ms, set: {t2:.2f}ms, set/TreeSet: {t2/t1:.2f}\n")
 
+    def test_treeset_backend(self):
+        def insert(ts, data):
+            for x in data:
+                ts.add(x)
+        def lookup(ts, keys):
+            for k in keys:
+                k in ts
+        def scan(ts):
+            for _ in ts:
+                pass
+        cnt = 3
+        print()
+        for i in range(3):
+            N = 10000 * (10 ** i)
+            data = random.sample(range(4 * N), N)
+            keys = random.sample(range(4 * N), 10000)
+            for dtype in ["object", "int64"]:
+                ts = {b: TreeSet(backend=b, dtype=dtype) for b in ["avl", "btree"]}
+                t = {b: timeit(1, insert, ts[b], data) for b in ts}
+                print(f"Insert {N} random numbers ({dtype}) once")
+                print(f"avl: {t['avl']:.2f}ms, btree: {t['btree']:.2f}ms, avl/btree: {t['avl']/t['btree']:.2f}")
+                t = {b: timeit(cnt, lookup, ts[b], keys) for b in ts}
+                print(f"Look up 10000 keys in {N} numbers ({dtype}), run {cnt} times")
+                print(f"avl: {t['avl']:.2f}ms, btree: {t['btree']:.2f}ms, avl/btree: {t['avl']/t['btree']:.2f}")
+                t = {b: timeit(cnt, scan, ts[b]) for b in ts}
+                print(f"Scan {N} numbers ({dtype}), run {cnt} times")
+                print(f"avl: {t['avl']:.2f}ms, btree: {t['btree']:.2f}ms, avl/btree: {t['avl']/t['btree']:.2f}")
+                m = {b: ts[b].stats()["bytes"] / N for b in ts}
+                print(f"Bytes per key, avl: {m['avl']:.1f}, btree: {m['btree']:.1f}\n")
+
+    def test_treeset_key(self):
+        class Lower(str):
+            # ordering by calling the key function in every comparison
+            def __lt__(self, other):
+                return self.lower() < other.lower()
+            def __gt__(self, other):
+                return self.lower() > other.lower()
+            def __eq__(self, other):
+                return self.lower() == other.lower()
+            __hash__ = str.__hash__
+        def insert(ts, data):
+            for x in data:
+                ts.add(x)
+        def lookup(ts, keys):
+            for k in keys:
+                k in ts
+        cnt = 3
+        print()
+        for i in range(3):
+            N = 10000 * (10 ** i)
+            data = [f"Key{random.randint(0, 4 * N)}" for _ in range(N)]
+            keys = [f"KEY{random.randint(0, 4 * N)}" for _ in range(10000)]
+            ts1 = TreeSet(key=str.lower)
+            ts2 = TreeSet()
+            t1 = timeit(1, insert, ts1, data)
+            t2 = timeit(1, insert, ts2, [Lower(x) for x in data])
+            print(f"Insert {N} strings ordered by str.lower once")
+            print(f"key=str.lower: {t1:.2f}ms, __lt__: {t2:.2f}ms, __lt__/key: {t2/t1:.2f}")
+            t1 = timeit(cnt, lookup, ts1, keys)
+            t2 = timeit(cnt, lookup, ts2, [Lower(x) for x in keys])
+            print(f"Look up 10000 strings in {N} strings, run {cnt} times")
+            print(f"key=str.lower: {t1:.2f}ms, __lt__: {t2:.2f}ms, __lt__/key: {t2/t1:.2f}\n")
+
+
+    def test_treeset_buffer(self):
+        def export(ts):
+            array("q", ts)
+        def load(data):
+            TreeSet(data, dtype="int64")
+        cnt = 5
+        print()
+        for i in range(3):
+            N = 10000 * (10 ** i)
+            ts = TreeSet((random.randint(-2 ** 40, 2 ** 40) for _ in range(N)), dtype="int64")
+            t1 = timeit(cnt, ts.to_buffer)
+            t2 = timeit(cnt, export, ts)
+            print(f"Export {N} int64 keys, run {cnt} times")
+            print(f"to_buffer: {t1:.2f}ms, iteration: {t2:.2f}ms, iteration/to_buffer: {t2/t1:.2f}")
+            for order in ["random", "sorted"]:
+                data = [random.randint(-2 ** 40, 2 ** 40) for _ in range(N)]
+                if order == "sorted":
+                    data.sort()
+                t1 = timeit(cnt, TreeSet.from_buffer, array("q", data))
+                t2 = timeit(cnt, load, data)
+                print(f"Load {N} {order} int64 keys, run {cnt} times")
+                print(f"from_buffer: {t1:.2f}ms, list: {t2:.2f}ms, list/from_buffer: {t2/t1:.2f}")
+            print()
+
+    def test_treeset_frozen(self):
+        def lookup(ts, queries):
+            for q in queries:
+                q in ts
+        def bisect(ts, queries):
+            for q in queries:
+                ts.bisect_left(q)
+        cnt = 5
+        print()
+        for i in range(3):
+            N = 10000 * (10 ** i)
+            ts = TreeSet(random.sample(range(10 ** 9), N), dtype="int64")
+            fz = ts.freeze()
+            queries = [random.randrange(10 ** 9) for _ in range(100000)]
+            t1 = timeit(cnt, lookup, fz, queries)
+            t2 = timeit(cnt, lookup, ts, queries)
+            t3 = timeit(cnt, bisect, fz, queries)
+            t4 = timeit(cnt, bisect, ts, queries)
+            print(f"Look up {len(queries)} int64 keys in {N} keys ({fz.stats()['simd']}), run {cnt} times")
+            print(f"in FrozenTreeSet: {t1:.2f}ms, in TreeSet: {t2:.2f}ms, TreeSet/FrozenTreeSet: {t2/t1:.2f}")
+            print(f"bisect FrozenTreeSet: {t3:.2f}ms, TreeSet: {t4:.2f}ms, TreeSet/FrozenTreeSet: {t4/t3:.2f}")
+            print(f"bytes FrozenTreeSet: {fz.stats()['bytes']}, TreeSet: {ts.stats()['bytes']}\n")
+
+    def test_treemap_snapshot_view(self):
+        def snapshot_writes(m, keys):
+            view = m.snapshot()
+            for k in keys:
+                m[k] = 0
+            return view
+        def copy_writes(m, keys):
+            view = TreeMap(m.items())
+            for k in keys:
+                m[k] = 0
+            return view
+        cnt = 5
+        print()
+        for i in range(3):
+            N = 10000 * (10 ** i)
+            m = TreeMap(zip(random.sample(range(10 ** 9), N), range(N)), key_dtype="int64")
+            keys = [random.randrange(10 ** 9) for _ in range(1000)]
+            t1 = timeit(cnt, snapshot_writes, m, keys)
+            t2 = timeit(cnt, copy_writes, m, keys)
+            print(f"Take a view of {N} items, then write {len(keys)} keys, run {cnt} times")
+            print(f"snapshot: {t1:.2f}ms, copy: {t2:.2f}ms, copy/snapshot: {t2/t1:.2f}\n")
+
+    def test_treeset_pop(self):
+        def pop_oldest(ts, keys):
+            for k in keys:
+                ts.add(k)
+                ts.pop(0)
+        def remove_oldest(ts, keys):
+            for k in keys:
+                ts.add(k)
+                ts.remove(ts.loc(0))
+        cnt = 3
+        print()
+        for i in range(3):
+            N = 10000 * (10 ** i)
+            keys = [f"event:{j:09d}" for j in range(N, N + 100000)]
+            ts1 = TreeSet(f"event:{j:09d}" for j in range(N))
+            ts2 = TreeSet(ts1)
+            t1 = timeit(cnt, pop_oldest, ts1, keys)
+            t2 = timeit(cnt, remove_oldest, ts2, keys)
+            print(f"Slide a window of {N} str keys by {len(keys)} keys, run {cnt} times")
+            print(f"pop(0): {t1:.2f}ms, remove(loc(0)): {t2:.2f}ms, remove/pop: {t2/t1:.2f}\n")
+
+    def test_call_latency(self):
+        # small trees, where passing arguments costs about as much as the descent
+        ts = TreeSet(range(8))
+        m = TreeMap(zip(range(8), range(8)))
+        cases = [
+            "ts.add(3)",
+            "ts.remove(30)",
+            "ts.at_most(3)",
+            "ts.loc(3)",
+            "ts.bisect_left(3)",
+            "ts.iter_from(3)",
+            "ts.count_range(2, 5)",
+            "m.get(3)",
+            "m.get(30, -1)",
+            "m.at_least(3)",
+            "m.index(3)",
+            "m.items(reverse=True)",
+            "TreeSet()",
+            "TreeSet([1, 2])",
+            "TreeMap()",
+            "d.get(3)",
+        ]
+        env = {"ts": ts, "m": m, "d": {3: 3}, "TreeSet": TreeSet, "TreeMap": TreeMap}
+        cnt = 200000
+        print()
+        for stmt in cases:
+            t = min(repeat(stmt, number=cnt, repeat=5, globals=env))
+            print(f"{stmt}: {t * 1e9 / cnt:.1f}ns per call")
+
 
 class TreeMapBenchmark(unittest.TestCase):
 
@@ -107,5 +518,117 @@ class TreeMapBenchmark(unittest.TestCase):
             print(f"Find min in {N} keys, run {cnt} times")
             print(f"TreeMap: {t1:.2f}ms, dict: {t2:.2f}ms, dict/TreeMap: {t2/t1:.2f}\n")
 
+    def test_treemap_cursor(self):
+        def merge_cursor(m, patches):
+            c = m.cursor()
+            for k, v in patches:
+                while c and c.key < k:
+                    c.next()
+                if c and c.key == k:
+                    c.value = v
+                else:
+                    c.insert_before(k, v)
+        def merge_setitem(m, patches):
+            for k, v in patches:
+                m[k] = v
+        cnt = 1
+        print()
+        for i in range(3):
+            N = 10000 * (10 ** i)
+            patches = [(f"key:{j:09d}", j) for j in range(0, 3 * N, 3)]
+            m1 = TreeMap((f"key:{j:09d}", 0) for j in range(0, 3 * N, 2))
+            m2 = TreeMap(m1.items())
+            c1, c2 = m1.stats()["comparisons"], m2.stats()["comparisons"]
+            t1 = timeit(cnt, merge_cursor, m1, patches)
+            t2 = timeit(cnt, merge_setitem, m2, patches)
+            c1, c2 = m1.stats()["comparisons"] - c1, m2.stats()["comparisons"] - c2
+            print(f"Merge {N} sorted str items into a TreeMap of {len(m2)}, run {cnt} times")
+            print(f"cursor: {t1:.2f}ms, setitem: {t2:.2f}ms, setitem/cursor: {t2/t1:.2f}")
+            print(f"comparisons in the tree, cursor: {c1}, setitem: {c2}\n")
+
+    def test_treemap_append(self):
+        def append(m, stamps):
+            for t in stamps:
+                m[t] = t
+        cnt = 1
+        print()
+        for i in range(3):
+            N = 10000 * (10 ** i)
+            stamps = [1.7e9 + j * 0.001 for j in range(N)]
+            shuffled = random.sample(stamps, N)
+            m1, m2 = TreeMap(), TreeMap()
+            t1 = timeit(cnt, append, m1, stamps)
+            t2 = timeit(cnt, append, m2, shuffled)
+            c1, c2 = m1.stats()["comparisons"], m2.stats()["comparisons"]
+            print(f"Set {N} float timestamps, in order and shuffled, run {cnt} times")
+            print(f"in order: {t1:.2f}ms, shuffled: {t2:.2f}ms, shuffled/in order: {t2/t1:.2f}")
+            print(f"comparisons, in order: {c1}, shuffled: {c2}\n")
+
+    def test_treeset_extend_sorted(self):
+        cnt = 1
+        print()
+        for i in range(3):
+            N = 10000 * (10 ** i)
+            batch = [f"event:{j:09d}" for j in range(N, 2 * N)]
+            ts1 = TreeSet(f"event:{j:09d}" for j in range(N))
+            ts2 = TreeSet(ts1)
+            t1 = timeit(cnt, ts1.extend_sorted, batch)
+            t2 = timeit(cnt, ts2.extend, batch)
+            print(f"Append {N} sorted str keys to {N} keys, run {cnt} times")
+            print(f"extend_sorted: {t1:.2f}ms, extend: {t2:.2f}ms, extend/extend_sorted: {t2/t1:.2f}\n")
+
+    def test_treemap_increment(self):
+        def increment(m, words):
+            for w in words:
+                m.increment(w)
+        def get_set(m, words):
+            for w in words:
+                m[w] = m.get(w, 0) + 1
+        cnt = 1
+        print()
+        for i in range(3):
+            N = 10000 * (10 ** i)
+            words = [f"word:{random.randrange(N // 10):07d}" for _ in range(N)]
+            m1, m2 = TreeMap(value_dtype="int64"), TreeMap(value_dtype="int64")
+            t1 = timeit(cnt, increment, m1, words)
+            t2 = timeit(cnt, get_set, m2, words)
+            c1, c2 = m1.stats()["comparisons"], m2.stats()["comparisons"]
+            print(f"Count {N} str words of {N // 10} distinct, run {cnt} times")
+            print(f"increment: {t1:.2f}ms, get and set: {t2:.2f}ms, get and set/increment: {t2/t1:.2f}")
+            print(f"comparisons, increment: {c1}, get and set: {c2}\n")
+
+    def test_treemap_update_merge(self):
+        def setitems(m, pairs):
+            for k, v in pairs:
+                m[k] = v
+        cnt = 1
+        print()
+        for i in range(3):
+            N = 10000 * (10 ** i)
+            base = [(1.7e9 + j, float(j)) for j in range(0, 2 * N, 2)]
+            part = [(1.7e9 + j, -float(j)) for j in range(N, 3 * N, 2)]
+            src = TreeMap(part)
+            m1, m2, m3 = TreeMap(base), TreeMap(base), TreeMap(base)
+            t1 = timeit(cnt, m1.update, src)
+            t2 = timeit(cnt, m2.update, part)
+            t3 = timeit(cnt, setitems, m3, part)
+            print(f"Merge a partition of {N} pairs, half new, into {N} pairs, run {cnt} times")
+            print(f"update(TreeMap): {t1:.2f}ms, update(sorted pairs): {t2:.2f}ms, setitem: {t3:.2f}ms")
+            print(f"setitem/update(TreeMap): {t3/t1:.2f}, setitem/update(sorted pairs): {t3/t2:.2f}\n")
+
+    def test_treemap_copy(self):
+        cnt = 3
+        print()
+        for i in range(3):
+            N = 10000 * (10 ** i)
+            m = TreeMap((f"session:{j:09d}", j) for j in random.sample(range(N), N))
+            t1 = timeit(cnt, m.copy)
+            t2 = timeit(cnt, lambda: TreeMap(m.items()))
+            t3 = timeit(cnt, m.keyset)
+            t4 = timeit(cnt, lambda: TreeSet(m.keys()))
+            print(f"Copy a TreeMap of {N} str keys, run {cnt} times")
+            print(f"copy: {t1:.2f}ms, TreeMap(items): {t2:.2f}ms, TreeMap(items)/copy: {t2/t1:.2f}")
+            print(f"keyset: {t3:.2f}ms, TreeSet(keys): {t4:.2f}ms, TreeSet(keys)/keyset: {t4/t3:.2f}\n")
+
 if __name__ == "__main__":
     unittest.main()
\ No newline at end of file
@@ -1,6 +1,9 @@
 import unittest
-from pyavl import TreeMap
+from pyavl import TreeMap, TreeSet, FrozenTreeMap, BTreeMap, BTreeSet
 import random
+import io
+import operator
+import pickle
 
 class TreeMapTest(unittest.TestCase):
     
@@ -26,6 +29,25 @@ class TreeMapTest(unittest.TestCase):
         self.assertEqual(list(m.items()), sorted(d.items()))
         self.assertEqual(len(m), len(d))
     
+    def test_init_sorted(self):
+        data = [(n // 2, n) for n in range(1000)]
+        m = TreeMap(data)
+        self.assertEqual(list(m.items()), sorted(dict(data).items()))
+        data.reverse()
+        m = TreeMap(data)
+        self.assertEqual(list(m.items()), sorted(dict(data).items()))
+        # the first key and the last value of equal keys are kept
+        m = TreeMap([(1, "a"), (1.0, "b"), (0, "c")])
+        self.assertEqual(list(m.items()), [(0, "c"), (1, "b")])
+        self.assertIs(type(m.loc(1)[0]), int)
+        # unhashable keys
+        m = TreeMap([([2], 1), ([1], 2)])
+        self.assertEqual(list(m.keys()), [[1], [2]])
+        with self.assertRaises(ValueError):
+            TreeMap([(1, 2, 3)])
+        with self.assertRaises(TypeError):
+            TreeMap([1, 2])
+
     def test_get(self):
         data = [(n, n) for n in range(1000)]
         d = dict(data)
@@ -102,6 +124,15 @@ class TreeMapTest(unittest.TestCase):
         self.assertEqual(list(m.items()), [])
         self.assertEqual(len(m), 0)
     
+    def test_stats(self):
+        m = TreeMap((n, str(n)) for n in range(1000))
+        self.assertEqual(m.stats()["used"], 1000)
+        for n in range(500):
+            del m[n]
+        self.assertEqual(m.stats()["used"], 500)
+        m.clear()
+        self.assertEqual(m.stats()["chunks"], 0)
+
     def test_minmax(self):
         data = [
             (random.randint(-1000, 1000), random.randint(-1000, 1000))
@@ -129,6 +160,683 @@ class TreeMapTest(unittest.TestCase):
         self.assertEqual(m.at_least(23.3), 24)
 
 
+    def test_irange(self):
+        m = TreeMap({n: str(n) for n in range(0, 100, 3)})
+        self.assertEqual(list(m.irange(10, 20)), [12, 15, 18])
+        self.assertEqual(list(m.irange(12, 18, (False, True))), [15, 18])
+        self.assertEqual(len(m.irange(12, 18, inclusive=(False, False))), 1)
+        self.assertEqual(list(m.irange(lo=90)), [90, 93, 96, 99])
+        self.assertEqual(len(m.irange()), len(m))
+
+    def test_reverse_iter(self):
+        m = TreeMap({n: str(n) for n in range(0, 100, 3)})
+        self.assertEqual(list(reversed(m)), list(range(99, -1, -3)))
+        self.assertEqual(list(m.keys(reverse=True)), list(range(99, -1, -3)))
+        self.assertEqual(list(m.values(reverse=True)), [str(n) for n in range(99, -1, -3)])
+        self.assertEqual(list(m.items(reverse=True))[:2], [(99, "99"), (96, "96")])
+        self.assertEqual(list(m.items()), [(n, str(n)) for n in range(0, 100, 3)])
+        self.assertEqual(list(m.iter_from(90)), [90, 93, 96, 99])
+        self.assertEqual(list(m.iter_from(90, inclusive=False)), [93, 96, 99])
+        self.assertEqual(list(m.iter_before(9)), [6, 3, 0])
+        self.assertEqual(list(m.iter_before(9, True)), [9, 6, 3, 0])
+
+        # values may be replaced during iteration, but keys may not change
+        it = m.items()
+        next(it)
+        m[3] = "three"
+        self.assertEqual(next(it), (3, "three"))
+        del m[6]
+        with self.assertRaises(RuntimeError):
+            next(it)
+        it = m.values(reverse=True)
+        next(it)
+        m.clear()
+        with self.assertRaises(RuntimeError):
+            next(it)
+
+    def test_rank(self):
+        m = TreeMap({n: str(n) for n in range(0, 100, 3)})
+        self.assertEqual(m.rank(10), 4)
+        self.assertEqual(m.bisect_left(9), 3)
+        self.assertEqual(m.bisect_right(9), 4)
+        self.assertEqual(m.index(99), 33)
+        self.assertEqual(m.loc(m.index(30)), (30, "30"))
+        with self.assertRaises(KeyError):
+            m.index(10)
+        self.assertEqual(m.count_range(10, 20), 3)
+        self.assertEqual(m.count_range(12, 18, (False, False)), 1)
+        self.assertEqual(m.count_range(), len(m))
+
+    def test_get_many(self):
+        m = TreeMap({n: str(n) for n in range(0, 100, 3)})
+        keys = [random.randint(-10, 110) for _ in range(200)]
+        for q in [keys, sorted(keys), sorted(keys, reverse=True)]:
+            self.assertEqual(m.get_many(q), [m.get(k) for k in q])
+            self.assertEqual(m.get_many(q, -1), [m.get(k, -1) for k in q])
+            self.assertEqual(m.contains_many(q), [k in m for k in q])
+            self.assertEqual(m.at_most_many(q), [m.at_most(k) for k in q])
+            self.assertEqual(m.at_least_many(q), [m.at_least(k) for k in q])
+
+    def test_aggregate(self):
+        d = {random.randint(0, 500): float(random.randint(-100, 100)) for _ in range(300)}
+        m = TreeMap(d, aggregate=True)
+        self.assertEqual(m.value_dtype, "float64")
+        for _ in range(300):
+            k = random.randint(0, 500)
+            if random.random() < 0.5:
+                m[k] = d[k] = float(random.randint(-100, 100))
+            elif k in d:
+                del m[k], d[k]
+            lo, hi = sorted(random.randint(-10, 510) for _ in range(2))
+            inclusive = (random.random() < 0.5, random.random() < 0.5)
+            vals = [
+                v for k, v in d.items()
+                if (lo <= k if inclusive[0] else lo < k) and (k <= hi if inclusive[1] else k < hi)
+            ]
+            self.assertEqual(m.aggregate(lo, hi, inclusive=inclusive), sum(vals))
+            self.assertEqual(m.aggregate(lo, hi, "min", inclusive), min(vals, default=None))
+            self.assertEqual(m.aggregate(lo, hi, "max", inclusive), max(vals, default=None))
+            self.assertEqual(m.aggregate(lo, hi, "count", inclusive), len(vals))
+        self.assertEqual(m.aggregate(), sum(d.values()))
+        self.assertEqual(m.aggregate(hi=250, op="max"), max(v for k, v in d.items() if k <= 250))
+        m.clear()
+        self.assertEqual(m.aggregate(), 0.0)
+        self.assertEqual(m.aggregate(op="min"), None)
+        with self.assertRaises(ValueError):
+            m.aggregate(op="mean")
+        with self.assertRaises(ValueError):
+            TreeMap({1: 1.0}).aggregate()
+        self.assertEqual(TreeMap({1: 1.0}).aggregate(op="count"), 1)
+        with self.assertRaises(ValueError):
+            TreeMap(aggregate=True, value_dtype="int64")
+
+    def test_dtype(self):
+        data = [
+            (random.randint(-1000, 1000), random.random())
+            for _ in range(1000)
+        ]
+        d = dict(data)
+        m = TreeMap(data, key_dtype="int64", value_dtype="float64")
+        self.assertEqual((m.key_dtype, m.value_dtype), ("int64", "float64"))
+        self.assertEqual(list(m.items()), sorted(d.items()))
+        self.assertEqual(list(m.values()), [d[k] for k in sorted(d)])
+        m[5] = 2
+        self.assertEqual(m[5], 2.0)
+        self.assertEqual(m.get(10 ** 30, -1), -1)
+        with self.assertRaises(TypeError):
+            m["a"] = 1.0
+        with self.assertRaises(TypeError):
+            m[1] = "a"
+        del m[5]
+        self.assertFalse(5 in m)
+        with self.assertRaises(ValueError):
+            TreeMap([(float("nan"), 1.0)], key_dtype="float64")
+        m[6] = float("nan")
+        self.assertNotEqual(m[6], m[6])
+
+        # dtype names are reserved keywords
+        m = TreeMap(a=1, value_dtype="int64")
+        self.assertEqual(list(m.items()), [("a", 1)])
+        self.assertEqual(m.key_dtype, "object")
+        with self.assertRaises(ValueError):
+            TreeMap(key_dtype="int8")
+
+    def test_key_func(self):
+        data = [(random.randint(-1000, 1000), random.random()) for _ in range(2000)]
+        key = lambda x: -x
+        d = dict(data)
+        m = TreeMap(data, key=key, value_dtype="float64")
+        self.assertIs(m.key, key)
+        self.assertEqual(list(m.items()), sorted(d.items(), reverse=True))
+        self.assertEqual(m.at_most(0), min((k for k in d if k >= 0), default=None))
+        self.assertEqual(m.bisect_left(0), sum(1 for k in d if k > 0))
+        for k in list(d)[::2]:
+            self.assertEqual(m[k], d[k])
+            del m[k]
+            del d[k]
+        self.assertEqual(list(m.keys()), sorted(d, reverse=True))
+        self.assertEqual(m.get_many([-2000, 2000], 0.5), [0.5, 0.5])
+
+        # the first key is kept and the last value, as in a dict
+        m = TreeMap([("b", 1), ("A", 2), ("a", 3)], key=str.lower)
+        m["B"] = 4
+        self.assertEqual(list(m.items()), [("A", 3), ("b", 4)])
+        self.assertTrue("a" in m)
+        self.assertEqual(m.get("c", 0), 0)
+
+        m = TreeMap({i: float(i) for i in range(10)}, key=key, aggregate=True)
+        self.assertEqual(list(m.keys()), list(range(9, -1, -1)))
+        self.assertEqual(m.aggregate(7, 3), 25.0)
+        self.assertEqual(m.aggregate(7, 3, op="count"), 5)
+        with self.assertRaises(ValueError):
+            m.__init__(key=None)
+
+    def test_buffer(self):
+        data = [(random.randint(-1000, 1000), random.random()) for _ in range(1000)]
+        d = dict(data)
+        m = TreeMap(data, key_dtype="int64", value_dtype="float64")
+        keys, values = m.keys_array(), m.values_array()
+        self.assertEqual((keys.format, values.format), ("q", "d"))
+        self.assertEqual(keys.tolist(), sorted(d))
+        self.assertEqual(values.tolist(), [d[k] for k in sorted(d)])
+
+        m = TreeMap({"b": b"xy", "a": b"z"}, value_dtype="bytes")
+        self.assertEqual(m.values_array().tobytes(), b"z\0xy")
+        with self.assertRaises(TypeError):
+            m.keys_array()
+        with self.assertRaises(ValueError):
+            TreeMap(data, key=abs, key_dtype="int64").keys_array()
+
+    def test_snapshot(self):
+        data = [(random.randint(-1000, 1000), random.random()) for _ in range(1000)]
+        cases = [
+            TreeMap(data),
+            TreeMap(data, key_dtype="int64", value_dtype="float64"),
+            TreeMap(data, aggregate=True),
+            TreeMap({"b": [1], "A": None}, key=str.lower),
+            TreeMap({b"k": b"v"}, key_dtype="bytes", value_dtype="bytes"),
+            TreeMap(),
+        ]
+        for m in cases:
+            copy = pickle.loads(pickle.dumps(m))
+            self.assertEqual(list(copy.items()), list(m.items()))
+            self.assertEqual(
+                (copy.key_dtype, copy.value_dtype, copy.key), (m.key_dtype, m.value_dtype, m.key))
+            self.assertEqual(copy.stats()["comparisons"], 0)
+
+        f = io.BytesIO()
+        cases[2].save(f)
+        f.seek(0)
+        m = TreeMap.load(f)
+        self.assertEqual(m.aggregate(-500, 500), cases[2].aggregate(-500, 500))
+        m[2000] = 1.0
+        self.assertEqual(m.aggregate(None, None, op="count"), len(cases[2]) + 1)
+        f.seek(0)
+        with self.assertRaises(ValueError):
+            TreeSet.load(f)
+
+    def test_freeze(self):
+        data = [(random.randint(-1000, 1000), random.random()) for _ in range(1000)]
+        cases = [
+            TreeMap(data),
+            TreeMap(data, key_dtype="int64", value_dtype="float64"),
+            TreeMap(data, aggregate=True),
+            TreeMap({b"k": b"v", b"a": b"w"}, key_dtype="bytes", value_dtype="bytes"),
+            TreeMap(),
+        ]
+        for m in cases:
+            fm = m.freeze()
+            self.assertEqual((fm.key_dtype, fm.value_dtype), (m.key_dtype, m.value_dtype))
+            self.assertEqual(len(fm), len(m))
+            self.assertEqual(list(fm), list(m))
+            self.assertEqual(list(fm.items()), list(m.items()))
+            self.assertEqual(list(fm.values(reverse=True)), list(m.values(reverse=True)))
+            self.assertEqual(list(reversed(fm)), list(reversed(m)))
+            for k in list(m)[::10]:
+                self.assertTrue(k in fm)
+                self.assertEqual(fm[k], m[k])
+                self.assertEqual(fm.index(k), m.index(k))
+            for _ in range(200):
+                x = random.randint(-1010, 1010)
+                if m.key_dtype == "bytes":
+                    x = bytes([random.randint(96, 108)])
+                self.assertEqual(fm.get(x, -1), m.get(x, -1))
+                self.assertEqual(fm.at_most(x), m.at_most(x))
+                self.assertEqual(fm.at_least(x), m.at_least(x))
+                self.assertEqual(fm.rank(x), m.rank(x))
+                self.assertEqual(fm.count_range(None, x), m.count_range(None, x))
+            if len(m):
+                self.assertEqual(fm.min(), m.min())
+                self.assertEqual(fm.max(), m.max())
+                self.assertEqual(fm.loc(-2), m.loc(-2))
+
+        fm = FrozenTreeMap({"b": 1}, a=2)
+        self.assertEqual(list(fm.items()), [("a", 2), ("b", 1)])
+        self.assertEqual(list(fm.irange("a", "b", inclusive=(False, True))), ["b"])
+        with self.assertRaises(KeyError):
+            fm["c"]
+        with self.assertRaises(ValueError):
+            TreeMap({"a": 1}, key=str.lower).freeze()
+
+    def test_persistent_snapshot(self):
+        for kwargs in ({}, {"key_dtype": "int64", "aggregate": True}, {"key": lambda x: -x}):
+            m = TreeMap(**kwargs)
+            d = {}
+            views = []
+            for i in range(3000):
+                x = random.randint(0, 300)
+                if random.random() < 0.55:
+                    m[x] = d[x] = float(i)
+                elif x in d:
+                    del m[x], d[x]
+                if i % 100 == 0:
+                    views.append((m.snapshot(), dict(d)))
+                if i == 1500:
+                    m.clear()
+                    d.clear()
+            for view, items in views:
+                self.assertEqual(len(view), len(items))
+                self.assertEqual(dict(view.items()), items)
+                self.assertEqual(list(view), sorted(items, key=kwargs.get("key")))
+                self.assertIs(view.owner, m)
+                self.assertIs(view.snapshot(), view)
+                if kwargs.get("aggregate"):
+                    self.assertEqual(view.aggregate(op="sum"), sum(items.values()))
+            self.assertEqual(dict(m.items()), d)
+            del views, view
+            self.assertEqual(m.stats()["used"], len(m))
+
+        m = TreeMap({"a": 1})
+        view = m.snapshot()
+        m["a"] = 2
+        self.assertEqual((view["a"], m["a"]), (1, 2))
+        self.assertEqual(view.get("b", 3), 3)
+        self.assertTrue("a" in view)
+        self.assertEqual(list(pickle.loads(pickle.dumps(view)).items()), [("a", 1)])
+        with self.assertRaises(TypeError):
+            view["a"] = 3
+        with self.assertRaises(ValueError):
+            m.__init__(aggregate=True)
+
+    def test_popitem(self):
+        m = TreeMap({i: float(i) for i in range(1000)}, aggregate=True)
+        ref = list(m.items())
+        view = m.snapshot()
+        for _ in range(300):
+            i = random.randint(-len(ref), len(ref) - 1)
+            self.assertEqual(m.popitem(i), ref.pop(i))
+        self.assertEqual(m.popitem(), ref.pop())
+        self.assertEqual(m.popitem(index=0), ref.pop(0))
+        self.assertEqual(list(m.items()), ref)
+        self.assertEqual(m.aggregate(op="sum"), sum(v for _, v in ref))
+        self.assertEqual(len(view), 1000)
+        with self.assertRaises(IndexError):
+            m.popitem(len(ref))
+        with self.assertRaises(KeyError):
+            TreeMap().popitem()
+
+
+    def test_cursor(self):
+        m = TreeMap({i: float(i) for i in range(0, 1000, 2)}, aggregate=True)
+        view = m.snapshot()
+        c = m.cursor()
+        self.assertTrue(c.seek(100))
+        self.assertEqual((c.key, c.value, c.rank), (100, 100.0, 50))
+        c.value = -1.0
+        c.insert_after(101, 0.5)
+        c.insert_before(99, 0.25)
+        self.assertEqual((c.key, c.rank), (100, 51))
+        self.assertTrue(c.next())
+        self.assertEqual(c.value, 0.5)
+        c.erase()
+        self.assertEqual(c.key, 102)
+        with self.assertRaises(TypeError):
+            c.insert_after(103)
+        self.assertEqual(m.aggregate(98, 102), 98.0 + 0.25 - 1.0 + 102.0)
+        self.assertEqual(list(m.irange(98, 102)), [98, 99, 100, 102])
+        self.assertEqual(len(m), 501)
+        self.assertEqual(list(view.items()), [(i, float(i)) for i in range(0, 1000, 2)])
+
+        c = view.cursor()
+        self.assertFalse(c.seek(99))
+        self.assertEqual((c.key, c.value), (100, 100.0))
+        with self.assertRaises(TypeError):
+            c.value = 1.0
+        with self.assertRaises(TypeError):
+            c.erase()
+        self.assertTrue(c.prev())
+        self.assertEqual(c.key, 98)
+
+
+    def test_append(self):
+        m = TreeMap(aggregate=True)
+        views = []
+        for i in range(1000):
+            m[i] = float(i)
+            if i % 100 == 0:
+                views.append(m.snapshot())
+            self.assertEqual((m.min(), m.max()), ((0, 0.0), (i, float(i))))
+        self.assertLess(m.stats()["comparisons"], 1000)
+        self.assertEqual(m.aggregate(), sum(range(1000)))
+        for i, view in enumerate(views):
+            self.assertEqual(view.max(), (100 * i, 100.0 * i))
+        del m[999]
+        m[-1] = 2.0
+        self.assertEqual((m.min(), m.max()), ((-1, 2.0), (998, 998.0)))
+
+
+    def test_upsert(self):
+        m = TreeMap()
+        self.assertEqual(m.setdefault(2, "b"), "b")
+        self.assertEqual(m.setdefault(2, "c"), "b")
+        self.assertIsNone(m.setdefault(1))
+        calls = []
+        factory = lambda: calls.append(1) or []
+        m.get_or_insert(3, factory).append("x")
+        m.get_or_insert(3, factory).append("y")
+        self.assertEqual((m[3], len(calls)), (["x", "y"], 1))
+        self.assertEqual(m.update_with(4, lambda v: v + 1, 0), 1)
+        self.assertEqual(m.update_with(4, lambda v: v * 10), 10)
+        self.assertEqual(m.increment(5), 1)
+        self.assertEqual(m.increment(5, delta=2.5), 3.5)
+        self.assertEqual(list(m.keys()), [1, 2, 3, 4, 5])
+        with self.assertRaises(TypeError):
+            m.increment(2)
+        with self.assertRaises(TypeError):
+            m.get_or_insert(6)
+        self.assertNotIn(6, m)
+
+        m = TreeMap(key_dtype="int64", value_dtype="int64")
+        for i in range(1000):
+            m.increment(i % 7, i)
+        self.assertEqual(dict(m.items()), {r: sum(range(r, 1000, 7)) for r in range(7)})
+        m[0] = 2 ** 63 - 1
+        with self.assertRaises(OverflowError):
+            m.increment(0)
+        self.assertEqual(m[0], 2 ** 63 - 1)
+        with self.assertRaises(TypeError):
+            m.increment(1, 1.5)
+
+        m = TreeMap(aggregate=True)
+        views = []
+        for i in range(100):
+            m.increment(i % 10, 1.0)
+            if i % 25 == 0:
+                views.append(m.snapshot())
+        self.assertEqual((m.aggregate(), len(m)), (100.0, 10))
+        self.assertEqual([v.aggregate() for v in views], [1.0, 26.0, 51.0, 76.0])
+        self.assertEqual(views[0][0], 1.0)
+
+        m = TreeMap((i, i) for i in range(100))
+        def grow(v):
+            for i in range(100, 200):
+                m[i] = i
+            return -v
+        self.assertEqual(m.update_with(50, grow), -50)
+        self.assertEqual(m.update_with(500, lambda v: grow(0) or 7), 7)
+        self.assertEqual((len(m), m[50], m[500]), (201, -50, 7))
+        self.assertEqual(list(m.keys()), list(range(200)) + [500])
+
+
+    def test_update_merge(self):
+        # TreeMaps and snapshots hand over their nodes in order
+        a = TreeMap(((i, float(i)) for i in range(0, 3000, 2)), aggregate=True)
+        b = TreeMap(((i, -1.0) for i in range(0, 3000, 3)), aggregate=True)
+        d = dict(a.items())
+        d.update(b.items())
+        view = b.snapshot()
+        ncmp = a.stats()["comparisons"]
+        a.update(view)
+        self.assertLess(a.stats()["comparisons"] - ncmp, len(a))
+        self.assertEqual(list(a.items()), sorted(d.items()))
+        self.assertEqual(a.aggregate(), sum(d.values()))
+        self.assertEqual(list(TreeMap(b).items()), list(b.items()))
+        a.update(a)
+        self.assertEqual(len(a), len(d))
+
+        # the first key and the last value of equal keys are kept
+        m = TreeMap([(1, "a"), (2, "b")])
+        m.update([(2.0, "c"), (3, "d"), (1.0, "e")])
+        self.assertEqual(list(m.items()), [(1, "e"), (2, "c"), (3, "d")])
+        self.assertIs(type(m.loc(1)[0]), int)
+
+        # unhashable keys, mappings, sorted streams and small batches
+        m = TreeMap([([2], 1)])
+        m.update([([3], 2), ([1], 3)])
+        self.assertEqual(list(m.items()), [([1], 3), ([2], 1), ([3], 2)])
+        m = TreeMap({"a": 1}, value_dtype="int64")
+        m.update(TreeSet([("c", 3), ("b", 2)]))
+        m.update(TreeMap({"d": 4}))
+        self.assertEqual(list(m.items()), [("a", 1), ("b", 2), ("c", 3), ("d", 4)])
+        m = TreeMap((i, i) for i in range(1000))
+        cur = m.cursor()
+        m.update((i, -i) for i in range(500, 1500))
+        m.update([(2000, 0), (-1, 0)])
+        self.assertEqual(list(m.items()), [(-1, 0)] + [(i, i if i < 500 else -i) for i in range(1500)] + [(2000, 0)])
+        with self.assertRaises(RuntimeError):
+            cur.next()
+
+        # with snapshots or keys compared in Python, pairs are set one by one
+        m = TreeMap(((i, i) for i in range(100)), key=lambda k: -k)
+        view = m.snapshot()
+        m.update((i, 0) for i in range(50, 150))
+        self.assertEqual(list(m.keys()), list(range(149, -1, -1)))
+        self.assertEqual((m[60], view[60], len(view)), (0, 60, 100))
+        m = TreeMap(((i, "x"), i) for i in range(100))
+        m.update(((i, "x"), -i) for i in range(50, 150))
+        self.assertEqual(list(m.values()), list(range(50)) + [-i for i in range(50, 150)])
+        with self.assertRaises(ValueError):
+            m.update([(1, 2, 3)])
+        with self.assertRaises(TypeError):
+            m.update(5)
+
+        # pairs are streamed, sorted by key with the values along, stably
+        data = [(random.randrange(500), i) for i in range(3000)]
+        for kwargs in ({}, {"key_dtype": "int64", "value_dtype": "int64"}, {"key": lambda k: -k}):
+            m = TreeMap(iter(data), **kwargs)
+            d = dict(data)
+            self.assertEqual(sorted(m.items()), sorted(d.items()))
+            m.update(iter(data[:100]))
+            self.assertEqual(len(m), len(d))
+        m = TreeMap()
+        with self.assertRaises(TypeError):
+            m.update(iter([(2, 1), (1, 1), ("a", 1)]))
+        m.update([("a", 1)])
+        self.assertEqual(list(m.items()), [("a", 1)])
+
+
+    def test_copy(self):
+        import copy
+        data = [(random.randrange(100000), random.random()) for _ in range(5000)]
+        for m in [TreeMap(data), TreeMap(data, aggregate=True), TreeMap(data, key=lambda k: -k),
+                  TreeMap(data, key_dtype="int64", value_dtype="float64"), TreeMap()]:
+            view = m.snapshot()
+            ncmp = m.stats()["comparisons"]
+            for cp in [m.copy(), copy.copy(m), view.copy()]:
+                self.assertIs(type(cp), TreeMap)
+                self.assertEqual(list(cp.items()), list(m.items()))
+                self.assertEqual(cp.stats()["comparisons"], 0)
+            keys = m.keyset()
+            self.assertEqual((type(keys), list(keys)), (TreeSet, list(m.keys())))
+            self.assertEqual(list(view.keyset()), list(m.keys()))
+            self.assertEqual(m.stats()["comparisons"], ncmp)
+        m = TreeMap(((i, float(i)) for i in range(100)), aggregate=True)
+        cp = m.copy()
+        cp[1000] = 1.0
+        del cp[0]
+        cp[5] = 0.0
+        self.assertEqual((m.aggregate(), cp.aggregate()), (4950.0, 4946.0))
+        self.assertEqual((len(m), len(cp), m[5]), (100, 100, 5.0))
+        keys = TreeMap({"a": 1, "B": 2}, key=str.lower).keyset()
+        keys.add("C")
+        self.assertEqual(list(keys), ["a", "B", "C"])
+        self.assertIn("b", keys)
+
+    def test_btree_backend(self):
+        m = TreeMap(backend="btree")
+        self.assertIsInstance(m, BTreeMap)
+        self.assertEqual(m.backend, "btree")
+        self.assertEqual(TreeMap().backend, "avl")
+        with self.assertRaises(ValueError):
+            TreeMap(backend="skiplist")
+        ref = {}
+        for _ in range(50000):
+            x = random.randint(-3000, 3000)
+            if random.random() < 0.6:
+                m[x] = ref[x] = random.random()
+            elif x in ref:
+                del m[x]
+                del ref[x]
+            else:
+                with self.assertRaises(KeyError):
+                    del m[x]
+        items = sorted(ref.items())
+        keys = [k for k, _ in items]
+        self.assertEqual(len(m), len(items))
+        self.assertEqual(list(m.items()), items)
+        self.assertEqual(list(m.items(reverse=True)), items[::-1])
+        self.assertEqual(list(m.values()), [v for _, v in items])
+        self.assertEqual(list(reversed(m)), keys[::-1])
+        self.assertEqual((m.min(), m.max()), (items[0], items[-1]))
+        for i in range(0, len(items), 37):
+            self.assertEqual(m.loc(i), items[i])
+            self.assertEqual(m.index(keys[i]), i)
+        for x in range(-3010, 3010, 7):
+            self.assertEqual(x in m, x in ref)
+            self.assertEqual(m.get(x, "-"), ref.get(x, "-"))
+            self.assertEqual(m.rank(x), sum(1 for k in keys if k < x))
+            self.assertEqual(m.at_most(x), max((k for k in keys if k <= x), default=None))
+            self.assertEqual(m.at_least(x), min((k for k in keys if k >= x), default=None))
+        self.assertEqual(m.aggregate(-100, 100, op="count"), sum(1 for k in keys if -100 <= k <= 100))
+        with self.assertRaises(ValueError):
+            m.aggregate()
+        with self.assertRaises(ValueError):
+            TreeMap(backend="btree", aggregate=True)
+        with self.assertRaises(IndexError):
+            m.loc(len(items))
+        with self.assertRaises(KeyError):
+            m[5000]
+
+        # dtypes of keys and values are shared with the AVL backend
+        m = TreeMap({2.5: 1, 1.5: 2}, key_dtype="float64", value_dtype="int64", backend="btree")
+        self.assertEqual(list(m.items()), [(1.5, 2), (2.5, 1)])
+        self.assertEqual((m.key_dtype, m.value_dtype), ("float64", "int64"))
+        self.assertEqual(list(m.values_array()), [2, 1])
+        with self.assertRaises(ValueError):
+            m.__init__(value_dtype="float64")
+        m = TreeMap(((i, -i) for i in range(100000)), backend="btree")
+        self.assertEqual(m.loc(77777), (77777, -77777))
+        for x in range(0, 100000, 3):
+            del m[x]
+        self.assertEqual(list(m.keys()), [x for x in range(100000) if x % 3])
+        self.assertGreater(m.stats()["fill"], 0.4)
+        it = iter(m)
+        next(it)
+        m[0] = 0
+        with self.assertRaises(RuntimeError):
+            next(it)
+        m.clear()
+        self.assertEqual(list(m.items()), [])
+        with self.assertRaises(KeyError):
+            m.popitem()
+
+        # a BTreeMap is a TreeMap, equal to one with the same items
+        m = TreeMap({i: str(i) for i in range(10)}, backend="btree")
+        self.assertIsInstance(m, TreeMap)
+        self.assertEqual(m, TreeMap({i: str(i) for i in range(10)}))
+        self.assertEqual(TreeMap({i: str(i) for i in range(10)}), m)
+        self.assertNotEqual(m, TreeMap({i: "" for i in range(10)}, backend="btree"))
+        with self.assertRaises(TypeError):
+            hash(m)
+        with self.assertRaises(ValueError):
+            BTreeMap(backend="avl")
+
+    def test_btree_api(self):
+        public = {name for name in dir(TreeMap) if not name.startswith("__") or
+            name in ("__reversed__", "__reduce__", "__copy__")}
+        # every method reading the AVL tree is overridden
+        self.assertEqual(
+            public - set(BTreeMap.__dict__) - {"key", "key_dtype", "_from_snapshot"}, set())
+        for key in [None, operator.neg]:
+            data = [(random.randint(-500, 500), random.random()) for _ in range(3000)]
+            other = [random.randint(-700, 300) for _ in range(2000)]
+            avl, bt = TreeMap(data, key=key), TreeMap(data, key=key, backend="btree")
+            self.assertEqual(list(bt.items()), list(avl.items()))
+            self.assertIs(bt.key, key)
+            for x in range(-520, 520, 13):
+                self.assertEqual(list(bt.iter_from(x)), list(avl.iter_from(x)))
+                self.assertEqual(list(bt.iter_from(x, False)), list(avl.iter_from(x, False)))
+                self.assertEqual(list(bt.iter_before(x)), list(avl.iter_before(x)))
+                self.assertEqual(list(bt.iter_before(x, True)), list(avl.iter_before(x, True)))
+                self.assertEqual(list(reversed(bt.irange(x, x + 80, (False, True)))),
+                    list(reversed(avl.irange(x, x + 80, (False, True)))))
+                self.assertEqual(bt.count_range(x, None), avl.count_range(x, None))
+                self.assertEqual(bt.bisect_right(x), avl.bisect_right(x))
+            self.assertEqual(bt.contains_many(other), avl.contains_many(other))
+            self.assertEqual(bt.get_many(other, 0), avl.get_many(other, 0))
+            self.assertEqual(bt.at_most_many(other), avl.at_most_many(other))
+            self.assertEqual(bt.at_least_many(sorted(other)), avl.at_least_many(sorted(other)))
+            # batches keep the first key and the last value, merging or inserting one by one
+            for batch in [[(x, -x) for x in other], [(x, 0) for x in other[:20]], {}]:
+                bt.update(batch)
+                avl.update(batch)
+                self.assertEqual(list(bt.items()), list(avl.items()))
+            a, b = bt.copy(), avl.copy()
+            self.assertIsInstance(a, BTreeMap)
+            a.update(TreeMap({x: "m" for x in range(-50, 50)}, key=key, backend="btree"))
+            b.update({x: "m" for x in range(-50, 50)})
+            self.assertEqual(list(a.items()), list(b.items()))
+            for x in [-3, 7, 9999]:
+                self.assertEqual(a.setdefault(x, "d"), b.setdefault(x, "d"))
+                self.assertEqual(a.update_with(x, str), b.update_with(x, str))
+                self.assertEqual(a.increment(x, "+"), b.increment(x, "+"))
+                self.assertEqual(a.get_or_insert(x + 1, list), b.get_or_insert(x + 1, list))
+            for i in [0, -1, 17, len(a) // 2]:
+                self.assertEqual(a.popitem(i), b.popitem(i))
+            self.assertEqual(list(a.items()), list(b.items()))
+            self.assertEqual(list(bt.keyset()), list(avl.keys()))
+            self.assertIsInstance(bt.keyset(), BTreeSet)
+            view = bt.snapshot()
+            bt.clear()
+            self.assertEqual(list(view.items()), list(avl.items()))
+            bt.update(view)
+            copied = pickle.loads(pickle.dumps(bt))
+            self.assertIsInstance(copied, BTreeMap)
+            self.assertEqual(list(copied.items()), list(avl.items()))
+            self.assertEqual(copied.key, key)
+
+        # int64 values are incremented in place
+        m = TreeMap(key_dtype="int64", value_dtype="int64", backend="btree")
+        for i in range(1000):
+            m.increment(i % 7, i)
+        self.assertEqual(dict(m.items()), {r: sum(range(r, 1000, 7)) for r in range(7)})
+        m[0] = 2 ** 63 - 1
+        with self.assertRaises(OverflowError):
+            m.increment(0)
+        self.assertEqual(m[0], 2 ** 63 - 1)
+        with self.assertRaises(TypeError):
+            m.increment(1, 1.5)
+        m = TreeMap(((i, i) for i in range(100)), backend="btree")
+        def grow(v):
+            for i in range(100, 200):
+                m[i] = i
+            return -v
+        self.assertEqual(m.update_with(50, grow), -50)
+        self.assertEqual((len(m), m[50]), (200, -50))
+
+        # snapshots are shared with TreeMap
+        m = TreeMap(((i, float(i)) for i in range(0, 3000, 3)), key_dtype="int64",
+            value_dtype="float64", backend="btree")
+        self.assertEqual(list(m.freeze().items()), list(m.items()))
+        self.assertEqual(list(FrozenTreeMap(m).items()), list(m.items()))
+        self.assertEqual(list(m.keys_array()), list(m.keys()))
+        f = io.BytesIO()
+        m.save(f)
+        f.seek(0)
+        self.assertEqual(TreeMap.load(f), m)
+        f = io.BytesIO()
+        TreeMap({i: float(i) for i in range(5)}, key=operator.neg, aggregate=True).save(f)
+        f.seek(0)
+        self.assertEqual(list(BTreeMap.load(f).items()), [(i, float(i)) for i in range(4, -1, -1)])
+
+        # cursors step across leaves, insert, erase and set values in place
+        m = TreeMap({i: float(i) for i in range(0, 1000, 2)}, backend="btree")
+        c = m.cursor()
+        self.assertTrue(c.seek(100))
+        self.assertEqual((c.key, c.value, c.rank), (100, 100.0, 50))
+        c.value = -1.0
+        c.insert_after(101, 0.5)
+        c.insert_before(99, 0.25)
+        self.assertEqual((c.key, c.rank), (100, 51))
+        self.assertTrue(c.next())
+        self.assertEqual(c.value, 0.5)
+        c.erase()
+        self.assertEqual(c.key, 102)
+        with self.assertRaises(TypeError):
+            c.insert_after(103)
+        self.assertEqual(list(m.irange(98, 102)), [98, 99, 100, 102])
+        self.assertEqual((len(m), m[100], m[99]), (501, -1.0, 0.25))
+
 
 if __name__ == "__main__":
     unittest.main()
\ No newline at end of file
@@ -1,6 +1,19 @@
 import unittest
-from pyavl import TreeSet
+from pyavl import TreeSet, BTreeSet, FrozenTreeSet
 import random
+from array import array
+import io
+import operator
+import os
+import pickle
+import tempfile
+import zlib
+
+unpickled = []
+
+class Unpickled:
+    def __reduce__(self):
+        return (unpickled.append, (None,))
 
 class TreeSetTest(unittest.TestCase):
     
@@ -27,6 +40,33 @@ class TreeSetTest(unittest.TestCase):
             sorted(s), list(ts),
             "TreeSet.__init__ fails")
     
+    def test_init_sorted(self):
+        for data in [
+            list(range(1000)),
+            [n // 3 for n in range(1000)],
+            list(range(1000, 0, -1)),
+            [str(n) for n in range(1000)],
+        ]:
+            ts = TreeSet(data)
+            self.assertEqual(list(ts), sorted(set(data)))
+            self.assertEqual(len(ts), len(set(data)))
+            for i, x in enumerate(ts):
+                self.assertEqual(ts.loc(i), x)
+            ts.extend(data[:10])
+            self.assertEqual(len(ts), len(set(data)))
+        ts = TreeSet(range(1023))
+        # a perfectly balanced tree keeps balanced under deletions
+        for n in range(0, 1023, 2):
+            ts.remove(n)
+        self.assertEqual(list(ts), list(range(1, 1023, 2)))
+        ts = TreeSet(range(10), dtype="float64")
+        self.assertEqual(list(ts), [float(n) for n in range(10)])
+        with self.assertRaises(TypeError):
+            TreeSet([1, "a", 2])
+        ts = TreeSet([1, 1.0, True])
+        self.assertEqual(len(ts), 1)
+        self.assertIs(type(ts.min()), int)
+
     def test_extend(self):
         data = [random.randint(-1000, 1000) for _ in range(100000)]
         s = set(data)
@@ -85,5 +125,894 @@ class TreeSetTest(unittest.TestCase):
         # test at_least
         self.assertEqual(s.at_least(23.3), 24)
 
+    def test_key_types(self):
+        # specialized comparisons
+        big = [random.randint(-2 ** 70, 2 ** 70) for _ in range(1000)]
+        for data in [
+            big + list(range(-100, 100)),
+            [random.random() for _ in range(1000)],
+            [str(random.randint(0, 10000)) for _ in range(1000)],
+            [bytes(str(random.randint(0, 10000)), "ascii") for _ in range(1000)],
+            [(random.randint(0, 10), str(random.randint(0, 10))) for _ in range(1000)],
+        ]:
+            ts = TreeSet(data)
+            self.assertEqual(sorted(set(data)), list(ts))
+            for x in data[:100]:
+                self.assertTrue(x in ts)
+        # fallback to generic comparisons on mixed types
+        ts = TreeSet(range(100))
+        ts.extend([n + 0.5 for n in range(100)])
+        ts.add(True)
+        self.assertEqual(len(ts), 200)
+        self.assertEqual(list(ts), sorted(list(range(100)) + [n + 0.5 for n in range(100)]))
+        self.assertTrue(10.0 in ts)
+        self.assertFalse(10.25 in ts)
+        with self.assertRaises(TypeError):
+            ts.add("a")
+
+    def test_dtype(self):
+        data = [random.randint(-2 ** 63, 2 ** 63 - 1) for _ in range(1000)]
+        ts = TreeSet(data, dtype="int64")
+        self.assertEqual(ts.dtype, "int64")
+        self.assertEqual(list(ts), sorted(set(data)))
+        for x in data[:100]:
+            self.assertTrue(x in ts)
+            ts.remove(x)
+            self.assertFalse(x in ts)
+        self.assertEqual(ts.at_most(2 ** 70), ts.max())
+        self.assertEqual(ts.at_least(-2 ** 70), ts.min())
+        self.assertFalse(0.5 in ts)
+        with self.assertRaises(OverflowError):
+            ts.add(2 ** 63)
+        with self.assertRaises(TypeError):
+            ts.add(1.0)
+
+        data = [random.random() for _ in range(1000)]
+        ts = TreeSet(data, dtype="float64")
+        self.assertEqual(list(ts), sorted(set(data)))
+        ts.add(3)
+        self.assertEqual(ts.max(), 3.0)
+        self.assertTrue(3 in ts)
+        self.assertEqual(ts.at_most(0.5), max(x for x in data if x <= 0.5))
+
+        # NaN has no order, so it is not a float64 key
+        nan = float("nan")
+        for make in [lambda: TreeSet([1.0, nan, 0.5], dtype="float64"),
+                lambda: TreeSet([1.0, nan], dtype="float64", backend="btree"),
+                lambda: TreeSet.from_buffer(array("d", [1.0, nan])),
+                lambda: FrozenTreeSet([1.0, nan], dtype="float64"), lambda: ts.add(nan)]:
+            with self.assertRaises(ValueError):
+                make()
+        self.assertEqual(list(ts), sorted(set(data + [3.0])))
+
+        data = [bytes(str(random.randint(0, 1000)), "ascii") for _ in range(1000)]
+        ts = TreeSet(data, dtype="bytes")
+        self.assertEqual(list(ts), sorted(set(data)))
+        with self.assertRaises(TypeError):
+            ts.add("a")
+
+        with self.assertRaises(ValueError):
+            TreeSet(dtype="int32")
+
+    def test_insert_delete_random(self):
+        s = set()
+        ts = TreeSet()
+        for _ in range(20000):
+            x = random.randint(0, 2000)
+            if random.random() < 0.5:
+                s.add(x)
+                ts.add(x)
+            elif x in s:
+                s.remove(x)
+                ts.remove(x)
+        keys = sorted(s)
+        self.assertEqual(list(ts), keys)
+        for i in range(0, len(keys), 37):
+            self.assertEqual(ts.loc(i), keys[i])
+
+    def test_comparisons(self):
+        N = 1 << 14
+        ts = TreeSet()
+        data = random.sample(range(N), N)
+        for x in data:
+            ts.add(x)
+        # a single comparison per level of a tree of height at most 1.44 log2(N)
+        inserted = ts.stats()["comparisons"]
+        self.assertLessEqual(inserted, N * 1.45 * 14)
+        for x in data:
+            ts.remove(x)
+        self.assertLessEqual(ts.stats()["comparisons"] - inserted, N * 1.45 * 14)
+        ts.clear()
+        self.assertEqual(ts.stats()["comparisons"], 0)
+
+    def test_set_algebra(self):
+        ops = [
+            ("union", "update", "__or__", "__ior__", set.union),
+            ("intersection", "intersection_update", "__and__", "__iand__", set.intersection),
+            ("difference", "difference_update", "__sub__", "__isub__", set.difference),
+            ("symmetric_difference", "symmetric_difference_update",
+                "__xor__", "__ixor__", set.symmetric_difference),
+        ]
+        for dtype, make in [(None, int), ("int64", int), ("float64", float), (None, str)]:
+            for n, m in [(0, 50), (50, 0), (1000, 1000), (5000, 30), (30, 5000)]:
+                a = set(make(random.randint(0, 4 * (n + m))) for _ in range(n))
+                b = set(make(random.randint(0, 4 * (n + m))) for _ in range(m))
+                for name, update, op, iop, ref in ops:
+                    expected = sorted(ref(a, b))
+                    ta, tb = TreeSet(a, dtype=dtype), TreeSet(b, dtype=dtype)
+                    self.assertEqual(list(getattr(ta, name)(b)), expected)
+                    self.assertEqual(list(getattr(ta, op)(tb)), expected)
+                    self.assertEqual(list(ta), sorted(a))
+                    self.assertEqual(list(tb), sorted(b))
+                    getattr(ta, update)(b)
+                    self.assertEqual(list(ta), expected)
+                    self.assertEqual(len(ta), len(expected))
+                    ta = TreeSet(a, dtype=dtype)
+                    ta_id = id(ta)
+                    ta = getattr(ta, iop)(tb)
+                    self.assertEqual(id(ta), ta_id)
+                    self.assertEqual(list(ta), expected)
+                    for i in range(0, len(expected), 97):
+                        self.assertEqual(ta.loc(i), expected[i])
+                ta = TreeSet(a, dtype=dtype)
+                self.assertEqual(ta.issubset(b), a <= b)
+                self.assertEqual(ta.issuperset(b), a >= b)
+                self.assertEqual(ta.isdisjoint(b), a.isdisjoint(b))
+                self.assertTrue(ta.issubset(a | b))
+                self.assertTrue(ta.issuperset(a & b))
+
+        ts = TreeSet(range(10))
+        ts |= ts
+        self.assertEqual(list(ts), list(range(10)))
+        ts ^= ts
+        self.assertEqual(list(ts), [])
+        self.assertIs(TreeSet.__or__(TreeSet(), [1]), NotImplemented)
+        with self.assertRaises(TypeError):
+            ts |= [1]
+
+    def test_set_algebra_mixed(self):
+        ts = TreeSet([1, 2, 3])
+        ts |= TreeSet([2.5, 0.5])
+        self.assertEqual(list(ts), [0.5, 1, 2, 2.5, 3])
+        ts -= TreeSet([2.5, 1])
+        self.assertEqual(list(ts), [0.5, 2, 3])
+        ts.add(1.5)
+        self.assertEqual(list(ts), [0.5, 1.5, 2, 3])
+
+        # keys are only comparable with each other, so set operations fail half-way
+        class Key:
+            def __init__(self, v):
+                self.v = v
+            def __lt__(self, other):
+                return self.v < other.v
+            def __eq__(self, other):
+                return self.v == other.v
+        ts = TreeSet(range(10))
+        for op in ["update", "intersection_update", "difference_update", "union"]:
+            with self.assertRaises((TypeError, AttributeError)):
+                getattr(ts, op)([Key(n) for n in range(5, 15)])
+            self.assertEqual(list(ts), list(range(10)))
+        self.assertEqual(list(ts), list(range(10)))
+        ts.add(10)
+        self.assertEqual(len(ts), 11)
+
+    def test_irange(self):
+        for dtype in [None, "int64"]:
+            data = sorted(set(random.randint(-1000, 1000) for _ in range(500)))
+            ts = TreeSet(data, dtype=dtype)
+            for _ in range(200):
+                lo, hi = sorted(random.randint(-1100, 1100) for _ in range(2))
+                for inclusive in [(True, True), (True, False), (False, True), (False, False)]:
+                    expected = [
+                        x for x in data
+                        if (lo <= x if inclusive[0] else lo < x)
+                        and (x <= hi if inclusive[1] else x < hi)
+                    ]
+                    view = ts.irange(lo, hi, inclusive)
+                    self.assertEqual(list(view), expected)
+                    self.assertEqual(len(view), len(expected))
+                self.assertEqual(list(ts[lo:hi]), [x for x in data if lo <= x < hi])
+                self.assertEqual(len(ts[lo:hi]), len([x for x in data if lo <= x < hi]))
+                self.assertEqual(list(ts.irange(hi, lo)), [x for x in data if x == lo == hi])
+            self.assertEqual(list(ts[:]), data)
+            self.assertEqual(list(ts.irange(hi=data[10])), data[:11])
+            self.assertEqual(list(ts[data[-10]:]), data[-10:])
+
+        # views are live
+        ts = TreeSet(range(10))
+        view = ts[3:6]
+        self.assertEqual(list(view), [3, 4, 5])
+        ts.remove(4)
+        ts.add(3.5)
+        self.assertEqual(list(view), [3, 3.5, 5])
+        self.assertEqual(len(view), 3)
+        with self.assertRaises(TypeError):
+            ts[0]
+        with self.assertRaises(ValueError):
+            ts[0:5:2]
+        with self.assertRaises(TypeError):
+            len(ts["a":])
+
+    def test_reverse_iter(self):
+        for dtype in [None, "int64"]:
+            data = sorted(set(random.randint(-1000, 1000) for _ in range(500)))
+            ts = TreeSet(data, dtype=dtype)
+            self.assertEqual(list(reversed(ts)), data[::-1])
+            for _ in range(200):
+                k = random.randint(-1100, 1100)
+                self.assertEqual(list(ts.iter_from(k)), [x for x in data if x >= k])
+                self.assertEqual(list(ts.iter_from(k, False)), [x for x in data if x > k])
+                self.assertEqual(list(ts.iter_before(k)), [x for x in data if x < k][::-1])
+                self.assertEqual(
+                    list(ts.iter_before(k, inclusive=True)), [x for x in data if x <= k][::-1])
+                lo, hi = sorted((k, random.randint(-1100, 1100)))
+                self.assertEqual(list(reversed(ts[lo:hi])), [x for x in data if lo <= x < hi][::-1])
+        self.assertEqual(list(reversed(TreeSet())), [])
+        self.assertEqual(list(TreeSet().iter_from(1)), [])
+        with self.assertRaises(TypeError):
+            TreeSet([1, 2]).iter_from("a")
+
+        # iterators over a changed tree stop instead of walking stale nodes
+        ts = TreeSet(range(100))
+        for change in [lambda: ts.add(1000), lambda: ts.remove(50), ts.clear]:
+            iters = [iter(ts), reversed(ts), ts.iter_from(10), ts[20:80].__iter__(),
+                reversed(ts[20:80])]
+            for it in iters:
+                next(it)
+            change()
+            for it in iters:
+                with self.assertRaises(RuntimeError):
+                    next(it)
+                self.assertEqual(list(it), [])
+            ts.update(range(100))
+
+    def test_rank(self):
+        import bisect
+        for dtype in [None, "int64", "float64"]:
+            data = sorted(set(random.randint(-1000, 1000) for _ in range(500)))
+            ts = TreeSet(data, dtype=dtype)
+            for _ in range(200):
+                k = random.randint(-1100, 1100)
+                self.assertEqual(ts.rank(k), bisect.bisect_left(data, k))
+                self.assertEqual(ts.bisect_left(k), bisect.bisect_left(data, k))
+                self.assertEqual(ts.bisect_right(k), bisect.bisect_right(data, k))
+                if k in ts:
+                    self.assertEqual(ts.index(k), data.index(k))
+                    self.assertEqual(ts.loc(ts.index(k)), k)
+                else:
+                    with self.assertRaises(ValueError):
+                        ts.index(k)
+                lo, hi = sorted((k, random.randint(-1100, 1100)))
+                self.assertEqual(ts.count_range(lo, hi), len(ts.irange(lo, hi)))
+                self.assertEqual(
+                    ts.count_range(lo, hi, (False, True)), len([x for x in data if lo < x <= hi]))
+            self.assertEqual(ts.count_range(), len(data))
+            self.assertEqual(ts.count_range(hi=data[9]), 10)
+            self.assertEqual(ts.count_range(5, 1), 0)
+        self.assertEqual(TreeSet().rank(1), 0)
+        self.assertEqual(TreeSet([1, 2, 3]).loc(-3), 1)
+        with self.assertRaises(TypeError):
+            TreeSet([1, 2]).bisect_right("a")
+
+    def test_lookup_many(self):
+        for dtype in [None, "int64", "float64"]:
+            data = sorted(set(random.randint(-1000, 1000) for _ in range(500)))
+            ts = TreeSet(data, dtype=dtype)
+            keys = [random.randint(-1100, 1100) for _ in range(300)]
+            for q in [keys, sorted(keys), sorted(keys, reverse=True), sorted(keys) * 2]:
+                self.assertEqual(ts.contains_many(q), [k in ts for k in q])
+                self.assertEqual(ts.at_most_many(q), [ts.at_most(k) for k in q])
+                self.assertEqual(ts.at_least_many(iter(q)), [ts.at_least(k) for k in q])
+        self.assertEqual(TreeSet().contains_many([1, 2]), [False, False])
+        self.assertEqual(TreeSet([1, 2]).at_most_many([]), [])
+        with self.assertRaises(TypeError):
+            TreeSet([1, 2]).contains_many(1)
+        with self.assertRaises(TypeError):
+            TreeSet([1, 2]).at_most_many([1, "a"])
+
+    def test_stats(self):
+        ts = TreeSet(range(10000))
+        stats = ts.stats()
+        self.assertEqual(stats["used"], 10000)
+        self.assertGreaterEqual(stats["capacity"], 10000)
+        self.assertGreater(stats["chunks"], 0)
+        # freed nodes are recycled
+        for n in range(0, 10000, 2):
+            ts.remove(n)
+        self.assertEqual(ts.stats()["used"], 5000)
+        self.assertGreater(ts.stats()["fragmentation"], 0.4)
+        ts.extend(range(10000, 15000))
+        self.assertEqual(ts.stats()["capacity"], stats["capacity"])
+        self.assertEqual(list(ts), list(range(1, 10000, 2)) + list(range(10000, 15000)))
+        # chunks are released at once
+        ts.clear()
+        self.assertEqual(ts.stats()["chunks"], 0)
+        ts.add(1)
+        ts.remove(1)
+        self.assertEqual(ts.stats()["bytes"], 0)
+
+    def test_btree_backend(self):
+        ts = TreeSet(backend="btree")
+        self.assertIsInstance(ts, BTreeSet)
+        self.assertEqual(ts.backend, "btree")
+        self.assertEqual(TreeSet().backend, "avl")
+        with self.assertRaises(ValueError):
+            TreeSet(backend="skiplist")
+        ref = set()
+        for _ in range(50000):
+            x = random.randint(-3000, 3000)
+            if random.random() < 0.6:
+                ts.add(x)
+                ref.add(x)
+            else:
+                ts.remove(x)
+                ref.discard(x)
+        keys = sorted(ref)
+        self.assertEqual(len(ts), len(keys))
+        self.assertEqual(list(ts), keys)
+        self.assertEqual(list(reversed(ts)), keys[::-1])
+        self.assertEqual(ts.min(), keys[0])
+        self.assertEqual(ts.max(), keys[-1])
+        for i in range(0, len(keys), 37):
+            self.assertEqual(ts.loc(i), keys[i])
+            self.assertEqual(ts.loc(i - len(keys)), keys[i])
+            self.assertEqual(ts.index(keys[i]), i)
+        for x in range(-3010, 3010, 7):
+            self.assertEqual(x in ts, x in ref)
+            self.assertEqual(ts.rank(x), sum(1 for k in keys if k < x))
+            self.assertEqual(ts.at_most(x), max((k for k in keys if k <= x), default=None))
+            self.assertEqual(ts.at_least(x), min((k for k in keys if k >= x), default=None))
+        self.assertEqual(ts.count_range(-100, 100), sum(1 for k in keys if -100 <= k <= 100))
+        with self.assertRaises(IndexError):
+            ts.loc(len(keys))
+        with self.assertRaises(ValueError):
+            ts.index(5000)
+
+        # bulk loads and dtypes are shared with the AVL backend
+        ts = TreeSet([3.5, 1.5, 2.5, 1.5], dtype="float64", backend="btree")
+        self.assertEqual(list(ts), [1.5, 2.5, 3.5])
+        self.assertEqual(ts.dtype, "float64")
+        ts = TreeSet(range(100000), backend="btree")
+        self.assertEqual(ts.loc(77777), 77777)
+        for x in range(0, 100000, 3):
+            ts.remove(x)
+        self.assertEqual(list(ts), [x for x in range(100000) if x % 3])
+        self.assertGreater(ts.stats()["fill"], 0.4)
+        it = iter(ts)
+        next(it)
+        ts.add(0)
+        with self.assertRaises(RuntimeError):
+            next(it)
+        ts.clear()
+        self.assertEqual(list(ts), [])
+        self.assertEqual(ts.stats()["bytes"], 0)
+        with self.assertRaises(ValueError):
+            ts.min()
+
+        # a BTreeSet is a TreeSet, equal to one with the same keys
+        ts = TreeSet(range(10), backend="btree")
+        self.assertIsInstance(ts, TreeSet)
+        self.assertEqual(ts, TreeSet(range(10)))
+        self.assertEqual(TreeSet(range(10)), ts)
+        self.assertNotEqual(ts, TreeSet(range(11), backend="btree"))
+        with self.assertRaises(TypeError):
+            hash(ts)
+        with self.assertRaises(ValueError):
+            BTreeSet(backend="avl")
+
+    def test_btree_api(self):
+        public = {name for name in dir(TreeSet) if not name.startswith("__") or
+            name in ("__reversed__", "__reduce__", "__copy__")}
+        # every method reading the AVL tree is overridden
+        self.assertEqual(public - set(BTreeSet.__dict__) - {"dtype", "key", "_from_snapshot"}, set())
+        for key in [None, operator.neg]:
+            data = [random.randint(-500, 500) for _ in range(3000)]
+            other = [random.randint(-700, 300) for _ in range(2000)]
+            avl, bt = TreeSet(data, key=key), TreeSet(data, key=key, backend="btree")
+            self.assertEqual(list(bt), list(avl))
+            self.assertIs(bt.key, key)
+            for x in range(-520, 520, 13):
+                self.assertEqual(list(bt.iter_from(x)), list(avl.iter_from(x)))
+                self.assertEqual(list(bt.iter_from(x, False)), list(avl.iter_from(x, False)))
+                self.assertEqual(list(bt.iter_before(x)), list(avl.iter_before(x)))
+                self.assertEqual(list(bt.iter_before(x, True)), list(avl.iter_before(x, True)))
+                self.assertEqual(list(bt[x:x + 50]), list(avl[x:x + 50]))
+                self.assertEqual(list(reversed(bt.irange(x, x + 80, (False, True)))),
+                    list(reversed(avl.irange(x, x + 80, (False, True)))))
+                self.assertEqual(len(bt.irange(x, None)), len(avl.irange(x, None)))
+            self.assertEqual(bt.contains_many(other), avl.contains_many(other))
+            self.assertEqual(bt.at_most_many(other), avl.at_most_many(other))
+            self.assertEqual(bt.at_least_many(sorted(other)), avl.at_least_many(sorted(other)))
+            for op in ["union", "intersection", "difference", "symmetric_difference"]:
+                res = getattr(bt, op)(other)
+                self.assertIsInstance(res, BTreeSet)
+                self.assertEqual(list(res), list(getattr(avl, op)(other)))
+                a, b = bt.copy(), avl.copy()
+                update = "update" if op == "union" else op + "_update"
+                getattr(a, update)(TreeSet(other, key=key))
+                getattr(b, update)(other)
+                self.assertEqual(list(a), list(b))
+            for sub in [data[:100], other, []]:
+                self.assertEqual(bt.issubset(sub), avl.issubset(sub))
+                self.assertEqual(bt.issuperset(sub), avl.issuperset(sub))
+                self.assertEqual(bt.isdisjoint(sub), avl.isdisjoint(sub))
+            self.assertTrue(bt.issubset(data) and bt.issuperset(avl))
+            a, b = bt.copy(), avl.copy()
+            a.extend_sorted(other)
+            b.extend_sorted(other)
+            self.assertEqual(list(a), list(b))
+            a.extend_sorted(range(-10, 10))
+            b.extend_sorted(range(-10, 10))
+            self.assertEqual(list(a), list(b))
+            for i in [0, -1, 17, len(a) // 2]:
+                self.assertEqual(a.pop(i), b.pop(i))
+                del a[i]
+                del b[i]
+            a.delete_range(10, 50)
+            b.delete_range(10, 50)
+            del a[-100:100]
+            del b[-100:100]
+            self.assertEqual(list(a), list(b))
+            copied = pickle.loads(pickle.dumps(bt))
+            self.assertIsInstance(copied, BTreeSet)
+            self.assertEqual(list(copied), list(avl))
+            self.assertEqual(copied.key, key)
+
+        # operators mix both engines, the result taking the engine on the left
+        bt, avl = TreeSet([1, 2, 3], backend="btree"), TreeSet([2, 3, 4])
+        self.assertIsInstance(bt | avl, BTreeSet)
+        self.assertEqual(list(bt | avl), [1, 2, 3, 4])
+        self.assertNotIsInstance(avl & bt, BTreeSet)
+        self.assertEqual(list(avl & bt), [2, 3])
+        self.assertEqual(list(bt - avl), [1])
+        self.assertEqual(list(avl ^ bt), [1, 4])
+        bt |= avl
+        self.assertEqual(list(bt), [1, 2, 3, 4])
+        with self.assertRaises(IndexError):
+            TreeSet(backend="btree").pop()
+        with self.assertRaises(RuntimeError):
+            for x in bt:
+                bt.update([x + 10])
+
+        # snapshots and buffers are shared with TreeSet
+        bt = TreeSet(range(0, 3000, 3), dtype="int64", backend="btree")
+        self.assertEqual(list(TreeSet.from_buffer(bt.to_buffer())), list(bt))
+        self.assertEqual(list(BTreeSet.from_buffer(array("q", [5, 1, 3, 1]))), [1, 3, 5])
+        self.assertEqual(list(bt.freeze()), list(bt))
+        self.assertEqual(list(FrozenTreeSet(bt)), list(bt))
+        f = io.BytesIO()
+        bt.save(f)
+        f.seek(0)
+        self.assertEqual(TreeSet.load(f), bt)
+        f = io.BytesIO()
+        TreeSet(range(5), key=operator.neg).save(f)
+        f.seek(0)
+        self.assertEqual(list(BTreeSet.load(f)), [4, 3, 2, 1, 0])
+
+        # cursors step across leaves, insert and erase in place
+        for kwargs in ({}, {"key": operator.neg}):
+            bt = TreeSet(random.sample(range(0, 10000, 2), 500), backend="btree", **kwargs)
+            ref = list(bt)
+            c = bt.cursor()
+            keys = []
+            while c:
+                keys.append(c.key)
+                c.next()
+            self.assertEqual(keys, ref)
+            keys = []
+            while c.prev():
+                keys.append(c.key)
+            self.assertEqual(keys, ref[::-1])
+            self.assertTrue(c.seek(ref[100]))
+            self.assertEqual((c.rank, c.key), (100, ref[100]))
+            for _ in range(300):
+                c.seek_rank(random.randrange(len(ref) - 1))
+                r = c.rank
+                if abs(ref[r + 1] - ref[r]) == 2:
+                    mid = (ref[r] + ref[r + 1]) // 2
+                    c.insert_after(mid)
+                    ref.insert(r + 1, mid)
+                    self.assertEqual(c.rank, r)
+                else:
+                    with self.assertRaises(ValueError):
+                        c.insert_after(ref[r])
+                    c.erase()
+                    del ref[r]
+                    self.assertEqual(c.key, ref[r])
+            self.assertEqual(list(bt), ref)
+
+    def test_key_func(self):
+        calls = []
+        def key(x):
+            calls.append(x)
+            return (x % 10, x)
+        data = [random.randint(-1000, 1000) for _ in range(2000)]
+        ts = TreeSet(data, key=key)
+        self.assertIs(ts.key, key)
+        self.assertEqual(len(calls), len(data))
+        keys = sorted(set(data), key=key)
+        self.assertEqual(list(ts), keys)
+        self.assertEqual(list(reversed(ts)), keys[::-1])
+        self.assertEqual((ts.min(), ts.max()), (keys[0], keys[-1]))
+        # the key function runs once for each object added, never for nodes in the tree
+        del calls[:]
+        for x in range(1000, 1100):
+            ts.add(x)
+        self.assertEqual(len(calls), 100)
+        keys = sorted(set(keys) | set(range(1000, 1100)), key=key)
+        self.assertEqual(list(ts), keys)
+
+        # queries take objects and compare their keys
+        for x in range(-1010, 1010, 13):
+            self.assertEqual(x in ts, x in keys)
+            self.assertEqual(ts.bisect_left(x), sum(1 for k in keys if key(k) < key(x)))
+            self.assertEqual(
+                ts.at_most(x), max((k for k in keys if key(k) <= key(x)), key=key, default=None))
+        self.assertEqual(
+            ts.at_least_many([5, 1109]),
+            [min((k for k in keys if key(k) >= key(x)), key=key, default=None) for x in [5, 1109]])
+        self.assertEqual(list(ts.irange(3, 5)), [k for k in keys if key(3) <= key(k) <= key(5)])
+        self.assertEqual(list(ts[3:5]), [k for k in keys if key(3) <= key(k) < key(5)])
+        self.assertEqual(ts.index(keys[17]), 17)
+        for x in keys[::3]:
+            ts.remove(x)
+        self.assertEqual(list(ts), [k for i, k in enumerate(keys) if i % 3])
+
+        # equal keys are the same element, and the first object added is kept
+        ts = TreeSet(["b", "A", "a"], key=str.lower)
+        ts.add("B")
+        self.assertEqual(list(ts), ["A", "b"])
+        self.assertTrue("a" in ts)
+        u = ts.union(["c", "C"])
+        self.assertIs(u.key, str.lower)
+        self.assertEqual(list(u), ["A", "b", "c"])
+        self.assertEqual(list(ts.intersection(["B", "z"])), ["b"])
+        self.assertTrue(ts.issubset(["a", "B"]))
+
+        ts = TreeSet(range(10), dtype="int64", key=lambda x: -x)
+        self.assertEqual(list(ts), list(range(9, -1, -1)))
+        self.assertEqual(ts.stats()["node_size"], TreeSet().stats()["node_size"] + 8)
+        with self.assertRaises(ValueError):
+            ts.__init__(key=None)
+        with self.assertRaises(TypeError):
+            TreeSet(key=1)
+        with self.assertRaises(ZeroDivisionError):
+            TreeSet([0], key=lambda x: 1 / x)
+
+    def test_buffer(self):
+        data = [random.randint(-10 ** 12, 10 ** 12) for _ in range(2000)]
+        ts = TreeSet(data, dtype="int64")
+        buf = ts.to_buffer()
+        self.assertEqual((buf.format, buf.itemsize, buf.c_contiguous), ("q", 8, True))
+        self.assertEqual(buf.tolist(), sorted(set(data)))
+        self.assertEqual(list(TreeSet.from_buffer(buf)), list(ts))
+
+        # dtypes follow the formats of buffers, duplicates are dropped
+        ts = TreeSet.from_buffer(array("h", [5, -3, 5, 2]))
+        self.assertEqual((ts.dtype, list(ts)), ("int64", [-3, 2, 5]))
+        ts = TreeSet.from_buffer(array("f", [0.5, -1.25]))
+        self.assertEqual((ts.dtype, list(ts)), ("float64", [-1.25, 0.5]))
+        self.assertEqual(TreeSet.from_buffer(ts.to_buffer()).to_buffer().tolist(), [-1.25, 0.5])
+        ts = TreeSet.from_buffer(b"banana")
+        self.assertEqual(list(ts), [97, 98, 110])
+        self.assertEqual(len(TreeSet.from_buffer(array("d"))), 0)
+        with self.assertRaises(TypeError):
+            TreeSet.from_buffer(memoryview(bytes(range(12))).cast("B", (3, 4)))
+
+        # bytes are padded with NUL to the longest key, and stripped when loaded
+        ts = TreeSet([b"pear", b"fig", b""], dtype="bytes")
+        buf = ts.to_buffer()
+        self.assertEqual((buf.format, buf.tobytes()), ("4s", b"\0" * 4 + b"fig\0pear"))
+        self.assertEqual(list(TreeSet.from_buffer(buf)), [b"", b"fig", b"pear"])
+
+        with self.assertRaises(OverflowError):
+            TreeSet.from_buffer(array("Q", [2 ** 63]))
+        with self.assertRaises(TypeError):
+            TreeSet.from_buffer(memoryview(b"ab").cast("c"))
+        with self.assertRaises(TypeError):
+            TreeSet.from_buffer([1, 2])
+        with self.assertRaises(TypeError):
+            TreeSet([1, 2]).to_buffer()
+        with self.assertRaises(ValueError):
+            TreeSet([1, 2], dtype="int64", key=abs).to_buffer()
+
+    def test_snapshot(self):
+        cases = [
+            TreeSet(random.randint(-10 ** 6, 10 ** 6) for _ in range(1000)),
+            TreeSet((random.random() for _ in range(1000)), dtype="float64"),
+            TreeSet([b"", b"x", b"\xff" * 300], dtype="bytes"),
+            TreeSet(["\u00e9t\u00e9", "a\udc80", "b" * 200]),
+            TreeSet([(1, 2), (0,)]),
+            TreeSet([2 ** 70, -1]),
+            TreeSet([-2 ** 63, 2 ** 63 - 1, 0], dtype="int64"),
+            TreeSet(["x" * 100000, "y" * 70000 + "\u00e9"]),
+            TreeSet(["B", "a", "c"], key=str.lower),
+            TreeSet(),
+        ]
+        for ts in cases:
+            copy = pickle.loads(pickle.dumps(ts))
+            self.assertEqual(list(copy), list(ts))
+            self.assertEqual((copy.dtype, copy.key), (ts.dtype, ts.key))
+            f = io.BytesIO()
+            ts.save(f)
+            f.seek(0)
+            self.assertEqual(list(TreeSet.load(f)), list(ts))
+
+        # loading links nodes without comparing keys
+        ts = TreeSet(range(0, 100000, 3), dtype="int64")
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, "ts.pavl")
+            ts.save(path)
+            loaded = TreeSet.load(path)
+            self.assertEqual(loaded.stats()["comparisons"], 0)
+            self.assertEqual(list(loaded), list(ts))
+            self.assertEqual(loaded.loc(100), 300)
+            loaded.add(1)
+            self.assertTrue(1 in loaded)
+
+            with open(path, "rb") as f:
+                data = bytearray(f.read())
+            corrupted = bytearray(data)
+            corrupted[100] ^= 1
+            for bad in [corrupted, data[:-1], b"PAVL", b"not a snapshot"]:
+                with open(path, "wb") as f:
+                    f.write(bad)
+                with self.assertRaises(ValueError):
+                    TreeSet.load(path)
+        with self.assertRaises(ValueError):
+            TreeSet._from_snapshot(pickle.dumps(TreeSet())[:-1])
+
+        # headers are validated, with a valid checksum, before anything is allocated
+        f = io.BytesIO()
+        TreeSet(range(10), dtype="int64").save(f)
+        data = f.getvalue()[:-4]
+        for offset, patch in [(5, b"\x07"), (8, (2 ** 62).to_bytes(8, "little"))]:
+            bad = data[:offset] + patch + data[offset + len(patch):]
+            bad += zlib.crc32(bad).to_bytes(4, "little")
+            with self.assertRaisesRegex(ValueError, "Invalid TreeSet or TreeMap snapshot"):
+                TreeSet.load(io.BytesIO(bad))
+
+        # nothing is unpickled before the checksum is verified
+        f = io.BytesIO()
+        TreeSet([Unpickled()]).save(f)
+        data = bytearray(f.getvalue())
+        data[-1] ^= 1
+        with self.assertRaises(ValueError):
+            TreeSet.load(io.BytesIO(bytes(data)))
+        self.assertEqual(unpickled, [])
+
+        # a key function that cannot be pickled fails the save, and nothing is written
+        f = io.BytesIO()
+        with self.assertRaises((AttributeError, pickle.PicklingError)):
+            TreeSet(range(5), key=lambda x: -x).save(f)
+        self.assertEqual(f.getvalue(), b"")
+
+    def test_freeze(self):
+        cases = [
+            (TreeSet((random.randint(-10 ** 4, 10 ** 4) for _ in range(5000)), dtype="int64"),
+                lambda: random.randint(-10 ** 4 - 10, 10 ** 4 + 10)),
+            (TreeSet((random.uniform(-100, 100) for _ in range(5000)), dtype="float64"),
+                lambda: random.uniform(-110, 110)),
+            (TreeSet(random.randint(-10 ** 4, 10 ** 4) for _ in range(5000)),
+                lambda: random.randint(-10 ** 4 - 10, 10 ** 4 + 10)),
+            (TreeSet([b"b", b"bb", b"d"], dtype="bytes"), lambda: random.choice([b"", b"b", b"c", b"e"])),
+            (TreeSet(range(17), dtype="int64"), lambda: random.randint(-1, 18)),
+            (TreeSet(dtype="int64"), lambda: random.randint(-1, 1)),
+        ]
+        for ts, gen in cases:
+            fz = ts.freeze()
+            self.assertEqual(fz.dtype, ts.dtype)
+            self.assertEqual(len(fz), len(ts))
+            self.assertEqual(list(fz), list(ts))
+            self.assertEqual(list(reversed(fz)), list(reversed(ts)))
+            for _ in range(1000):
+                x = gen()
+                self.assertEqual(x in fz, x in ts)
+                self.assertEqual(fz.at_most(x), ts.at_most(x))
+                self.assertEqual(fz.at_least(x), ts.at_least(x))
+                self.assertEqual(fz.bisect_left(x), ts.bisect_left(x))
+                self.assertEqual(fz.bisect_right(x), ts.bisect_right(x))
+                self.assertEqual(fz.count_range(x, None), ts.count_range(x, None))
+                self.assertEqual(list(fz.irange(None, x, inclusive=(True, False))),
+                    list(ts.irange(None, x, inclusive=(True, False))))
+            for i in range(-len(ts), len(ts), 7):
+                self.assertEqual(fz.loc(i), ts.loc(i))
+
+        # extremes of unboxed keys, and queries of other types
+        fz = FrozenTreeSet([-2 ** 63, 0, 2 ** 63 - 1], dtype="int64")
+        self.assertEqual(fz.bisect_right(2 ** 63 - 1), 3)
+        self.assertEqual(fz.bisect_left(2 ** 70), 3)
+        self.assertEqual(fz.at_most(-2 ** 70), None)
+        self.assertEqual(fz.index(0.0), 1)
+        fz = FrozenTreeSet([float("-inf"), 1.5, float("inf")], dtype="float64")
+        self.assertEqual(fz.bisect_right(float("inf")), 3)
+        self.assertEqual(fz.at_least(1), 1.5)
+        self.assertEqual(fz.min(), float("-inf"))
+        self.assertEqual(fz.max(), float("inf"))
+
+        fz = FrozenTreeSet(TreeSet(["b", "a"]))
+        self.assertEqual(list(fz), ["a", "b"])
+        self.assertEqual(fz.index("b"), 1)
+        self.assertGreater(fz.stats()["comparisons"], 0)
+        self.assertIn(fz.stats()["simd"], ["avx2", "sse4.2", "scalar"])
+        with self.assertRaises(ValueError):
+            fz.index("c")
+        with self.assertRaises(IndexError):
+            fz.loc(2)
+        with self.assertRaises(ValueError):
+            TreeSet(["a"], key=str.lower).freeze()
+        with self.assertRaises(ValueError):
+            FrozenTreeSet().min()
+
+    def test_pop(self):
+        for kwargs in ({}, {"dtype": "int64"}, {"key": lambda x: -x}):
+            ts = TreeSet(random.sample(range(10000), 1000), **kwargs)
+            ref = list(ts)
+            for _ in range(100):
+                i = random.randint(-len(ref) - 5, len(ref) + 5)
+                j = i + random.randint(-3, 20)
+                ts.delete_range(i, j)
+                del ref[i:j]
+                if ref:
+                    i = random.randint(-len(ref), len(ref) - 1)
+                    del ts[i], ref[i]
+            ts.delete_range(0, 3)
+            del ref[:3]
+            ts.delete_range(-3)
+            del ref[-3:]
+            self.assertEqual(list(ts), ref)
+            self.assertEqual(ts.stats()["used"], len(ref))
+
+        # del ts[i] removes a position like pop(i), while slices are key ranges as in ts[lo:hi]
+        ts = TreeSet(range(0, 200, 2))
+        del ts[5:10]
+        self.assertEqual(list(ts[0:20]), [0, 2, 4, 10, 12, 14, 16, 18])
+        del ts[100:]
+        self.assertEqual(ts.max(), 98)
+        del ts[1], ts[-1]
+        self.assertEqual((ts.loc(0), ts.loc(1), ts.max()), (0, 4, 96))
+        with self.assertRaises(IndexError):
+            del ts[len(ts)]
+        with self.assertRaises(IndexError):
+            del ts[-len(ts) - 1]
+        ts.delete_range(end=2, start=0)
+        self.assertEqual(ts.min(), 10)
+        del ts[:]
+        self.assertEqual(len(ts), 0)
+        with self.assertRaises(IndexError):
+            del ts[0]
+        with self.assertRaises(ValueError):
+            del ts[1:5:2]
+        with self.assertRaises(TypeError):
+            del ts["a"]
+        with self.assertRaises(TypeError):
+            ts[1:2] = [1]
+
+
+    def test_cursor(self):
+        for kwargs in ({}, {"dtype": "int64"}, {"key": lambda x: -x}):
+            ts = TreeSet(random.sample(range(0, 10000, 2), 500), **kwargs)
+            ref = list(ts)
+            c = ts.cursor()
+            self.assertEqual(c.key, ref[0])
+            keys = []
+            while c:
+                keys.append(c.key)
+                c.next()
+            self.assertEqual(keys, ref)
+            self.assertEqual(c.rank, len(ref))
+            keys = []
+            while c.prev():
+                keys.append(c.key)
+            self.assertEqual(keys, ref[::-1])
+            self.assertEqual(c.rank, -1)
+            with self.assertRaises(IndexError):
+                c.key
+
+            self.assertTrue(c.seek(ref[100]))
+            self.assertEqual((c.rank, c.key), (100, ref[100]))
+            self.assertTrue(c.seek_rank(-1))
+            self.assertEqual(c.key, ref[-1])
+            self.assertFalse(c.seek_rank(len(ref)))
+            for _ in range(300):
+                c.seek_rank(random.randrange(len(ref) - 1))
+                r = c.rank
+                if abs(ref[r + 1] - ref[r]) == 2:
+                    mid = (ref[r] + ref[r + 1]) // 2
+                    c.insert_after(mid)
+                    ref.insert(r + 1, mid)
+                    self.assertEqual(c.rank, r)
+                else:
+                    with self.assertRaises(ValueError):
+                        c.insert_after(ref[r])
+                    c.erase()
+                    del ref[r]
+                    self.assertEqual(c.key, ref[r])
+                self.assertEqual(len(ts), len(ref))
+            self.assertEqual(list(ts), ref)
+
+        ts = TreeSet([1, 5])
+        c = ts.cursor()
+        c.insert_before(0)
+        c.seek(5)
+        c.insert_before(3)
+        c.insert_after(9)
+        with self.assertRaises(ValueError):
+            c.insert_before(2)
+        self.assertEqual((list(ts), c.key), ([0, 1, 3, 5, 9], 5))
+        c.next()
+        c.next()
+        c.insert_before(10)
+        self.assertEqual((list(ts), c.rank), ([0, 1, 3, 5, 9, 10], 6))
+        with self.assertRaises(TypeError):
+            c.insert_after(11, 1)
+        ts.add(2)
+        with self.assertRaises(RuntimeError):
+            c.next()
+        self.assertTrue(c.seek(2))
+        ts |= TreeSet([20])
+        with self.assertRaises(RuntimeError):
+            c.next()
+
+        # a key function changing the tree makes the cursor stale before it links
+        def kf(k):
+            if k == 55.5:
+                for x in list(ts):
+                    if x != 3:
+                        ts.remove(x)
+            return k
+        ts = TreeSet(range(100), key=kf)
+        c = ts.cursor()
+        c.seek(55)
+        with self.assertRaises(RuntimeError):
+            c.insert_after(55.5)
+        self.assertEqual((len(ts), list(ts), ts.loc(0)), (1, [3], 3))
+
+
+    def test_extend_sorted(self):
+        for kwargs in ({}, {"dtype": "int64"}, {"key": lambda x: -x}):
+            order = kwargs.get("key")
+            ts = TreeSet(**kwargs)
+            ref = set()
+            for _ in range(20):
+                batch = sorted(random.sample(range(-5000, 10000), 300), key=order)
+                ts.extend_sorted(batch)
+                ref.update(batch)
+                expected = sorted(ref, key=order)
+                self.assertEqual(list(ts), expected)
+                self.assertEqual(ts.max(), expected[-1])
+                self.assertEqual(ts.min(), expected[0])
+            ts.extend_sorted(random.sample(range(20000), 300))
+            self.assertEqual(len(ts), len(set(ts)))
+            self.assertEqual(ts.stats()["used"], len(ts))
+
+        ts = TreeSet(dtype="int64")
+        for i in range(1000):
+            ts.add(i)
+            ts.add(-i)
+            self.assertEqual((ts.min(), ts.max()), (-i, i))
+        self.assertLess(ts.stats()["comparisons"], 2 * 2000)
+        self.assertEqual(list(ts), list(range(-999, 1000)))
+
+
+    def test_copy(self):
+        import copy
+        data = random.sample(range(100000), 5000)
+        for ts in [TreeSet(data), TreeSet(map(str, data)), TreeSet(data, dtype="int64"),
+                   TreeSet(data, key=lambda k: -k), TreeSet()]:
+            ncmp = ts.stats()["comparisons"]
+            for cp in [ts.copy(), copy.copy(ts), TreeSet(ts, dtype=ts.dtype, key=ts.key)]:
+                self.assertIs(type(cp), TreeSet)
+                self.assertEqual(list(cp), list(ts))
+                self.assertEqual((cp.dtype, cp.stats()["comparisons"]), (ts.dtype, 0))
+            self.assertEqual(ts.stats()["comparisons"], ncmp)
+        ts = TreeSet([[2], [1]])
+        cp = ts.copy()
+        cp.add([3])
+        cp.remove([1])
+        self.assertEqual((list(ts), list(cp)), ([[1], [2]], [[2], [3]]))
+        self.assertIs(cp.min(), ts.max())
+
+
 if __name__ == "__main__":
     unittest.main()
\ No newline at end of file